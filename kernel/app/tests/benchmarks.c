@@ -13,6 +13,7 @@
 #include <err.h>
 #include <stdlib.h>
 #include <string.h>
+#include <kernel/mutex.h>
 #include <kernel/thread.h>
 #include <platform.h>
 #include <arch/ops.h>
@@ -160,6 +161,24 @@ __NO_INLINE static void bench_memcpy(void)
     free(buf);
 }
 
+__NO_INLINE static void bench_mutex(void)
+{
+    mutex_t m;
+    mutex_init(&m);
+
+    uint64_t count = arch_cycle_count();
+    for (uint i = 0; i < ITER; i++) {
+        mutex_acquire(&m);
+        mutex_release(&m);
+    }
+    count = arch_cycle_count() - count;
+
+    printf("took %" PRIu64 " cycles to acquire and release an uncontended mutex %u times, %" PRIu64 " cycles/iteration\n",
+           count, ITER, count / ITER);
+
+    mutex_destroy(&m);
+}
+
 #if WITH_LIB_LIBM && !WITH_NO_FP
 #include <math.h>
 
@@ -216,6 +235,8 @@ void benchmarks(void)
     bench_cset_uint64_t();
     bench_cset_wide();
 
+    bench_mutex();
+
 #if WITH_LIB_LIBM && !WITH_NO_FP
     bench_sincos();
 #endif
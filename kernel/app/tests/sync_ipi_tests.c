@@ -42,7 +42,7 @@ static int deadlock_test_thread(void *arg) {
 
     int counter = 0;
     arch_disable_ints();
-    mp_sync_exec(MP_CPU_ALL_BUT_LOCAL, counter_task, &counter);
+    mp_sync_exec(MP_IPI_TARGET_ALL_BUT_LOCAL, NULL, counter_task, &counter);
     arch_enable_ints();
     return 0;
 }
@@ -73,11 +73,47 @@ cleanup:
     event_destroy(&gate);
 };
 
+/* check the cpu mask helpers, including across word boundaries */
+static void cpu_mask_test(void) {
+    mp_cpu_mask_t m = mp_cpu_mask_none();
+    ASSERT(mp_cpu_mask_is_empty(&m));
+    ASSERT(mp_cpu_mask_first(&m) == SMP_MAX_CPUS);
+    ASSERT(mp_cpu_mask_last(&m) == SMP_MAX_CPUS);
+
+    uint expected_count = 0;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu += 3) {
+        mp_cpu_mask_set(&m, cpu);
+        expected_count++;
+    }
+    ASSERT(mp_cpu_mask_count(&m) == expected_count);
+    ASSERT(mp_cpu_mask_first(&m) == 0);
+    ASSERT(mp_cpu_mask_last(&m) == ((SMP_MAX_CPUS - 1) / 3) * 3);
+
+    uint cpu, expected = 0;
+    mp_cpu_mask_for_each(cpu, &m) {
+        ASSERT(cpu == expected);
+        expected += 3;
+    }
+    ASSERT(expected == expected_count * 3);
+
+    mp_cpu_mask_t last = mp_cpu_mask_of(SMP_MAX_CPUS - 1);
+    mp_cpu_mask_t both = mp_cpu_mask_or(&m, &last);
+    ASSERT(mp_cpu_mask_test(&both, SMP_MAX_CPUS - 1));
+    ASSERT(mp_cpu_mask_last(&both) == SMP_MAX_CPUS - 1);
+    mp_cpu_mask_t rest = mp_cpu_mask_andnot(&both, &m);
+    ASSERT(mp_cpu_mask_equal(&rest, &last) || mp_cpu_mask_is_empty(&rest));
+
+    mp_cpu_mask_atomic_set(&m, 1);
+    ASSERT(mp_cpu_mask_atomic_clear(&m, 1));
+    ASSERT(!mp_cpu_mask_atomic_clear(&m, 1));
+}
+
 int sync_ipi_tests(int argc, const cmd_args *argv)
 {
+    cpu_mask_test();
+
     uint num_cpus = arch_max_num_cpus();
-    uint online = mp_get_online_mask();
-    if (online != (1U << num_cpus) - 1) {
+    if (mp_get_online_count() != num_cpus) {
         printf("Can only run test with all CPUs online\n");
         return ERR_NOT_SUPPORTED;
     }
@@ -92,7 +128,8 @@ int sync_ipi_tests(int argc, const cmd_args *argv)
         LTRACEF("Sequential test\n");
         int inorder_counter = 0;
         for (uint i = 0; i < num_cpus; ++i) {
-            mp_sync_exec(1 << i, inorder_count_task, &inorder_counter);
+            mp_cpu_mask_t mask = mp_cpu_mask_of(i);
+            mp_sync_exec(MP_IPI_TARGET_MASK, &mask, inorder_count_task, &inorder_counter);
             LTRACEF("  Finished signaling CPU %u\n", i);
         }
     }
@@ -105,7 +142,7 @@ int sync_ipi_tests(int argc, const cmd_args *argv)
         spin_lock_saved_state_t irqstate;
         arch_interrupt_save(&irqstate, SPIN_LOCK_FLAG_INTERRUPTS);
 
-        mp_sync_exec(MP_CPU_ALL_BUT_LOCAL, counter_task, &counter);
+        mp_sync_exec(MP_IPI_TARGET_ALL_BUT_LOCAL, NULL, counter_task, &counter);
 
         arch_interrupt_restore(irqstate, SPIN_LOCK_FLAG_INTERRUPTS);
 
@@ -113,6 +150,18 @@ int sync_ipi_tests(int argc, const cmd_args *argv)
         ASSERT((uint)counter == num_cpus - 1);
     }
 
+    /* Test that an explicit mask reaches every cpu in it */
+    for (uint i = 0; i < runs; ++i) {
+        LTRACEF("Mask test (%u CPUs)\n", num_cpus);
+        int counter = 0;
+
+        mp_cpu_mask_t mask = mp_get_online_mask();
+        mp_sync_exec(MP_IPI_TARGET_MASK, &mask, counter_task, &counter);
+
+        LTRACEF("  Finished signaling mask (%d)\n", counter);
+        ASSERT((uint)counter == num_cpus);
+    }
+
     for (uint i = 0; i < runs; ++i) {
         LTRACEF("Deadlock test\n");
         deadlock_test();
@@ -16,7 +16,9 @@
 #include <string.h>
 #include <kernel/thread.h>
 #include <kernel/mutex.h>
+#include <kernel/rwlock.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <platform.h>
 
 static int sleep_thread(void *arg)
@@ -89,6 +91,156 @@ static int mutex_test(void)
     return 0;
 }
 
+static volatile int rwlock_readers;
+static volatile int rwlock_writers;
+
+static int rwlock_thread(void *arg)
+{
+    const int iterations = 100000;
+
+    rwlock_t *l = (rwlock_t *)arg;
+
+    printf("rwlock tester thread %p starting up, will go for %d iterations\n", get_current_thread(), iterations);
+
+    for (int i = 0; i < iterations; i++) {
+        if (rand() % 8 == 0) {
+            rwlock_acquire_write(l);
+
+            if (atomic_add(&rwlock_writers, 1) != 0 || rwlock_readers != 0)
+                panic("someone else has the rwlock while it is held exclusively\n");
+            thread_yield();
+            atomic_add(&rwlock_writers, -1);
+
+            rwlock_release_write(l);
+        } else {
+            rwlock_acquire_read(l);
+
+            atomic_add(&rwlock_readers, 1);
+            if (rwlock_writers != 0)
+                panic("a writer has the rwlock while it is held shared\n");
+            thread_yield();
+            atomic_add(&rwlock_readers, -1);
+
+            rwlock_release_read(l);
+        }
+        thread_yield();
+    }
+
+    return 0;
+}
+
+static void rwlock_test(void)
+{
+    rwlock_t l;
+    rwlock_init(&l);
+
+    thread_t *threads[5];
+
+    for (uint i=0; i < countof(threads); i++) {
+        threads[i] = thread_create("rwlock tester", &rwlock_thread, &l, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(threads[i]);
+    }
+
+    for (uint i=0; i < countof(threads); i++) {
+        thread_join(threads[i], NULL, INFINITE_TIME);
+    }
+
+    rwlock_destroy(&l);
+
+    printf("done with rwlock tests\n");
+}
+
+/* priority inversion: a low priority thread holds a mutex a high priority
+ * thread wants, while a medium priority thread hogs the cpu. with priority
+ * inheritance the owner runs at the waiter's priority, so the high priority
+ * thread waits about as long as the critical section, not the hog. */
+struct inherit_args {
+    mutex_t m;
+    event_t held;
+    lk_time_t wait;
+};
+
+static const lk_time_t inherit_hold = LK_MSEC(10);
+static const lk_time_t inherit_hog = LK_MSEC(200);
+
+static int inherit_low_thread(void *arg)
+{
+    struct inherit_args *args = (struct inherit_args *)arg;
+
+    mutex_acquire(&args->m);
+    event_signal(&args->held, true);
+    spin(inherit_hold / 1000);
+    mutex_release(&args->m);
+
+    return 0;
+}
+
+static int inherit_medium_thread(void *arg)
+{
+    spin(inherit_hog / 1000);
+    return 0;
+}
+
+static int inherit_high_thread(void *arg)
+{
+    struct inherit_args *args = (struct inherit_args *)arg;
+
+    lk_time_t start = current_time();
+    mutex_acquire(&args->m);
+    args->wait = current_time() - start;
+    mutex_release(&args->m);
+
+    return 0;
+}
+
+static void mutex_inherit_test(void)
+{
+    printf("testing mutex priority inheritance\n");
+
+    const int rounds = 5;
+    int failures = 0;
+
+    for (int i = 0; i < rounds; i++) {
+        struct inherit_args args;
+        mutex_init(&args.m);
+        event_init(&args.held, false, 0);
+        args.wait = 0;
+
+        /* everyone shares cpu 0, so the hog really does starve the owner */
+        thread_t *low = thread_create("inherit low", &inherit_low_thread, &args,
+                                      LOW_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_pinned_cpu(low, 0);
+        thread_resume(low);
+        event_wait(&args.held);
+
+        thread_t *medium = thread_create("inherit medium", &inherit_medium_thread, NULL,
+                                         DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_pinned_cpu(medium, 0);
+        thread_t *high = thread_create("inherit high", &inherit_high_thread, &args,
+                                       HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_pinned_cpu(high, 0);
+        thread_resume(medium);
+        thread_resume(high);
+
+        thread_join(high, NULL, INFINITE_TIME);
+        thread_join(low, NULL, INFINITE_TIME);
+        thread_join(medium, NULL, INFINITE_TIME);
+
+        printf("round %d: high priority thread waited %" PRIu64 " us\n", i, args.wait / 1000);
+        if (args.wait >= inherit_hog / 2)
+            failures++;
+
+        event_destroy(&args.held);
+        mutex_destroy(&args.m);
+    }
+
+    if (failures)
+        printf("mutex priority inheritance FAILED, %d of %d rounds were inverted\n",
+               failures, rounds);
+    else
+        printf("done with mutex priority inheritance test\n");
+}
+
 static event_t e;
 
 static int event_signaler(void *arg)
@@ -598,11 +750,80 @@ static void kill_tests(void)
     event_destroy(&e);
 }
 
+#if WITH_SMP
+static int deadline_waiter_thread(void *arg)
+{
+    event_wait((event_t *)arg);
+    return 0;
+}
+
+/* a deadline thread blocked while its cpu is unplugged has to be woken
+ * somewhere that is still running */
+static void deadline_unplug_test(void)
+{
+    mp_cpu_mask_t online = mp_get_online_mask();
+    uint curr = arch_curr_cpu_num();
+    uint target = SMP_MAX_CPUS;
+    uint cpu;
+    mp_cpu_mask_for_each(cpu, &online) {
+        if (cpu != 0 && cpu != curr)
+            target = cpu;
+    }
+    if (target == SMP_MAX_CPUS) {
+        printf("skipping deadline unplug test, no cpu to unplug\n");
+        return;
+    }
+
+    printf("testing unplugging cpu %u under a blocked deadline thread\n", target);
+
+    event_t e;
+    event_init(&e, false, 0);
+
+    /* admit it to the target cpu, then let it run anywhere */
+    thread_t *t = thread_create("deadline waiter", &deadline_waiter_thread, &e,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_pinned_cpu(t, target);
+    status_t status = thread_set_deadline(t, LK_MSEC(1), LK_MSEC(5), LK_MSEC(10));
+    thread_set_pinned_cpu(t, -1);
+    if (status != NO_ERROR) {
+        printf("deadline unplug test FAILED, could not admit thread: %d\n", status);
+        thread_resume(t);
+        event_signal(&e, true);
+        thread_join(t, NULL, INFINITE_TIME);
+        event_destroy(&e);
+        return;
+    }
+
+    thread_resume(t);
+    thread_sleep_relative(LK_MSEC(50));
+
+    status = mp_unplug_cpu(target);
+    if (status != NO_ERROR)
+        printf("deadline unplug test FAILED, could not unplug cpu %u: %d\n", target, status);
+
+    event_signal(&e, true);
+    status_t joined = thread_join(t, NULL, current_time() + LK_SEC(1));
+
+    if (status == NO_ERROR)
+        mp_hotplug_cpu(target);
+
+    if (joined != NO_ERROR) {
+        printf("deadline unplug test FAILED, thread never woke up\n");
+        return;
+    }
+
+    event_destroy(&e);
+    printf("done with deadline unplug test\n");
+}
+#endif
+
 int thread_tests(void)
 {
     kill_tests();
 
     mutex_test();
+    mutex_inherit_test();
+    rwlock_test();
     event_test();
 
     spinlock_test();
@@ -615,6 +836,10 @@ int thread_tests(void)
 
     join_test();
 
+#if WITH_SMP
+    deadline_unplug_test();
+#endif
+
     return 0;
 }
 
@@ -7,8 +7,11 @@
 #include "tests.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <err.h>
 #include <inttypes.h>
+#include <rand.h>
+#include <arch/ops.h>
 #include <kernel/timer.h>
 #include <kernel/event.h>
 #include <kernel/thread.h>
@@ -75,8 +78,138 @@ static void timer_test_all_cpus(void)
     printf("%u threads created, %u threads joined\n", max, joined);
 }
 
+#define STRESS_TIMER_COUNT 100000
+
+static int stress_fired;
+static int stress_early;
+static int stress_out_of_order;
+static lk_time_t stress_last_fired[SMP_MAX_CPUS];
+
+static enum handler_return timer_stress_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    uint cpu = arch_curr_cpu_num();
+
+    if (TIME_LT(now, timer->scheduled_time))
+        atomic_add(&stress_early, 1);
+    // each cpu must fire its own timers in deadline order
+    if (TIME_LT(timer->scheduled_time, stress_last_fired[cpu]))
+        atomic_add(&stress_out_of_order, 1);
+    stress_last_fired[cpu] = timer->scheduled_time;
+
+    atomic_add(&stress_fired, 1);
+
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_test_stress(void)
+{
+    timer_t* timers = malloc(sizeof(timer_t) * STRESS_TIMER_COUNT);
+    if (!timers) {
+        printf("failed to allocate %d timers\n", STRESS_TIMER_COUNT);
+        return;
+    }
+
+    stress_fired = 0;
+    stress_early = 0;
+    stress_out_of_order = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        stress_last_fired[i] = 0;
+
+    // far enough out that arming everything finishes before the first one fires
+    lk_time_t base = current_time() + LK_SEC(1);
+
+    uint64_t arm_cycles = arch_cycle_count();
+    for (int i = 0; i < STRESS_TIMER_COUNT; i++) {
+        timer_initialize(&timers[i]);
+        lk_time_t deadline = base + LK_USEC(rand() % 100000);
+        timer_set_oneshot(&timers[i], deadline, timer_stress_cb, NULL);
+    }
+    arm_cycles = arch_cycle_count() - arm_cycles;
+
+    // cancel every other timer, visiting them in a scattered order
+    uint64_t cancel_cycles = arch_cycle_count();
+    for (int i = 0; i < STRESS_TIMER_COUNT; i++) {
+        int index = (int)(((uint64_t)i * 7919) % STRESS_TIMER_COUNT);
+        if (index & 1)
+            timer_cancel(&timers[index]);
+    }
+    cancel_cycles = arch_cycle_count() - cancel_cycles;
+
+    printf("armed %d timers in %" PRIu64 " cycles, cancelled %d in %" PRIu64 " cycles\n",
+           STRESS_TIMER_COUNT, arm_cycles, STRESS_TIMER_COUNT / 2, cancel_cycles);
+
+    // wait for the remaining half to fire
+    const int expected = STRESS_TIMER_COUNT / 2;
+    lk_time_t give_up = base + LK_SEC(5);
+    while (atomic_load(&stress_fired) < expected && TIME_LT(current_time(), give_up))
+        thread_sleep_relative(LK_MSEC(10));
+
+    // make sure none of them are still in flight before freeing them
+    for (int i = 0; i < STRESS_TIMER_COUNT; i++)
+        timer_cancel(&timers[i]);
+
+    int fired = atomic_load(&stress_fired);
+    if (fired != expected || stress_early || stress_out_of_order) {
+        printf("FAIL: %d of %d timers fired, %d early, %d out of order\n",
+               fired, expected, stress_early, stress_out_of_order);
+    } else {
+        printf("PASS: %d timers fired in order\n", fired);
+    }
+
+    free(timers);
+}
+
+static lk_time_t coalesce_fired[3];
+
+static enum handler_return timer_coalesce_cb(struct timer* timer, lk_time_t now, void* arg)
+{
+    coalesce_fired[(uintptr_t)arg] = now;
+
+    return INT_NO_RESCHEDULE;
+}
+
+// a timer with slack whose deadline has passed should run from the next
+// timer interrupt on its cpu, even if another timer is due before it
+static void timer_test_coalesce(void)
+{
+    timer_t timers[3];
+    for (uint i = 0; i < countof(timers); i++) {
+        timer_initialize(&timers[i]);
+        coalesce_fired[i] = 0;
+    }
+
+    // keep them all on the same cpu
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    lk_time_t base = current_time();
+    // the first interrupt
+    timer_set_oneshot(&timers[0], base + LK_MSEC(20), timer_coalesce_cb, (void*)0);
+    // what the hardware timer is set for after that
+    timer_set_oneshot(&timers[1], base + LK_MSEC(40), timer_coalesce_cb, (void*)1);
+    // due by the first interrupt, but allowed to wait for a long time after it
+    timer_set_oneshot_etc(&timers[2], base + LK_MSEC(10), LK_SEC(1), timer_coalesce_cb, (void*)2);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    thread_sleep_relative(LK_MSEC(100));
+    for (uint i = 0; i < countof(timers); i++)
+        timer_cancel(&timers[i]);
+
+    if (coalesce_fired[0] == 0 || coalesce_fired[2] != coalesce_fired[0]) {
+        printf("FAIL: slack timer fired at %" PRIu64 ", first interrupt at %" PRIu64 "\n",
+               coalesce_fired[2], coalesce_fired[0]);
+    } else {
+        printf("PASS: slack timer coalesced into the first interrupt\n");
+    }
+}
+
 void timer_tests(void)
 {
     // timer fires on all cpus
     timer_test_all_cpus();
+
+    // lots of timers armed and cancelled at once
+    timer_test_stress();
+
+    // expired timers with slack ride along with an earlier interrupt
+    timer_test_coalesce();
 }
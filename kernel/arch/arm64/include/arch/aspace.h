@@ -19,7 +19,9 @@ struct arch_aspace {
     /* magic value for use-after-free detection */
     uint32_t magic;
 
-    uint16_t asid;
+    /* hardware ASID in the low MMU_ARM64_ASID_BITS, the generation it was handed
+     * out in above them, or 0 if the aspace has never been switched to */
+    uint64_t asid;
 
     /* pointer to the translation table */
     paddr_t tt_phys;
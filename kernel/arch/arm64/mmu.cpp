@@ -10,10 +10,13 @@
 #include <debug.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/auto_lock.h>
+#include <kernel/cpu_mask.h>
 #include <kernel/mutex.h>
 #include <kernel/vm.h>
 #include <lib/heap.h>
-#include <rand.h>
+#include <list.h>
+#include <magenta/atomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -27,48 +30,216 @@ static_assert(((long)KERNEL_ASPACE_BASE >> MMU_KERNEL_SIZE_SHIFT) == -1, "");
 static_assert(MMU_KERNEL_SIZE_SHIFT <= 48, "");
 static_assert(MMU_KERNEL_SIZE_SHIFT >= 25, "");
 
-static uint64_t asid_pool[(1 << MMU_ARM64_ASID_BITS) / 64];
-static mutex_t asid_lock = MUTEX_INITIAL_VALUE(asid_lock);
-
 uint32_t arm64_zva_shift;
 
 /* the main translation table */
 pte_t arm64_kernel_translation_table[MMU_KERNEL_PAGE_TABLE_ENTRIES_TOP] __ALIGNED(MMU_KERNEL_PAGE_TABLE_ENTRIES_TOP * 8)
     __SECTION(".bss.prebss.translation_table");
 
-static status_t arm64_mmu_alloc_asid(uint16_t* asid) {
+// ASIDs are handed out to address spaces as they are switched to, and tagged with
+// the generation they were handed out in. Once a generation runs out of ASIDs, the
+// next one starts with only the ASIDs running on some cpu still taken, and every
+// cpu flushes its TLB before it next switches address space. An address space
+// holding an ASID from an older generation gets a new one the next time it is
+// switched to, or keeps the old one if nobody has taken it since. ASID 0 is never
+// handed out, it's the one the kernel runs with.
+#define ASID_MASK ((1UL << MMU_ARM64_ASID_BITS) - 1)
+#define ASID_FIRST_GENERATION (1UL << MMU_ARM64_ASID_BITS)
+
+static SpinLock asid_lock;
+static uint64_t asid_generation = ASID_FIRST_GENERATION;
+static uint64_t asid_map[(1UL << MMU_ARM64_ASID_BITS) / 64];
+static uint64_t asid_next = 1;
+// the ASID each cpu last switched to, or 0 if a rollover has happened since
+static uint64_t asid_active[SMP_MAX_CPUS];
+// the ASID each cpu was running with at the last rollover
+static uint64_t asid_reserved[SMP_MAX_CPUS];
+static mp_cpu_mask_t asid_flush_pending;
+
+static inline bool asid_is_current(uint64_t asid) {
+    return ((asid ^ atomic_load_u64(&asid_generation)) & ~ASID_MASK) == 0;
+}
 
-    uint16_t new_asid;
-    uint32_t retry = 1 << MMU_ARM64_ASID_BITS;
+static inline bool asid_test_locked(uint64_t bit) {
+    return asid_map[bit / 64] & (1UL << (bit % 64));
+}
 
-    mutex_acquire(&asid_lock);
-    do {
-        new_asid = static_cast<uint16_t>(rand()) & ~(-(1 << MMU_ARM64_ASID_BITS));
-        retry--;
-        if (retry == 0) {
-            mutex_release(&asid_lock);
-            return ERR_NO_MEMORY;
+static inline void asid_set_locked(uint64_t bit) {
+    asid_map[bit / 64] |= 1UL << (bit % 64);
+}
+
+// returns the first free ASID at or after |start|, or 0 if there isn't one
+static uint64_t asid_find_free_locked(uint64_t start) {
+    for (uint64_t bit = start; bit <= ASID_MASK; bit = ROUNDDOWN(bit, 64) + 64) {
+        uint64_t word = asid_map[bit / 64] | ((1UL << (bit % 64)) - 1);
+        if (word != ~0UL)
+            return ROUNDDOWN(bit, 64) + __builtin_ctzl(~word);
+    }
+    return 0;
+}
+
+// start a new generation, with only the ASIDs running on some cpu taken
+static void asid_rollover_locked() {
+    memset(asid_map, 0, sizeof(asid_map));
+    asid_set_locked(0);
+
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        uint64_t asid = atomic_swap_u64(&asid_active[cpu], 0);
+        // a cpu that hasn't switched since the last rollover is still on its old one
+        if (asid == 0)
+            asid = asid_reserved[cpu];
+        asid_set_locked(asid & ASID_MASK);
+        asid_reserved[cpu] = asid;
+        mp_cpu_mask_set(&asid_flush_pending, cpu);
+    }
+
+    atomic_add_u64(&asid_generation, ASID_FIRST_GENERATION);
+}
+
+// if |asid| was running on a cpu at the last rollover, retag it with the current
+// generation and return true
+static bool asid_update_reserved_locked(uint64_t asid, uint64_t new_asid) {
+    bool reserved = false;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (asid_reserved[cpu] == asid) {
+            asid_reserved[cpu] = new_asid;
+            reserved = true;
         }
-    } while ((asid_pool[new_asid >> 6] & (1 << (new_asid % 64))) || (new_asid == 0));
+    }
+    return reserved;
+}
 
-    asid_pool[new_asid >> 6] = asid_pool[new_asid >> 6] | (1 << (new_asid % 64));
+static uint64_t asid_new_locked(uint64_t asid) {
+    uint64_t generation = atomic_load_u64(&asid_generation);
 
-    mutex_release(&asid_lock);
+    if (asid != 0) {
+        uint64_t new_asid = generation | (asid & ASID_MASK);
+        if (asid_update_reserved_locked(asid, new_asid))
+            return new_asid;
 
-    *asid = new_asid;
+        // hang on to the old one if nobody has taken it this generation
+        if (!asid_test_locked(asid & ASID_MASK)) {
+            asid_set_locked(asid & ASID_MASK);
+            return new_asid;
+        }
+    }
 
-    return NO_ERROR;
+    uint64_t bit = asid_find_free_locked(asid_next);
+    if (bit == 0) {
+        asid_rollover_locked();
+        generation = atomic_load_u64(&asid_generation);
+        bit = asid_find_free_locked(1);
+        // there are far more ASIDs than cpus
+        DEBUG_ASSERT(bit != 0);
+    }
+
+    asid_set_locked(bit);
+    asid_next = bit + 1;
+    return generation | bit;
 }
 
-static status_t arm64_mmu_free_asid(uint16_t asid) {
+// Called with interrupts disabled on the way to running |aspace|, returns the
+// ASID to run it with.
+static uint64_t arm64_mmu_switch_asid(arch_aspace_t* aspace) {
+    uint cpu = arch_curr_cpu_num();
+    uint64_t asid = atomic_load_u64(&aspace->asid);
+
+    // if our ASID is from this generation and no rollover has cleared this cpu's
+    // active ASID from under us, there's nothing else to do
+    uint64_t active = atomic_load_u64(&asid_active[cpu]);
+    if (active != 0 && asid_is_current(asid) &&
+        atomic_cmpxchg_u64(&asid_active[cpu], &active, asid))
+        return asid;
+
+    AutoSpinLock guard(asid_lock);
+
+    asid = atomic_load_u64(&aspace->asid);
+    if (!asid_is_current(asid)) {
+        asid = asid_new_locked(asid);
+        atomic_store_u64(&aspace->asid, asid);
+    }
 
-    mutex_acquire(&asid_lock);
+    if (mp_cpu_mask_test(&asid_flush_pending, cpu)) {
+        mp_cpu_mask_clear(&asid_flush_pending, cpu);
+        __asm__ volatile("tlbi vmalle1; dsb nsh; isb" ::: "memory");
+    }
 
-    asid_pool[asid >> 6] = asid_pool[asid >> 6] & ~(1 << (asid % 64));
+    atomic_store_u64(&asid_active[cpu], asid);
+    return asid;
+}
 
-    mutex_release(&asid_lock);
+// Gathers the TLB invalidations for the entries one map, unmap or protect changes,
+// and the page tables it frees. The page table updates are then published with a
+// single barrier, the TLBIs aren't each followed by a barrier of their own, and
+// the page tables aren't freed until no TLB can be caching them. Past
+// kMaxEntries, the whole ASID (or for the kernel, the whole TLB) is invalidated
+// instead, which is cheaper than that many TLBIs.
+class TlbBatch {
+public:
+    explicit TlbBatch(arch_aspace_t* aspace) : aspace_(aspace) {}
+    ~TlbBatch() { DEBUG_ASSERT(count_ == 0 && !all_ && list_is_empty(&page_tables_)); }
+
+    // invalidate whatever the entry covering vaddr translated it to
+    void Invalidate(vaddr_t vaddr) {
+        if (count_ < kMaxEntries) {
+            vaddrs_[count_++] = vaddr;
+        } else {
+            all_ = true;
+        }
+    }
 
-    return NO_ERROR;
+    // free a page table that has been unhooked, once the TLBs are clean
+    void FreePageTable(void* vaddr, paddr_t paddr, uint page_size_shift);
+
+    void Flush();
+
+private:
+    static constexpr size_t kMaxEntries = 32;
+
+    arch_aspace_t* const aspace_;
+    vaddr_t vaddrs_[kMaxEntries];
+    size_t count_ = 0;
+    bool all_ = false;
+    list_node page_tables_ = LIST_INITIAL_VALUE(page_tables_);
+};
+
+void TlbBatch::Flush() {
+    if (count_ == 0 && !all_ && list_is_empty(&page_tables_))
+        return;
+
+    // make the page table updates visible to table walks before the TLBIs
+    __asm__ volatile("dsb ishst" ::: "memory");
+
+    if (aspace_->flags & ARCH_ASPACE_FLAG_KERNEL) {
+        if (all_) {
+            __asm__ volatile("tlbi vmalle1is" ::: "memory");
+        } else {
+            for (size_t i = 0; i < count_; i++) {
+                __asm__ volatile("tlbi vaae1is, %0" ::"r"(vaddrs_[i] >> 12) : "memory");
+            }
+        }
+    } else {
+        // read after the barrier, so that if the aspace has been given a new ASID
+        // since, every walk made with it sees the updated tables. an aspace that
+        // has never run has nothing in any TLB.
+        uint64_t asid = atomic_load_u64(&aspace_->asid) & ASID_MASK;
+        if (asid != 0) {
+            if (all_) {
+                __asm__ volatile("tlbi aside1is, %0" ::"r"(asid << 48) : "memory");
+            } else {
+                for (size_t i = 0; i < count_; i++) {
+                    __asm__ volatile("tlbi vae1is, %0" ::"r"(vaddrs_[i] >> 12 | asid << 48)
+                                     : "memory");
+                }
+            }
+        }
+    }
+
+    __asm__ volatile("dsb ish; isb" ::: "memory");
+
+    count_ = 0;
+    all_ = false;
+    pmm_free(&page_tables_);
 }
 
 static inline bool is_valid_vaddr(arch_aspace_t* aspace, vaddr_t vaddr) {
@@ -281,6 +452,19 @@ static void free_page_table(void* vaddr, paddr_t paddr, uint page_size_shift) {
     }
 }
 
+void TlbBatch::FreePageTable(void* vaddr, paddr_t paddr, uint page_size_shift) {
+    if ((1UL << page_size_shift) >= PAGE_SIZE) {
+        vm_page_t* page = paddr_to_vm_page(paddr);
+        if (!page)
+            panic("bad page table paddr 0x%lx\n", paddr);
+        list_add_tail(&page_tables_, &page->free.node);
+    } else {
+        // the heap can't be handed a list, so flush now rather than holding on to it
+        Flush();
+        free_page_table(vaddr, paddr, page_size_shift);
+    }
+}
+
 static pte_t* arm64_mmu_get_page_table(vaddr_t index, uint page_size_shift, pte_t* page_table) {
     pte_t pte;
     paddr_t paddr;
@@ -344,7 +528,7 @@ static bool page_table_is_clear(pte_t* page_table, uint page_size_shift) {
 static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
                                   size_t size,
                                   uint index_shift, uint page_size_shift,
-                                  pte_t* page_table, uint asid) {
+                                  pte_t* page_table, TlbBatch* tlb) {
     pte_t* next_page_table;
     vaddr_t index;
     size_t chunk_size;
@@ -375,23 +559,19 @@ static ssize_t arm64_mmu_unmap_pt(vaddr_t vaddr, vaddr_t vaddr_rel,
             arm64_mmu_unmap_pt(vaddr, vaddr_rem, chunk_size,
                                index_shift - (page_size_shift - 3),
                                page_size_shift,
-                               next_page_table, asid);
+                               next_page_table, tlb);
             if (chunk_size == block_size ||
                 page_table_is_clear(next_page_table, page_size_shift)) {
                 LTRACEF("pte %p[0x%lx] = 0 (was page table)\n", page_table, index);
                 page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
-                __asm__ volatile("dmb ishst" ::
-                                     : "memory");
-                free_page_table(next_page_table, page_table_paddr, page_size_shift);
+                // walks may have cached the table entry as well as the ones in it
+                tlb->Invalidate(vaddr);
+                tlb->FreePageTable(next_page_table, page_table_paddr, page_size_shift);
             }
         } else if (pte) {
             LTRACEF("pte %p[0x%lx] = 0\n", page_table, index);
             page_table[index] = MMU_PTE_DESCRIPTOR_INVALID;
-            CF;
-            if (asid == MMU_ARM64_GLOBAL_ASID)
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            else
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
+            tlb->Invalidate(vaddr);
         } else {
             LTRACEF("pte %p[0x%lx] already clear\n", page_table, index);
         }
@@ -408,7 +588,7 @@ static ssize_t arm64_mmu_map_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                 paddr_t paddr_in,
                                 size_t size_in, pte_t attrs,
                                 uint index_shift, uint page_size_shift,
-                                pte_t* page_table, uint asid) {
+                                pte_t* page_table, TlbBatch* tlb) {
     ssize_t ret;
     pte_t* next_page_table;
     vaddr_t index;
@@ -452,7 +632,7 @@ static ssize_t arm64_mmu_map_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
 
             ret = arm64_mmu_map_pt(vaddr, vaddr_rem, paddr, chunk_size, attrs,
                                    index_shift - (page_size_shift - 3),
-                                   page_size_shift, next_page_table, asid);
+                                   page_size_shift, next_page_table, tlb);
             if (ret < 0)
                 goto err;
         } else {
@@ -484,15 +664,14 @@ static ssize_t arm64_mmu_map_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
 
 err:
     arm64_mmu_unmap_pt(vaddr_in, vaddr_rel_in, size_in - size,
-                       index_shift, page_size_shift, page_table, asid);
-    DSB;
+                       index_shift, page_size_shift, page_table, tlb);
     return ERR_INTERNAL;
 }
 
 static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                 size_t size_in, pte_t attrs,
                                 uint index_shift, uint page_size_shift,
-                                pte_t* page_table, uint asid) {
+                                pte_t* page_table, TlbBatch* tlb) {
     int ret;
     pte_t* next_page_table;
     vaddr_t index;
@@ -533,7 +712,7 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
                                        attrs,
                                        index_shift - (page_size_shift - 3),
                                        page_size_shift,
-                                       next_page_table, asid);
+                                       next_page_table, tlb);
             if (ret != 0) {
                 goto err;
             }
@@ -542,13 +721,7 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
             LTRACEF("pte %p[%#" PRIxPTR "] = %#" PRIx64 "\n",
                     page_table, index, pte);
             page_table[index] = pte;
-
-            CF;
-            if (asid == MMU_ARM64_GLOBAL_ASID) {
-                ARM64_TLBI(vaae1is, vaddr >> 12);
-            } else {
-                ARM64_TLBI(vae1is, vaddr >> 12 | (vaddr_t)asid << 48);
-            }
+            tlb->Invalidate(vaddr);
         } else {
             LTRACEF("page table entry does not exist, index %#" PRIxPTR
                     ", %#" PRIx64 "\n",
@@ -559,27 +732,25 @@ static int arm64_mmu_protect_pt(vaddr_t vaddr_in, vaddr_t vaddr_rel_in,
         size -= chunk_size;
     }
 
-    DSB;
     return 0;
 
 err:
     // TODO: Unroll any changes we've made, though in practice if we've reached
     // here there's a programming bug since the higher level region abstraction
     // should guard against us trying to change permissions on an umapped page
-    DSB;
     return ERR_INTERNAL;
 }
 
 static ssize_t arm64_mmu_map(vaddr_t vaddr, paddr_t paddr, size_t size, pte_t attrs,
                              vaddr_t vaddr_base, uint top_size_shift,
                              uint top_index_shift, uint page_size_shift,
-                             pte_t* top_page_table, uint asid) {
+                             pte_t* top_page_table, TlbBatch* tlb) {
     vaddr_t vaddr_rel = vaddr - vaddr_base;
     vaddr_t vaddr_rel_max = 1UL << top_size_shift;
 
     LTRACEF("vaddr %#" PRIxPTR ", paddr %#" PRIxPTR ", size %#" PRIxPTR
-            ", attrs %#" PRIx64 ", asid %#x\n",
-            vaddr, paddr, size, attrs, asid);
+            ", attrs %#" PRIx64 "\n",
+            vaddr, paddr, size, attrs);
 
     if (vaddr_rel > vaddr_rel_max - size || size > vaddr_rel_max) {
         TRACEF("vaddr %#" PRIxPTR ", size %#" PRIxPTR " out of range vaddr %#" PRIxPTR ", size %#" PRIxPTR "\n",
@@ -593,7 +764,8 @@ static ssize_t arm64_mmu_map(vaddr_t vaddr, paddr_t paddr, size_t size, pte_t at
     }
 
     ssize_t ret = arm64_mmu_map_pt(vaddr, vaddr_rel, paddr, size, attrs,
-                           top_index_shift, page_size_shift, top_page_table, asid);
+                           top_index_shift, page_size_shift, top_page_table, tlb);
+    // new entries only need to be visible to table walks
     DSB;
     return ret;
 }
@@ -601,11 +773,11 @@ static ssize_t arm64_mmu_map(vaddr_t vaddr, paddr_t paddr, size_t size, pte_t at
 static ssize_t arm64_mmu_unmap(vaddr_t vaddr, size_t size,
                                vaddr_t vaddr_base, uint top_size_shift,
                                uint top_index_shift, uint page_size_shift,
-                               pte_t* top_page_table, uint asid) {
+                               pte_t* top_page_table, TlbBatch* tlb) {
     vaddr_t vaddr_rel = vaddr - vaddr_base;
     vaddr_t vaddr_rel_max = 1UL << top_size_shift;
 
-    LTRACEF("vaddr 0x%lx, size 0x%lx, asid 0x%x\n", vaddr, size, asid);
+    LTRACEF("vaddr 0x%lx, size 0x%lx\n", vaddr, size);
 
     if (vaddr_rel > vaddr_rel_max - size || size > vaddr_rel_max) {
         TRACEF("vaddr 0x%lx, size 0x%lx out of range vaddr 0x%lx, size 0x%lx\n",
@@ -618,22 +790,19 @@ static ssize_t arm64_mmu_unmap(vaddr_t vaddr, size_t size,
         return ERR_INVALID_ARGS;
     }
 
-    ssize_t ret = arm64_mmu_unmap_pt(vaddr, vaddr_rel, size,
-                       top_index_shift, page_size_shift, top_page_table, asid);
-    DSB;
-    return ret;
+    return arm64_mmu_unmap_pt(vaddr, vaddr_rel, size,
+                              top_index_shift, page_size_shift, top_page_table, tlb);
 }
 
 static status_t arm64_mmu_protect(vaddr_t vaddr, size_t size, pte_t attrs,
                              vaddr_t vaddr_base, uint top_size_shift,
                              uint top_index_shift, uint page_size_shift,
-                             pte_t* top_page_table, uint asid) {
+                             pte_t* top_page_table, TlbBatch* tlb) {
     vaddr_t vaddr_rel = vaddr - vaddr_base;
     vaddr_t vaddr_rel_max = 1UL << top_size_shift;
 
-    LTRACEF("vaddr %#" PRIxPTR ", size %#" PRIxPTR ", attrs %#" PRIx64
-            ", asid %#x\n",
-            vaddr, size, attrs, asid);
+    LTRACEF("vaddr %#" PRIxPTR ", size %#" PRIxPTR ", attrs %#" PRIx64 "\n",
+            vaddr, size, attrs);
 
     if (vaddr_rel > vaddr_rel_max - size || size > vaddr_rel_max) {
         TRACEF("vaddr %#" PRIxPTR ", size %#" PRIxPTR " out of range vaddr %#" PRIxPTR ", size %#" PRIxPTR "\n",
@@ -646,10 +815,8 @@ static status_t arm64_mmu_protect(vaddr_t vaddr, size_t size, pte_t attrs,
         return ERR_INVALID_ARGS;
     }
 
-    status_t ret = arm64_mmu_protect_pt(vaddr, vaddr_rel, size, attrs,
-                           top_index_shift, page_size_shift, top_page_table, asid);
-    DSB;
-    return ret;
+    return arm64_mmu_protect_pt(vaddr, vaddr_rel, size, attrs,
+                                top_index_shift, page_size_shift, top_page_table, tlb);
 }
 
 status_t arch_mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, const size_t count, uint flags, size_t* mapped) {
@@ -676,20 +843,23 @@ status_t arch_mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, const
     if (count == 0)
         return NO_ERROR;
 
+    TlbBatch tlb(aspace);
     ssize_t ret;
     if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
         ret = arm64_mmu_map(vaddr, paddr, count * PAGE_SIZE,
                             mmu_flags_to_pte_attr(flags),
                             ~0UL << MMU_KERNEL_SIZE_SHIFT, MMU_KERNEL_SIZE_SHIFT,
                             MMU_KERNEL_TOP_SHIFT, MMU_KERNEL_PAGE_SIZE_SHIFT,
-                            aspace->tt_virt, MMU_ARM64_GLOBAL_ASID);
+                            aspace->tt_virt, &tlb);
     } else {
         ret = arm64_mmu_map(vaddr, paddr, count * PAGE_SIZE,
                             mmu_flags_to_pte_attr(flags),
                             0, MMU_USER_SIZE_SHIFT,
                             MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
-                            aspace->tt_virt, aspace->asid);
+                            aspace->tt_virt, &tlb);
     }
+    // only has anything to do if a failed map had to be unwound
+    tlb.Flush();
 
     if (mapped) {
         *mapped = (ret > 0) ? (ret / PAGE_SIZE) : 0u;
@@ -715,20 +885,20 @@ status_t arch_mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, const size_t count
     if (!IS_PAGE_ALIGNED(vaddr))
         return ERR_INVALID_ARGS;
 
+    TlbBatch tlb(aspace);
     ssize_t ret;
     if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
         ret = arm64_mmu_unmap(vaddr, count * PAGE_SIZE,
                               ~0UL << MMU_KERNEL_SIZE_SHIFT, MMU_KERNEL_SIZE_SHIFT,
                               MMU_KERNEL_TOP_SHIFT, MMU_KERNEL_PAGE_SIZE_SHIFT,
-                              aspace->tt_virt,
-                              MMU_ARM64_GLOBAL_ASID);
+                              aspace->tt_virt, &tlb);
     } else {
         ret = arm64_mmu_unmap(vaddr, count * PAGE_SIZE,
                               0, MMU_USER_SIZE_SHIFT,
                               MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
-                              aspace->tt_virt,
-                              aspace->asid);
+                              aspace->tt_virt, &tlb);
     }
+    tlb.Flush();
 
     if (unmapped) {
         *unmapped = (ret > 0) ? (ret / PAGE_SIZE) : 0u;
@@ -751,22 +921,22 @@ status_t arch_mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count, ui
     if (!(flags & ARCH_MMU_FLAG_PERM_READ))
         return ERR_INVALID_ARGS;
 
+    TlbBatch tlb(aspace);
     int ret;
     if (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) {
         ret = arm64_mmu_protect(vaddr, count * PAGE_SIZE,
                                 mmu_flags_to_pte_attr(flags),
                                 ~0UL << MMU_KERNEL_SIZE_SHIFT, MMU_KERNEL_SIZE_SHIFT,
                                 MMU_KERNEL_TOP_SHIFT, MMU_KERNEL_PAGE_SIZE_SHIFT,
-                                aspace->tt_virt,
-                                MMU_ARM64_GLOBAL_ASID);
+                                aspace->tt_virt, &tlb);
     } else {
         ret = arm64_mmu_protect(vaddr, count * PAGE_SIZE,
                                 mmu_flags_to_pte_attr(flags),
                                 0, MMU_USER_SIZE_SHIFT,
                                 MMU_USER_TOP_SHIFT, MMU_USER_PAGE_SIZE_SHIFT,
-                                aspace->tt_virt,
-                                aspace->asid);
+                                aspace->tt_virt, &tlb);
     }
+    tlb.Flush();
 
     return ret;
 }
@@ -793,13 +963,14 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
         aspace->size = size;
         aspace->tt_virt = arm64_kernel_translation_table;
         aspace->tt_phys = vaddr_to_paddr(aspace->tt_virt);
-        aspace->asid = (uint16_t)MMU_ARM64_GLOBAL_ASID;
+        // runs with ASID 0 in TTBR1, which is never handed out to user address spaces
+        aspace->asid = 0;
     } else {
         //DEBUG_ASSERT(base >= 0);
         DEBUG_ASSERT(base + size <= 1UL << MMU_USER_SIZE_SHIFT);
 
-        if (arm64_mmu_alloc_asid(&aspace->asid) != NO_ERROR)
-            return ERR_NO_MEMORY;
+        // handed an ASID the first time it is switched to
+        aspace->asid = 0;
 
         aspace->base = base;
         aspace->size = size;
@@ -832,15 +1003,17 @@ status_t arch_mmu_destroy_aspace(arch_aspace_t* aspace) {
 
     // XXX make sure it's not mapped
 
+    // the ASID isn't given back, it's reclaimed at the next rollover. whatever
+    // gets it next mustn't find our entries in the TLBs though.
+    if (aspace->asid != 0) {
+        __asm__ volatile("dsb ishst; tlbi aside1is, %0; dsb ish; isb"
+                         ::"r"((aspace->asid & ASID_MASK) << 48) : "memory");
+    }
+
     vm_page_t* page = paddr_to_vm_page(aspace->tt_phys);
     DEBUG_ASSERT(page);
     pmm_free_page(page);
 
-    ARM64_TLBI(ASIDE1IS, aspace->asid);
-
-    arm64_mmu_free_asid(aspace->asid);
-    aspace->asid = 0;
-
     aspace->magic = 0;
 
     return NO_ERROR;
@@ -857,7 +1030,7 @@ void arch_mmu_context_switch(arch_aspace_t* old_aspace, arch_aspace_t* aspace) {
         DEBUG_ASSERT((aspace->flags & ARCH_ASPACE_FLAG_KERNEL) == 0);
 
         tcr = MMU_TCR_FLAGS_USER;
-        ttbr = ((uint64_t)aspace->asid << 48) | aspace->tt_phys;
+        ttbr = ((arm64_mmu_switch_asid(aspace) & ASID_MASK) << 48) | aspace->tt_phys;
         ARM64_WRITE_SYSREG(ttbr0_el1, ttbr);
 
         if (TRACE_CONTEXT_SWITCH)
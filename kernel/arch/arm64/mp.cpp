@@ -40,11 +40,22 @@ void arch_init_cpu_map(uint cluster_count, uint* cluster_cpus) {
     arm_num_cpus = cpu_id;
 }
 
-status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
+status_t arch_mp_send_ipi(mp_ipi_target_t target, const mp_cpu_mask_t *mask, mp_ipi_t ipi)
 {
-    LTRACEF("target 0x%x, ipi %u\n", target, (uint)ipi);
+    LTRACEF("target %d, ipi %u\n", (int)target, (uint)ipi);
 
-    return interrupt_send_ipi(target, ipi);
+    /* the interrupt controllers only deal in explicit cpu masks */
+    mp_cpu_mask_t targets;
+    if (target == MP_IPI_TARGET_MASK) {
+        targets = *mask;
+    } else {
+        targets = mp_get_online_mask();
+        if (target == MP_IPI_TARGET_ALL_BUT_LOCAL) {
+            mp_cpu_mask_clear(&targets, arch_curr_cpu_num());
+        }
+    }
+
+    return interrupt_send_ipi(&targets, ipi);
 }
 
 void arch_mp_init_percpu(void)
@@ -24,8 +24,8 @@
 
 void x86_init_smp(uint32_t *apic_ids, uint32_t num_cpus)
 {
-    DEBUG_ASSERT(num_cpus <= UINT8_MAX);
-    status_t status = x86_allocate_ap_structures(apic_ids, (uint8_t)num_cpus);
+    DEBUG_ASSERT(num_cpus <= SMP_MAX_CPUS);
+    status_t status = x86_allocate_ap_structures(apic_ids, num_cpus);
     if (status != NO_ERROR) {
         TRACEF("Failed to allocate structures for APs");
         return;
@@ -34,9 +34,16 @@ void x86_init_smp(uint32_t *apic_ids, uint32_t num_cpus)
     lk_init_secondary_cpus(num_cpus - 1);
 }
 
+static bool aps_booted(mp_cpu_mask_t *aps_still_booting)
+{
+    mp_cpu_mask_t mask = mp_cpu_mask_atomic_load(aps_still_booting);
+    return mp_cpu_mask_is_empty(&mask);
+}
+
 status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
 {
-    volatile int aps_still_booting = 0;
+    mp_cpu_mask_t aps_still_booting = MP_CPU_MASK_INITIAL_VALUE;
+    struct x86_ap_bootstrap_percpu *per_cpu = NULL;
     status_t status = ERR_INTERNAL;
 
     // Sanity check the given ids
@@ -49,7 +56,7 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
         if (mp_is_cpu_online(cpu)) {
             return ERR_BAD_STATE;
         }
-        aps_still_booting |= 1U << cpu;
+        mp_cpu_mask_set(&aps_still_booting, cpu);
     }
 
     struct x86_ap_bootstrap_data *bootstrap_data = NULL;
@@ -64,11 +71,17 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
         return status;
     }
 
-    bootstrap_data->cpu_id_counter = 0;
-    bootstrap_data->cpu_waiting_mask = &aps_still_booting;
     // Zero the kstack list so if we have to bail, we can safely free the
     // resources.
-    memset(&bootstrap_data->per_cpu, 0, sizeof(bootstrap_data->per_cpu));
+    per_cpu = (struct x86_ap_bootstrap_percpu *)calloc(count, sizeof(*per_cpu));
+    if (!per_cpu) {
+        status = ERR_NO_MEMORY;
+        goto cleanup_aspace;
+    }
+
+    bootstrap_data->cpu_id_counter = 0;
+    bootstrap_data->cpu_waiting_mask = &aps_still_booting;
+    bootstrap_data->per_cpu = per_cpu;
     // Allocate kstacks and threads for all processors
     for (unsigned int i = 0; i < count; ++i) {
         thread_t *thread = (thread_t *)memalign(16,
@@ -83,8 +96,8 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
         }
         uintptr_t kstack_base =
                 (uint64_t)thread + ROUNDUP(sizeof(thread_t), 16);
-        bootstrap_data->per_cpu[i].kstack_base = kstack_base;
-        bootstrap_data->per_cpu[i].thread = (uint64_t)thread;
+        per_cpu[i].kstack_base = kstack_base;
+        per_cpu[i].thread = (uint64_t)thread;
 #if __has_feature(safe_stack)
         thread->unsafe_stack = (void *) (kstack_base + PAGE_SIZE);
         thread->stack_size = PAGE_SIZE;
@@ -117,7 +130,7 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
             apic_send_ipi(vec, apic_id, DELIVERY_MODE_STARTUP);
         }
 
-        if (aps_still_booting == 0) {
+        if (aps_booted(&aps_still_booting)) {
             break;
         }
         // Wait 1ms for cores to boot.  The docs recommend 200us between STARTUP
@@ -128,20 +141,20 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
     // The docs recommend waiting 200us for cores to boot.  We do a bit more
     // work before the cores report in, so wait longer (up to 1 second).
     for (int tries_left = 200;
-         aps_still_booting != 0 && tries_left > 0;
+         !aps_booted(&aps_still_booting) && tries_left > 0;
          --tries_left) {
 
         thread_sleep_relative(LK_MSEC(5));
     }
 
-    uint failed_aps;
-    failed_aps = (uint)atomic_swap(&aps_still_booting, 0);
-    if (failed_aps != 0) {
-        printf("Failed to boot CPUs: mask %x\n", failed_aps);
+    mp_cpu_mask_t failed_aps;
+    failed_aps = mp_cpu_mask_atomic_swap_none(&aps_still_booting);
+    if (!mp_cpu_mask_is_empty(&failed_aps)) {
+        printf("Failed to boot %u CPUs, first cpu %u\n", mp_cpu_mask_count(&failed_aps),
+               mp_cpu_mask_first(&failed_aps));
         for (uint i = 0; i < count; ++i) {
             int cpu = x86_apic_id_to_cpu_num(apic_ids[i]);
-            uint mask = 1U << cpu;
-            if ((failed_aps & mask) == 0) {
+            if (!mp_cpu_mask_test(&failed_aps, cpu)) {
                 continue;
             }
 
@@ -153,15 +166,15 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
             ASSERT(!mp_is_cpu_active(cpu));
 
             // Make sure the CPU is not marked online
-            atomic_and((volatile int *)&mp.online_cpus, ~mask);
+            mp_cpu_mask_atomic_clear(&mp.online_cpus, cpu);
 
             // Free the failed AP's thread, it was cancelled before it could use
             // it.
-            free((void *)bootstrap_data->per_cpu[i].thread);
+            free((void *)per_cpu[i].thread);
 
-            failed_aps &= ~mask;
+            mp_cpu_mask_clear(&failed_aps, cpu);
         }
-        DEBUG_ASSERT(failed_aps == 0);
+        DEBUG_ASSERT(mp_cpu_mask_is_empty(&failed_aps));
 
         status = ERR_TIMED_OUT;
 
@@ -173,11 +186,12 @@ status_t x86_bringup_aps(uint32_t *apic_ids, uint32_t count)
     goto cleanup_aspace;
 cleanup_allocations:
     for (unsigned int i = 0; i < count; ++i) {
-        if (bootstrap_data->per_cpu[i].thread) {
-            free((void *)bootstrap_data->per_cpu[i].thread);
+        if (per_cpu[i].thread) {
+            free((void *)per_cpu[i].thread);
         }
     }
 cleanup_aspace:
+    free(per_cpu);
     bootstrap_aspace->Destroy();
     VmAspace::kernel_aspace()->FreeRegion(reinterpret_cast<vaddr_t>(bootstrap_data));
 finish:
@@ -108,7 +108,7 @@ void arch_enter_uspace(uintptr_t entry_point, uintptr_t sp,
 #if WITH_SMP
 #include <arch/x86/apic.h>
 __NO_SAFESTACK __NO_RETURN
-void x86_secondary_entry(volatile int *aps_still_booting, thread_t *thread)
+void x86_secondary_entry(mp_cpu_mask_t *aps_still_booting, thread_t *thread)
 {
     // Would prefer this to be in init_percpu, but there is a dependency on a
     // page mapping existing, and the BP calls that before the VM subsystem is
@@ -137,9 +137,8 @@ void x86_secondary_entry(volatile int *aps_still_booting, thread_t *thread)
     // operation, we do not touch any resources associated with bootstrap
     // besides our thread_t and stack, since this is the checkpoint the
     // bootstrap process uses to identify completion.
-    int old_val = atomic_and(aps_still_booting, ~(1U << cpu_num));
-    if (old_val == 0) {
-        // If the value is already zero, then booting this CPU timed out.
+    if (!mp_cpu_mask_atomic_clear(aps_still_booting, cpu_num)) {
+        // If our bit is already clear, then booting this CPU timed out.
         goto fail;
     }
 
@@ -151,7 +150,10 @@ void x86_secondary_entry(volatile int *aps_still_booting, thread_t *thread)
 
     // Load the appropriate PAT/MTRRs.  This must happen after init_percpu, so
     // that this CPU is considered online.
-    x86_pat_sync(1U << cpu_num);
+    {
+        mp_cpu_mask_t cpu_mask = mp_cpu_mask_of(cpu_num);
+        x86_pat_sync(&cpu_mask);
+    }
 
     /* run early secondary cpu init routines up to the threading level */
     lk_init_level(LK_INIT_FLAG_SECONDARY_CPUS, LK_INIT_LEVEL_EARLIEST, LK_INIT_LEVEL_THREADING - 1);
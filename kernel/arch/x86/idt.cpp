@@ -127,7 +127,7 @@ __NO_SAFESTACK void idt_setup(struct idt *idt)
 // TODO(thgarnie): Move to C++ and non-compact VMAR for KASLR support.
 void idt_setup_readonly(void) {
     DEBUG_ASSERT(arch_curr_cpu_num() == 0);
-    DEBUG_ASSERT(mp_get_online_mask() == 1);
+    DEBUG_ASSERT(mp_get_online_count() == 1);
     status_t status = VmAspace::kernel_aspace()->AllocPhysical(
                                          "idt_readonly",
                                          sizeof(_idt),
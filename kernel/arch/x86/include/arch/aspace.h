@@ -9,6 +9,7 @@
 
 #include <magenta/compiler.h>
 #include <arch/x86/mmu.h>
+#include <kernel/cpu_mask.h>
 #include <kernel/spinlock.h>
 
 __BEGIN_CDECLS
@@ -29,9 +30,15 @@ struct arch_aspace {
     vaddr_t base;
     size_t size;
 
-    /* cpus that are currently executing in this aspace
-     * actually an mp_cpu_mask_t, but header dependencies. */
-    volatile int active_cpus;
+    /* cpus that are currently executing in this aspace, updated atomically */
+    mp_cpu_mask_t active_cpus;
+
+    /* process-context identifier tagging this aspace's TLB entries, or 0 if
+     * it has none and every switch to it flushes the TLB */
+    uint16_t pcid;
+    /* cpus that may hold stale TLB entries under pcid, and so have to flush
+     * them the next time they switch to this aspace, updated atomically */
+    mp_cpu_mask_t pcid_stale_cpus;
 
     /* Pointer to a bitmap::RleBitmap representing the range of ports
      * enabled in this aspace. */
@@ -11,6 +11,9 @@
 #define PAGE_SIZE 4096
 #define PAGE_SIZE_SHIFT 12
 
+/* the mmu can map 2MB pages, and splits them on a partial unmap or protect */
+#define ARCH_LARGE_PAGE_SIZE_SHIFT 21
+
 #define CACHE_LINE 32
 
 #define ARCH_DEFAULT_STACK_SIZE 8192
@@ -24,6 +24,7 @@
 #ifndef ASSEMBLY
 #include <assert.h>
 #include <magenta/compiler.h>
+#include <kernel/cpu_mask.h>
 #include <kernel/vm/vm_aspace.h>
 
 __BEGIN_CDECLS
@@ -63,21 +64,26 @@ struct __PACKED x86_realmode_entry_data {
     uint64_t registers_ptr;
 };
 
+// Per-cpu data handed to each AP
+struct x86_ap_bootstrap_percpu {
+    // Virtual address of base of initial kstack
+    uint64_t kstack_base;
+    // Virtual address of initial thread_t
+    uint64_t thread;
+};
+
 struct __PACKED x86_ap_bootstrap_data {
     struct x86_bootstrap16_data hdr;
 
     // Counter for APs to use to determine which stack to take
     uint32_t cpu_id_counter;
-    // Pointer to value to use to determine when APs are done with boot
-    volatile int *cpu_waiting_mask;
-
-    // Per-cpu data
-    struct __PACKED {
-        // Virtual address of base of initial kstack
-        uint64_t kstack_base;
-        // Virtual address of initial thread_t
-        uint64_t thread;
-    } per_cpu[SMP_MAX_CPUS - 1];
+    // Pointer to mask to use to determine when APs are done with boot
+    mp_cpu_mask_t *cpu_waiting_mask;
+
+    // Virtual address of the per-cpu data, one entry per AP.  This is kept
+    // out of the bootstrap page so that the number of APs is not limited by
+    // its size; APs only dereference it after switching to the kernel PML4.
+    struct x86_ap_bootstrap_percpu *per_cpu;
 };
 
 // Upon success, returns a pointer to the bootstrap aspace and to the
@@ -179,6 +179,10 @@ void x86_mmu_init(void);
 
 paddr_t x86_kernel_cr3(void);
 
+/* size of the page that maps vaddr in aspace, or 0 if it is not mapped */
+struct arch_aspace;
+size_t x86_mmu_mapping_size(struct arch_aspace *aspace, vaddr_t vaddr);
+
 __END_CDECLS
 
 #endif // !ASSEMBLY
@@ -11,6 +11,6 @@
 __BEGIN_CDECLS
 
 void x86_mmu_mem_type_init(void);
-void x86_pat_sync(mp_cpu_mask_t targets);
+void x86_pat_sync(const mp_cpu_mask_t *targets);
 
 __END_CDECLS
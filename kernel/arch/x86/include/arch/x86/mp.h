@@ -26,6 +26,7 @@
 #include <arch/x86.h>
 #include <arch/x86/idt.h>
 #include <assert.h>
+#include <kernel/cpu_mask.h>
 #include <magenta/compiler.h>
 #include <magenta/tls.h>
 #include <stdint.h>
@@ -95,7 +96,7 @@ void x86_set_local_apic_id(uint32_t apic_id);
 int x86_apic_id_to_cpu_num(uint32_t apic_id);
 
 // Allocate all of the necessary structures for all of the APs to run.
-status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count);
+status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint32_t cpu_count);
 
 static inline struct x86_percpu *x86_get_percpu(void)
 {
@@ -107,7 +108,7 @@ static inline uint arch_curr_cpu_num(void)
     return x86_get_percpu()->cpu_num;
 }
 
-extern uint8_t x86_num_cpus;
+extern uint32_t x86_num_cpus;
 static uint arch_max_num_cpus(void)
 {
     return x86_num_cpus;
@@ -132,7 +133,7 @@ static void arch_set_in_int_handler(bool in_irq)
 enum handler_return x86_ipi_generic_handler(void);
 enum handler_return x86_ipi_reschedule_handler(void);
 void x86_ipi_halt_handler(void) __NO_RETURN;
-void x86_secondary_entry(volatile int *aps_still_booting, thread_t *thread);
+void x86_secondary_entry(mp_cpu_mask_t *aps_still_booting, thread_t *thread);
 
 __END_CDECLS
 
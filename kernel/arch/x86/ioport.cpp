@@ -121,7 +121,7 @@ int x86_set_io_bitmap(uint32_t port, uint32_t len, bool enable) {
     // Let all other CPUs know about the update
     if (status == NO_ERROR) {
         struct ioport_update_context task_context = {.aspace = as};
-        mp_sync_exec(MP_CPU_ALL_BUT_LOCAL, ioport_update_task, &task_context);
+        mp_sync_exec(MP_IPI_TARGET_ALL_BUT_LOCAL, nullptr, ioport_update_task, &task_context);
     }
 
     arch_interrupt_restore(state, 0);
@@ -32,6 +32,16 @@ uint8_t g_paddr_width = 32;
 /* True if the system supports 1GB pages */
 static bool supports_huge_pages = false;
 
+/* True if address spaces are tagged with process-context identifiers, so
+ * switching between them doesn't have to flush the TLB */
+static bool pcid_enabled = false;
+
+/* Allocator for PCIDs.  PCID 0 is never handed out; it is used by the kernel
+ * aspace and by any aspace created once the rest have run out. */
+#define X86_NUM_PCIDS (X86_CR3_PCID_MASK + 1)
+static spin_lock_t pcid_lock = SPIN_LOCK_INITIAL_VALUE;
+static uint64_t pcid_bitmap[X86_NUM_PCIDS / 64] = { 1 };
+
 /* top level kernel page tables, initialized in start.S */
 pt_entry_t pml4[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE);
 pt_entry_t pdp[NO_OF_PT_ENTRIES] __ALIGNED(PAGE_SIZE); /* temporary */
@@ -123,69 +133,205 @@ static void x86_tlb_global_invalidate() {
     }
 }
 
-/* Task used for invalidating a TLB entry on each CPU */
-struct tlb_invalidate_page_context {
+static mp_cpu_mask_t x86_all_cpus_mask() {
+    mp_cpu_mask_t mask;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++) {
+        mask.bits[i] = ~0ull;
+    }
+    return mask;
+}
+
+/* Hand out an unused PCID, or 0 if there are none left */
+static uint16_t x86_pcid_alloc() {
+    if (!pcid_enabled) {
+        return 0;
+    }
+
+    uint16_t pcid = 0;
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&pcid_lock, state);
+    for (uint i = 0; i < countof(pcid_bitmap); i++) {
+        if (~pcid_bitmap[i] != 0) {
+            uint bit = __builtin_ctzll(~pcid_bitmap[i]);
+            pcid_bitmap[i] |= 1ull << bit;
+            pcid = static_cast<uint16_t>(i * 64 + bit);
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pcid_lock, state);
+    return pcid;
+}
+
+static void x86_pcid_free(uint16_t pcid) {
+    if (pcid == 0) {
+        return;
+    }
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&pcid_lock, state);
+    DEBUG_ASSERT(pcid_bitmap[pcid / 64] & (1ull << (pcid % 64)));
+    pcid_bitmap[pcid / 64] &= ~(1ull << (pcid % 64));
+    spin_unlock_irqrestore(&pcid_lock, state);
+}
+
+/* TLB invalidations queued up by a single map/unmap/protect operation.  The
+ * page table updates are made first, then every CPU that needs it is flushed
+ * with a single mp_sync_exec rather than one IPI round per page. */
+struct PendingTlbInvalidation {
+    /* Beyond this many pages it is cheaper to flush the whole TLB than to
+     * invlpg each page */
+    static constexpr uint kMaxPages = 32;
+
+    /* A queued page, packed into a word: the page aligned vaddr, with the
+     * page table level and whether it is a global mapping in the low bits */
+    struct Item {
+        uint64_t raw;
+
+        vaddr_t addr() const { return raw & ~(uint64_t)(PAGE_SIZE - 1); }
+        page_table_levels level() const { return static_cast<page_table_levels>(raw & 0x3); }
+        bool is_global() const { return raw & 0x4; }
+    };
+    static_assert(X86_PAGING_LEVELS <= 4, "level doesn't fit in an Item");
+
+    PendingTlbInvalidation() {
+        list_initialize(&freed_page_tables);
+    }
+    ~PendingTlbInvalidation() {
+        DEBUG_ASSERT(count == 0 && !full_shootdown);
+        DEBUG_ASSERT(list_is_empty(&freed_page_tables));
+    }
+
+    /* Queue the invalidation of the entry mapping vaddr at the given level */
+    void enqueue(vaddr_t vaddr, page_table_levels level, bool is_global) {
+        contains_global |= is_global;
+
+        /* Dropping a whole PML4 entry, or running out of room, turns this
+         * into a full flush */
+        if (level == PML4_L || count == kMaxPages) {
+            full_shootdown = true;
+            return;
+        }
+        if (full_shootdown) {
+            return;
+        }
+        item[count++].raw = (vaddr & ~(uint64_t)(PAGE_SIZE - 1)) | level | (is_global ? 0x4 : 0);
+    }
+
+    /* Hold on to a page table page that was unlinked by this operation.
+     * Other CPUs may still be walking it until the invalidation is done. */
+    void free_page_table(vm_page_t* page) {
+        list_add_tail(&freed_page_tables, &page->free.node);
+        page_tables_freed = true;
+    }
+
+    /* Reset once the invalidation has been carried out, releasing any page
+     * tables that were waiting on it */
+    void clear() {
+        if (!list_is_empty(&freed_page_tables)) {
+            pmm_free(&freed_page_tables);
+        }
+        count = 0;
+        full_shootdown = false;
+        contains_global = false;
+        page_tables_freed = false;
+    }
+
+    uint count = 0;
+    bool full_shootdown = false;
+    bool contains_global = false;
+    bool page_tables_freed = false;
+    Item item[kMaxPages];
+    list_node freed_page_tables;
+};
+
+/* Task used for carrying out a PendingTlbInvalidation on each CPU */
+struct tlb_invalidate_context {
+    arch_aspace_t* aspace;
     ulong target_cr3;
-    vaddr_t vaddr;
-    enum page_table_levels level;
-    bool global_page;
+    const PendingTlbInvalidation* pending;
 };
-static void tlb_invalidate_page_task(void* raw_context) {
+static void tlb_invalidate_task(void* raw_context) {
     DEBUG_ASSERT(arch_ints_disabled());
-    tlb_invalidate_page_context* context = (tlb_invalidate_page_context*)raw_context;
+    tlb_invalidate_context* context = (tlb_invalidate_context*)raw_context;
+    const PendingTlbInvalidation* pending = context->pending;
 
     ulong cr3 = x86_get_cr3();
-    if (context->target_cr3 != cr3 && !context->global_page) {
+    bool this_aspace = context->target_cr3 == (cr3 & X86_CR3_BASE_MASK);
+    if (!this_aspace && !pending->contains_global) {
         /* This invalidation doesn't apply to this CPU, ignore it */
         return;
     }
 
-    switch (context->level) {
-    case PML4_L:
-        x86_tlb_global_invalidate();
-        break;
-    case PDP_L:
-    case PD_L:
-    case PT_L:
-        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)context->vaddr));
-        break;
+    /* Everything queued is flushed from the current PCID below, and this CPU
+     * has been in the aspace since before the invalidation was queued, so it
+     * has no reason to flush again when it next switches back in. */
+    arch_aspace_t* aspace = context->aspace;
+    if (this_aspace && aspace && aspace->pcid != 0) {
+        mp_cpu_mask_atomic_clear(&aspace->pcid_stale_cpus, arch_curr_cpu_num());
+    }
+
+    /* invlpg only drops paging-structure cache entries of the current PCID,
+     * and kernel page tables are walked under every PCID, so freeing one
+     * needs every PCID flushed */
+    bool flush_all_pcids = pcid_enabled && pending->contains_global && pending->page_tables_freed;
+
+    if (pending->full_shootdown || flush_all_pcids) {
+        if (pending->contains_global) {
+            x86_tlb_global_invalidate();
+        } else {
+            /* reloading cr3 drops every non-global translation */
+            x86_set_cr3(cr3);
+        }
+        return;
+    }
+
+    for (uint i = 0; i < pending->count; ++i) {
+        const PendingTlbInvalidation::Item& item = pending->item[i];
+        if (!this_aspace && !item.is_global()) {
+            continue;
+        }
+        __asm__ volatile("invlpg %0" ::"m"(*(uint8_t*)item.addr()));
     }
 }
 
 /**
- * @brief Invalidate a single page at a given page table level
+ * @brief Carry out a batch of queued TLB invalidations
  *
  * @param aspace The aspace we're invalidating for (if NULL, assume for current one)
- * @param vaddr The virtual address we are invalidating the TLB entry for
- * @param level The page table level that maps this vaddr
- * @param global_page True if we are invalidating a global mapping
- *
- * TODO(teisenbe): Optimize this.  This is horribly inefficient.
- * We should also change this to pool invalidations from a single
- * "transaction" and then only execute a single mp_sync_exec for that
- * transaction, rather than one per page.
+ * @param pending The invalidations queued up by a page table update
  */
-void x86_tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, enum page_table_levels level,
-                             bool global_page) {
-    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3();
-    struct tlb_invalidate_page_context task_context = {
-        .target_cr3 = cr3, .vaddr = vaddr, .level = level, .global_page = global_page,
+static void x86_tlb_invalidate(arch_aspace_t* aspace, const PendingTlbInvalidation* pending) {
+    if (pending->count == 0 && !pending->full_shootdown) {
+        return;
+    }
+
+    ulong cr3 = aspace ? aspace->pt_phys : x86_get_cr3() & X86_CR3_BASE_MASK;
+    struct tlb_invalidate_context task_context = {
+        .aspace = aspace, .target_cr3 = cr3, .pending = pending,
     };
 
+    /* CPUs that have switched away from a PCID tagged aspace still hold its
+     * TLB entries.  Rather than interrupting them, mark every CPU as needing
+     * to flush the PCID the next time it switches back in; those that have
+     * it active now clear the mark when they run the task.  This must be
+     * done before active_cpus is loaded below, so a CPU that switches in
+     * concurrently either sees the mark or is sent the task. */
+    if (aspace && aspace->pcid != 0) {
+        mp_cpu_mask_t all = x86_all_cpus_mask();
+        mp_cpu_mask_atomic_or(&aspace->pcid_stale_cpus, &all);
+    }
+
     /* Target only CPUs this aspace is active on.  It may be the case that some
      * other CPU will become active in it after this load, or will have left it
      * just before this load.  In the former case, it is becoming active after
      * the write to the page table, so it will see the change.  In the latter
      * case, it will get a spurious request to flush. */
-    mp_cpu_mask_t targets;
-    if (global_page || aspace == nullptr) {
-        targets = MP_CPU_ALL;
+    if (pending->contains_global || aspace == nullptr) {
+        mp_sync_exec(MP_IPI_TARGET_ALL, nullptr, tlb_invalidate_task, &task_context);
     } else {
-        targets = atomic_load(&aspace->active_cpus);
-        static_assert(sizeof(mp_cpu_mask_t) == sizeof(aspace->active_cpus), "err");
+        mp_cpu_mask_t targets = mp_cpu_mask_atomic_load(&aspace->active_cpus);
+        mp_sync_exec(MP_IPI_TARGET_MASK, &targets, tlb_invalidate_task, &task_context);
     }
-
-    mp_sync_exec(targets, tlb_invalidate_page_task, &task_context);
 }
 
 template <int Level>
@@ -373,10 +519,10 @@ struct PageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Carry out the TLB invalidations queued up by an update
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
-        x86_tlb_invalidate_page(aspace, vaddr, Base::level, global_page);
+    static void tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
+        x86_tlb_invalidate(aspace, pending);
     }
 };
 
@@ -424,9 +570,9 @@ struct ExtendedPageTable : PageTableBase<Level> {
     }
 
     /**
-     * @brief Invalidate a single page at a given page table level
+     * @brief Carry out the TLB invalidations queued up by an update
      */
-    static void tlb_invalidate_page(arch_aspace_t* aspace, vaddr_t vaddr, bool global_page) {
+    static void tlb_invalidate(arch_aspace_t* aspace, PendingTlbInvalidation* pending) {
         // TODO(abdulla): Implement this.
     }
 };
@@ -504,8 +650,8 @@ struct MappingCursor {
 };
 
 template <typename PageTable>
-static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte, paddr_t paddr,
-                         arch_flags_t flags) {
+static void update_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte,
+                         paddr_t paddr, arch_flags_t flags) {
     DEBUG_ASSERT(pte);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(paddr));
 
@@ -515,23 +661,23 @@ static void update_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte,
     *pte = paddr;
     *pte |= flags | X86_MMU_PG_P;
 
-    /* attempt to invalidate the page */
+    /* queue up an invalidation of the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        pending->enqueue(vaddr, PageTable::level, is_kernel_address(vaddr));
     }
 }
 
 template <typename PageTable>
-static void unmap_entry(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static void unmap_entry(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte) {
     DEBUG_ASSERT(pte);
 
     pt_entry_t olde = *pte;
 
     *pte = 0;
 
-    /* attempt to invalidate the page */
+    /* queue up an invalidation of the page */
     if (IS_PAGE_PRESENT(olde)) {
-        PageTable::tlb_invalidate_page(aspace, vaddr, is_kernel_address(vaddr));
+        pending->enqueue(vaddr, PageTable::level, is_kernel_address(vaddr));
     }
 }
 
@@ -556,7 +702,7 @@ static pt_entry_t* _map_alloc_page(void) {
  * @brief Split the given large page into smaller pages
  */
 template <typename PageTable>
-static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t* pte) {
+static status_t x86_mmu_split(PendingTlbInvalidation* pending, vaddr_t vaddr, pt_entry_t* pte) {
     static_assert(PageTable::level != PT_L, "tried splitting PT_L");
     LTRACEF_LEVEL(2, "splitting table %p at level %d\n", pte, PageTable::level);
 
@@ -577,14 +723,14 @@ static status_t x86_mmu_split(arch_aspace_t* aspace, vaddr_t vaddr, pt_entry_t*
         pt_entry_t* e = m + i;
         // If this is a PDP_L (i.e. huge page), flags will include the
         // PS bit still, so the new PD entries will be large pages.
-        update_entry<typename PageTable::LowerTable>(aspace, new_vaddr, e, new_paddr, flags);
+        update_entry<typename PageTable::LowerTable>(pending, new_vaddr, e, new_paddr, flags);
         new_vaddr += ps;
         new_paddr += ps;
     }
     DEBUG_ASSERT(new_vaddr == vaddr + PageTable::page_size());
 
     flags = PageTable::intermediate_arch_flags();
-    update_entry<PageTable>(aspace, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
+    update_entry<PageTable>(pending, vaddr, pte, X86_VIRT_TO_PHYS(m), flags);
     return NO_ERROR;
 }
 
@@ -676,12 +822,15 @@ status_t x86_mmu_get_mapping<ExtendedPageTable<PT_L>>(pt_entry_t* table, vaddr_t
  * unmap within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations needed by the update are queued here for
+ * the caller to carry out
  *
  * @return true if at least one page was unmapped at this level
  */
 template <typename PageTable>
 static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
-                                   const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                   const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                   PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -715,7 +864,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             bool vaddr_level_aligned = PageTable::page_aligned(new_cursor->vaddr);
             // If the request covers the entire large page, just unmap it
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+                unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
                 unmapped = true;
 
                 new_cursor->vaddr += ps;
@@ -725,7 +874,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            status_t status = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            status_t status = x86_mmu_split<PageTable>(pending, page_vaddr, e);
             if (status != NO_ERROR) {
                 panic("Need to implement recovery from split failure");
             }
@@ -734,7 +883,7 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         bool lower_unmapped = x86_mmu_remove_mapping<typename PageTable::LowerTable>(
-            aspace, next_table, *new_cursor, &cursor);
+            aspace, next_table, *new_cursor, &cursor, pending);
 
         // If we were requesting to unmap everything in the lower page table,
         // we know we can unmap the lower level page table.  Otherwise, if
@@ -754,8 +903,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
         }
         if (unmap_page_table) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
-            pmm_free_page(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
+            pending->free_page_table(paddr_to_vm_page(X86_VIRT_TO_PHYS(next_table)));
             unmapped = true;
         }
         *new_cursor = cursor;
@@ -771,7 +920,8 @@ static bool x86_mmu_remove_mapping(arch_aspace_t* aspace, pt_entry_t* table,
 template <typename PageTable>
 static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
                                       const MappingCursor& start_cursor,
-                                      MappingCursor* new_cursor) {
+                                      MappingCursor* new_cursor,
+                                      PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -783,7 +933,7 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
     for (; index != NO_OF_PT_ENTRIES && new_cursor->size != 0; ++index) {
         pt_entry_t* e = table + index;
         if (IS_PAGE_PRESENT(*e)) {
-            unmap_entry<PageTable>(aspace, new_cursor->vaddr, e);
+            unmap_entry<PageTable>(pending, new_cursor->vaddr, e);
             unmapped = true;
         }
 
@@ -797,16 +947,19 @@ static bool x86_mmu_remove_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
 template <>
 bool x86_mmu_remove_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                              const MappingCursor& start_cursor,
-                                             MappingCursor* new_cursor) {
-    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor);
+                                             MappingCursor* new_cursor,
+                                             PendingTlbInvalidation* pending) {
+    return x86_mmu_remove_mapping_l0<PageTable<PT_L>>(aspace, table, start_cursor, new_cursor,
+                                                      pending);
 }
 
 template <>
 bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                      const MappingCursor& start_cursor,
-                                                     MappingCursor* new_cursor) {
+                                                     MappingCursor* new_cursor,
+                                                     PendingTlbInvalidation* pending) {
     return x86_mmu_remove_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, start_cursor,
-                                                              new_cursor);
+                                                              new_cursor, pending);
 }
 
 /**
@@ -820,6 +973,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_e
  * act on within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations needed by the update are queued here for
+ * the caller to carry out
  *
  * @return NO_ERROR if successful
  * @return ERR_ALREADY_EXISTS if the range overlaps an existing mapping
@@ -827,7 +982,8 @@ bool x86_mmu_remove_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_e
  */
 template <typename PageTable>
 static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
-                                    const MappingCursor& start_cursor, MappingCursor* new_cursor) {
+                                    const MappingCursor& start_cursor, MappingCursor* new_cursor,
+                                    PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     DEBUG_ASSERT(x86_mmu_check_vaddr(start_cursor.vaddr));
     DEBUG_ASSERT(x86_mmu_check_paddr(start_cursor.paddr));
@@ -855,7 +1011,7 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
         if (level_supports_large_pages && !IS_PAGE_PRESENT(*e) && level_valigned &&
             level_paligned && new_cursor->size >= ps) {
 
-            update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+            update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                     arch_flags | X86_MMU_PG_PS);
 
             new_cursor->paddr += ps;
@@ -873,13 +1029,13 @@ static status_t x86_mmu_add_mapping(arch_aspace_t* aspace, pt_entry_t* table, ui
 
                 LTRACEF_LEVEL(2, "new table %p at level %d\n", m, PageTable::level);
 
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
+                update_entry<PageTable>(pending, new_cursor->vaddr, e, X86_VIRT_TO_PHYS(m),
                                         interm_arch_flags);
             }
 
             MappingCursor cursor;
             ret = x86_mmu_add_mapping<typename PageTable::LowerTable>(
-                aspace, get_next_table_from_entry(*e), mmu_flags, *new_cursor, &cursor);
+                aspace, get_next_table_from_entry(*e), mmu_flags, *new_cursor, &cursor, pending);
             *new_cursor = cursor;
             DEBUG_ASSERT(new_cursor->size <= start_cursor.size);
             if (ret != NO_ERROR) {
@@ -895,7 +1051,8 @@ err:
         // new_cursor->size should be how much is left to be mapped still
         cursor.size -= new_cursor->size;
         if (cursor.size > 0) {
-            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result);
+            x86_mmu_remove_mapping<typename PageTable::TopTable>(aspace, table, cursor, &result,
+                                                                 pending);
             DEBUG_ASSERT(result.size == 0);
         }
     }
@@ -906,7 +1063,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_remove_mapping_l0 used with wrong level");
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
 
@@ -921,7 +1079,7 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
             return ERR_ALREADY_EXISTS;
         }
 
-        update_entry<PageTable>(aspace, new_cursor->vaddr, table + index, new_cursor->paddr,
+        update_entry<PageTable>(pending, new_cursor->vaddr, table + index, new_cursor->paddr,
                                 arch_flags);
 
         new_cursor->paddr += PAGE_SIZE;
@@ -936,18 +1094,20 @@ static status_t x86_mmu_add_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table,
 template <>
 status_t x86_mmu_add_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                               uint mmu_flags, const MappingCursor& start_cursor,
-                                              MappingCursor* new_cursor) {
+                                              MappingCursor* new_cursor,
+                                              PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                   new_cursor);
+                                                   new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                       uint mmu_flags,
                                                       const MappingCursor& start_cursor,
-                                                      MappingCursor* new_cursor) {
+                                                      MappingCursor* new_cursor,
+                                                      PendingTlbInvalidation* pending) {
     return x86_mmu_add_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                           new_cursor);
+                                                           new_cursor, pending);
 }
 
 /**
@@ -961,11 +1121,14 @@ status_t x86_mmu_add_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_
  * act on within table
  * @param new_cursor A returned cursor describing how much work was not
  * completed.  Must be non-null.
+ * @param pending TLB invalidations needed by the update are queued here for
+ * the caller to carry out
  */
 template <typename PageTable>
 static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                        const MappingCursor& start_cursor,
-                                       MappingCursor* new_cursor) {
+                                       MappingCursor* new_cursor,
+                                       PendingTlbInvalidation* pending) {
     DEBUG_ASSERT(table);
     LTRACEF("L: %d, %016" PRIxPTR " %016zx\n", PageTable::level, start_cursor.vaddr,
             start_cursor.size);
@@ -999,8 +1162,8 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             // If the request covers the entire large page, just change the
             // permissions
             if (vaddr_level_aligned && new_cursor->size >= ps) {
-                update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
-                                        arch_flags | X86_MMU_PG_PS);
+                update_entry<PageTable>(pending, new_cursor->vaddr, e,
+                                        PageTable::paddr_from_pte(*e), arch_flags | X86_MMU_PG_PS);
 
                 new_cursor->vaddr += ps;
                 new_cursor->size -= ps;
@@ -1009,7 +1172,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
             }
             // Otherwise, we need to split it
             vaddr_t page_vaddr = new_cursor->vaddr & ~(ps - 1);
-            ret = x86_mmu_split<PageTable>(aspace, page_vaddr, e);
+            ret = x86_mmu_split<PageTable>(pending, page_vaddr, e);
             if (ret != NO_ERROR) {
                 goto err;
             }
@@ -1018,7 +1181,7 @@ static status_t x86_mmu_update_mapping(arch_aspace_t* aspace, pt_entry_t* table,
         MappingCursor cursor;
         pt_entry_t* next_table = get_next_table_from_entry(*e);
         ret = x86_mmu_update_mapping<typename PageTable::LowerTable>(aspace, next_table, mmu_flags,
-                                                                     *new_cursor, &cursor);
+                                                                     *new_cursor, &cursor, pending);
         *new_cursor = cursor;
         if (ret != NO_ERROR) {
             goto err;
@@ -1037,7 +1200,8 @@ err:
 template <typename PageTable>
 static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* table, uint mmu_flags,
                                           const MappingCursor& start_cursor,
-                                          MappingCursor* new_cursor) {
+                                          MappingCursor* new_cursor,
+                                          PendingTlbInvalidation* pending) {
     static_assert(PageTable::level == PT_L, "x86_mmu_update_mapping_l0 used with wrong level");
     LTRACEF("%016" PRIxPTR " %016zx\n", start_cursor.vaddr, start_cursor.size);
     DEBUG_ASSERT(IS_PAGE_ALIGNED(start_cursor.size));
@@ -1051,7 +1215,7 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* tab
         pt_entry_t* e = table + index;
         // Skip unmapped pages (we may encounter these due to demand paging)
         if (IS_PAGE_PRESENT(*e)) {
-            update_entry<PageTable>(aspace, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
+            update_entry<PageTable>(pending, new_cursor->vaddr, e, PageTable::paddr_from_pte(*e),
                                     arch_flags);
         }
 
@@ -1065,18 +1229,20 @@ static status_t x86_mmu_update_mapping_l0(arch_aspace_t* aspace, pt_entry_t* tab
 template <>
 status_t x86_mmu_update_mapping<PageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                  uint mmu_flags, const MappingCursor& start_cursor,
-                                                 MappingCursor* new_cursor) {
+                                                 MappingCursor* new_cursor,
+                                                 PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<PageTable<PT_L>>(aspace, table, mmu_flags, start_cursor,
-                                                      new_cursor);
+                                                      new_cursor, pending);
 }
 
 template <>
 status_t x86_mmu_update_mapping<ExtendedPageTable<PT_L>>(arch_aspace_t* aspace, pt_entry_t* table,
                                                          uint mmu_flags,
                                                          const MappingCursor& start_cursor,
-                                                         MappingCursor* new_cursor) {
+                                                         MappingCursor* new_cursor,
+                                                         PendingTlbInvalidation* pending) {
     return x86_mmu_update_mapping_l0<ExtendedPageTable<PT_L>>(aspace, table, mmu_flags,
-                                                              start_cursor, new_cursor);
+                                                              start_cursor, new_cursor, pending);
 }
 
 template <template <int> class PageTable>
@@ -1101,7 +1267,11 @@ static status_t mmu_unmap(arch_aspace_t* aspace, vaddr_t vaddr, const size_t cou
     };
 
     MappingCursor result;
-    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result);
+    PendingTlbInvalidation tlb;
+    x86_mmu_remove_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt, start, &result,
+                                                        &tlb);
+    PageTable<MAX_PAGING_LEVEL>::tlb_invalidate(aspace, &tlb);
+    tlb.clear();
     DEBUG_ASSERT(result.size == 0);
 
     if (unmapped)
@@ -1147,8 +1317,11 @@ static status_t mmu_map(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t paddr, con
         .paddr = paddr, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
-    status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(aspace, aspace->pt_virt,
-                                                                       mmu_flags, start, &result);
+    PendingTlbInvalidation tlb;
+    status_t status = x86_mmu_add_mapping<PageTable<MAX_PAGING_LEVEL>>(
+        aspace, aspace->pt_virt, mmu_flags, start, &result, &tlb);
+    PageTable<MAX_PAGING_LEVEL>::tlb_invalidate(aspace, &tlb);
+    tlb.clear();
     if (status != NO_ERROR) {
         dprintf(SPEW, "Add mapping failed with err=%d\n", status);
         return status;
@@ -1195,8 +1368,11 @@ static status_t mmu_protect(arch_aspace_t* aspace, vaddr_t vaddr, size_t count,
         .paddr = 0, .vaddr = vaddr, .size = count * PAGE_SIZE,
     };
     MappingCursor result;
+    PendingTlbInvalidation tlb;
     status_t status = x86_mmu_update_mapping<PageTable<MAX_PAGING_LEVEL>>(
-        aspace, aspace->pt_virt, mmu_flags, start, &result);
+        aspace, aspace->pt_virt, mmu_flags, start, &result, &tlb);
+    PageTable<MAX_PAGING_LEVEL>::tlb_invalidate(aspace, &tlb);
+    tlb.clear();
     if (status != NO_ERROR) {
         return status;
     }
@@ -1215,11 +1391,21 @@ status_t guest_mmu_protect(guest_paspace_t* paspace, vaddr_t vaddr, size_t count
 }
 
 void x86_mmu_early_init() {
+    /* PCIDs are only used along with global pages, so that switching to the
+     * kernel aspace and flushing PCID 0 keeps the kernel's own mappings and
+     * toggling CR4.PGE is always there to flush every PCID at once */
+    pcid_enabled = x86_feature_test(X86_FEATURE_PCID) && (x86_get_cr4() & X86_CR4_PGE);
+
     x86_mmu_mem_type_init();
     x86_mmu_percpu_init();
 
-    /* unmap the lower identity mapping */
-    unmap_entry<PageTable<PML4_L>>(nullptr, 0, &pml4[0]);
+    /* unmap the lower identity mapping, which start.S built out of global
+     * pages */
+    PendingTlbInvalidation tlb;
+    pml4[0] = 0;
+    tlb.enqueue(0, PML4_L, true);
+    x86_tlb_invalidate(nullptr, &tlb);
+    tlb.clear();
 
     /* get the address width from the CPU */
     uint8_t vaddr_width = x86_linear_address_width();
@@ -1254,6 +1440,8 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
     aspace->flags = mmu_flags;
     aspace->base = base;
     aspace->size = size;
+    aspace->pcid = 0;
+    aspace->pcid_stale_cpus = mp_cpu_mask_none();
     if (mmu_flags & ARCH_ASPACE_FLAG_KERNEL) {
         aspace->pt_phys = kernel_pt_phys;
         aspace->pt_virt = (pt_entry_t*)X86_PHYS_TO_VIRT(aspace->pt_phys);
@@ -1279,10 +1467,17 @@ status_t arch_mmu_init_aspace(arch_aspace_t* aspace, vaddr_t base, size_t size,
         memcpy(aspace->pt_virt + NO_OF_PT_ENTRIES / 2, &KERNEL_PT[NO_OF_PT_ENTRIES / 2],
                sizeof(pt_entry_t) * NO_OF_PT_ENTRIES / 2);
 
-        LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p\n", aspace->pt_phys, aspace->pt_virt);
+        /* A recycled PCID may still have entries from its last aspace in the
+         * TLB of any CPU, so each CPU flushes it the first time it switches
+         * to this aspace. */
+        aspace->pcid = x86_pcid_alloc();
+        aspace->pcid_stale_cpus = x86_all_cpus_mask();
+
+        LTRACEF("user aspace: pt phys %#" PRIxPTR ", virt %p, pcid %u\n", aspace->pt_phys,
+                aspace->pt_virt, aspace->pcid);
     }
     aspace->io_bitmap = nullptr;
-    aspace->active_cpus = 0;
+    aspace->active_cpus = mp_cpu_mask_none();
     spin_lock_init(&aspace->io_bitmap_lock);
 
     return NO_ERROR;
@@ -1307,7 +1502,9 @@ status_t guest_mmu_init_paspace(guest_paspace_t* paspace, size_t size) {
     paspace->flags = ARCH_MMU_FLAG_GUEST_PASPACE;
     paspace->base = 0;
     paspace->size = size;
-    paspace->active_cpus = 0;
+    paspace->active_cpus = mp_cpu_mask_none();
+    paspace->pcid = 0;
+    paspace->pcid_stale_cpus = mp_cpu_mask_none();
     paspace->io_bitmap = nullptr;
     spin_lock_init(&paspace->io_bitmap_lock);
 
@@ -1317,7 +1514,7 @@ status_t guest_mmu_init_paspace(guest_paspace_t* paspace, size_t size) {
 template <template <int> class PageTable>
 status_t mmu_destroy_aspace(arch_aspace_t* aspace) {
     DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
-    DEBUG_ASSERT(aspace->active_cpus == 0);
+    DEBUG_ASSERT(mp_cpu_mask_is_empty(&aspace->active_cpus));
 
 #if LK_DEBUGLEVEL > 1
     pt_entry_t* table = static_cast<pt_entry_t*>(aspace->pt_virt);
@@ -1343,6 +1540,7 @@ status_t mmu_destroy_aspace(arch_aspace_t* aspace) {
     }
 
     pmm_free_page(paddr_to_vm_page(aspace->pt_phys));
+    x86_pcid_free(aspace->pcid);
 
     aspace->magic = 0;
 
@@ -1358,21 +1556,38 @@ status_t guest_mmu_destroy_paspace(guest_paspace_t* paspace) {
 }
 
 void arch_mmu_context_switch(arch_aspace_t* old_aspace, arch_aspace_t* aspace) {
-    mp_cpu_mask_t cpu_bit = 1U << arch_curr_cpu_num();
+    uint cpu = arch_curr_cpu_num();
     if (aspace != nullptr) {
         DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
-        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR "\n", aspace, aspace->pt_phys);
-        x86_set_cr3(aspace->pt_phys);
+        LTRACEF_LEVEL(3, "switching to aspace %p, pt %#" PRIXPTR ", pcid %u\n", aspace,
+                      aspace->pt_phys, aspace->pcid);
+
+        /* Become active before looking at pcid_stale_cpus, so that a
+         * concurrent shootdown either marks this CPU stale before we check,
+         * or sends this CPU its invalidation */
+        mp_cpu_mask_atomic_set(&aspace->active_cpus, cpu);
+
+        ulong cr3 = aspace->pt_phys;
+        if (aspace->pcid != 0) {
+            cr3 |= aspace->pcid;
+            if (mp_cpu_mask_atomic_test(&aspace->pcid_stale_cpus, cpu)) {
+                mp_cpu_mask_atomic_clear(&aspace->pcid_stale_cpus, cpu);
+            } else {
+                cr3 |= X86_CR3_NOFLUSH;
+            }
+        }
+        x86_set_cr3(cr3);
 
         if (old_aspace != nullptr) {
-            atomic_and(&old_aspace->active_cpus, ~cpu_bit);
+            mp_cpu_mask_atomic_clear(&old_aspace->active_cpus, cpu);
         }
-        atomic_or(&aspace->active_cpus, cpu_bit);
     } else {
         LTRACEF_LEVEL(3, "switching to kernel aspace, pt %#" PRIxPTR "\n", kernel_pt_phys);
+        /* PCID 0 may be shared by user aspaces that didn't get a PCID of
+         * their own, so this always flushes it */
         x86_set_cr3(kernel_pt_phys);
         if (old_aspace != nullptr) {
-            atomic_and(&old_aspace->active_cpus, ~cpu_bit);
+            mp_cpu_mask_atomic_clear(&old_aspace->active_cpus, cpu);
         }
     }
 
@@ -1450,6 +1665,31 @@ status_t arch_mmu_query(arch_aspace_t* aspace, vaddr_t vaddr, paddr_t* paddr, ui
     return mmu_query<PageTable>(aspace, vaddr, paddr, mmu_flags, x86_mmu_flags);
 }
 
+size_t x86_mmu_mapping_size(arch_aspace_t* aspace, vaddr_t vaddr) {
+    DEBUG_ASSERT(aspace->magic == ARCH_ASPACE_MAGIC);
+
+    if (!is_valid_vaddr(aspace, vaddr))
+        return 0;
+
+    page_table_levels level;
+    pt_entry_t* entry;
+    status_t status = x86_mmu_get_mapping<PageTable<MAX_PAGING_LEVEL>>(
+        aspace->pt_virt, vaddr, &level, &entry);
+    if (status != NO_ERROR)
+        return 0;
+
+    switch (level) {
+    case PDP_L:
+        return PageTable<PDP_L>::page_size();
+    case PD_L:
+        return PageTable<PD_L>::page_size();
+    case PT_L:
+        return PageTable<PT_L>::page_size();
+    default:
+        panic("x86_mmu_mapping_size: unhandled frame level\n");
+    }
+}
+
 status_t guest_mmu_query(guest_paspace_t* paspace, vaddr_t vaddr, paddr_t* paddr, uint* mmu_flags) {
     return mmu_query<ExtendedPageTable>(paspace, vaddr, paddr, mmu_flags, ept_mmu_flags);
 }
@@ -1468,6 +1708,10 @@ void x86_mmu_percpu_init(void) {
         cr4 |= X86_CR4_SMEP;
     if (x86_feature_test(X86_FEATURE_SMAP))
         cr4 |= X86_CR4_SMAP;
+    /* CR3 still holds the PCID 0 kernel page tables here, as enabling PCIDs
+     * requires */
+    if (pcid_enabled)
+        cr4 |= X86_CR4_PCIDE;
     x86_set_cr4(cr4);
 
     /* Set NXE bit in X86_MSR_IA32_EFER*/
@@ -78,9 +78,9 @@ static struct mtrrs *target_mtrrs = &THE_MTRRS;
 /* Function called by all CPUs to setup their PAT */
 static void x86_pat_sync_task(void *context);
 struct pat_sync_task_context {
-    /* Barrier counters for the two barriers described in Intel's algorithm */
-    volatile int barrier1;
-    volatile int barrier2;
+    /* Barrier masks for the two barriers described in Intel's algorithm */
+    mp_cpu_mask_t barrier1;
+    mp_cpu_mask_t barrier2;
 };
 
 extern void* boot_alloc_mem(size_t len);
@@ -106,7 +106,8 @@ void x86_mmu_mem_type_init(void)
 
     /* Update the PAT on the bootstrap processor (and sync any changes to the
      * MTRR that may have been made above). */
-    x86_pat_sync(1<<0);
+    mp_cpu_mask_t boot_cpu = mp_cpu_mask_of(0);
+    x86_pat_sync(&boot_cpu);
 }
 
 /* @brief Give the specificed CPUs our Page Attribute Tables and
@@ -119,16 +120,29 @@ void x86_mmu_mem_type_init(void)
  *
  * This algorithm is based on section 11.11.8 of Intel 3A
  */
-void x86_pat_sync(mp_cpu_mask_t targets)
+void x86_pat_sync(const mp_cpu_mask_t *targets)
 {
-    targets &= mp_get_online_mask();
+    mp_cpu_mask_t online = mp_get_online_mask();
+    mp_cpu_mask_t mask = mp_cpu_mask_and(targets, &online);
 
     struct pat_sync_task_context context = {
-        .barrier1 = (int)targets,
-        .barrier2 = (int)targets,
+        .barrier1 = mask,
+        .barrier2 = mask,
     };
     /* Step 1: Broadcast to all processors to execute the sequence */
-    mp_sync_exec(targets, x86_pat_sync_task, &context);
+    mp_sync_exec(MP_IPI_TARGET_MASK, &mask, x86_pat_sync_task, &context);
+}
+
+/* Check in at a barrier and wait for all other participants to do so */
+static void pat_sync_barrier(mp_cpu_mask_t *barrier, uint cpu)
+{
+    mp_cpu_mask_atomic_clear(barrier, cpu);
+    /* bits are only ever cleared, so checking each word in turn is enough */
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; ++i) {
+        while (atomic_load_u64(&barrier->bits[i]) != 0) {
+            arch_spinloop_pause();
+        }
+    }
 }
 
 static void x86_pat_sync_task(void *raw_context)
@@ -141,10 +155,7 @@ static void x86_pat_sync_task(void *raw_context)
     uint cpu = arch_curr_cpu_num();
 
     /* Step 3: Wait for all processors to reach this point. */
-    atomic_and(&context->barrier1, ~(1 << cpu));
-    while (context->barrier1 != 0) {
-        arch_spinloop_pause();
-    }
+    pat_sync_barrier(&context->barrier1, cpu);
 
     /* Step 4: Enter the no-fill cache mode (cache-disable and writethrough) */
     ulong cr0 = x86_get_cr0();
@@ -207,9 +218,16 @@ static void x86_pat_sync_task(void *raw_context)
     /* Step 10: Re-enable MTRRs (and set the default type) */
     write_msr(X86_MSR_IA32_MTRR_DEF_TYPE, target_mtrrs->mtrr_def);
 
-    /* Step 11: Flush all cache and the TLB again */
+    /* Step 11: Flush all cache and the TLB again.  With PCIDs enabled a CR3
+     * write only flushes the current PCID, but any change to CR4.PGE flushes
+     * them all. */
     __asm volatile ("wbinvd" ::: "memory");
-    x86_set_cr3(x86_get_cr3());
+    if (cr4 & X86_CR4_PCIDE) {
+        x86_set_cr4(cr4 | X86_CR4_PGE);
+        x86_set_cr4(cr4);
+    } else {
+        x86_set_cr3(x86_get_cr3());
+    }
 
     /* Step 12: Enter the normal cache mode */
     cr0 = x86_get_cr0();
@@ -224,10 +242,7 @@ static void x86_pat_sync_task(void *raw_context)
     }
 
     /* Step 14: Wait for all processors to reach this point. */
-    atomic_and(&context->barrier2, ~(1 << cpu));
-    while (context->barrier2 != 0) {
-        arch_spinloop_pause();
-    }
+    pat_sync_barrier(&context->barrier2, cpu);
 }
 
 /* Helper for decoding and printing MTRRs */
@@ -301,7 +316,8 @@ usage:
         uint num_cpus = arch_max_num_cpus();
         for (uint i = 0; i < num_cpus; ++i) {
             printf("CPU %u Page Attribute Table types:\n", i);
-            mp_sync_exec(1 << i, print_pat_entries, NULL);
+            mp_cpu_mask_t mask = mp_cpu_mask_of(i);
+            mp_sync_exec(MP_IPI_TARGET_MASK, &mask, print_pat_entries, NULL);
         }
     } else {
         printf("unknown command\n");
@@ -26,6 +26,7 @@
 #include <dev/hw_rng.h>
 #include <dev/interrupt.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <kernel/timer.h>
 #include <platform.h>
 
@@ -36,11 +37,19 @@
 __SECTION(".data") struct x86_percpu bp_percpu;
 
 static struct x86_percpu *ap_percpus;
-uint8_t x86_num_cpus = 1;
+uint32_t x86_num_cpus = 1;
 
 extern struct idt _idt;
 
-status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count)
+/* tell the scheduler which cpus share cores and caches */
+static void register_cpu_topology(uint cpu_num, uint32_t apic_id)
+{
+    x86_cpu_topology_t topo;
+    x86_cpu_topology_decode(apic_id, &topo);
+    mp_set_cpu_topology(cpu_num, topo.package_id, topo.core_id);
+}
+
+status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint32_t cpu_count)
 {
     ASSERT(ap_percpus == NULL);
 
@@ -57,20 +66,22 @@ status_t x86_allocate_ap_structures(uint32_t *apic_ids, uint8_t cpu_count)
     }
 
     uint32_t bootstrap_ap = apic_local_id();
+    register_cpu_topology(0, bootstrap_ap);
 
     uint apic_idx = 0;
     for (uint i = 0; i < cpu_count; ++i) {
         if (apic_ids[i] == bootstrap_ap) {
             continue;
         }
-        DEBUG_ASSERT(apic_idx != (uint)(cpu_count - 1));
-        if (apic_idx == (uint)cpu_count - 1) {
+        DEBUG_ASSERT(apic_idx != cpu_count - 1);
+        if (apic_idx == cpu_count - 1) {
             /* Never found bootstrap CPU in apic id list */
             return ERR_BAD_STATE;
         }
         ap_percpus[apic_idx].cpu_num = apic_idx + 1;
         ap_percpus[apic_idx].apic_id = apic_ids[i];
         ap_percpus[apic_idx].direct = &ap_percpus[apic_idx];
+        register_cpu_topology(apic_idx + 1, apic_ids[i]);
         apic_idx++;
     }
 
@@ -230,7 +241,7 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id)
         return (int)bp_percpu.cpu_num;
     }
 
-    for (uint i = 0; i < (uint)x86_num_cpus - 1; ++i) {
+    for (uint i = 0; i < x86_num_cpus - 1; ++i) {
         if (ap_percpus[i].apic_id == apic_id) {
             return (int)ap_percpus[i].cpu_num;
         }
@@ -239,7 +250,7 @@ int x86_apic_id_to_cpu_num(uint32_t apic_id)
 }
 
 #if WITH_SMP
-status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
+status_t arch_mp_send_ipi(mp_ipi_target_t target, const mp_cpu_mask_t *mask, mp_ipi_t ipi)
 {
     uint8_t vector = 0;
     switch (ipi) {
@@ -256,38 +267,34 @@ status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi)
             panic("Unexpected MP IPI value: %u", (uint)ipi);
     }
 
-    if (target == MP_CPU_ALL_BUT_LOCAL) {
+    if (target == MP_IPI_TARGET_ALL_BUT_LOCAL) {
         apic_send_broadcast_ipi(vector, DELIVERY_MODE_FIXED);
         return NO_ERROR;
-    } else if (target == MP_CPU_ALL) {
+    } else if (target == MP_IPI_TARGET_ALL) {
         apic_send_broadcast_self_ipi(vector, DELIVERY_MODE_FIXED);
         return NO_ERROR;
     }
 
-    ASSERT(x86_num_cpus <= sizeof(target) * 8);
-
-    mp_cpu_mask_t remaining = target;
-    uint cpu_id = 0;
-    while (remaining && cpu_id < x86_num_cpus) {
-        if (remaining & 1) {
-            struct x86_percpu *percpu;
-            if (cpu_id == 0) {
-                percpu = &bp_percpu;
-            } else {
-                percpu = &ap_percpus[cpu_id - 1];
-            }
-            /* Reschedule IPIs may occur before all CPUs are fully up.  Just
-             * ignore attempts to send them to down CPUs. */
-            if (ipi != MP_IPI_RESCHEDULE) {
-                DEBUG_ASSERT(percpu->apic_id != INVALID_APIC_ID);
-            }
-            /* Make sure the CPU is actually up before sending the IPI */
-            if (percpu->apic_id != INVALID_APIC_ID) {
-                apic_send_ipi(vector, (uint8_t)percpu->apic_id, DELIVERY_MODE_FIXED);
-            }
+    uint cpu_id;
+    mp_cpu_mask_for_each(cpu_id, mask) {
+        if (cpu_id >= x86_num_cpus) {
+            break;
+        }
+        struct x86_percpu *percpu;
+        if (cpu_id == 0) {
+            percpu = &bp_percpu;
+        } else {
+            percpu = &ap_percpus[cpu_id - 1];
+        }
+        /* Reschedule IPIs may occur before all CPUs are fully up.  Just
+         * ignore attempts to send them to down CPUs. */
+        if (ipi != MP_IPI_RESCHEDULE) {
+            DEBUG_ASSERT(percpu->apic_id != INVALID_APIC_ID);
+        }
+        /* Make sure the CPU is actually up before sending the IPI */
+        if (percpu->apic_id != INVALID_APIC_ID) {
+            apic_send_ipi(vector, (uint8_t)percpu->apic_id, DELIVERY_MODE_FIXED);
         }
-        remaining >>= 1;
-        cpu_id++;
     }
 
     return NO_ERROR;
@@ -122,8 +122,9 @@ void x86_processor_trace_init(void)
 // Intel Processor Trace support needs to be able to map cr3 values that
 // appear in the trace to pids that ld.so uses to dump memory maps.
 void arch_trace_process_create(uint64_t pid, const arch_aspace_t* aspace) {
-    // The cr3 value that appears in Intel PT h/w tracing.
-    uint64_t cr3 = aspace->pt_phys;
+    // The cr3 value that appears in Intel PT h/w tracing, which includes
+    // the aspace's PCID.
+    uint64_t cr3 = aspace->pt_phys | aspace->pcid;
     ktrace(TAG_IPT_PROCESS_CREATE, (uint32_t)pid, (uint32_t)(pid >> 32),
            (uint32_t)cr3, (uint32_t)(cr3 >> 32));
 }
@@ -169,7 +170,7 @@ status_t x86_ipt_set_mode(ipt_trace_mode_t mode) {
     if (ipt_cpu_state)
         return ERR_BAD_STATE;
 
-    mp_sync_exec(MP_CPU_ALL, x86_ipt_set_mode_task,
+    mp_sync_exec(MP_IPI_TARGET_ALL, nullptr, x86_ipt_set_mode_task,
                  reinterpret_cast<void*>(static_cast<uintptr_t>(mode)));
     trace_mode = mode;
 
@@ -267,7 +268,7 @@ status_t x86_ipt_cpu_mode_start() {
     ktrace(TAG_IPT_START, (uint32_t)nom_freq, 0,
            (uint32_t)kernel_cr3, (uint32_t)(kernel_cr3 >> 32));
 
-    mp_sync_exec(MP_CPU_ALL, x86_ipt_start_cpu_task, ipt_cpu_state);
+    mp_sync_exec(MP_IPI_TARGET_ALL, nullptr, x86_ipt_start_cpu_task, ipt_cpu_state);
     return NO_ERROR;
 }
 
@@ -315,7 +316,7 @@ status_t x86_ipt_cpu_mode_stop() {
 
     TRACEF("Disabling processor trace\n");
 
-    mp_sync_exec(MP_CPU_ALL, x86_ipt_stop_cpu_task, ipt_cpu_state);
+    mp_sync_exec(MP_IPI_TARGET_ALL, nullptr, x86_ipt_stop_cpu_task, ipt_cpu_state);
     ktrace(TAG_IPT_STOP, 0, 0, 0, 0);
     active = false;
     return NO_ERROR;
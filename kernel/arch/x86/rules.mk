@@ -87,7 +87,7 @@ include $(LOCAL_DIR)/toolchain.mk
 # enable more if smp is requested
 ifeq ($(call TOBOOL,$(WITH_SMP)),true)
 
-SMP_MAX_CPUS ?= 16
+SMP_MAX_CPUS ?= 256
 KERNEL_DEFINES += \
 	WITH_SMP=1
 MODULE_SRCS += \
@@ -262,11 +262,11 @@ static enum handler_return gic_handle_fiq(struct iframe *frame)
     PANIC_UNIMPLEMENTED;
 }
 
-static status_t gic_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi) {
+static status_t gic_send_ipi(const mp_cpu_mask_t *mask, mp_ipi_t ipi) {
     uint gic_ipi_num = ipi + ipi_base;
 
-    /* filter out targets outside of the range of cpus we care about */
-    target &= ((1UL << SMP_MAX_CPUS) - 1);
+    /* the GICv2 target list only covers the first 8 cpus */
+    u_int target = (u_int)(mask->bits[0] & 0xff);
     if (target != 0) {
         LTRACEF("target 0x%x, gic_ipi %u\n", target, gic_ipi_num);
         arm_gic_sgi(gic_ipi_num, ARM_GIC_SGI_FLAG_NS, target);
@@ -152,7 +152,7 @@ static void gic_init(void)
     gic_init_percpu_early();
 }
 
-static status_t arm_gic_sgi(u_int irq, u_int flags, u_int cpu_mask)
+static status_t arm_gic_sgi(u_int irq, u_int flags, const mp_cpu_mask_t *targets)
 {
     if (flags != ARM_GIC_SGI_FLAG_NS) {
         return ERR_INVALID_ARGS;
@@ -164,15 +164,16 @@ static status_t arm_gic_sgi(u_int irq, u_int flags, u_int cpu_mask)
 
     smp_wmb();
 
+    mp_cpu_mask_t cpu_mask = *targets;
     uint cpu = 0;
     uint cluster = 0;
     uint64_t val = 0;
-    while (cpu_mask && cpu < arch_max_num_cpus()) {
+    while (!mp_cpu_mask_is_empty(&cpu_mask) && cpu < arch_max_num_cpus()) {
         u_int mask = 0;
         while (arch_cpu_num_to_cluster_id(cpu) == cluster) {
-            if (cpu_mask & (1u << cpu)) {
+            if (mp_cpu_mask_test(&cpu_mask, cpu)) {
                 mask |= 1u << arch_cpu_num_to_cpu_id(cpu);
-                cpu_mask &= ~(1u << cpu);
+                mp_cpu_mask_clear(&cpu_mask, cpu);
             }
             cpu += 1;
         }
@@ -293,13 +294,12 @@ static enum handler_return gic_handle_fiq(iframe* frame) {
     PANIC_UNIMPLEMENTED;
 }
 
-static status_t gic_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi) {
+static status_t gic_send_ipi(const mp_cpu_mask_t *target, mp_ipi_t ipi) {
     uint gic_ipi_num = ipi + ipi_base;
 
-    /* filter out targets outside of the range of cpus we care about */
-    target &= ((1UL << arch_max_num_cpus()) - 1);
-    if (target != 0) {
-        LTRACEF("target 0x%x, gic_ipi %u\n", target, gic_ipi_num);
+    /* cpus outside of the range we care about are skipped by arm_gic_sgi */
+    if (!mp_cpu_mask_is_empty(target)) {
+        LTRACEF("target first %u, gic_ipi %u\n", mp_cpu_mask_first(target), gic_ipi_num);
         arm_gic_sgi(gic_ipi_num, ARM_GIC_SGI_FLAG_NS, target);
     }
 
@@ -45,7 +45,7 @@ bool is_valid_interrupt(unsigned int vector, uint32_t flags);
 unsigned int remap_interrupt(unsigned int vector);
 
 /* sends an inter-processor interrupt */
-status_t interrupt_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi);
+status_t interrupt_send_ipi(const mp_cpu_mask_t *target, mp_ipi_t ipi);
 
 /* performs per-cpu initialization for the interrupt controller */
 void interrupt_init_percpu(void);
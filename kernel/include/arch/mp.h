@@ -12,8 +12,9 @@
 
 __BEGIN_CDECLS
 
-/* send inter processor interrupt, if supported */
-status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi);
+/* send inter processor interrupt, if supported.  mask is only consulted
+ * when target is MP_IPI_TARGET_MASK. */
+status_t arch_mp_send_ipi(mp_ipi_target_t target, const mp_cpu_mask_t *mask, mp_ipi_t ipi);
 
 /* Bring a CPU up and enter it into the scheduler */
 status_t platform_mp_cpu_hotplug(uint cpu_id);
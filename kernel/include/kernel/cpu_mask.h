@@ -0,0 +1,206 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/atomic.h>
+#include <magenta/compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS;
+
+/* A set of cpus, one bit per cpu number up to SMP_MAX_CPUS.
+ *
+ * This header is deliberately free of other kernel dependencies so that
+ * low level structures (such as the x86 arch_aspace) can embed a mask.
+ */
+#define MP_CPU_MASK_WORD_BITS (64u)
+#define MP_CPU_MASK_WORDS \
+    ((SMP_MAX_CPUS + MP_CPU_MASK_WORD_BITS - 1) / MP_CPU_MASK_WORD_BITS)
+
+typedef struct mp_cpu_mask {
+    uint64_t bits[MP_CPU_MASK_WORDS];
+} mp_cpu_mask_t;
+
+#define MP_CPU_MASK_INITIAL_VALUE { { 0 } }
+
+static inline uint mp_cpu_mask_word(uint cpu)
+{
+    return cpu / MP_CPU_MASK_WORD_BITS;
+}
+
+static inline uint64_t mp_cpu_mask_bit(uint cpu)
+{
+    return 1ull << (cpu % MP_CPU_MASK_WORD_BITS);
+}
+
+static inline mp_cpu_mask_t mp_cpu_mask_none(void)
+{
+    mp_cpu_mask_t m = MP_CPU_MASK_INITIAL_VALUE;
+    return m;
+}
+
+static inline mp_cpu_mask_t mp_cpu_mask_of(uint cpu)
+{
+    mp_cpu_mask_t m = MP_CPU_MASK_INITIAL_VALUE;
+    m.bits[mp_cpu_mask_word(cpu)] = mp_cpu_mask_bit(cpu);
+    return m;
+}
+
+static inline void mp_cpu_mask_set(mp_cpu_mask_t *m, uint cpu)
+{
+    m->bits[mp_cpu_mask_word(cpu)] |= mp_cpu_mask_bit(cpu);
+}
+
+static inline void mp_cpu_mask_clear(mp_cpu_mask_t *m, uint cpu)
+{
+    m->bits[mp_cpu_mask_word(cpu)] &= ~mp_cpu_mask_bit(cpu);
+}
+
+static inline bool mp_cpu_mask_test(const mp_cpu_mask_t *m, uint cpu)
+{
+    return (m->bits[mp_cpu_mask_word(cpu)] & mp_cpu_mask_bit(cpu)) != 0;
+}
+
+static inline bool mp_cpu_mask_is_empty(const mp_cpu_mask_t *m)
+{
+    uint64_t acc = 0;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        acc |= m->bits[i];
+    return acc == 0;
+}
+
+static inline bool mp_cpu_mask_equal(const mp_cpu_mask_t *a, const mp_cpu_mask_t *b)
+{
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++) {
+        if (a->bits[i] != b->bits[i])
+            return false;
+    }
+    return true;
+}
+
+static inline mp_cpu_mask_t mp_cpu_mask_and(const mp_cpu_mask_t *a, const mp_cpu_mask_t *b)
+{
+    mp_cpu_mask_t m;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        m.bits[i] = a->bits[i] & b->bits[i];
+    return m;
+}
+
+static inline mp_cpu_mask_t mp_cpu_mask_or(const mp_cpu_mask_t *a, const mp_cpu_mask_t *b)
+{
+    mp_cpu_mask_t m;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        m.bits[i] = a->bits[i] | b->bits[i];
+    return m;
+}
+
+/* a & ~b */
+static inline mp_cpu_mask_t mp_cpu_mask_andnot(const mp_cpu_mask_t *a, const mp_cpu_mask_t *b)
+{
+    mp_cpu_mask_t m;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        m.bits[i] = a->bits[i] & ~b->bits[i];
+    return m;
+}
+
+static inline uint mp_cpu_mask_count(const mp_cpu_mask_t *m)
+{
+    uint count = 0;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        count += (uint)__builtin_popcountll(m->bits[i]);
+    return count;
+}
+
+/* returns the lowest numbered cpu >= cpu in the mask, or SMP_MAX_CPUS if none */
+static inline uint mp_cpu_mask_next(const mp_cpu_mask_t *m, uint cpu)
+{
+    if (cpu >= SMP_MAX_CPUS)
+        return SMP_MAX_CPUS;
+
+    uint i = mp_cpu_mask_word(cpu);
+    uint64_t word = m->bits[i] & ~(mp_cpu_mask_bit(cpu) - 1);
+    for (;;) {
+        if (word != 0) {
+            uint next = i * MP_CPU_MASK_WORD_BITS + (uint)__builtin_ctzll(word);
+            return next < SMP_MAX_CPUS ? next : SMP_MAX_CPUS;
+        }
+        if (++i == MP_CPU_MASK_WORDS)
+            return SMP_MAX_CPUS;
+        word = m->bits[i];
+    }
+}
+
+/* returns the lowest numbered cpu in the mask, or SMP_MAX_CPUS if empty */
+static inline uint mp_cpu_mask_first(const mp_cpu_mask_t *m)
+{
+    return mp_cpu_mask_next(m, 0);
+}
+
+/* returns the highest numbered cpu in the mask, or SMP_MAX_CPUS if empty */
+static inline uint mp_cpu_mask_last(const mp_cpu_mask_t *m)
+{
+    for (uint i = MP_CPU_MASK_WORDS; i-- > 0;) {
+        if (m->bits[i] != 0)
+            return i * MP_CPU_MASK_WORD_BITS + (MP_CPU_MASK_WORD_BITS - 1) -
+                   (uint)__builtin_clzll(m->bits[i]);
+    }
+    return SMP_MAX_CPUS;
+}
+
+/* iterate cpu over every cpu number set in the mask, in increasing order */
+#define mp_cpu_mask_for_each(cpu, m) \
+    for ((cpu) = mp_cpu_mask_first(m); (cpu) < SMP_MAX_CPUS; \
+         (cpu) = mp_cpu_mask_next((m), (cpu) + 1))
+
+/* Atomic accessors, for masks that are updated without a lock held.  Each
+ * word is accessed atomically, but a load of a multi-word mask is not a
+ * single snapshot. */
+static inline void mp_cpu_mask_atomic_set(volatile mp_cpu_mask_t *m, uint cpu)
+{
+    atomic_or_u64(&m->bits[mp_cpu_mask_word(cpu)], mp_cpu_mask_bit(cpu));
+}
+
+/* returns true if the cpu was set in the mask prior to clearing it */
+static inline bool mp_cpu_mask_atomic_clear(volatile mp_cpu_mask_t *m, uint cpu)
+{
+    uint64_t bit = mp_cpu_mask_bit(cpu);
+    return (atomic_and_u64(&m->bits[mp_cpu_mask_word(cpu)], ~bit) & bit) != 0;
+}
+
+static inline bool mp_cpu_mask_atomic_test(volatile mp_cpu_mask_t *m, uint cpu)
+{
+    return (atomic_load_u64(&m->bits[mp_cpu_mask_word(cpu)]) & mp_cpu_mask_bit(cpu)) != 0;
+}
+
+static inline void mp_cpu_mask_atomic_or(volatile mp_cpu_mask_t *m, const mp_cpu_mask_t *src)
+{
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++) {
+        if (src->bits[i] != 0)
+            atomic_or_u64(&m->bits[i], src->bits[i]);
+    }
+}
+
+static inline mp_cpu_mask_t mp_cpu_mask_atomic_load(volatile mp_cpu_mask_t *m)
+{
+    mp_cpu_mask_t ret;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        ret.bits[i] = atomic_load_u64(&m->bits[i]);
+    return ret;
+}
+
+/* atomically clears every word of the mask, returning the prior contents */
+static inline mp_cpu_mask_t mp_cpu_mask_atomic_swap_none(volatile mp_cpu_mask_t *m)
+{
+    mp_cpu_mask_t ret;
+    for (uint i = 0; i < MP_CPU_MASK_WORDS; i++)
+        ret.bits[i] = atomic_swap_u64(&m->bits[i], 0);
+    return ret;
+}
+
+__END_CDECLS;
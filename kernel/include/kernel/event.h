@@ -25,6 +25,9 @@ typedef struct event {
 } event_t;
 
 #define EVENT_FLAG_AUTOUNSIGNAL 1
+/* the signaler blocks soon after signaling (e.g. replying to a call), so a
+ * lone waiter is best placed near the signaler's cpu */
+#define EVENT_FLAG_SYNC_WAKE    2
 
 #define EVENT_INITIAL_VALUE(e, initial, _flags) \
 { \
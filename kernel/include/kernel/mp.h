@@ -11,18 +11,21 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <kernel/cpu_mask.h>
 #include <kernel/mutex.h>
 #include <kernel/thread.h>
 
 __BEGIN_CDECLS;
 
-typedef uint32_t mp_cpu_mask_t;
-typedef void (*mp_ipi_task_func_t)(void *context);
 typedef void (*mp_sync_task_t)(void *context);
 
-#define MP_CPU_ALL_BUT_LOCAL (UINT32_MAX)
-#define MP_CPU_ALL (1U<<31)
-static_assert(SMP_MAX_CPUS <= 31, "");
+/* which cpus an ipi or sync task is directed at; the mask argument that
+ * accompanies these is only consulted for MP_IPI_TARGET_MASK */
+typedef enum {
+    MP_IPI_TARGET_MASK,
+    MP_IPI_TARGET_ALL,
+    MP_IPI_TARGET_ALL_BUT_LOCAL,
+} mp_ipi_target_t;
 
 /* by default, mp_mbx_reschedule does not signal to cpus that are running realtime
  * threads. Override this behavior.
@@ -40,73 +43,80 @@ typedef enum {
 #ifdef WITH_SMP
 void mp_init(void);
 
-void mp_reschedule(mp_cpu_mask_t target, uint flags);
-void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context);
+void mp_reschedule(const mp_cpu_mask_t *target, uint flags);
+void mp_reschedule_cpu(uint cpu, uint flags);
+void mp_sync_exec(mp_ipi_target_t target, const mp_cpu_mask_t *mask,
+                  mp_sync_task_t task, void *context);
 void mp_set_curr_cpu_online(bool online);
 void mp_set_curr_cpu_active(bool active);
 
 status_t mp_hotplug_cpu(uint cpu_id);
 status_t mp_unplug_cpu(uint cpu_id);
 
+/* Describe where a cpu sits in the machine.  Called by arch code during
+ * bringup; cpus in the same package are assumed to share a last level cache
+ * and cpus with the same core id in a package are smt siblings. */
+void mp_set_cpu_topology(uint cpu, uint package_id, uint core_id);
+
 /* called from arch code during reschedule irq */
 enum handler_return mp_mbx_reschedule_irq(void);
 /* called from arch code during generic task irq */
 enum handler_return mp_mbx_generic_irq(void);
 
-/* represents a pending task for some number of CPUs to execute */
-struct mp_ipi_task {
-    struct list_node node;
-
-    mp_ipi_task_func_t func;
-    void *context;
-};
-
 /* global mp state to track what the cpus are up to */
 struct mp_state {
-    /* cpus that are currently online */
-    volatile mp_cpu_mask_t online_cpus;
-    /* cpus that are currently schedulable */
-    volatile mp_cpu_mask_t active_cpus;
+    /* cpus that are currently online, updated atomically */
+    mp_cpu_mask_t online_cpus;
+    /* cpus that are currently schedulable, updated atomically */
+    mp_cpu_mask_t active_cpus;
 
     /* only safely accessible with thread lock held */
     mp_cpu_mask_t idle_cpus;
     mp_cpu_mask_t realtime_cpus;
 
     spin_lock_t ipi_task_lock;
-    /* list of outstanding tasks for CPUs to execute.  Should only be
-     * accessed with the ipi_task_lock held */
-    struct list_node ipi_task_list[SMP_MAX_CPUS];
+    /* list of outstanding sync tasks, each naming the CPUs that have yet to
+     * pick it up.  Should only be accessed with the ipi_task_lock held */
+    struct list_node ipi_task_list;
+    /* cpus that may have a task waiting for them in ipi_task_list.  Set
+     * with the ipi_task_lock held, but may be read without it */
+    mp_cpu_mask_t ipi_task_pending;
 
     /* lock for serializing CPU hotplug/unplug operations */
     mutex_t hotplug_lock;
+
+    /* per cpu, the cpus sharing its core and its last level cache (each
+     * including the cpu itself).  Written with the thread lock held */
+    mp_cpu_mask_t smt_siblings[SMP_MAX_CPUS];
+    mp_cpu_mask_t cache_siblings[SMP_MAX_CPUS];
 };
 
 extern struct mp_state mp;
 
 static inline int mp_is_cpu_active(uint cpu)
 {
-    return atomic_load((int *)&mp.active_cpus) & (1 << cpu);
+    return mp_cpu_mask_atomic_test(&mp.active_cpus, cpu);
 }
 
 static inline int mp_is_cpu_idle(uint cpu)
 {
-    return mp.idle_cpus & (1 << cpu);
+    return mp_cpu_mask_test(&mp.idle_cpus, cpu);
 }
 
 static inline int mp_is_cpu_online(uint cpu)
 {
-    return mp.online_cpus & (1 << cpu);
+    return mp_cpu_mask_atomic_test(&mp.online_cpus, cpu);
 }
 
 /* must be called with the thread lock held */
 static inline void mp_set_cpu_idle(uint cpu)
 {
-    mp.idle_cpus |= 1U << cpu;
+    mp_cpu_mask_set(&mp.idle_cpus, cpu);
 }
 
 static inline void mp_set_cpu_busy(uint cpu)
 {
-    mp.idle_cpus &= ~(1U << cpu);
+    mp_cpu_mask_clear(&mp.idle_cpus, cpu);
 }
 
 static inline mp_cpu_mask_t mp_get_idle_mask(void)
@@ -116,35 +126,53 @@ static inline mp_cpu_mask_t mp_get_idle_mask(void)
 
 static inline mp_cpu_mask_t mp_get_active_mask(void)
 {
-    return atomic_load((int *)&mp.active_cpus);
+    return mp_cpu_mask_atomic_load(&mp.active_cpus);
 }
 
 static inline mp_cpu_mask_t mp_get_online_mask(void)
 {
-    return mp.online_cpus;
+    return mp_cpu_mask_atomic_load(&mp.online_cpus);
+}
+
+static inline uint mp_get_online_count(void)
+{
+    mp_cpu_mask_t online = mp_get_online_mask();
+    return mp_cpu_mask_count(&online);
 }
 
 static inline void mp_set_cpu_realtime(uint cpu)
 {
-    mp.realtime_cpus |= 1U << cpu;
+    mp_cpu_mask_set(&mp.realtime_cpus, cpu);
 }
 
 static inline void mp_set_cpu_non_realtime(uint cpu)
 {
-    mp.realtime_cpus &= ~(1U << cpu);
+    mp_cpu_mask_clear(&mp.realtime_cpus, cpu);
 }
 
 static inline mp_cpu_mask_t mp_get_realtime_mask(void)
 {
     return mp.realtime_cpus;
 }
+
+static inline const mp_cpu_mask_t *mp_get_smt_siblings(uint cpu)
+{
+    return &mp.smt_siblings[cpu];
+}
+
+static inline const mp_cpu_mask_t *mp_get_cache_siblings(uint cpu)
+{
+    return &mp.cache_siblings[cpu];
+}
 #else
 static inline void mp_init(void) {}
-static inline void mp_reschedule(mp_cpu_mask_t target, uint flags) {}
-static inline void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context)
+static inline void mp_reschedule(const mp_cpu_mask_t *target, uint flags) {}
+static inline void mp_reschedule_cpu(uint cpu, uint flags) {}
+static inline void mp_sync_exec(mp_ipi_target_t target, const mp_cpu_mask_t *mask,
+                                mp_sync_task_t task, void *context)
 {
-    if (target != MP_CPU_ALL &&
-        (!(target & 0x1) || target == MP_CPU_ALL_BUT_LOCAL)) return;
+    if (target == MP_IPI_TARGET_ALL_BUT_LOCAL ||
+        (target == MP_IPI_TARGET_MASK && !mp_cpu_mask_test(mask, 0))) return;
     spin_lock_saved_state_t irqstate;
     arch_interrupt_save(&irqstate, SPIN_LOCK_FLAG_INTERRUPTS);
     task(context);
@@ -152,6 +180,7 @@ static inline void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void
 }
 static inline void mp_set_curr_cpu_active(bool active) {}
 static inline void mp_set_curr_cpu_online(bool online) {}
+static inline void mp_set_cpu_topology(uint cpu, uint package_id, uint core_id) {}
 
 static inline enum handler_return mp_mbx_reschedule_irq(void) { return INT_NO_RESCHEDULE; }
 static inline enum handler_return mp_mbx_generic_irq(void) { return INT_NO_RESCHEDULE; }
@@ -164,15 +193,16 @@ static inline int mp_is_cpu_online(uint cpu) { return 1; }
 static inline void mp_set_cpu_idle(uint cpu) {}
 static inline void mp_set_cpu_busy(uint cpu) {}
 
-static inline mp_cpu_mask_t mp_get_idle_mask(void) { return 0; }
+static inline mp_cpu_mask_t mp_get_idle_mask(void) { return mp_cpu_mask_none(); }
 
 static inline void mp_set_cpu_realtime(uint cpu) {}
 static inline void mp_set_cpu_non_realtime(uint cpu) {}
 
-static inline mp_cpu_mask_t mp_get_realtime_mask(void) { return 0; }
+static inline mp_cpu_mask_t mp_get_realtime_mask(void) { return mp_cpu_mask_none(); }
 
-static inline mp_cpu_mask_t mp_get_active_mask(void) { return 1; }
-static inline mp_cpu_mask_t mp_get_online_mask(void) { return 1; }
+static inline mp_cpu_mask_t mp_get_active_mask(void) { return mp_cpu_mask_of(0); }
+static inline mp_cpu_mask_t mp_get_online_mask(void) { return mp_cpu_mask_of(0); }
+static inline uint mp_get_online_count(void) { return 1; }
 #endif
 
 __END_CDECLS;
@@ -19,18 +19,20 @@ __BEGIN_CDECLS;
 
 #define MUTEX_MAGIC (0x6D757478)  // 'mutx'
 
+/* the low bit of the mutex value is set if there are threads blocked in the
+ * wait queue, the rest of it is the holding thread_t pointer (or 0 if unheld) */
+#define MUTEX_FLAG_QUEUED ((uintptr_t)1)
+
 typedef struct TA_CAP("mutex") mutex {
     uint32_t magic;
-    thread_t *holder;
-    int count;
+    uintptr_t val;
     wait_queue_t wait;
 } mutex_t;
 
 #define MUTEX_INITIAL_VALUE(m) \
 { \
     .magic = MUTEX_MAGIC, \
-    .holder = NULL, \
-    .count = 0, \
+    .val = 0, \
     .wait = WAIT_QUEUE_INITIAL_VALUE((m).wait), \
 }
 
@@ -48,10 +50,16 @@ void mutex_release(mutex_t *m) TA_REL(m);
 void mutex_acquire_internal(mutex_t *m) TA_ACQ(m);
 void mutex_release_internal(mutex_t *m, bool reschedule) TA_REL(m);
 
+/* the thread currently holding the mutex, or NULL */
+static inline thread_t *mutex_holder(const mutex_t *m)
+{
+    return (thread_t *)(__atomic_load_n(&m->val, __ATOMIC_RELAXED) & ~MUTEX_FLAG_QUEUED);
+}
+
 /* does the current thread hold the mutex? */
 static bool is_mutex_held(const mutex_t *m)
 {
-    return m->holder == get_current_thread();
+    return mutex_holder(m) == get_current_thread();
 }
 
 __END_CDECLS;
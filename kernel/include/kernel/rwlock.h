@@ -0,0 +1,123 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <magenta/compiler.h>
+#include <magenta/thread_annotations.h>
+#include <debug.h>
+#include <stdint.h>
+#include <kernel/thread.h>
+
+__BEGIN_CDECLS;
+
+#define RWLOCK_MAGIC (0x72776c6b)  // 'rwlk'
+
+/* the low bit of the lock value is set while it is held exclusively, the
+ * next bit is set if there are threads blocked in either wait queue, and the
+ * rest of it counts the threads holding it shared */
+#define RWLOCK_FLAG_WRITER ((uintptr_t)1)
+#define RWLOCK_FLAG_QUEUED ((uintptr_t)2)
+#define RWLOCK_READER      ((uintptr_t)4)
+
+typedef struct TA_CAP("mutex") rwlock {
+    uint32_t magic;
+    uintptr_t val;
+    thread_t *writer;
+    wait_queue_t read_wait;
+    wait_queue_t write_wait;
+} rwlock_t;
+
+#define RWLOCK_INITIAL_VALUE(l) \
+{ \
+    .magic = RWLOCK_MAGIC, \
+    .val = 0, \
+    .writer = NULL, \
+    .read_wait = WAIT_QUEUE_INITIAL_VALUE((l).read_wait), \
+    .write_wait = WAIT_QUEUE_INITIAL_VALUE((l).write_wait), \
+}
+
+/* Rules for reader-writer locks:
+ * - They are only safe to use from thread context.
+ * - They are non-recursive, in either mode.
+ * - Once a thread is waiting to acquire it exclusively, new shared acquirers
+ *   wait behind it, so a steady stream of readers cannot starve writers.
+ * - Unlike mutexes, they do not lend the priority of waiters to the holders.
+ */
+
+void rwlock_init(rwlock_t *);
+void rwlock_destroy(rwlock_t *);
+void rwlock_acquire_read(rwlock_t *l) TA_ACQ_SHARED(l);
+void rwlock_release_read(rwlock_t *l) TA_REL_SHARED(l);
+void rwlock_acquire_write(rwlock_t *l) TA_ACQ(l);
+void rwlock_release_write(rwlock_t *l) TA_REL(l);
+
+/* does the current thread hold the lock exclusively? */
+static inline bool rwlock_is_write_held(const rwlock_t *l)
+{
+    return __atomic_load_n(&l->writer, __ATOMIC_RELAXED) == get_current_thread();
+}
+
+/* does the current thread hold the lock exclusively, or does anyone hold it
+ * shared? shared holders are not tracked, so this is only good for asserts */
+static inline bool rwlock_is_held(const rwlock_t *l)
+{
+    uintptr_t val = __atomic_load_n(&l->val, __ATOMIC_RELAXED);
+    return rwlock_is_write_held(l) ||
+           (val & ~(RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED)) != 0;
+}
+
+__END_CDECLS;
+
+#ifdef __cplusplus
+
+#include <mxtl/macros.h>
+
+class TA_SCOPED_CAP AutoReadLock {
+public:
+    explicit AutoReadLock(rwlock_t* lock) TA_ACQ_SHARED(lock) : lock_(lock) {
+        rwlock_acquire_read(lock_);
+    }
+    ~AutoReadLock() TA_REL() { release(); }
+
+    // early release the lock before the object goes out of scope
+    void release() TA_REL() {
+        if (lock_) {
+            rwlock_release_read(lock_);
+            lock_ = nullptr;
+        }
+    }
+
+    // suppress default constructors
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoReadLock);
+
+private:
+    rwlock_t* lock_;
+};
+
+class TA_SCOPED_CAP AutoWriteLock {
+public:
+    explicit AutoWriteLock(rwlock_t* lock) TA_ACQ(lock) : lock_(lock) {
+        rwlock_acquire_write(lock_);
+    }
+    ~AutoWriteLock() TA_REL() { release(); }
+
+    // early release the lock before the object goes out of scope
+    void release() TA_REL() {
+        if (lock_) {
+            rwlock_release_write(lock_);
+            lock_ = nullptr;
+        }
+    }
+
+    // suppress default constructors
+    DISALLOW_COPY_ASSIGN_AND_MOVE(AutoWriteLock);
+
+private:
+    rwlock_t* lock_;
+};
+
+#endif // __cplusplus
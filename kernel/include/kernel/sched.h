@@ -12,12 +12,30 @@
 
 /* scheduler routines, used internally by thread.c */
 
+/* sched_unblock_etc flags */
+/* the waker is about to block, place the thread near the waker's cpu */
+#define SCHED_UNBLOCK_FLAG_SYNC (1 << 0)
+
 void sched_init_early(void);
 thread_t *sched_get_top_thread(uint cpu);
 
 void sched_block(void);
 void sched_unblock(thread_t *t, bool resched);
+void sched_unblock_etc(thread_t *t, bool resched, uint flags);
 void sched_unblock_list(struct list_node *list, bool resched);
 
 void sched_yield(void);
 void sched_preempt(void);
+
+/* change the effective priority of a thread in any state, moving it to the
+ * matching run queue if it's ready */
+void sched_change_priority(thread_t *t, int priority);
+
+/* admit a thread to the deadline class on some cpu with the bandwidth to
+ * spare, or with a zero runtime take it out again. returns ERR_NO_RESOURCES
+ * if no cpu can take it */
+status_t sched_set_deadline(thread_t *t, lk_time_t runtime, lk_time_t deadline,
+                            lk_time_t period);
+
+/* move threads queued on a cpu that is going offline to the current cpu */
+void sched_transition_off_cpu(uint old_cpu);
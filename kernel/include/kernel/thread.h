@@ -16,6 +16,7 @@
 #include <arch/thread.h>
 #include <kernel/wait.h>
 #include <kernel/spinlock.h>
+#include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <debug.h>
 
@@ -56,6 +57,7 @@ typedef void (*thread_user_callback_t)(enum thread_user_state_change new_state,
 #define THREAD_FLAG_REAL_TIME                 (1<<3)
 #define THREAD_FLAG_IDLE                      (1<<4)
 #define THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK  (1<<5)
+#define THREAD_FLAG_DEADLINE                  (1<<6)
 
 #define THREAD_SIGNAL_KILL                    (1<<0)
 #define THREAD_SIGNAL_SUSPEND                 (1<<1)
@@ -68,13 +70,53 @@ typedef void (*thread_user_callback_t)(enum thread_user_state_change new_state,
 
 #define THREAD_LINEBUFFER_LENGTH 128
 
+/* number of buckets in the wakeup latency histograms. bucket 0 counts
+ * latencies under 1us, bucket i counts [2^(i-1), 2^i) us and the last bucket
+ * also collects everything longer.
+ * N.B. This must match MX_INFO_THREAD_STATS_LATENCY_BUCKETS. */
+#define THREAD_LATENCY_BUCKETS 16
+
+/* scheduler latency accounting for a thread, protected by the thread lock */
+struct thread_sched_stats {
+    /* when the thread last went into a run queue, 0 if it isn't in one */
+    lk_time_t ready_timestamp;
+    /* set if it went into the run queue by being unblocked */
+    bool woken;
+
+    /* total time spent ready to run but waiting in a run queue */
+    lk_time_t run_queue_wait;
+    ulong wakeups;
+    ulong preemptions; /* involuntary, by quantum expiry or a higher priority thread */
+    ulong migrations;  /* started running on a different cpu than it last ran on */
+    ulong wakeup_latency[THREAD_LATENCY_BUCKETS];
+};
+
+/* deadline scheduling parameters and the state of the current job (one
+ * period's worth of work), protected by the thread lock */
+struct thread_deadline {
+    lk_time_t runtime;  /* cpu time the thread may use in each period */
+    lk_time_t deadline; /* when that has to be done by, from the start of the period */
+    lk_time_t period;
+    uint64_t bandwidth; /* runtime / deadline, as admitted to cpu */
+    uint cpu;
+    struct list_node admitted_node; /* in cpu's list of admitted threads */
+
+    lk_time_t release;      /* start of the current job */
+    lk_time_t abs_deadline; /* release + deadline */
+    lk_time_t remaining;    /* budget left in the current job */
+    lk_time_t charged_at;   /* when the budget was last charged, if running */
+    bool throttled;         /* out of budget until release + period */
+    timer_t replenish_timer; /* fires at release + period while throttled */
+};
+
 typedef struct thread {
     int magic;
     struct list_node thread_list_node;
 
     /* active bits */
     struct list_node queue_node;
-    int priority;
+    int priority; /* effective priority, base_priority raised by any inheritance */
+    int base_priority;
     enum thread_state state;
     lk_time_t last_started_running;
     lk_time_t remaining_time_slice;
@@ -83,8 +125,16 @@ typedef struct thread {
 #if WITH_SMP
     uint last_cpu; /* last/current cpu the thread is running on */
     int pinned_cpu; /* only run on pinned_cpu if >= 0 */
+    uint queued_cpu; /* cpu whose run queue the thread is in while ready */
 #endif
 
+    /* priority inheritance, protected by the thread lock. while blocked on a
+     * lock, pi_owner is the thread holding it and this thread sits in the
+     * owner's pi_donors list, lending the owner its priority. */
+    struct thread *pi_owner;
+    struct list_node pi_node;
+    struct list_node pi_donors;
+
     /* pointer to the kernel address space this thread is associated with */
     vmm_aspace_t *aspace;
 
@@ -101,6 +151,15 @@ typedef struct thread {
      * left the scheduler. */
     lk_time_t runtime_ns;
 
+    struct thread_sched_stats sched_stats;
+
+    /* only meaningful with THREAD_FLAG_DEADLINE set */
+    struct thread_deadline deadline;
+
+    /* how late timeouts for this thread's sleeps and waits may fire so they
+     * can be coalesced with other timers, 0 for exact deadlines */
+    lk_time_t timer_slack;
+
     /* if blocked, a pointer to the wait queue */
     struct wait_queue *blocking_wait_queue;
 
@@ -222,9 +281,53 @@ static inline status_t thread_sleep(lk_time_t deadline) {
 /* non-interruptable relative delay version of thread_sleep */
 status_t thread_sleep_relative(lk_time_t delay);
 
+/* priority inheritance, thread lock must be held.
+ * thread_pi_block_on() lends t's priority to owner, and transitively to
+ * whatever owner is blocked on, until thread_pi_unblock() is called for t.
+ * calling it again moves the loan to a new owner. */
+void thread_pi_block_on(thread_t *t, thread_t *owner);
+void thread_pi_unblock(thread_t *t);
+
 /* return the number of nanoseconds a thread has been running for */
 lk_time_t thread_runtime(const thread_t *t);
 
+/* return a snapshot of a thread's scheduler latency accounting. run queue
+ * wait time includes the current wait if the thread is ready */
+void thread_get_sched_stats(const thread_t *t, struct thread_sched_stats *stats);
+
+/* the histogram bucket a wakeup latency is counted in */
+static inline uint thread_latency_bucket(lk_time_t latency)
+{
+    uint64_t us = latency / 1000;
+    if (us == 0)
+        return 0;
+    uint bucket = 64 - (uint)__builtin_clzll(us);
+    return bucket < THREAD_LATENCY_BUCKETS ? bucket : THREAD_LATENCY_BUCKETS - 1;
+}
+
+/* the largest timer slack a thread may request */
+#define THREAD_MAX_TIMER_SLACK LK_SEC(1)
+
+/* set how late the thread's sleep and wait timeouts are allowed to fire */
+status_t thread_set_timer_slack(thread_t *t, lk_time_t slack);
+
+static inline lk_time_t thread_get_timer_slack(const thread_t *t)
+{
+    return __atomic_load_n(&t->timer_slack, __ATOMIC_RELAXED);
+}
+
+/* limits on deadline scheduling parameters */
+#define THREAD_MIN_DEADLINE_RUNTIME LK_USEC(100)
+#define THREAD_MAX_DEADLINE_PERIOD LK_SEC(10)
+
+/* move a thread into the deadline scheduling class, where it is guaranteed
+ * runtime ns of cpu time within deadline ns of the start of every period.
+ * all zeros moves it back to priority scheduling */
+status_t thread_set_deadline(thread_t *t, lk_time_t runtime, lk_time_t deadline,
+                             lk_time_t period);
+void thread_get_deadline(thread_t *t, lk_time_t *runtime, lk_time_t *deadline,
+                         lk_time_t *period);
+
 /* deliver a kill signal to a thread */
 void thread_kill(thread_t *t, bool block);
 
@@ -240,9 +343,15 @@ void thread_yield(void);             /* give up the cpu and time slice voluntari
 void thread_preempt(bool interrupt); /* get preempted (return to head of queue and reschedule) */
 void thread_resched(void);
 
+static inline bool thread_is_deadline(const thread_t *t)
+{
+    return !!(t->flags & THREAD_FLAG_DEADLINE);
+}
+
 static inline bool thread_is_realtime(thread_t *t)
 {
-    return (t->flags & THREAD_FLAG_REAL_TIME) && t->priority > DEFAULT_PRIORITY;
+    return ((t->flags & THREAD_FLAG_REAL_TIME) && t->priority > DEFAULT_PRIORITY) ||
+           thread_is_deadline(t);
 }
 
 static inline bool thread_is_idle(thread_t *t)
@@ -252,7 +361,7 @@ static inline bool thread_is_idle(thread_t *t)
 
 static inline bool thread_is_real_time_or_idle(thread_t *t)
 {
-    return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
+    return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE | THREAD_FLAG_DEADLINE));
 }
 
 /* called on every timer tick for the scheduler to do quantum expiration */
@@ -291,13 +400,25 @@ struct thread_stats {
     ulong interrupts; /* hardware interrupts, minus timer interrupts or inter-processor interrupts */
     ulong timer_ints; /* timer interrupts */
     ulong timers; /* timer callbacks */
+    ulong timers_coalesced; /* timer callbacks run early to share another timer's interrupt */
     ulong exceptions; /* exceptions such as page fault or undefined opcode */
     ulong syscalls;
 
+    /* time threads spent ready in this cpu's run queue before it ran them */
+    lk_time_t run_queue_wait;
+    /* how long woken threads waited before this cpu ran them, see thread_latency_bucket() */
+    ulong wakeup_latency[THREAD_LATENCY_BUCKETS];
+
 #if WITH_SMP
     /* inter-processor interrupts */
     ulong reschedule_ipis;
     ulong generic_ipis;
+
+    /* threads taken from another cpu's run queue */
+    ulong steals;
+
+    /* threads run here that last ran on another cpu */
+    ulong migrations;
 #endif
 };
 
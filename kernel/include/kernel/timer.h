@@ -22,11 +22,23 @@ typedef enum handler_return (*timer_callback)(struct timer *, lk_time_t now, voi
 
 #define TIMER_MAGIC (0x74696D72)  //'timr'
 
+struct timer_heap_node {
+    struct timer_heap_node *child;
+    struct timer_heap_node *sibling;
+    struct timer_heap_node *prev; /* parent if leftmost child, left sibling otherwise */
+};
+
 typedef struct timer {
     int magic;
-    struct list_node node;
+
+    /* links in the per cpu timer heaps, ordered by latest firing time and by
+     * deadline, only valid while queued_cpu >= 0 */
+    struct timer_heap_node latest_node;
+    struct timer_heap_node deadline_node;
+    int queued_cpu; /* <0 if not queued */
 
     lk_time_t scheduled_time;
+    lk_time_t slack; // may fire up to this long after scheduled_time
     lk_time_t period;
 
     timer_callback callback;
@@ -39,8 +51,11 @@ typedef struct timer {
 #define TIMER_INITIAL_VALUE(t) \
 { \
     .magic = TIMER_MAGIC, \
-    .node = LIST_INITIAL_CLEARED_VALUE, \
+    .latest_node = { NULL, NULL, NULL }, \
+    .deadline_node = { NULL, NULL, NULL }, \
+    .queued_cpu = -1, \
     .scheduled_time = 0, \
+    .slack = 0, \
     .period = 0, \
     .callback = NULL, \
     .arg = NULL, \
@@ -54,9 +69,12 @@ typedef struct timer {
  * - Timers may be canceled or reprogrammed from within their callback
  * - Setting and canceling timers is not thread safe and cannot be done concurrently
  * - timer_cancel() may spin waiting for a pending timer to complete on another cpu
+ * - A timer with slack may fire any time between its deadline and deadline + slack,
+ *   which lets the timer code run it from the same interrupt as a nearby timer
 */
 void timer_initialize(timer_t *);
 void timer_set_oneshot(timer_t *, lk_time_t deadline, timer_callback, void *arg);
+void timer_set_oneshot_etc(timer_t *, lk_time_t deadline, lk_time_t slack, timer_callback, void *arg);
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 void timer_cancel(timer_t *);
 
@@ -38,6 +38,17 @@ __BEGIN_CDECLS
 #define ROUNDUP_PAGE_SIZE(x) ROUNDUP((x), PAGE_SIZE)
 #define IS_PAGE_ALIGNED(x) IS_ALIGNED((x), PAGE_SIZE)
 
+/* Size of the large pages the vm may map user memory with when the backing
+ * pages are physically contiguous and suitably aligned.  Equal to PAGE_SIZE on
+ * architectures that cannot split a large page on a partial unmap or protect.
+ */
+#ifdef ARCH_LARGE_PAGE_SIZE_SHIFT
+#define LARGE_PAGE_SIZE_SHIFT ARCH_LARGE_PAGE_SIZE_SHIFT
+#else
+#define LARGE_PAGE_SIZE_SHIFT PAGE_SIZE_SHIFT
+#endif
+#define LARGE_PAGE_SIZE (1UL << LARGE_PAGE_SIZE_SHIFT)
+
 struct mmu_initial_mapping {
     paddr_t phys;
     vaddr_t virt;
@@ -112,6 +123,7 @@ status_t pmm_add_arena(const pmm_arena_info_t* arena) __NONNULL((1));
 /* flags for allocation routines below */
 #define PMM_ALLOC_FLAG_ANY (0x0)  /* no restrictions on which arena to allocate from */
 #define PMM_ALLOC_FLAG_KMAP (0x1) /* allocate only from arenas marked KMAP */
+#define PMM_ALLOC_FLAG_ZEROED (0x2) /* return pages filled with zeros */
 
 /* Allocate count pages of physical memory, adding to the tail of the passed list.
  * The list must be initialized.
@@ -149,6 +161,33 @@ size_t pmm_count_free_pages(void);
 // Return amount of physical memory in system, in bytes.
 size_t pmm_count_total_bytes(void);
 
+/* Levels of free memory, from the pmm.low_mem_* kernel commandline watermarks.
+ * The callback is called from a dedicated thread with no locks held whenever the
+ * level changes, and once when it is registered if the level isn't normal.
+ */
+typedef enum pmm_mem_level {
+    PMM_MEM_LEVEL_NORMAL,
+    PMM_MEM_LEVEL_WARNING,
+    PMM_MEM_LEVEL_CRITICAL,
+} pmm_mem_level_t;
+
+typedef void (*pmm_mem_level_callback_t)(pmm_mem_level_t level);
+
+void pmm_set_mem_level_callback(pmm_mem_level_callback_t callback);
+pmm_mem_level_t pmm_get_mem_level(void);
+
+/* Pool of pre-zeroed free pages used to satisfy PMM_ALLOC_FLAG_ZEROED allocations.
+ * Hits and misses count zeroed page allocations that did and did not come from the pool.
+ */
+typedef struct pmm_zero_pool_stats {
+    size_t pages;
+    size_t target;
+    uint64_t hits;
+    uint64_t misses;
+} pmm_zero_pool_stats_t;
+
+void pmm_get_zero_pool_stats(pmm_zero_pool_stats_t* stats) __NONNULL((1));
+
 /* Allocate a run of pages out of the kernel area and return the pointer in kernel space.
  * If the optional list is passed, append the allocate page structures to the tail of the list.
  * If the optional physical address pointer is passed, return the address.
@@ -29,6 +29,8 @@ typedef struct vm_page {
         struct {
             // in allocated/just freed state, use a linked list to hold the page in a queue
             struct list_node node;
+            // size of the pmm free block this page heads, if VM_PAGE_FLAG_FREE_BLOCK is set
+            uint8_t order;
         } free;
 #if __cplusplus
         struct {
@@ -42,6 +44,10 @@ typedef struct vm_page {
     };
 } vm_page_t;
 
+// flags for vm_page_t
+#define VM_PAGE_FLAG_ZEROED (1u << 0) // free page that is known to be filled with zeros
+#define VM_PAGE_FLAG_FREE_BLOCK (1u << 1) // free page at the start of a pmm buddy block
+
 // pmm will maintain pages of this size
 #define VM_PAGE_STRUCT_SIZE (sizeof(vm_page_t))
 static_assert(sizeof(vm_page_t) == 32, "");
@@ -53,6 +59,7 @@ enum vm_page_state {
     VM_PAGE_STATE_HEAP,
     VM_PAGE_STATE_OBJECT,
     VM_PAGE_STATE_MMU, /* allocated to serve arch-specific mmu purposes */
+    VM_PAGE_STATE_CACHED, /* free, but held in a per-cpu pmm cache */
 
     _VM_PAGE_STATE_COUNT
 };
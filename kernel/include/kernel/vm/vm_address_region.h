@@ -113,8 +113,11 @@ public:
     mxtl::RefPtr<VmMapping> as_vm_mapping();
 
     // Page fault in an address within the region.  Recursively traverses
-    // the regions to find the target mapping, if it exists.
-    virtual status_t PageFault(vaddr_t va, uint pf_flags) = 0;
+    // the regions to find the target mapping, if it exists.  Returns
+    // ERR_SHOULD_WAIT and a request to wait on if the page has to come from
+    // a page source.
+    virtual status_t PageFault(vaddr_t va, uint pf_flags,
+                               mxtl::RefPtr<VmPageRequest>* page_request) = 0;
 
     // WAVL tree key function
     vaddr_t GetKey() const { return base(); }
@@ -162,6 +165,10 @@ protected:
     // Version of AllocatedPages() that does not acquire the aspace lock
     virtual size_t AllocatedPagesLocked() const = 0;
 
+    // Change the size of a region, keeping the gap tracking in the parent's child
+    // tree up to date.  |aspace_->lock()| must be held.
+    void SetSizeLocked(size_t size);
+
     // Transition from NOT_READY to READY, and add references to self to related
     // structures.
     virtual void Activate() = 0;
@@ -194,9 +201,37 @@ protected:
         }
     };
 
+    // keeps the subtree_* fields below up to date as the parent's child tree changes.
+    // the other hooks only count rebalancing steps for the mxtl tests.
+    struct WAVLTreeGapObserver {
+        static void RecordInsert() {}
+        static void RecordInsertPromote() {}
+        static void RecordInsertRotation() {}
+        static void RecordInsertDoubleRotation() {}
+
+        static void RecordErase() {}
+        static void RecordEraseDemote() {}
+        static void RecordEraseRotation() {}
+        static void RecordEraseDoubleRotation() {}
+
+        static void RecordSubtreeChanged(VmAddressRegionOrMapping* node) {
+            node->UpdateSubtreeGaps();
+        }
+    };
+
+    // recompute the subtree_* fields from this node and its children in the tree
+    void UpdateSubtreeGaps();
+
     // node for element in list of parent's children.
     mxtl::WAVLTreeNodeState<mxtl::RefPtr<VmAddressRegionOrMapping>, bool> subregion_list_node_;
 
+    // The span of the subtree of the parent's child tree rooted at this node, and
+    // the largest gap between two consecutive regions within it.  These let the
+    // parent's allocators skip over parts of the tree with no room.
+    vaddr_t subtree_first_base_ = 0;
+    vaddr_t subtree_last_byte_ = 0;
+    size_t subtree_max_gap_ = 0;
+
     char name_[32];
 };
 
@@ -235,7 +270,8 @@ public:
     bool is_mapping() const override { return false; }
 
     void Dump(uint depth, bool verbose) const override;
-    status_t PageFault(vaddr_t va, uint pf_flags) override;
+    status_t PageFault(vaddr_t va, uint pf_flags,
+                       mxtl::RefPtr<VmPageRequest>* page_request) override;
 
 protected:
     static const uint32_t kMagic = 0x564d4152; // VMAR
@@ -262,7 +298,7 @@ protected:
 private:
     using ChildList = mxtl::WAVLTree<vaddr_t, mxtl::RefPtr<VmAddressRegionOrMapping>,
                                      mxtl::DefaultKeyedObjectTraits<vaddr_t, VmAddressRegionOrMapping>,
-                                     WAVLTreeTraits>;
+                                     WAVLTreeTraits, WAVLTreeGapObserver>;
 
     DISALLOW_COPY_ASSIGN_AND_MOVE(VmAddressRegion);
 
@@ -327,6 +363,18 @@ private:
     template <typename F>
     void ForEachGap(F func, uint8_t align_pow2);
 
+    // Utility for allocators for finding gaps between children of at least
+    // *min_size* bytes, using the gap sizes tracked in the child tree to skip
+    // subtrees without one.  F should have a signature of
+    // bool func(const ChildList::iterator& prev, const ChildList::iterator& next),
+    // and is called for each gap in the subtree rooted at *node* in address
+    // order.  *prev* is the child before the subtree, or end() if there is none.
+    // The gap after the last child in the subtree is not included.  If func
+    // returns false, the iteration stops and false is returned.
+    template <typename F>
+    bool ForEachLargeGapLocked(const ChildList::iterator& node, const ChildList::iterator& prev,
+                               size_t min_size, F& func);
+
     // list of subregions, indexed by base address
     ChildList subregions_;
 };
@@ -367,7 +415,8 @@ public:
         return;
     }
 
-    status_t PageFault(vaddr_t va, uint pf_flags) override {
+    status_t PageFault(vaddr_t va, uint pf_flags,
+                       mxtl::RefPtr<VmPageRequest>* page_request) override {
         // We should never be trying to page fault on this...
         ASSERT(false);
         return ERR_BAD_STATE;
@@ -431,7 +480,8 @@ public:
     bool is_mapping() const override { return true; }
 
     void Dump(uint depth, bool verbose) const override;
-    status_t PageFault(vaddr_t va, uint pf_flags) override;
+    status_t PageFault(vaddr_t va, uint pf_flags,
+                       mxtl::RefPtr<VmPageRequest>* page_request) override;
 
 protected:
     static const uint32_t kMagic = 0x564d4150; // VMAP
@@ -477,6 +527,15 @@ private:
     // in Clang around capability aliasing, we need to relax the analysis.
     void ActivateLocked();
 
+    // Map the large page containing va if the object backs it contiguously.
+    // Must be called with both the object_ lock and the aspace's page table
+    // lock held, but has the same analysis limitation as above.
+    bool MapLargePageLocked(vaddr_t va, uint mmu_flags);
+
+    // Map already resident pages surrounding a read fault at va.  Must be called
+    // with both the object_ lock and the aspace's page table lock held.
+    void FaultAroundLocked(vaddr_t va, uint mmu_flags);
+
     // pointer and region of the object we are mapping
     mxtl::RefPtr<VmObject> object_;
     uint64_t object_offset_ = 0;
@@ -9,6 +9,7 @@
 #include <arch/mmu.h>
 #include <assert.h>
 #include <kernel/mutex.h>
+#include <kernel/rwlock.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
 #include <lib/crypto/prng.h>
@@ -113,11 +114,19 @@ public:
 
 protected:
     // Share the aspace lock with VmAddressRegion/VmMapping so they can serialize
-    // changes to the aspace.
+    // changes to the aspace.  Page faults hold it shared, since they do not
+    // change the vmar tree; everything else that walks the tree holds it
+    // exclusively.
     friend class VmAddressRegionOrMapping;
     friend class VmAddressRegion;
     friend class VmMapping;
-    mutex_t* lock() { return &lock_; }
+    rwlock_t* lock() { return &lock_; }
+
+    // Serializes changes to the arch page tables.  Concurrent page faults only
+    // hold the aspace lock shared, and vmos unmap their pages without holding it
+    // at all, so every arch_mmu_map/unmap/protect on this aspace holds this lock
+    // instead.  Acquired after the aspace lock and any vmo lock.
+    mutex_t* page_table_lock() { return &page_table_lock_; }
 
     // Expose the PRNG for ASLR to VmAddressRegion
     crypto::PRNG& AslrPrng() {
@@ -152,7 +161,8 @@ private:
     bool aspace_destroyed_ = false;
     bool aslr_enabled_ = false;
 
-    mutable mutex_t lock_ = MUTEX_INITIAL_VALUE(lock_);
+    mutable rwlock_t lock_ = RWLOCK_INITIAL_VALUE(lock_);
+    mutex_t page_table_lock_ = MUTEX_INITIAL_VALUE(page_table_lock_);
 
     // root of virtual address space
     // Access to this reference is guarded by lock_.
@@ -22,6 +22,8 @@
 #include <stdint.h>
 
 class VmMapping;
+class VmPageRequest;
+class VmPageSource;
 
 typedef status_t (*vmo_lookup_fn_t)(void* context, size_t offset, size_t index, paddr_t pa);
 
@@ -49,7 +51,9 @@ public:
         return AllocatedPagesInRange(0, size());
     }
 
-    // find physical pages to back the range of the object
+    // find physical pages to back the range of the object. if memory runs out
+    // partway, ERR_NO_MEMORY is returned and whatever was already committed stays
+    // committed, with *committed saying how much that was
     virtual status_t CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
         return ERR_NOT_SUPPORTED;
     }
@@ -65,6 +69,39 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // let the kernel throw away the pages of a page aligned range when memory runs low,
+    // after which the range reads as zeros
+    virtual status_t UnlockRange(uint64_t offset, uint64_t len) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // stop the kernel from throwing away a page aligned range, and report whether
+    // any of it was thrown away while it was unlocked
+    virtual status_t LockRange(uint64_t offset, uint64_t len, bool* discarded) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // the source that supplies this vmo's pages on demand, if it has one
+    virtual VmPageSource* page_source() const { return nullptr; }
+
+    // hand a vmo with a page source the pages for a page aligned range, in order,
+    // waking up anyone waiting for them. takes the pages it uses off the list.
+    virtual status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // remove the pages backing a page aligned range and append them to the list,
+    // leaving the range decommitted
+    virtual status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // replace the pages backing a page aligned range with ones from the list, in
+    // order, freeing whatever was there before. takes the pages it uses off the list.
+    virtual status_t ReplacePages(uint64_t offset, uint64_t len, list_node* pages) {
+        return ERR_NOT_SUPPORTED;
+    }
+
     // read/write operators against kernel pointers only
     virtual status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) {
         return ERR_NOT_SUPPORTED;
@@ -116,10 +153,24 @@ public:
         return ERR_NOT_SUPPORTED;
     }
 
+    // called when the last handle to the object has been closed, after which only
+    // mappings and clones can reach its contents
+    virtual void OnZeroHandles() {}
+
     // get a pointer to the page structure and/or physical address at the specified offset.
     // valid flags are VMM_PF_FLAG_*
-    virtual status_t GetPageLocked(uint64_t offset, uint pf_flags,
-                                   vm_page_t** page, paddr_t* pa) TA_REQ(lock_) {
+    // if the page has to come from a page source, returns ERR_SHOULD_WAIT and a request the
+    // caller waits on, after dropping all of its locks, before trying again. callers that
+    // can't wait pass a null page_request and the page is treated as not present.
+    virtual status_t GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** page, paddr_t* pa,
+                                   mxtl::RefPtr<VmPageRequest>* page_request) TA_REQ(lock_) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // get the physical address of a range that is entirely backed by pages this object
+    // already owns and that are physically contiguous. never faults in or allocates pages.
+    virtual status_t LookupContiguousLocked(uint64_t offset, uint64_t len, paddr_t* pa)
+        TA_REQ(lock_) {
         return ERR_NOT_SUPPORTED;
     }
 
@@ -170,6 +221,7 @@ protected:
 
     // list of every child
     mxtl::DoublyLinkedList<VmObject*> children_list_ TA_GUARDED(lock_);
+    uint32_t children_count_ TA_GUARDED(lock_) = 0;
 
     // parent pointer (may be null)
     mxtl::RefPtr<VmObject> parent_ TA_GUARDED(lock_);
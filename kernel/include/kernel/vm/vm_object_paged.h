@@ -11,6 +11,7 @@
 #include <kernel/vm.h>
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_page_list.h>
+#include <kernel/vm/vm_page_source.h>
 #include <lib/user_copy/user_ptr.h>
 #include <list.h>
 #include <magenta/thread_annotations.h>
@@ -20,15 +21,26 @@
 #include <mxtl/macros.h>
 #include <mxtl/ref_counted.h>
 #include <mxtl/ref_ptr.h>
+#include <mxtl/unique_ptr.h>
 #include <stdint.h>
 
 // the main VM object type, holding a list of pages
 class VmObjectPaged final : public VmObject {
 public:
-    static mxtl::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size);
+    // options for Create()
+    // back the object with physically contiguous runs of LARGE_PAGE_SIZE where possible,
+    // so that mappings of it can use large pages
+    static constexpr uint32_t kLargePages = (1u << 0);
+
+    static mxtl::RefPtr<VmObject> Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                         uint32_t options = 0);
 
     static mxtl::RefPtr<VmObject> CreateFromROData(const void* data, size_t size);
 
+    // create an object whose pages are all supplied by source as they are needed
+    static mxtl::RefPtr<VmObject> CreateFromSource(mxtl::RefPtr<VmPageSource> source,
+                                                   uint64_t size);
+
     status_t Resize(uint64_t size) override;
     status_t ResizeLocked(uint64_t size) override TA_REQ(lock_);
     uint64_t size() const override
@@ -43,6 +55,14 @@ public:
                                    uint8_t alignment_log2) override;
     status_t DecommitRange(uint64_t offset, uint64_t len, uint64_t* decommitted) override;
 
+    status_t UnlockRange(uint64_t offset, uint64_t len) override;
+    status_t LockRange(uint64_t offset, uint64_t len, bool* discarded) override;
+
+    VmPageSource* page_source() const override { return page_source_.get(); }
+    status_t SupplyPages(uint64_t offset, uint64_t len, list_node* pages) override;
+    status_t TakePages(uint64_t offset, uint64_t len, list_node* pages) override;
+    status_t ReplacePages(uint64_t offset, uint64_t len, list_node* pages) override;
+
     status_t Read(void* ptr, uint64_t offset, size_t len, size_t* bytes_read) override;
     status_t Write(const void* ptr, uint64_t offset, size_t len, size_t* bytes_written) override;
     status_t Lookup(uint64_t offset, uint64_t len, uint pf_flags,
@@ -63,9 +83,12 @@ public:
     status_t CleanInvalidateCache(const uint64_t offset, const uint64_t len) override;
     status_t SyncCache(const uint64_t offset, const uint64_t len) override;
 
-    status_t GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t**, paddr_t*) override
+    status_t GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t**, paddr_t*,
+                           mxtl::RefPtr<VmPageRequest>* page_request) override
         // Calls a Locked method of the parent, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
+    status_t LookupContiguousLocked(uint64_t offset, uint64_t len, paddr_t* pa)
+        override TA_REQ(lock_);
 
     status_t CloneCOW(uint64_t offset, uint64_t size,
                       mxtl::RefPtr<VmObject>* clone_vmo) override
@@ -76,9 +99,43 @@ public:
         // Called under the parent's lock, which confuses analysis.
         TA_NO_THREAD_SAFETY_ANALYSIS;
 
+    void OnZeroHandles() override;
+
+    // debug counters for copy-on-write clone chains: the longest chain any clone has been
+    // created at the end of, and how many intermediate objects have been spliced out
+    static uint64_t max_clone_chain_depth();
+    static uint64_t collapsed_clone_count();
+
+    // free the pages of unlocked ranges, least recently unlocked first, until at
+    // least count pages have been freed or there is nothing left to discard.
+    // returns the number of pages freed.
+    static size_t ReclaimDiscardablePages(size_t count);
+
+    // free the pages of just this object's unlocked ranges. returns the number of
+    // pages freed.
+    size_t ReclaimUnlockedPages();
+
+    // total number of pages freed by ReclaimDiscardablePages()
+    static uint64_t discarded_page_count();
+
+    // traits to belong to the global list of objects with unlocked ranges
+    struct DiscardableListTraits {
+        static mxtl::DoublyLinkedListNodeState<VmObjectPaged*>& node_state(VmObjectPaged& obj) {
+            return obj.discardable_list_node_;
+        }
+    };
+
 private:
+    // a range that userspace has unlocked, and whether its pages have been thrown away
+    struct DiscardableRange : public mxtl::DoublyLinkedListable<mxtl::unique_ptr<DiscardableRange>> {
+        uint64_t offset;
+        uint64_t len;
+        bool discarded;
+    };
+
     // private constructor (use Create())
-    explicit VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent);
+    VmObjectPaged(uint32_t pmm_alloc_flags, uint32_t options, mxtl::RefPtr<VmObject> parent,
+                  mxtl::RefPtr<VmPageSource> page_source = nullptr);
 
     // private destructor, only called from refptr
     ~VmObjectPaged() override;
@@ -97,6 +154,10 @@ private:
     status_t AddPage(vm_page_t* p, uint64_t offset);
     status_t AddPageLocked(vm_page_t* p, uint64_t offset) TA_REQ(lock_);
 
+    // commit the empty, LARGE_PAGE_SIZE aligned run containing offset with
+    // physically contiguous pages
+    status_t CommitLargePageLocked(uint64_t offset) TA_REQ(lock_);
+
     // internal page list routine
     void AddPageToArray(size_t index, vm_page_t* p);
 
@@ -108,14 +169,49 @@ private:
     // set our offset within our parent
     status_t SetParentOffsetLocked(uint64_t o) TA_REQ(lock_);
 
+    // while our parent is only reachable through us, move the pages of it we can
+    // see into us and take its place as a child of its own parent
+    void CollapseParentLocked()
+        // Touches the parent's members under the shared lock, which confuses analysis.
+        TA_NO_THREAD_SAFETY_ANALYSIS;
+
+    // take the range out of the unlocked ranges, or'ing into *discarded whether any of
+    // it had been thrown away. spare is used if a range has to be split in two.
+    void RemoveDiscardableRangesLocked(uint64_t offset, uint64_t len,
+                                       mxtl::unique_ptr<DiscardableRange>* spare,
+                                       bool* discarded) TA_REQ(lock_);
+
+    // throw away the pages of every unlocked range that still has them, adding the
+    // number freed to *freed. returns true if some couldn't be thrown away yet.
+    bool DiscardUnlockedRanges(size_t* freed);
+
     // maximum size of a VMO is one page less than the full 64bit range
     static const uint64_t MAX_SIZE = ROUNDDOWN(UINT64_MAX, PAGE_SIZE);
 
     // members
     uint64_t size_ TA_GUARDED(lock_) = 0;
     uint64_t parent_offset_ TA_GUARDED(lock_) = 0;
+    // only offsets below this are looked up in the parent, anything past it reads as zero.
+    // lowered when an ancestor that was only partially visible is collapsed into us
+    uint64_t parent_limit_ TA_GUARDED(lock_) = UINT64_MAX;
     uint32_t pmm_alloc_flags_ TA_GUARDED(lock_) = PMM_ALLOC_FLAG_ANY;
+    const uint32_t options_ = 0;
+
+    // set once our last handle is closed. from then on, once we have no mappings and
+    // a single child, that child is the only thing that can see our pages and can
+    // collapse us into itself.
+    bool collapsible_ TA_GUARDED(lock_) = false;
+
+    // where pages we don't have come from, instead of being zero filled
+    const mxtl::RefPtr<VmPageSource> page_source_;
 
     // a tree of pages
     VmPageList page_list_ TA_GUARDED(lock_);
+
+    // ranges whose pages may be thrown away under memory pressure, in no particular order
+    mxtl::DoublyLinkedList<mxtl::unique_ptr<DiscardableRange>> discardable_ranges_ TA_GUARDED(lock_);
+    // set once a range has been unlocked, and never cleared
+    bool discardable_ TA_GUARDED(lock_) = false;
+    // guarded by the global discardable list lock
+    mxtl::DoublyLinkedListNodeState<VmObjectPaged*> discardable_list_node_;
 };
@@ -0,0 +1,82 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <err.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <magenta/thread_annotations.h>
+#include <mxtl/canary.h>
+#include <mxtl/intrusive_double_list.h>
+#include <mxtl/macros.h>
+#include <mxtl/ref_counted.h>
+#include <mxtl/ref_ptr.h>
+#include <stdint.h>
+
+// An outstanding request for one page of a vmo that is backed by a VmPageSource.
+// Every thread that needs the page waits on the same request, without holding
+// any vm locks, and looks the page up again once the request completes.
+class VmPageRequest final : public mxtl::RefCounted<VmPageRequest>,
+                            public mxtl::DoublyLinkedListable<mxtl::RefPtr<VmPageRequest>> {
+public:
+    explicit VmPageRequest(uint64_t offset);
+    ~VmPageRequest();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageRequest);
+
+    uint64_t offset() const { return offset_; }
+
+    // block until the page has been supplied or the source gave up on it.
+    // returns ERR_INTERRUPTED if the thread is killed while waiting.
+    status_t Wait();
+
+    // wake up everyone waiting, passing them status
+    void Complete(status_t status);
+
+private:
+    mxtl::Canary<mxtl::magic("VMPR")> canary_;
+
+    const uint64_t offset_;
+    event_t event_;
+    // set before the event is signaled, and only read after waiting on it
+    status_t status_ = NO_ERROR;
+};
+
+// Something that supplies the contents of a vmo's pages on demand, such as a
+// userspace pager. The vmo asks it for pages it doesn't have, and is handed
+// them later with VmObjectPaged::SupplyPages().
+class VmPageSource : public mxtl::RefCounted<VmPageSource> {
+public:
+    VmPageSource();
+    virtual ~VmPageSource();
+
+    DISALLOW_COPY_ASSIGN_AND_MOVE(VmPageSource);
+
+    // Called with the vmo's lock held when a thread needs the page at offset.
+    // Returns ERR_SHOULD_WAIT along with the request to wait on if the page is
+    // on its way, or an error if the source can't provide it.
+    status_t GetPage(uint64_t offset, mxtl::RefPtr<VmPageRequest>* request);
+
+    // Called with the vmo's lock held once the pages in the range have been
+    // added to it, to wake up anyone waiting for them.
+    void OnPagesSupplied(uint64_t offset, uint64_t len);
+
+    // Fail every outstanding request, and every one made from now on.
+    void Detach();
+
+protected:
+    // Ask for the page at offset to be supplied. Called with the vmo's lock
+    // held, so must not block.
+    virtual status_t SendRequest(uint64_t offset) = 0;
+
+private:
+    mxtl::Canary<mxtl::magic("VMPS")> canary_;
+
+    Mutex lock_;
+    bool detached_ TA_GUARDED(lock_) = false;
+    mxtl::DoublyLinkedList<mxtl::RefPtr<VmPageRequest>> requests_ TA_GUARDED(lock_);
+};
@@ -53,6 +53,9 @@ status_t wait_queue_block(wait_queue_t *, lk_time_t deadline);
  * wait_queue_error = what wait_queue_block() should return for the blocking thread.
  */
 int wait_queue_wake_one(wait_queue_t *, bool reschedule, status_t wait_queue_error);
+/* as above, sched_flags (SCHED_UNBLOCK_FLAG_*) are hints for placing the thread */
+int wait_queue_wake_one_etc(wait_queue_t *, bool reschedule, status_t wait_queue_error,
+                            uint sched_flags);
 int wait_queue_wake_all(wait_queue_t *, bool reschedule, status_t wait_queue_error);
 
 /*
@@ -71,10 +71,9 @@ usage:
 
 static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
 {
-    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        if (!mp_is_cpu_active(i))
-            continue;
-
+    mp_cpu_mask_t active = mp_get_active_mask();
+    uint i;
+    mp_cpu_mask_for_each(i, &active) {
         printf("thread stats (cpu %u):\n", i);
         printf("\ttotal idle time: %" PRIu64 "\n", thread_stats[i].idle_time);
         printf("\ttotal busy time: %" PRIu64 "\n",
@@ -82,6 +81,8 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\treschedules: %lu\n", thread_stats[i].reschedules);
 #if WITH_SMP
         printf("\treschedule_ipis: %lu\n", thread_stats[i].reschedule_ipis);
+        printf("\tsteals: %lu\n", thread_stats[i].steals);
+        printf("\tmigrations: %lu\n", thread_stats[i].migrations);
 #endif
         printf("\tcontext_switches: %lu\n", thread_stats[i].context_switches);
         printf("\tpreempts: %lu\n", thread_stats[i].preempts);
@@ -89,6 +90,13 @@ static int cmd_threadstats(int argc, const cmd_args *argv, uint32_t flags)
         printf("\tinterrupts: %lu\n", thread_stats[i].interrupts);
         printf("\ttimer interrupts: %lu\n", thread_stats[i].timer_ints);
         printf("\ttimers: %lu\n", thread_stats[i].timers);
+        printf("\ttimers coalesced: %lu\n", thread_stats[i].timers_coalesced);
+        printf("\trun queue wait time: %" PRIu64 "\n", thread_stats[i].run_queue_wait);
+        printf("\twakeup latency (log2 us buckets):");
+        for (uint b = 0; b < THREAD_LATENCY_BUCKETS; b++) {
+            printf(" %lu", thread_stats[i].wakeup_latency[b]);
+        }
+        printf("\n");
     }
 
     return 0;
@@ -108,11 +116,10 @@ static enum handler_return threadload(struct timer *t, lk_time_t now, void *arg)
             " ipi (rs  gen)\n"
 #endif
             );
-    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        /* dont display time for inactive cpus */
-        if (!mp_is_cpu_active(i))
-            continue;
-
+    /* dont display time for inactive cpus */
+    mp_cpu_mask_t active = mp_get_active_mask();
+    uint i;
+    mp_cpu_mask_for_each(i, &active) {
         lk_time_t idle_time = thread_stats[i].idle_time;
 
         /* if the cpu is currently idle, add the time since it went idle up until now to the idle counter */
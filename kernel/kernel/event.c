@@ -29,6 +29,7 @@
 #include <debug.h>
 #include <assert.h>
 #include <err.h>
+#include <kernel/sched.h>
 #include <kernel/thread.h>
 
 /**
@@ -141,11 +142,13 @@ int event_signal_etc(event_t *e, bool reschedule, status_t wait_result)
     THREAD_LOCK(state);
 
     int wake_count = 0;
+    uint sched_flags = (e->flags & EVENT_FLAG_SYNC_WAKE) ? SCHED_UNBLOCK_FLAG_SYNC : 0;
 
     if (!e->signaled) {
         if (e->flags & EVENT_FLAG_AUTOUNSIGNAL) {
             /* try to release one thread and leave unsignaled if successful */
-            if ((wake_count = wait_queue_wake_one(&e->wait, reschedule, wait_result)) <= 0) {
+            if ((wake_count = wait_queue_wake_one_etc(&e->wait, reschedule, wait_result,
+                                                      sched_flags)) <= 0) {
                 /*
                  * if we didn't actually find a thread to wake up, go to
                  * signaled state and let the next call to event_wait
@@ -156,7 +159,12 @@ int event_signal_etc(event_t *e, bool reschedule, status_t wait_result)
         } else {
             /* release all threads and remain signaled */
             e->signaled = true;
-            wake_count = wait_queue_wake_all(&e->wait, reschedule, wait_result);
+            if (sched_flags && e->wait.count == 1) {
+                wake_count = wait_queue_wake_one_etc(&e->wait, reschedule, wait_result,
+                                                     sched_flags);
+            } else {
+                wake_count = wait_queue_wake_all(&e->wait, reschedule, wait_result);
+            }
         }
     }
 
@@ -18,8 +18,10 @@
 #include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/sched.h>
 #include <kernel/spinlock.h>
 #include <kernel/timer.h>
+#include <lib/dpc.h>
 
 #define LOCAL_TRACE 0
 
@@ -30,86 +32,130 @@ struct mp_state mp __CPU_ALIGN = {
     .ipi_task_lock = SPIN_LOCK_INITIAL_VALUE,
 };
 
-/* Helpers used for implementing mp_sync */
-struct mp_sync_context;
-static void mp_sync_task(void *context);
+/* a sync task in flight; lives on the stack of the mp_sync_exec caller */
+struct mp_sync_context {
+    struct list_node node;
+    mp_sync_task_t task;
+    void *task_context;
+    /* Mask of which CPUs have yet to pick up the task.  Protected by the
+     * ipi_task_lock */
+    mp_cpu_mask_t pending_cpus;
+    /* Mask of which CPUs need to finish the task */
+    mp_cpu_mask_t outstanding_cpus;
+};
+
+/* topology ids as reported by the arch, see mp_set_cpu_topology */
+static struct {
+    uint package_id;
+    uint core_id;
+    bool valid;
+} cpu_topology[SMP_MAX_CPUS];
 
 void mp_init(void)
 {
     mp.ipi_task_lock = SPIN_LOCK_INITIAL_VALUE;
-    for (uint i = 0; i < countof(mp.ipi_task_list); ++i) {
-        list_initialize(&mp.ipi_task_list[i]);
+    list_initialize(&mp.ipi_task_list);
+
+    /* until told otherwise, every cpu stands alone */
+    for (uint i = 0; i < SMP_MAX_CPUS; ++i) {
+        mp.smt_siblings[i] = mp_cpu_mask_of(i);
+        mp.cache_siblings[i] = mp_cpu_mask_of(i);
     }
 }
 
-void mp_reschedule(mp_cpu_mask_t target, uint flags)
+void mp_set_cpu_topology(uint cpu, uint package_id, uint core_id)
 {
-    if (target == 0)
-        return;
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
 
-    uint local_cpu = arch_curr_cpu_num();
+    LTRACEF("cpu %u package %u core %u\n", cpu, package_id, core_id);
 
-    LTRACEF("local %u, target 0x%x\n", local_cpu, target);
+    THREAD_LOCK(state);
+
+    DEBUG_ASSERT(!cpu_topology[cpu].valid);
+    cpu_topology[cpu].package_id = package_id;
+    cpu_topology[cpu].core_id = core_id;
+    cpu_topology[cpu].valid = true;
+
+    for (uint i = 0; i < SMP_MAX_CPUS; ++i) {
+        if (i == cpu || !cpu_topology[i].valid ||
+            cpu_topology[i].package_id != package_id) {
+            continue;
+        }
 
-    if (target == MP_CPU_ALL) {
-        target = mp.active_cpus;
+        mp_cpu_mask_set(&mp.cache_siblings[i], cpu);
+        mp_cpu_mask_set(&mp.cache_siblings[cpu], i);
+
+        if (cpu_topology[i].core_id == core_id) {
+            mp_cpu_mask_set(&mp.smt_siblings[i], cpu);
+            mp_cpu_mask_set(&mp.smt_siblings[cpu], i);
+        }
     }
 
+    THREAD_UNLOCK(state);
+}
+
+void mp_reschedule(const mp_cpu_mask_t *target, uint flags)
+{
+    uint local_cpu = arch_curr_cpu_num();
+
+    LTRACEF("local %u, target first %u\n", local_cpu, mp_cpu_mask_first(target));
+
     /* mask out cpus that are not active and the local cpu */
-    target &= mp.active_cpus;
+    mp_cpu_mask_t active = mp_get_active_mask();
+    mp_cpu_mask_t mask = mp_cpu_mask_and(target, &active);
 
     /* mask out cpus that are currently running realtime code */
     if ((flags & MP_RESCHEDULE_FLAG_REALTIME) == 0) {
-        target &= ~mp.realtime_cpus;
+        mask = mp_cpu_mask_andnot(&mask, &mp.realtime_cpus);
     }
-    target &= ~(1U << local_cpu);
+    mp_cpu_mask_clear(&mask, local_cpu);
 
-    LTRACEF("local %u, post mask target now 0x%x\n", local_cpu, target);
+    if (mp_cpu_mask_is_empty(&mask))
+        return;
 
-    arch_mp_send_ipi(target, MP_IPI_RESCHEDULE);
+    LTRACEF("local %u, post mask target count %u\n", local_cpu, mp_cpu_mask_count(&mask));
+
+    arch_mp_send_ipi(MP_IPI_TARGET_MASK, &mask, MP_IPI_RESCHEDULE);
 }
 
-struct mp_sync_context {
-    mp_sync_task_t task;
-    void *task_context;
-    /* Mask of which CPUs need to finish the task */
-    volatile mp_cpu_mask_t outstanding_cpus;
-};
+void mp_reschedule_cpu(uint cpu, uint flags)
+{
+    mp_cpu_mask_t mask = mp_cpu_mask_of(cpu);
+    mp_reschedule(&mask, flags);
+}
 
-static void mp_sync_task(void *raw_context)
+static void mp_sync_task(struct mp_sync_context *context)
 {
-    struct mp_sync_context *context = raw_context;
     context->task(context->task_context);
     /* use seq-cst atomic to ensure this update is not seen before the
      * side-effects of context->task */
-    atomic_and((int *)&context->outstanding_cpus, ~(1U << arch_curr_cpu_num()));
+    mp_cpu_mask_atomic_clear(&context->outstanding_cpus, arch_curr_cpu_num());
     arch_spinloop_signal();
 }
 
 /* @brief Execute a task on the specified CPUs, and block on the calling
  *        CPU until all CPUs have finished the task.
  *
- *  If MP_CPU_ALL or MP_CPU_ALL_BUT_LOCAL is the target, the online CPU
- *  mask will be used to determine actual targets.
+ *  If MP_IPI_TARGET_ALL or MP_IPI_TARGET_ALL_BUT_LOCAL is the target, the
+ *  online CPU mask will be used to determine actual targets and |mask| is
+ *  ignored.
  *
- * Interrupts must be disabled if calling with MP_CPU_ALL_BUT_LOCAL as target
+ * Interrupts must be disabled if calling with MP_IPI_TARGET_ALL_BUT_LOCAL as target
  */
-void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context)
+void mp_sync_exec(mp_ipi_target_t target, const mp_cpu_mask_t *mask,
+                  mp_sync_task_t task, void *context)
 {
-    uint num_cpus = arch_max_num_cpus();
-
-    if (target == MP_CPU_ALL) {
-        target = mp_get_online_mask();
-    } else if (target == MP_CPU_ALL_BUT_LOCAL) {
+    /* Mask any offline CPUs from target list */
+    mp_cpu_mask_t targets = mp_get_online_mask();
+    if (target == MP_IPI_TARGET_ALL_BUT_LOCAL) {
         /* targeting all other CPUs but the current one is hazardous
          * if the local CPU may be changed underneath us */
         DEBUG_ASSERT(arch_ints_disabled());
-        target = mp_get_online_mask() & ~(1U << arch_curr_cpu_num());
+        mp_cpu_mask_clear(&targets, arch_curr_cpu_num());
+    } else if (target == MP_IPI_TARGET_MASK) {
+        targets = mp_cpu_mask_and(&targets, mask);
     }
 
-    /* Mask any offline CPUs from target list */
-    target &= mp_get_online_mask();
-
     /* disable interrupts so our current CPU doesn't change */
     spin_lock_saved_state_t irqstate;
     arch_interrupt_save(&irqstate, SPIN_LOCK_FLAG_INTERRUPTS);
@@ -118,42 +164,35 @@ void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context)
     uint local_cpu = arch_curr_cpu_num();
 
     /* remove self from target lists, since no need to IPI ourselves */
-    bool targetting_self = !!(target & (1U << local_cpu));
-    target &= ~(1U << local_cpu);
+    bool targetting_self = mp_cpu_mask_test(&targets, local_cpu);
+    mp_cpu_mask_clear(&targets, local_cpu);
 
-    /* create tasks to enqueue (we need one per target due to each containing
-     * a linked list node */
+    /* A single context is shared by all of the targets; each one claims it
+     * by clearing its bit in pending_cpus, so the cost of a sync does not
+     * scale with SMP_MAX_CPUS on the caller's stack */
     struct mp_sync_context sync_context = {
+        .node = LIST_INITIAL_CLEARED_VALUE,
         .task = task,
         .task_context = context,
-        .outstanding_cpus = target,
+        .pending_cpus = targets,
+        .outstanding_cpus = targets,
     };
 
-    struct mp_ipi_task sync_tasks[SMP_MAX_CPUS] = {};
-    for (uint i = 0; i < num_cpus; ++i) {
-        sync_tasks[i].func = mp_sync_task;
-        sync_tasks[i].context = &sync_context;
-    }
+    if (!mp_cpu_mask_is_empty(&targets)) {
+        /* enqueue the task */
+        spin_lock(&mp.ipi_task_lock);
+        list_add_tail(&mp.ipi_task_list, &sync_context.node);
+        mp_cpu_mask_atomic_or(&mp.ipi_task_pending, &targets);
+        spin_unlock(&mp.ipi_task_lock);
 
-    /* enqueue tasks */
-    spin_lock(&mp.ipi_task_lock);
-    mp_cpu_mask_t remaining = target;
-    uint cpu_id = 0;
-    while (remaining && cpu_id < num_cpus) {
-        if (remaining & 1) {
-            list_add_tail(&mp.ipi_task_list[cpu_id], &sync_tasks[cpu_id].node);
-        }
-        remaining >>= 1;
-        cpu_id++;
+        /* let CPUs know to begin executing */
+        __UNUSED status_t status = arch_mp_send_ipi(MP_IPI_TARGET_MASK, &targets,
+                                                    MP_IPI_GENERIC);
+        DEBUG_ASSERT(status == NO_ERROR);
     }
-    spin_unlock(&mp.ipi_task_lock);
-
-    /* let CPUs know to begin executing */
-    __UNUSED status_t status = arch_mp_send_ipi(target, MP_IPI_GENERIC);
-    DEBUG_ASSERT(status == NO_ERROR);
 
     if (targetting_self) {
-        mp_sync_task(&sync_context);
+        task(context);
     }
     smp_mb();
 
@@ -165,19 +204,19 @@ void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context)
     while (1) {
         /* See comment in mp_unplug_trampoline about related CPU hotplug
          * guarantees. */
-        mp_cpu_mask_t outstanding = atomic_load_relaxed(
-                (int *)&sync_context.outstanding_cpus);
+        mp_cpu_mask_t outstanding = mp_cpu_mask_atomic_load(&sync_context.outstanding_cpus);
         mp_cpu_mask_t online = mp_get_online_mask();
-        if ((outstanding & online) == 0) {
+        outstanding = mp_cpu_mask_and(&outstanding, &online);
+        if (mp_cpu_mask_is_empty(&outstanding)) {
             break;
         }
 
         /* If interrupts are still disabled, we need to attempt to process any
          * tasks queued for us in order to prevent deadlock. */
         if (ints_disabled) {
-            /* Optimistically check if our task list has work without the lock.
+            /* Optimistically check if we have work without the lock.
              * mp_mbx_generic_irq will take the lock and check again */
-            if (!list_is_empty(&mp.ipi_task_list[local_cpu])) {
+            if (mp_cpu_mask_atomic_test(&mp.ipi_task_pending, local_cpu)) {
                 mp_mbx_generic_irq();
                 continue;
             }
@@ -187,16 +226,13 @@ void mp_sync_exec(mp_cpu_mask_t target, mp_sync_task_t task, void *context)
     }
     smp_mb();
 
-    /* make sure the sync_tasks aren't in lists anymore, since they're
-     * stack allocated */
-    spin_lock_irqsave(&mp.ipi_task_lock, irqstate);
-    for (uint i = 0; i < num_cpus; ++i) {
-        /* If a task is still around, it's because the CPU went offline. */
-        if (list_in_list(&sync_tasks[i].node)) {
-            list_delete(&sync_tasks[i].node);
-        }
+    /* make sure the context isn't in the list anymore, since it's stack
+     * allocated */
+    if (list_in_list(&sync_context.node)) {
+        spin_lock_irqsave(&mp.ipi_task_lock, irqstate);
+        list_delete(&sync_context.node);
+        spin_unlock_irqrestore(&mp.ipi_task_lock, irqstate);
     }
-    spin_unlock_irqrestore(&mp.ipi_task_lock, irqstate);
 }
 
 static void mp_unplug_trampoline(void) __NO_RETURN;
@@ -299,8 +335,15 @@ status_t mp_unplug_cpu(uint cpu_id) {
     /* Set real time to cancel the pre-emption timer */
     thread_set_real_time(t);
 
+    /* Stop the target's dpc thread, so it isn't left stranded partway
+     * through a dpc when the CPU goes away.  This has to happen while the
+     * target is still scheduling threads, since the dpc thread needs to run
+     * there to exit, so it is restarted if the unplug thread can't start. */
+    dpc_shutdown(cpu_id);
+
     status = thread_detach_and_resume(t);
     if (status != NO_ERROR) {
+        dpc_restart(cpu_id);
         goto cleanup_thread;
     }
 
@@ -312,6 +355,12 @@ status_t mp_unplug_cpu(uint cpu_id) {
     /* Now that the CPU is no longer processing tasks, move all of its timers */
     timer_transition_off_cpu(cpu_id);
 
+    /* and any threads that were waiting in its run queue */
+    sched_transition_off_cpu(cpu_id);
+
+    /* and any dpcs that were queued on it */
+    dpc_transition_off_cpu(cpu_id);
+
     status = platform_mp_cpu_unplug(cpu_id);
     if (status != NO_ERROR) {
         /* Do not cleanup the unplug thread in this case.  We have successfully
@@ -333,9 +382,9 @@ cleanup_mutex:
 void mp_set_curr_cpu_online(bool online)
 {
     if (online) {
-        atomic_or((volatile int *)&mp.online_cpus, 1U << arch_curr_cpu_num());
+        mp_cpu_mask_atomic_set(&mp.online_cpus, arch_curr_cpu_num());
     } else {
-        atomic_and((volatile int *)&mp.online_cpus, ~(1U << arch_curr_cpu_num()));
+        mp_cpu_mask_atomic_clear(&mp.online_cpus, arch_curr_cpu_num());
     }
 
 }
@@ -343,9 +392,9 @@ void mp_set_curr_cpu_online(bool online)
 void mp_set_curr_cpu_active(bool active)
 {
     if (active) {
-        atomic_or((volatile int *)&mp.active_cpus, 1U << arch_curr_cpu_num());
+        mp_cpu_mask_atomic_set(&mp.active_cpus, arch_curr_cpu_num());
     } else {
-        atomic_and((volatile int *)&mp.active_cpus, ~(1U << arch_curr_cpu_num()));
+        mp_cpu_mask_atomic_clear(&mp.active_cpus, arch_curr_cpu_num());
     }
 }
 
@@ -357,15 +406,25 @@ enum handler_return mp_mbx_generic_irq(void)
     THREAD_STATS_INC(generic_ipis);
 
     while (1) {
-        struct mp_ipi_task *task;
+        struct mp_sync_context *context = NULL;
+        struct mp_sync_context *entry;
         spin_lock(&mp.ipi_task_lock);
-        task = list_remove_head_type(&mp.ipi_task_list[local_cpu], struct mp_ipi_task, node);
+        list_for_every_entry(&mp.ipi_task_list, entry, struct mp_sync_context, node) {
+            if (mp_cpu_mask_test(&entry->pending_cpus, local_cpu)) {
+                mp_cpu_mask_clear(&entry->pending_cpus, local_cpu);
+                context = entry;
+                break;
+            }
+        }
+        if (context == NULL) {
+            mp_cpu_mask_atomic_clear(&mp.ipi_task_pending, local_cpu);
+        }
         spin_unlock(&mp.ipi_task_lock);
-        if (task == NULL) {
+        if (context == NULL) {
             break;
         }
 
-        task->func(task->context);
+        mp_sync_task(context);
     }
     return INT_NO_RESCHEDULE;
 }
@@ -378,7 +437,7 @@ enum handler_return mp_mbx_reschedule_irq(void)
 
     THREAD_STATS_INC(reschedule_ipis);
 
-    return (mp.active_cpus & (1U << cpu)) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+    return mp_is_cpu_active(cpu) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
 
 __WEAK status_t arch_mp_cpu_hotplug(uint cpu_id) { return ERR_NOT_SUPPORTED; }
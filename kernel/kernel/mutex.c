@@ -19,8 +19,35 @@
 #include <debug.h>
 #include <assert.h>
 #include <err.h>
+#include <inttypes.h>
+#include <platform.h>
+#include <kernel/mp.h>
 #include <kernel/thread.h>
 
+/* a contended acquire spins for as long as the holder is running on another
+ * cpu. this only bounds the spin for holders that keep running with the
+ * mutex held for a long time, after which we go to sleep in the wait queue */
+#define MUTEX_SPIN_MAX_DURATION LK_USEC(50)
+
+static inline uintptr_t mutex_val(const mutex_t *m)
+{
+    return __atomic_load_n(&m->val, __ATOMIC_RELAXED);
+}
+
+/* try to move the mutex from oldval to newval, with acquire semantics */
+static inline bool mutex_cmpxchg_acquire(mutex_t *m, uintptr_t *oldval, uintptr_t newval)
+{
+    return __atomic_compare_exchange_n(&m->val, oldval, newval, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* try to move the mutex from oldval to newval, with release semantics */
+static inline bool mutex_cmpxchg_release(mutex_t *m, uintptr_t *oldval, uintptr_t newval)
+{
+    return __atomic_compare_exchange_n(&m->val, oldval, newval, false,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief  Initialize a mutex_t
  */
@@ -42,37 +69,105 @@ void mutex_destroy(mutex_t *m)
 
     THREAD_LOCK(state);
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(m->count > 0)) {
+    if (unlikely(mutex_val(m) != 0)) {
+        thread_t *holder = mutex_holder(m);
         panic("mutex_destroy: thread %p (%s) tried to destroy locked mutex %p,"
               " locked by %p (%s)\n",
               get_current_thread(), get_current_thread()->name, m,
-              m->holder, m->holder->name);
+              holder, holder->name);
     }
 #endif
     m->magic = 0;
-    m->count = 0;
+    m->val = 0;
     wait_queue_destroy(&m->wait);
     THREAD_UNLOCK(state);
 }
 
+/* spin waiting for the holder to drop the mutex for as long as it is running
+ * on another cpu. returns true if the mutex was acquired.
+ */
+static bool mutex_adaptive_spin(mutex_t *m, thread_t *ct)
+{
+#if WITH_SMP
+    /* nobody else could be running to release it */
+    if (mp_get_online_count() < 2)
+        return false;
+
+    lk_time_t deadline = current_time() + MUTEX_SPIN_MAX_DURATION;
+    do {
+        uintptr_t oldval = mutex_val(m);
+        if (oldval == 0) {
+            if (mutex_cmpxchg_acquire(m, &oldval, (uintptr_t)ct))
+                return true;
+            continue;
+        }
+
+        /* other threads have already given up and are sleeping, get in line behind them */
+        if (oldval & MUTEX_FLAG_QUEUED)
+            break;
+
+        /* a holder that isn't running can't release it any time soon, so
+         * block instead. the holder may exit and be freed as soon as it lets
+         * go of the mutex, so its state is only trusted if it still holds
+         * the mutex afterwards. the read itself is harmless either way, as
+         * threads live in always mapped kernel memory. */
+        thread_t *holder = (thread_t *)oldval;
+        enum thread_state holder_state = __atomic_load_n(&holder->state, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&m->val, __ATOMIC_ACQUIRE) != oldval)
+            continue;
+        if (holder_state != THREAD_RUNNING)
+            break;
+
+        arch_spinloop_pause();
+    } while (TIME_LT(current_time(), deadline));
+#endif
+
+    return false;
+}
+
 void mutex_acquire_internal(mutex_t *m) TA_NO_THREAD_SAFETY_ANALYSIS
 {
     DEBUG_ASSERT(arch_ints_disabled());
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    if (unlikely(++m->count > 1)) {
+    thread_t *ct = get_current_thread();
+
+    for (;;) {
+        uintptr_t oldval = mutex_val(m);
+
+        /* it may have been released since the caller last looked */
+        if (oldval == 0) {
+            if (mutex_cmpxchg_acquire(m, &oldval, (uintptr_t)ct))
+                return;
+            continue;
+        }
+
+        /* flag that we're about to block so the holder takes the slow path
+         * on release. that path needs the thread lock, so it cannot run until
+         * we are safely in the wait queue. */
+        if ((oldval & MUTEX_FLAG_QUEUED) == 0 &&
+            !mutex_cmpxchg_acquire(m, &oldval, oldval | MUTEX_FLAG_QUEUED))
+            continue;
+
+        /* the holder can no longer drop the mutex without the thread lock,
+         * so lend it our priority until it hands the mutex over */
+        thread_pi_block_on(ct, (thread_t *)(oldval & ~MUTEX_FLAG_QUEUED));
+
         status_t ret = wait_queue_block(&m->wait, INFINITE_TIME);
         if (unlikely(ret < NO_ERROR)) {
             /* mutexes are not interruptable and cannot time out, so it
              * is illegal to return with any error state.
              */
             panic("mutex_acquire_internal: wait_queue_block returns with error %d m %p, thr %p, sp %p\n",
-                   ret, m, get_current_thread(), __GET_FRAME());
+                   ret, m, ct, __GET_FRAME());
         }
-    }
 
-    m->holder = get_current_thread();
+        /* ownership was handed to us directly by the releasing thread */
+        DEBUG_ASSERT(mutex_holder(m) == ct);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return;
+    }
 }
 
 /**
@@ -85,12 +180,23 @@ void mutex_acquire(mutex_t *m)
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    thread_t *ct = get_current_thread();
+
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() == m->holder))
+    if (unlikely(ct == mutex_holder(m)))
         panic("mutex_acquire: thread %p (%s) tried to acquire mutex %p it already owns.\n",
-              get_current_thread(), get_current_thread()->name, m);
+              ct, ct->name, m);
 #endif
 
+    /* fast path: assume it's unheld and try to grab it */
+    uintptr_t oldval = 0;
+    if (likely(mutex_cmpxchg_acquire(m, &oldval, (uintptr_t)ct)))
+        return;
+
+    /* contended, give the holder a chance to let go before we block */
+    if (mutex_adaptive_spin(m, ct))
+        return;
+
     THREAD_LOCK(state);
     mutex_acquire_internal(m);
     THREAD_UNLOCK(state);
@@ -102,12 +208,44 @@ void mutex_release_internal(mutex_t *m, bool reschedule) TA_NO_THREAD_SAFETY_ANA
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
     DEBUG_ASSERT(!arch_in_int_handler());
 
-    m->holder = 0;
+    thread_t *ct = get_current_thread();
+
+    /* nobody is waiting, just drop it */
+    uintptr_t oldval = (uintptr_t)ct;
+    if (likely(mutex_cmpxchg_release(m, &oldval, 0)))
+        return;
 
-    if (unlikely(--m->count >= 1)) {
-        /* release a thread */
-        wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
+    DEBUG_ASSERT(oldval == ((uintptr_t)ct | MUTEX_FLAG_QUEUED));
+
+    /* hand the mutex directly to the highest priority waiter, first come
+     * first served among equals, keeping the queued flag if there are more
+     * behind it */
+    thread_t *t = NULL;
+    thread_t *waiter;
+    list_for_every_entry(&m->wait.list, waiter, thread_t, queue_node) {
+        if (!t || waiter->priority > t->priority)
+            t = waiter;
+    }
+    DEBUG_ASSERT_MSG(t, "mutex_release: wait queue is empty but m->val = %#" PRIxPTR "\n", oldval);
+
+    uintptr_t newval = t ? (uintptr_t)t | (m->wait.count > 1 ? MUTEX_FLAG_QUEUED : 0) : 0;
+    __atomic_store_n(&m->val, newval, __ATOMIC_RELEASE);
+
+    if (t) {
+        /* the new owner stops lending us its priority, and everyone still
+         * waiting lends theirs to the new owner instead */
+        thread_pi_unblock(t);
+        list_for_every_entry(&m->wait.list, waiter, thread_t, queue_node) {
+            if (waiter != t)
+                thread_pi_block_on(waiter, t);
+        }
+
+        /* move it to the head so it's the one woken */
+        list_delete(&t->queue_node);
+        list_add_head(&m->wait.list, &t->queue_node);
     }
+
+    wait_queue_wake_one(&m->wait, reschedule, NO_ERROR);
 }
 
 /**
@@ -118,15 +256,22 @@ void mutex_release(mutex_t *m)
     DEBUG_ASSERT(m->magic == MUTEX_MAGIC);
     DEBUG_ASSERT(!arch_in_int_handler());
 
+    thread_t *ct = get_current_thread();
+
 #if LK_DEBUGLEVEL > 0
-    if (unlikely(get_current_thread() != m->holder)) {
+    if (unlikely(ct != mutex_holder(m))) {
+        thread_t *holder = mutex_holder(m);
         panic("mutex_release: thread %p (%s) tried to release mutex %p it doesn't own. owned by %p (%s)\n",
-              get_current_thread(), get_current_thread()->name, m, m->holder, m->holder ? m->holder->name : "none");
+              ct, ct->name, m, holder, holder ? holder->name : "none");
     }
 #endif
 
+    /* fast path: nobody is waiting */
+    uintptr_t oldval = (uintptr_t)ct;
+    if (likely(mutex_cmpxchg_release(m, &oldval, 0)))
+        return;
+
     THREAD_LOCK(state);
     mutex_release_internal(m, true);
     THREAD_UNLOCK(state);
 }
-
@@ -11,6 +11,7 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_DEPS := \
 	kernel/lib/debug \
+	kernel/lib/dpc \
 	kernel/lib/heap \
 	kernel/lib/libc \
 	kernel/lib/mxtl \
@@ -21,6 +22,7 @@ MODULE_SRCS := \
 	$(LOCAL_DIR)/event.c \
 	$(LOCAL_DIR)/init.c \
 	$(LOCAL_DIR)/mutex.c \
+	$(LOCAL_DIR)/rwlock.c \
 	$(LOCAL_DIR)/sched.c \
 	$(LOCAL_DIR)/thread.c \
 	$(LOCAL_DIR)/timer.c \
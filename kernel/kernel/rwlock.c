@@ -0,0 +1,268 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+/**
+ * @file
+ * @brief  Reader-writer lock functions
+ *
+ * Uncontended acquires and releases are a single atomic operation on the lock
+ * value. Once anyone has to block, the lock is handed directly from the last
+ * holder to the threads being woken, with the thread lock held, in the same
+ * way as for mutexes.
+ *
+ * @defgroup rwlock Reader-writer lock
+ * @{
+ */
+
+#include <kernel/rwlock.h>
+#include <debug.h>
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/thread.h>
+
+static inline uintptr_t rwlock_val(const rwlock_t *l)
+{
+    return __atomic_load_n(&l->val, __ATOMIC_RELAXED);
+}
+
+/* try to move the lock from oldval to newval, with acquire semantics */
+static inline bool rwlock_cmpxchg_acquire(rwlock_t *l, uintptr_t *oldval, uintptr_t newval)
+{
+    return __atomic_compare_exchange_n(&l->val, oldval, newval, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* try to move the lock from oldval to newval, with release semantics */
+static inline bool rwlock_cmpxchg_release(rwlock_t *l, uintptr_t *oldval, uintptr_t newval)
+{
+    return __atomic_compare_exchange_n(&l->val, oldval, newval, false,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief  Initialize a rwlock_t
+ */
+void rwlock_init(rwlock_t *l)
+{
+    *l = (rwlock_t)RWLOCK_INITIAL_VALUE(*l);
+}
+
+/**
+ * @brief  Destroy a rwlock_t
+ *
+ * The rwlock_t object itself is not freed.
+ */
+void rwlock_destroy(rwlock_t *l)
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    THREAD_LOCK(state);
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(rwlock_val(l) != 0)) {
+        panic("rwlock_destroy: thread %p (%s) tried to destroy locked rwlock %p, val %#" PRIxPTR "\n",
+              get_current_thread(), get_current_thread()->name, l, rwlock_val(l));
+    }
+#endif
+    l->magic = 0;
+    l->val = 0;
+    l->writer = NULL;
+    wait_queue_destroy(&l->read_wait);
+    wait_queue_destroy(&l->write_wait);
+    THREAD_UNLOCK(state);
+}
+
+/* The lock has just been dropped by its last holder and there are threads
+ * waiting for it. Give it to all of the waiting readers or to the first
+ * waiting writer, keeping the queued flag if anyone is left behind.
+ */
+static void rwlock_hand_off_locked(rwlock_t *l, bool prefer_readers)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(l->read_wait.count > 0 || l->write_wait.count > 0);
+
+    if (l->read_wait.count > 0 && (prefer_readers || l->write_wait.count == 0)) {
+        uintptr_t newval = (uintptr_t)l->read_wait.count * RWLOCK_READER;
+        if (l->write_wait.count > 0)
+            newval |= RWLOCK_FLAG_QUEUED;
+        __atomic_store_n(&l->val, newval, __ATOMIC_RELEASE);
+
+        wait_queue_wake_all(&l->read_wait, true, NO_ERROR);
+    } else {
+        uintptr_t newval = RWLOCK_FLAG_WRITER;
+        if (l->write_wait.count > 1 || l->read_wait.count > 0)
+            newval |= RWLOCK_FLAG_QUEUED;
+        __atomic_store_n(&l->val, newval, __ATOMIC_RELEASE);
+
+        wait_queue_wake_one(&l->write_wait, true, NO_ERROR);
+    }
+}
+
+/**
+ * @brief  Acquire the lock shared
+ */
+void rwlock_acquire_read(rwlock_t *l)
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(rwlock_is_write_held(l)))
+        panic("rwlock_acquire_read: thread %p (%s) tried to acquire rwlock %p it already owns.\n",
+              get_current_thread(), get_current_thread()->name, l);
+#endif
+
+    /* fast path: nobody holds it exclusively or is waiting for it */
+    uintptr_t oldval = rwlock_val(l);
+    while (likely((oldval & (RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED)) == 0)) {
+        if (rwlock_cmpxchg_acquire(l, &oldval, oldval + RWLOCK_READER))
+            return;
+    }
+
+    THREAD_LOCK(state);
+    for (;;) {
+        oldval = rwlock_val(l);
+
+        /* the writer may have let go since we last looked */
+        if ((oldval & (RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED)) == 0) {
+            if (rwlock_cmpxchg_acquire(l, &oldval, oldval + RWLOCK_READER))
+                break;
+            continue;
+        }
+
+        /* flag that we're about to block so the last holder takes the slow
+         * path on release, which cannot run until we are in the wait queue */
+        if ((oldval & RWLOCK_FLAG_QUEUED) == 0 &&
+            !rwlock_cmpxchg_acquire(l, &oldval, oldval | RWLOCK_FLAG_QUEUED))
+            continue;
+
+        status_t ret = wait_queue_block(&l->read_wait, INFINITE_TIME);
+        if (unlikely(ret < NO_ERROR)) {
+            panic("rwlock_acquire_read: wait_queue_block returns with error %d l %p, thr %p\n",
+                  ret, l, get_current_thread());
+        }
+
+        /* we were counted in as a reader before being woken */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        break;
+    }
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Release the lock from shared mode
+ */
+void rwlock_release_read(rwlock_t *l)
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    uintptr_t oldval = rwlock_val(l);
+    DEBUG_ASSERT_MSG(oldval >= RWLOCK_READER && (oldval & RWLOCK_FLAG_WRITER) == 0,
+                     "rwlock_release_read: rwlock %p is not held shared, val %#" PRIxPTR "\n",
+                     l, oldval);
+
+    /* fast path: nobody is waiting */
+    while (likely((oldval & RWLOCK_FLAG_QUEUED) == 0)) {
+        if (rwlock_cmpxchg_release(l, &oldval, oldval - RWLOCK_READER))
+            return;
+    }
+
+    /* someone is waiting, and since the queued flag is only cleared by the last
+     * holder letting go, it stays set until we are done here */
+    THREAD_LOCK(state);
+    uintptr_t newval = __atomic_sub_fetch(&l->val, RWLOCK_READER, __ATOMIC_RELEASE);
+    if (newval < RWLOCK_READER)
+        rwlock_hand_off_locked(l, false);
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Acquire the lock exclusively
+ */
+void rwlock_acquire_write(rwlock_t *l)
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+    thread_t *ct = get_current_thread();
+
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(rwlock_is_write_held(l)))
+        panic("rwlock_acquire_write: thread %p (%s) tried to acquire rwlock %p it already owns.\n",
+              ct, ct->name, l);
+#endif
+
+    /* fast path: assume it's unheld and try to grab it */
+    uintptr_t oldval = 0;
+    if (likely(rwlock_cmpxchg_acquire(l, &oldval, RWLOCK_FLAG_WRITER))) {
+        __atomic_store_n(&l->writer, ct, __ATOMIC_RELAXED);
+        return;
+    }
+
+    THREAD_LOCK(state);
+    for (;;) {
+        oldval = rwlock_val(l);
+
+        /* it may have been released since we last looked */
+        if (oldval == 0) {
+            if (rwlock_cmpxchg_acquire(l, &oldval, RWLOCK_FLAG_WRITER))
+                break;
+            continue;
+        }
+
+        if ((oldval & RWLOCK_FLAG_QUEUED) == 0 &&
+            !rwlock_cmpxchg_acquire(l, &oldval, oldval | RWLOCK_FLAG_QUEUED))
+            continue;
+
+        status_t ret = wait_queue_block(&l->write_wait, INFINITE_TIME);
+        if (unlikely(ret < NO_ERROR)) {
+            panic("rwlock_acquire_write: wait_queue_block returns with error %d l %p, thr %p\n",
+                  ret, l, ct);
+        }
+
+        /* ownership was handed to us directly by the releasing thread */
+        DEBUG_ASSERT(rwlock_val(l) & RWLOCK_FLAG_WRITER);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        break;
+    }
+    __atomic_store_n(&l->writer, ct, __ATOMIC_RELAXED);
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief  Release the lock from exclusive mode
+ */
+void rwlock_release_write(rwlock_t *l)
+{
+    DEBUG_ASSERT(l->magic == RWLOCK_MAGIC);
+    DEBUG_ASSERT(!arch_in_int_handler());
+
+#if LK_DEBUGLEVEL > 0
+    if (unlikely(!rwlock_is_write_held(l))) {
+        thread_t *ct = get_current_thread();
+        panic("rwlock_release_write: thread %p (%s) tried to release rwlock %p it doesn't own.\n",
+              ct, ct->name, l);
+    }
+#endif
+
+    __atomic_store_n(&l->writer, NULL, __ATOMIC_RELAXED);
+
+    /* fast path: nobody is waiting */
+    uintptr_t oldval = RWLOCK_FLAG_WRITER;
+    if (likely(rwlock_cmpxchg_release(l, &oldval, 0)))
+        return;
+
+    DEBUG_ASSERT(oldval == (RWLOCK_FLAG_WRITER | RWLOCK_FLAG_QUEUED));
+
+    /* let any readers that queued up behind us in first, so that writers
+     * cannot starve them either */
+    THREAD_LOCK(state);
+    rwlock_hand_off_locked(l, true);
+    THREAD_UNLOCK(state);
+}
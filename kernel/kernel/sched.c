@@ -15,143 +15,603 @@
 #include <err.h>
 #include <kernel/mp.h>
 #include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <platform.h>
 
-/* legacy implementation that just broadcast ipis for every reschedule */
-#define BROADCAST_RESCHEDULE 0
+/* per cpu run queues. the queues themselves are protected by each run
+ * queue's own lock, which nests inside the thread lock. the deadline
+ * admission state and the budget timer are still protected by the thread
+ * lock */
+struct run_queue {
+    spin_lock_t lock;
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+    struct list_node queue[NUM_PRIORITIES];
+    uint32_t bitmap;
+    uint count; /* number of ready threads in all of the queues */
+
+    /* deadline threads admitted to this cpu run ahead of every priority.
+     * ready ones are kept sorted by absolute deadline, ones that used up
+     * their budget sit in throttled until their next period */
+    struct list_node deadline_queue;
+    struct list_node throttled;
+    struct list_node deadline_admitted; /* every admitted thread, in any state */
+    uint64_t deadline_bandwidth; /* sum of the admitted threads' bandwidth */
+
+    /* preempts a running deadline thread when its budget runs out */
+    timer_t budget_timer;
+    bool budget_timer_armed;
+} __CPU_ALIGN;
+
+static struct run_queue run_queues[SMP_MAX_CPUS];
+
+static uint remove_from_run_queue(thread_t *t);
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-static_assert(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * CHAR_BIT, "");
+static_assert(NUM_PRIORITIES <= sizeof(run_queues[0].bitmap) * CHAR_BIT, "");
 
-/* pick a 'random' cpu */
-static mp_cpu_mask_t rand_cpu(const mp_cpu_mask_t mask)
+/* deadline threads are admitted to a cpu while the sum of their runtime /
+ * deadline stays under DEADLINE_MAX_BANDWIDTH, leaving the rest of it to
+ * everyone else. bandwidths are fixed point, DEADLINE_BANDWIDTH_SHIFT bits
+ * after the point */
+#define DEADLINE_BANDWIDTH_SHIFT 20
+#define DEADLINE_MAX_BANDWIDTH ((95ull << DEADLINE_BANDWIDTH_SHIFT) / 100)
+
+/* compute the highest priority queue with a thread in it from a run queue bitmap */
+static inline uint highest_queue(uint32_t bitmap)
 {
-    if (unlikely(mask == 0))
-        return 0;
+    DEBUG_ASSERT(bitmap != 0);
+
+    return HIGHEST_PRIORITY - __builtin_clz(bitmap)
+           - (sizeof(bitmap) * CHAR_BIT - NUM_PRIORITIES);
+}
 
-    /* check that the mask passed in has at least one bit set in the online mask */
+/* pick a 'random' cpu, returns SMP_MAX_CPUS if there are no online cpus in the mask */
+static uint rand_cpu(const mp_cpu_mask_t *mask)
+{
+    /* only consider cpus in the mask that are online */
     mp_cpu_mask_t online = mp_get_online_mask();
-    if (unlikely((mask & online) == 0))
-        return 0;
+    mp_cpu_mask_t candidates = mp_cpu_mask_and(mask, &online);
+    if (unlikely(mp_cpu_mask_is_empty(&candidates)))
+        return SMP_MAX_CPUS;
 
-    /* compute the highest online cpu */
-    uint highest_cpu = (sizeof(mp_cpu_mask_t) * CHAR_BIT - 1) - __builtin_clz(online);
+    /* not very random, round robins through the mask starting after the last pick.
+     * protected by THREAD_LOCK, safe to use non atomically */
+    static uint rot = 0;
 
-    /* not very random, round robins a bit through the mask until it gets a hit */
-    for (;;) {
-        /* protected by THREAD_LOCK, safe to use non atomically */
-        static uint rot = 0;
+    uint cpu = mp_cpu_mask_next(&candidates, rot + 1);
+    if (cpu >= SMP_MAX_CPUS)
+        cpu = mp_cpu_mask_first(&candidates);
 
-        if (++rot > highest_cpu)
-            rot = 0;
+    rot = cpu;
+    return cpu;
+}
 
-        if ((1u << rot) & mask)
-            return (1u << rot);
+#if WITH_SMP
+/* restrict an idle mask to the cpus whose smt siblings are all idle too */
+static mp_cpu_mask_t idle_cores(const mp_cpu_mask_t *idle)
+{
+    mp_cpu_mask_t cores = *idle;
+    uint cpu;
+    mp_cpu_mask_for_each(cpu, idle) {
+        mp_cpu_mask_t busy_siblings = mp_cpu_mask_andnot(mp_get_smt_siblings(cpu), idle);
+        if (!mp_cpu_mask_is_empty(&busy_siblings))
+            mp_cpu_mask_clear(&cores, cpu);
     }
+    return cores;
 }
 
-/* find a cpu to wake up */
-static mp_cpu_mask_t find_cpu(thread_t *t)
+/* pick a cpu out of mask that shares a cache with cpu, returns SMP_MAX_CPUS if none */
+static uint cache_sibling_in(const mp_cpu_mask_t *mask, uint cpu)
 {
-#if BROADCAST_RESCHEDULE
-    return MP_CPU_ALL_BUT_LOCAL;
-#elif WITH_SMP
-    /* get the last cpu the thread ran on */
-    mp_cpu_mask_t last_ran_cpu_mask = (1u << thread_last_cpu(t));
+    mp_cpu_mask_t m = mp_cpu_mask_and(mask, mp_get_cache_siblings(cpu));
+    return rand_cpu(&m);
+}
+
+/* pick an idle cpu, preferring ones on a fully idle core so a busy smt sibling
+ * isn't sharing execution resources, and ones that share a cache with either
+ * of the near cpus so the thread's working set is still close by */
+static uint pick_idle_cpu(const mp_cpu_mask_t *idle, uint near0, uint near1)
+{
+    mp_cpu_mask_t cores = idle_cores(idle);
+
+    const mp_cpu_mask_t *tiers[] = { &cores, idle };
+    for (uint i = 0; i < countof(tiers); i++) {
+        uint cpu = cache_sibling_in(tiers[i], near0);
+        if (cpu < SMP_MAX_CPUS)
+            return cpu;
+        if (near1 != near0) {
+            cpu = cache_sibling_in(tiers[i], near1);
+            if (cpu < SMP_MAX_CPUS)
+                return cpu;
+        }
+    }
+
+    /* nothing nearby, take a whole core anywhere before doubling up on one */
+    uint cpu = rand_cpu(&cores);
+    if (cpu < SMP_MAX_CPUS)
+        return cpu;
+
+    return rand_cpu(idle);
+}
+#endif
+
+/* find a cpu whose run queue the thread should be placed in */
+static uint find_cpu(thread_t *t, uint flags)
+{
+    uint curr_cpu = arch_curr_cpu_num();
+
+    /* as do deadline threads, out of the cpu they were admitted to */
+    if (thread_is_deadline(t))
+        return t->deadline.cpu;
+
+#if WITH_SMP
+    /* pinned threads only ever run out of their own cpu's queue */
+    if (unlikely(thread_pinned_cpu(t) >= 0))
+        return (uint)thread_pinned_cpu(t);
+
+    /* only consider cpus that are still scheduling */
+    mp_cpu_mask_t active_cpu_mask = mp_get_active_mask();
 
-    /* the current cpu */
-    mp_cpu_mask_t curr_cpu_mask = (1u << arch_curr_cpu_num());
+    /* get the last cpu the thread ran on */
+    uint last_cpu = thread_last_cpu(t);
+    bool last_cpu_active = mp_cpu_mask_test(&active_cpu_mask, last_cpu);
 
     /* get a list of idle cpus */
     mp_cpu_mask_t idle_cpu_mask = mp_get_idle_mask();
-    if (idle_cpu_mask != 0) {
-        if (idle_cpu_mask & curr_cpu_mask) {
+    idle_cpu_mask = mp_cpu_mask_and(&idle_cpu_mask, &active_cpu_mask);
+
+    /* the waker says it's about to block, so keep the thread on a cpu that
+     * shares a cache with it, which holds whatever data it just handed over.
+     * an idle sibling can run it straight away, whether or not the waker
+     * really does block.  Failing that it can wait for this cpu, as long as
+     * nothing else is already waiting for it */
+    if (flags & SCHED_UNBLOCK_FLAG_SYNC) {
+        uint cpu = cache_sibling_in(&idle_cpu_mask, curr_cpu);
+        if (cpu < SMP_MAX_CPUS)
+            return cpu;
+
+        if (mp_cpu_mask_test(&active_cpu_mask, curr_cpu) && run_queues[curr_cpu].count == 0)
+            return curr_cpu;
+    }
+
+    if (!mp_cpu_mask_is_empty(&idle_cpu_mask)) {
+        if (mp_cpu_mask_test(&idle_cpu_mask, curr_cpu)) {
             /* the current cpu is idle, so run it here */
-            return 0;
+            return curr_cpu;
         }
 
-        if (last_ran_cpu_mask & idle_cpu_mask) {
+        if (last_cpu_active && mp_cpu_mask_test(&idle_cpu_mask, last_cpu)) {
             /* the last core it ran on is idle and isn't the current cpu */
-            return last_ran_cpu_mask;
+            return last_cpu;
         }
 
-        /* pick an idle_cpu */
-        return rand_cpu(idle_cpu_mask);
+        /* pick an idle_cpu, near where the thread last ran or the waker */
+        uint cpu = pick_idle_cpu(&idle_cpu_mask, last_cpu_active ? last_cpu : curr_cpu, curr_cpu);
+        if (cpu < SMP_MAX_CPUS)
+            return cpu;
     }
 
-    /* no idle cpus */
-    if (last_ran_cpu_mask == curr_cpu_mask) {
-        /* the last cpu it ran on is us */
+    /* no idle cpus, avoid cpus that are running real time threads since they
+     * will not reschedule until that thread blocks */
+    mp_cpu_mask_t realtime_cpu_mask = mp_get_realtime_mask();
+    mp_cpu_mask_t busy_cpu_mask = mp_cpu_mask_andnot(&active_cpu_mask, &realtime_cpu_mask);
+    if (!last_cpu_active || last_cpu == curr_cpu ||
+        !mp_cpu_mask_test(&busy_cpu_mask, last_cpu)) {
+        /* the last cpu it ran on is us or is unavailable */
         /* pick a random cpu that isn't the current one */
-        return rand_cpu(mp_get_online_mask() & ~(curr_cpu_mask));
+        mp_cpu_mask_clear(&busy_cpu_mask, curr_cpu);
+        uint cpu = rand_cpu(&busy_cpu_mask);
+        if (cpu < SMP_MAX_CPUS)
+            return cpu;
     } else {
         /* pick the last cpu it ran on */
-        return last_ran_cpu_mask;
+        return last_cpu;
     }
-#else /* !WITH_SMP */
-    /* no smp, dont send an IPI */
-    return 0;
 #endif
+
+    /* fall back to the local queue */
+    return curr_cpu;
+}
+
+/* deadline scheduling */
+static uint64_t deadline_compute_bandwidth(lk_time_t runtime, lk_time_t deadline)
+{
+    /* round up, admission should err on the side of refusing */
+    return ((runtime << DEADLINE_BANDWIDTH_SHIFT) + deadline - 1) / deadline;
+}
+
+static void deadline_new_job(thread_t *t, lk_time_t release)
+{
+    struct thread_deadline *dl = &t->deadline;
+
+    dl->release = release;
+    dl->abs_deadline = release + dl->deadline;
+    dl->remaining = dl->runtime;
+    dl->throttled = false;
+}
+
+/* put a ready deadline thread in its cpu's deadline queue, or in the
+ * throttled list if it has no budget left */
+static void deadline_insert(thread_t *t)
+{
+    uint cpu = t->deadline.cpu;
+    struct run_queue *rq = &run_queues[cpu];
+
+#if WITH_SMP
+    t->queued_cpu = cpu;
+#endif
+
+    spin_lock(&rq->lock);
+
+    if (t->deadline.throttled) {
+        list_add_tail(&rq->throttled, &t->queue_node);
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    /* earliest deadline first, in order of arrival among equals */
+    struct list_node *before = &rq->deadline_queue;
+    thread_t *entry;
+    list_for_every_entry(&rq->deadline_queue, entry, thread_t, queue_node) {
+        if (TIME_LT(t->deadline.abs_deadline, entry->deadline.abs_deadline)) {
+            before = &entry->queue_node;
+            break;
+        }
+    }
+    list_add_before(before, &t->queue_node);
+
+    spin_unlock(&rq->lock);
+
+    /* it outranks everything a cpu running priority threads would pick, and
+     * possibly the deadline thread it's running, so always ask */
+    if (cpu != arch_curr_cpu_num())
+        mp_reschedule_cpu(cpu, MP_RESCHEDULE_FLAG_REALTIME);
+}
+
+/* timer callback starting the next period of a throttled deadline thread */
+static enum handler_return deadline_replenish(timer_t *timer, lk_time_t now, void *arg)
+{
+    thread_t *t = (thread_t *)arg;
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    if (timer_trylock_or_cancel(timer, &thread_lock))
+        return INT_NO_RESCHEDULE;
+
+    if (!thread_is_deadline(t) || !t->deadline.throttled) {
+        spin_unlock(&thread_lock);
+        return INT_NO_RESCHEDULE;
+    }
+
+    /* a thread that overran by more than a period starts afresh rather
+     * than catching up on the periods it missed */
+    lk_time_t release = t->deadline.release + t->deadline.period;
+    if (TIME_LT(release, now))
+        release = now;
+    deadline_new_job(t, release);
+
+    /* a blocked thread just keeps its fresh budget for when it's woken */
+    if (t->state == THREAD_READY) {
+        remove_from_run_queue(t);
+        deadline_insert(t);
+    }
+
+    spin_unlock(&thread_lock);
+
+    return INT_RESCHEDULE;
+}
+
+/* charge the current thread for the cpu it used since it was last charged,
+ * throttling it until its next period if that was the last of its budget */
+static void deadline_charge(thread_t *t)
+{
+    if (!thread_is_deadline(t))
+        return;
+
+    struct thread_deadline *dl = &t->deadline;
+    lk_time_t now = current_time();
+    lk_time_t used = now - dl->charged_at;
+    dl->charged_at = now;
+
+    if (used < dl->remaining) {
+        dl->remaining -= used;
+        return;
+    }
+
+    dl->remaining = 0;
+    if (!dl->throttled) {
+        dl->throttled = true;
+        timer_cancel(&dl->replenish_timer);
+        timer_set_oneshot(&dl->replenish_timer, dl->release + dl->period,
+                          deadline_replenish, t);
+    }
+}
+
+/* decide which job a waking deadline thread is on. it keeps the current one
+ * if the budget left fits in the time left at its admitted bandwidth,
+ * otherwise running it out would take more than its share and it starts a
+ * new job now (the constant bandwidth server wakeup rule) */
+static void deadline_wakeup(thread_t *t)
+{
+    struct thread_deadline *dl = &t->deadline;
+    lk_time_t now = current_time();
+
+    /* the replenish timer starts the next job */
+    if (dl->throttled)
+        return;
+
+    if (TIME_GTE(now, dl->abs_deadline) ||
+        (dl->remaining << DEADLINE_BANDWIDTH_SHIFT) > (dl->abs_deadline - now) * dl->bandwidth)
+        deadline_new_job(t, now);
+}
+
+static void deadline_cancel_budget_timer(struct run_queue *rq)
+{
+    if (rq->budget_timer_armed) {
+        timer_cancel(&rq->budget_timer);
+        rq->budget_timer_armed = false;
+    }
+}
+
+/* timer callback for a deadline thread running out of budget, preempting it
+ * charges and throttles it */
+static enum handler_return deadline_budget_expired(timer_t *timer, lk_time_t now, void *arg)
+{
+    return INT_RESCHEDULE;
+}
+
+/* pull the earliest deadline thread out of a run queue, arming the budget
+ * timer for it */
+static thread_t *deadline_dequeue(struct run_queue *rq)
+{
+    deadline_cancel_budget_timer(rq);
+
+    spin_lock(&rq->lock);
+    thread_t *t = list_remove_head_type(&rq->deadline_queue, thread_t, queue_node);
+    spin_unlock(&rq->lock);
+    if (!t)
+        return NULL;
+
+    lk_time_t now = current_time();
+    t->deadline.charged_at = now;
+    timer_set_oneshot(&rq->budget_timer, now + t->deadline.remaining,
+                      deadline_budget_expired, NULL);
+    rq->budget_timer_armed = true;
+
+    return t;
+}
+
+/* pick the admitted cpu with the most deadline bandwidth to spare */
+static uint deadline_pick_cpu(thread_t *t, uint64_t bandwidth)
+{
+    mp_cpu_mask_t candidates = mp_get_active_mask();
+    if (thread_pinned_cpu(t) >= 0) {
+        mp_cpu_mask_t pinned = mp_cpu_mask_of((uint)thread_pinned_cpu(t));
+        candidates = mp_cpu_mask_and(&candidates, &pinned);
+    }
+
+    uint best = SMP_MAX_CPUS;
+    uint64_t best_spare = 0;
+    uint cpu;
+    mp_cpu_mask_for_each(cpu, &candidates) {
+        uint64_t used = run_queues[cpu].deadline_bandwidth;
+        if (thread_is_deadline(t) && t->deadline.cpu == cpu)
+            used -= t->deadline.bandwidth;
+        if (used + bandwidth > DEADLINE_MAX_BANDWIDTH)
+            continue;
+
+        uint64_t spare = DEADLINE_MAX_BANDWIDTH - used;
+        if (best == SMP_MAX_CPUS || spare > best_spare) {
+            best = cpu;
+            best_spare = spare;
+        }
+    }
+
+    return best;
 }
 
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t)
+static void insert_in_run_queue_head(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    if (thread_is_deadline(t)) {
+        deadline_insert(t);
+        return;
+    }
+
+#if WITH_SMP
+    t->queued_cpu = cpu;
+#endif
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    struct run_queue *rq = &run_queues[cpu];
+    spin_lock(&rq->lock);
+    list_add_head(&rq->queue[t->priority], &t->queue_node);
+    rq->bitmap |= (1u << t->priority);
+    rq->count++;
+    spin_unlock(&rq->lock);
 }
 
-static void insert_in_run_queue_tail(thread_t *t)
+static void insert_in_run_queue_tail(uint cpu, thread_t *t)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    if (thread_is_deadline(t)) {
+        deadline_insert(t);
+        return;
+    }
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+#if WITH_SMP
+    t->queued_cpu = cpu;
+#endif
+
+    struct run_queue *rq = &run_queues[cpu];
+    spin_lock(&rq->lock);
+    list_add_tail(&rq->queue[t->priority], &t->queue_node);
+    rq->bitmap |= (1u << t->priority);
+    rq->count++;
+    spin_unlock(&rq->lock);
 }
 
-thread_t *sched_get_top_thread(uint cpu)
+/* take a ready thread back out of whichever run queue it is in, returning the cpu */
+static uint remove_from_run_queue(thread_t *t)
+{
+    DEBUG_ASSERT(t->state == THREAD_READY);
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+    DEBUG_ASSERT(arch_ints_disabled());
+
+#if WITH_SMP
+    uint cpu = t->queued_cpu;
+#else
+    uint cpu = 0;
+#endif
+    struct run_queue *rq = &run_queues[cpu];
+
+    spin_lock(&rq->lock);
+    list_delete(&t->queue_node);
+    if (!thread_is_deadline(t)) {
+        if (list_is_empty(&rq->queue[t->priority]))
+            rq->bitmap &= ~(1u << t->priority);
+        rq->count--;
+    }
+    spin_unlock(&rq->lock);
+
+    return cpu;
+}
+
+/* pull the highest priority thread out of a run queue that is allowed to run on cpu */
+static thread_t *run_queue_dequeue(struct run_queue *rq, uint cpu)
 {
     thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+
+    spin_lock(&rq->lock);
+
+    uint32_t local_run_queue_bitmap = rq->bitmap;
 
     while (local_run_queue_bitmap) {
         /* find the first (remaining) queue with a thread in it */
-        uint next_queue = HIGHEST_PRIORITY - __builtin_clz(local_run_queue_bitmap)
-                          - (sizeof(run_queue_bitmap) * CHAR_BIT - NUM_PRIORITIES);
+        uint next_queue = highest_queue(local_run_queue_bitmap);
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
+        list_for_every_entry(&rq->queue[next_queue], newthread, thread_t, queue_node) {
 #if WITH_SMP
             if (likely(newthread->pinned_cpu < 0) || (uint)newthread->pinned_cpu == cpu)
 #endif
             {
                 list_delete(&newthread->queue_node);
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+                if (list_is_empty(&rq->queue[next_queue]))
+                    rq->bitmap &= ~(1u << next_queue);
+                rq->count--;
 
+                spin_unlock(&rq->lock);
                 return newthread;
             }
         }
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+        local_run_queue_bitmap &= ~(1u << next_queue);
+    }
+
+    spin_unlock(&rq->lock);
+    return NULL;
+}
+
+#if WITH_SMP
+/* try to take a thread from another cpu's run queue. the victim is the cpu
+ * holding the highest priority ready thread, ties broken by queue length.
+ * the other queues are sized up without their locks, run_queue_dequeue()
+ * takes the victim's and copes with it having emptied in the meantime.
+ */
+static thread_t *steal_thread(uint cpu)
+{
+    mp_cpu_mask_t online = mp_get_online_mask();
+    struct run_queue *victim = NULL;
+    uint victim_priority = 0;
+    uint i;
+
+    mp_cpu_mask_for_each(i, &online) {
+        struct run_queue *rq = &run_queues[i];
+        uint32_t bitmap = rq->bitmap;
+
+        if (i == cpu || bitmap == 0)
+            continue;
+
+        uint pri = highest_queue(bitmap);
+        if (!victim || pri > victim_priority ||
+            (pri == victim_priority && rq->count > victim->count)) {
+            victim = rq;
+            victim_priority = pri;
+        }
     }
+
+    if (!victim)
+        return NULL;
+
+    thread_t *t = run_queue_dequeue(victim, cpu);
+    if (t)
+        THREAD_STATS_INC(steals);
+
+    return t;
+}
+#endif
+
+thread_t *sched_get_top_thread(uint cpu)
+{
+    thread_t *newthread = deadline_dequeue(&run_queues[cpu]);
+    if (newthread)
+        return newthread;
+
+    newthread = run_queue_dequeue(&run_queues[cpu], cpu);
+    if (newthread)
+        return newthread;
+
+#if WITH_SMP
+    /* nothing local to run, see if another cpu has work to spare */
+    newthread = steal_thread(cpu);
+    if (newthread)
+        return newthread;
+#endif
+
     /* no threads to run, select the idle thread for this cpu */
     return &idle_threads[cpu];
 }
 
+/* note when a thread starts waiting in a run queue, thread_resched() charges
+ * the wait when the thread is picked to run */
+static void mark_ready(thread_t *t, bool woken)
+{
+    t->sched_stats.ready_timestamp = current_time();
+    t->sched_stats.woken = woken;
+    if (woken)
+        t->sched_stats.wakeups++;
+}
+
+/* place a newly readied thread in a cpu's run queue and poke that cpu */
+static void sched_enqueue_ready(thread_t *t, bool local, uint flags)
+{
+    uint curr_cpu = arch_curr_cpu_num();
+    uint cpu = curr_cpu;
+
+    if (!local || thread_pinned_cpu(t) >= 0 || thread_is_deadline(t))
+        cpu = find_cpu(t, flags);
+
+    t->state = THREAD_READY;
+    mark_ready(t, true);
+    if (thread_is_deadline(t))
+        deadline_wakeup(t);
+    insert_in_run_queue_head(cpu, t);
+
+    if (cpu != curr_cpu)
+        mp_reschedule_cpu(cpu, 0);
+}
+
 void sched_block(void)
 {
     __UNUSED thread_t *current_thread = get_current_thread();
@@ -160,6 +620,8 @@ void sched_block(void)
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
     DEBUG_ASSERT(current_thread->state != THREAD_RUNNING);
 
+    deadline_charge(current_thread);
+
     // XXX deal with time slice fiddling here
 
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
@@ -167,6 +629,11 @@ void sched_block(void)
 }
 
 void sched_unblock(thread_t *t, bool resched)
+{
+    sched_unblock_etc(t, resched, 0);
+}
+
+void sched_unblock_etc(thread_t *t, bool resched, uint flags)
 {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(spin_lock_held(&thread_lock));
@@ -179,14 +646,14 @@ void sched_unblock(thread_t *t, bool resched)
         thread_t *current_thread = get_current_thread();
 
         current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
+        deadline_charge(current_thread);
+        mark_ready(current_thread, false);
+        insert_in_run_queue_head(arch_curr_cpu_num(), current_thread);
     }
 
-    /* stuff the new thread in the run queue */
-    t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-
-    mp_reschedule(find_cpu(t), 0);
+    /* stuff the new thread in a run queue, keeping it local if we're about
+     * to give it our cpu */
+    sched_enqueue_ready(t, resched, flags);
 
     if (resched)
         thread_resched();
@@ -205,7 +672,9 @@ void sched_unblock_list(struct list_node *list, bool resched)
         thread_t *current_thread = get_current_thread();
 
         current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
+        deadline_charge(current_thread);
+        mark_ready(current_thread, false);
+        insert_in_run_queue_head(arch_curr_cpu_num(), current_thread);
     }
 
     /* pop the list of threads and shove into the scheduler */
@@ -214,11 +683,8 @@ void sched_unblock_list(struct list_node *list, bool resched)
         DEBUG_ASSERT(t->magic == THREAD_MAGIC);
         DEBUG_ASSERT(!thread_is_idle(t));
 
-        /* stuff the new thread in the run queue */
-        t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
-
-        mp_reschedule(find_cpu(t), 0);
+        /* stuff the new thread in a run queue */
+        sched_enqueue_ready(t, false, 0);
     }
 
     if (resched)
@@ -234,7 +700,9 @@ void sched_yield(void)
     current_thread->state = THREAD_READY;
     current_thread->remaining_time_slice = 0;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        insert_in_run_queue_tail(current_thread);
+        deadline_charge(current_thread);
+        mark_ready(current_thread, false);
+        insert_in_run_queue_tail(arch_curr_cpu_num(), current_thread);
     }
     thread_resched();
 }
@@ -242,22 +710,198 @@ void sched_yield(void)
 void sched_preempt(void)
 {
     thread_t *current_thread = get_current_thread();
+    uint cpu = arch_curr_cpu_num();
 
     /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
     current_thread->state = THREAD_READY;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
+        current_thread->sched_stats.preemptions++;
+        deadline_charge(current_thread);
+        mark_ready(current_thread, false);
         if (current_thread->remaining_time_slice > 0)
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(cpu, current_thread);
         else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+            insert_in_run_queue_tail(cpu, current_thread); /* if we're out of quantum, go to the tail of the queue */
     }
     sched_block();
 }
 
+void sched_change_priority(thread_t *t, int priority)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (t->priority == priority)
+        return;
+
+    if (t->state != THREAD_READY || thread_is_idle(t) || thread_is_deadline(t)) {
+        /* running threads pick up the change at their next reschedule,
+         * blocked ones when they are woken. deadline threads are queued
+         * by deadline, so only use it once they leave that class */
+        t->priority = priority;
+        return;
+    }
+
+    /* move it to the queue for the new priority, at the head so a thread
+     * that was just boosted to get a lock out of the way runs promptly */
+    bool raised = priority > t->priority;
+    uint cpu = remove_from_run_queue(t);
+    t->priority = priority;
+    insert_in_run_queue_head(cpu, t);
+
+    if (raised && cpu != arch_curr_cpu_num())
+        mp_reschedule_cpu(cpu, 0);
+}
+
+status_t sched_set_deadline(thread_t *t, lk_time_t runtime, lk_time_t deadline,
+                            lk_time_t period)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(!thread_is_idle(t));
+
+    uint64_t bandwidth = 0;
+    uint cpu = 0;
+    if (runtime != 0) {
+        bandwidth = deadline_compute_bandwidth(runtime, deadline);
+        cpu = deadline_pick_cpu(t, bandwidth);
+        if (cpu >= SMP_MAX_CPUS)
+            return ERR_NO_RESOURCES;
+    }
+
+    /* a ready thread moves queues, and maybe cpus */
+    bool ready = t->state == THREAD_READY;
+    if (ready)
+        remove_from_run_queue(t);
+
+    struct thread_deadline *dl = &t->deadline;
+    if (thread_is_deadline(t)) {
+        DEBUG_ASSERT(run_queues[dl->cpu].deadline_bandwidth >= dl->bandwidth);
+        run_queues[dl->cpu].deadline_bandwidth -= dl->bandwidth;
+        list_delete(&dl->admitted_node);
+        timer_cancel(&dl->replenish_timer);
+        dl->throttled = false;
+    }
+
+    if (runtime != 0) {
+        dl->runtime = runtime;
+        dl->deadline = deadline;
+        dl->period = period;
+        dl->bandwidth = bandwidth;
+        dl->cpu = cpu;
+        run_queues[cpu].deadline_bandwidth += bandwidth;
+        list_add_tail(&run_queues[cpu].deadline_admitted, &dl->admitted_node);
+
+        lk_time_t now = current_time();
+        dl->charged_at = now;
+        deadline_new_job(t, now);
+        t->flags |= THREAD_FLAG_DEADLINE;
+    } else {
+        t->flags &= ~THREAD_FLAG_DEADLINE;
+    }
+
+    if (ready) {
+        uint target = find_cpu(t, 0);
+        insert_in_run_queue_tail(target, t);
+        if (target != arch_curr_cpu_num())
+            mp_reschedule_cpu(target, 0);
+    } else if (t->state == THREAD_RUNNING && t != get_current_thread()) {
+        /* have it move to its new cpu or pick up its new budget */
+        mp_reschedule_cpu(thread_last_cpu(t), MP_RESCHEDULE_FLAG_REALTIME);
+    }
+
+    return NO_ERROR;
+}
+
+/* move all of the unpinned threads waiting on old_cpu over to the current cpu.
+ * used when old_cpu is being taken out of the scheduler.
+ */
+void sched_transition_off_cpu(uint old_cpu)
+{
+    DEBUG_ASSERT(old_cpu < SMP_MAX_CPUS);
+
+    THREAD_LOCK(state);
+
+    uint cpu = arch_curr_cpu_num();
+    DEBUG_ASSERT(cpu != old_cpu);
+
+    /* gather them up first, only one run queue lock is held at a time */
+    struct list_node moving = LIST_INITIAL_VALUE(moving);
+    struct run_queue *rq = &run_queues[old_cpu];
+    spin_lock(&rq->lock);
+    for (uint i = 0; i < NUM_PRIORITIES; i++) {
+        thread_t *t, *temp;
+        list_for_every_entry_safe(&rq->queue[i], t, temp, thread_t, queue_node) {
+            if (thread_pinned_cpu(t) >= 0)
+                continue;
+
+            list_delete(&t->queue_node);
+            rq->count--;
+            list_add_tail(&moving, &t->queue_node);
+        }
+        if (list_is_empty(&rq->queue[i]))
+            rq->bitmap &= ~(1u << i);
+    }
+    spin_unlock(&rq->lock);
+
+    thread_t *t;
+    while ((t = list_remove_head_type(&moving, thread_t, queue_node)))
+        insert_in_run_queue_tail(cpu, t);
+
+    /* every deadline thread admitted here moves, whether it is queued,
+     * blocked or running elsewhere for now, taking its bandwidth to the cpu
+     * with the most to spare, or to this one if that overcommits it. pinned
+     * ones stay behind like they do in the priority queues */
+    struct thread_deadline *dl, *dl_temp;
+    list_for_every_entry_safe(&rq->deadline_admitted, dl, dl_temp,
+                              struct thread_deadline, admitted_node) {
+        t = containerof(dl, thread_t, deadline);
+        if (thread_pinned_cpu(t) >= 0)
+            continue;
+
+        uint target = deadline_pick_cpu(t, dl->bandwidth);
+        if (target >= SMP_MAX_CPUS)
+            target = cpu;
+
+        rq->deadline_bandwidth -= dl->bandwidth;
+        list_delete(&dl->admitted_node);
+        dl->cpu = target;
+        run_queues[target].deadline_bandwidth += dl->bandwidth;
+        list_add_tail(&run_queues[target].deadline_admitted, &dl->admitted_node);
+
+        /* timer_transition_off_cpu() already moved the replenish timer, but
+         * rearm it so it fires on a cpu that is still running */
+        if (dl->throttled) {
+            timer_cancel(&dl->replenish_timer);
+            timer_set_oneshot(&dl->replenish_timer, dl->release + dl->period,
+                              deadline_replenish, t);
+        }
+
+        if (t->state == THREAD_READY) {
+            remove_from_run_queue(t);
+            deadline_insert(t);
+        }
+    }
+    deadline_cancel_budget_timer(rq);
+
+    /* let any idle cpus come and take some of the work */
+    mp_cpu_mask_t idle = mp_get_idle_mask();
+    mp_reschedule(&idle, 0);
+
+    THREAD_UNLOCK(state);
+}
+
 void sched_init_early(void)
 {
     /* initialize the run queues */
-    for (int i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct run_queue *rq = &run_queues[cpu];
+        spin_lock_init(&rq->lock);
+        for (int i = 0; i < NUM_PRIORITIES; i++)
+            list_initialize(&rq->queue[i]);
+        list_initialize(&rq->deadline_queue);
+        list_initialize(&rq->throttled);
+        list_initialize(&rq->deadline_admitted);
+        timer_initialize(&rq->budget_timer);
+    }
 }
-
@@ -64,6 +64,8 @@ void thread_resched(void);
 static int idle_thread_routine(void *) __NO_RETURN;
 static void thread_exit_locked(thread_t *current_thread, int retcode) __NO_RETURN;
 static void thread_do_suspend(void);
+static int thread_pi_effective_priority(const thread_t *t);
+static void thread_pi_release_donors(thread_t *t);
 
 /* scheduler */
 
@@ -79,6 +81,8 @@ static void init_thread_struct(thread_t *t, const char *name)
     thread_set_pinned_cpu(t, -1);
     strlcpy(t->name, name, sizeof(t->name));
     wait_queue_init(&t->retcode_wait_queue);
+    list_initialize(&t->pi_donors);
+    timer_initialize(&t->deadline.replenish_timer);
 }
 
 static void initial_thread_func(void) __NO_RETURN;
@@ -147,6 +151,7 @@ thread_t *thread_create_etc(
     t->entry = entry;
     t->arg = arg;
     t->priority = priority;
+    t->base_priority = priority;
     t->state = THREAD_INITIAL;
     t->signals = 0;
     t->blocking_wait_queue = NULL;
@@ -326,7 +331,7 @@ status_t thread_suspend(thread_t *t)
             break;
         case THREAD_RUNNING:
             /* thread is running (on another cpu) */
-            mp_reschedule(1u << thread_last_cpu(t), 0);
+            mp_reschedule_cpu(thread_last_cpu(t), 0);
             break;
         case THREAD_SUSPENDED:
             /* thread is suspended already */
@@ -429,6 +434,16 @@ status_t thread_detach(thread_t *t)
 
 __NO_RETURN static void thread_exit_locked(thread_t *current_thread, int retcode)
 {
+    /* stop lending our priority to anyone, and stop borrowing it. the latter
+     * only happens with user futexes, since a kernel thread exiting with a
+     * contended mutex held is a bug */
+    thread_pi_unblock(current_thread);
+    thread_pi_release_donors(current_thread);
+
+    /* give back any deadline bandwidth */
+    if (thread_is_deadline(current_thread))
+        sched_set_deadline(current_thread, 0, 0, 0);
+
     /* enter the dead state */
     current_thread->state = THREAD_DEATH;
     current_thread->retcode = retcode;
@@ -482,6 +497,9 @@ void thread_forget(thread_t *t)
     DEBUG_ASSERT(current_thread != t);
 
     list_delete(&t->thread_list_node);
+    /* a thread that never ran still holds its deadline bandwidth */
+    if (thread_is_deadline(t))
+        sched_set_deadline(t, 0, 0, 0);
     THREAD_UNLOCK(state);
 
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
@@ -558,7 +576,7 @@ void thread_kill(thread_t *t, bool block)
             break;
         case THREAD_RUNNING:
             /* thread is running (on another cpu) */
-            mp_reschedule(1u << thread_last_cpu(t), 0);
+            mp_reschedule_cpu(thread_last_cpu(t), 0);
             break;
         case THREAD_SUSPENDED:
             /* thread is suspended, resume it so it can get the kill signal */
@@ -607,7 +625,7 @@ static void thread_do_suspend(void)
         current_thread->state = THREAD_SUSPENDED;
         current_thread->signals &= ~THREAD_SIGNAL_SUSPEND;
 
-        thread_resched();
+        sched_block();
     }
 
     THREAD_UNLOCK(state);
@@ -659,6 +677,34 @@ __NO_SAFESTACK static void final_context_switch(thread_t *oldthread,
     arch_context_switch(oldthread, newthread);
 }
 
+/* charge the time a thread spent in a run queue now that it's been picked to run */
+static void thread_account_dispatch(thread_t *t, uint cpu, lk_time_t now)
+{
+    struct thread_sched_stats *stats = &t->sched_stats;
+
+#if WITH_SMP
+    /* a thread that has never run has no cache state to leave behind */
+    if (t->last_started_running != 0 && thread_last_cpu(t) != cpu) {
+        stats->migrations++;
+        THREAD_STATS_INC(migrations);
+    }
+#endif
+
+    if (stats->ready_timestamp == 0)
+        return;
+
+    lk_time_t wait = now - stats->ready_timestamp;
+    stats->ready_timestamp = 0;
+    stats->run_queue_wait += wait;
+    thread_stats[cpu].run_queue_wait += wait;
+
+    if (stats->woken) {
+        uint bucket = thread_latency_bucket(wait);
+        stats->wakeup_latency[bucket]++;
+        thread_stats[cpu].wakeup_latency[bucket]++;
+    }
+}
+
 /**
  * @brief  Cause another thread to be executed.
  *
@@ -691,10 +737,13 @@ void thread_resched(void)
     thread_t *oldthread = current_thread;
 
     /* if it's the same thread as we're already running, exit */
-    if (newthread == oldthread)
+    if (newthread == oldthread) {
+        newthread->sched_stats.ready_timestamp = 0;
         return;
+    }
 
     lk_time_t now = current_time();
+    thread_account_dispatch(newthread, cpu, now);
     oldthread->runtime_ns += now - oldthread->last_started_running;
     newthread->last_started_running = now;
 
@@ -944,7 +993,8 @@ status_t thread_sleep_etc(lk_time_t deadline, bool interruptable)
 
     if (deadline != INFINITE_TIME) {
         /* set a one shot timer to wake us up and reschedule */
-        timer_set_oneshot(&timer, deadline, thread_sleep_handler, (void *)current_thread);
+        timer_set_oneshot_etc(&timer, deadline, thread_get_timer_slack(current_thread),
+                              thread_sleep_handler, (void *)current_thread);
     }
     current_thread->state = THREAD_SLEEPING;
     current_thread->blocked_status = NO_ERROR;
@@ -993,6 +1043,112 @@ lk_time_t thread_runtime(const thread_t *t)
     return runtime;
 }
 
+/**
+ * @brief Return a snapshot of a thread's scheduler latency accounting.
+ *
+ * If the thread is currently waiting in a run queue the time it has waited so
+ * far is included in the run queue wait time.
+ */
+void thread_get_sched_stats(const thread_t *t, struct thread_sched_stats *stats)
+{
+    THREAD_LOCK(state);
+
+    *stats = t->sched_stats;
+    if (stats->ready_timestamp != 0) {
+        stats->run_queue_wait += current_time() - stats->ready_timestamp;
+    }
+
+    THREAD_UNLOCK(state);
+}
+
+/**
+ * @brief Set the timer slack of a thread.
+ *
+ * Timeouts of later sleeps and waits by the thread may fire up to slack
+ * nanoseconds after their deadline, letting them share a timer interrupt
+ * with other nearby timers.
+ *
+ * @return ERR_OUT_OF_RANGE if slack exceeds THREAD_MAX_TIMER_SLACK.
+ */
+status_t thread_set_timer_slack(thread_t *t, lk_time_t slack)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    if (slack > THREAD_MAX_TIMER_SLACK)
+        return ERR_OUT_OF_RANGE;
+
+    __atomic_store_n(&t->timer_slack, slack, __ATOMIC_RELAXED);
+    return NO_ERROR;
+}
+
+/**
+ * @brief Move a thread in or out of the deadline scheduling class
+ *
+ * A deadline thread is guaranteed runtime ns of cpu time within deadline ns
+ * of the start of every period, and runs ahead of every priority.  If it
+ * tries to use more, it is throttled until its next period.  A period starts
+ * when the previous one ends, or when the thread wakes if its remaining budget
+ * can't be used up by the current deadline without exceeding its share.
+ *
+ * Threads are admitted to a cpu while the deadline threads there are
+ * guaranteed no more than 95% of it in total.
+ *
+ * @param runtime, deadline, period  Zero to go back to priority scheduling.
+ *
+ * @return ERR_INVALID_ARGS if the parameters are out of order or range,
+ * ERR_NO_RESOURCES if no cpu has the bandwidth to admit the thread.
+ */
+status_t thread_set_deadline(thread_t *t, lk_time_t runtime, lk_time_t deadline,
+                             lk_time_t period)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    if (runtime != 0 || deadline != 0 || period != 0) {
+        if (runtime < THREAD_MIN_DEADLINE_RUNTIME || runtime > deadline ||
+            deadline > period || period > THREAD_MAX_DEADLINE_PERIOD)
+            return ERR_INVALID_ARGS;
+    }
+
+    if (thread_is_idle(t))
+        return ERR_INVALID_ARGS;
+
+    THREAD_LOCK(state);
+
+    status_t status = sched_set_deadline(t, runtime, deadline, period);
+    if (status == NO_ERROR && t == get_current_thread()) {
+#if PLATFORM_HAS_DYNAMIC_TIMER
+        /* like thread_set_real_time(), deadline threads don't take the
+         * preemption tick. a thread leaving the class needs it back */
+        uint cpu = arch_curr_cpu_num();
+        timer_cancel(&preempt_timer[cpu]);
+        if (!thread_is_real_time_or_idle(t))
+            timer_set_periodic(&preempt_timer[cpu], THREAD_TICK_RATE,
+                               (timer_callback)thread_timer_tick, NULL);
+#endif
+        /* let the scheduler move us to our cpu and deadline order */
+        sched_preempt();
+    }
+
+    THREAD_UNLOCK(state);
+
+    return status;
+}
+
+void thread_get_deadline(thread_t *t, lk_time_t *runtime, lk_time_t *deadline,
+                         lk_time_t *period)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    THREAD_LOCK(state);
+
+    bool is_deadline = thread_is_deadline(t);
+    *runtime = is_deadline ? t->deadline.runtime : 0;
+    *deadline = is_deadline ? t->deadline.deadline : 0;
+    *period = is_deadline ? t->deadline.period : 0;
+
+    THREAD_UNLOCK(state);
+}
+
 /**
  * @brief Construct a thread t around the current running state
  *
@@ -1009,6 +1165,7 @@ void thread_construct_first(thread_t *t, const char *name)
 
     init_thread_struct(t, name);
     t->priority = HIGHEST_PRIORITY;
+    t->base_priority = HIGHEST_PRIORITY;
     t->state = THREAD_RUNNING;
     t->flags = THREAD_FLAG_DETACHED;
     t->signals = 0;
@@ -1087,13 +1244,112 @@ void thread_set_priority(int priority)
         priority = IDLE_PRIORITY + 1;
     if (priority > HIGHEST_PRIORITY)
         priority = HIGHEST_PRIORITY;
-    current_thread->priority = priority;
+    current_thread->base_priority = priority;
+    current_thread->priority = thread_pi_effective_priority(current_thread);
 
     sched_preempt();
 
     THREAD_UNLOCK(state);
 }
 
+/* the priority a thread should run at: its own, or that of the highest
+ * priority thread waiting on a lock it holds */
+static int thread_pi_effective_priority(const thread_t *t)
+{
+    int priority = t->base_priority;
+
+    thread_t *donor;
+    list_for_every_entry(&t->pi_donors, donor, thread_t, pi_node) {
+        if (donor->priority > priority)
+            priority = donor->priority;
+    }
+
+    return priority;
+}
+
+/* recompute t's effective priority after its donors changed, and carry any
+ * change along the chain of lock owners t is itself blocked behind */
+static void thread_pi_update(thread_t *t)
+{
+    while (t) {
+        int priority = thread_pi_effective_priority(t);
+        if (priority == t->priority)
+            return;
+
+        sched_change_priority(t, priority);
+        t = t->pi_owner;
+    }
+}
+
+/**
+ * @brief Lend a thread's priority to the owner of the lock it is blocking on
+ *
+ * Until thread_pi_unblock() is called, owner runs at no less than t's
+ * priority, as does anything owner is blocked behind in turn.  Calling this
+ * on a thread that is already lending its priority moves the loan over to
+ * the new owner.
+ *
+ * The thread lock must be held.
+ */
+void thread_pi_block_on(thread_t *t, thread_t *owner)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    if (t->pi_owner == owner)
+        return;
+
+    thread_pi_unblock(t);
+
+    /* an owner that never started or is dead will not release anything, nor
+     * can it use the boost. only started threads go through
+     * thread_exit_locked(), which returns the loans */
+    if (!owner || owner->state == THREAD_INITIAL || owner->state == THREAD_DEATH)
+        return;
+
+    DEBUG_ASSERT(owner->magic == THREAD_MAGIC);
+
+    /* user futex owners are whatever userspace claims, so refuse to close a
+     * cycle rather than trust the chain to end */
+    for (thread_t *o = owner; o; o = o->pi_owner) {
+        if (o == t)
+            return;
+    }
+
+    t->pi_owner = owner;
+    list_add_tail(&owner->pi_donors, &t->pi_node);
+    thread_pi_update(owner);
+}
+
+/**
+ * @brief Stop a thread from lending its priority
+ *
+ * The thread lock must be held.
+ */
+void thread_pi_unblock(thread_t *t)
+{
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+
+    thread_t *owner = t->pi_owner;
+    if (!owner)
+        return;
+
+    list_delete(&t->pi_node);
+    t->pi_owner = NULL;
+    thread_pi_update(owner);
+}
+
+/* drop every loan made to t, used when it exits */
+static void thread_pi_release_donors(thread_t *t)
+{
+    thread_t *donor;
+    while ((donor = list_remove_head_type(&t->pi_donors, thread_t, pi_node))) {
+        donor->pi_owner = NULL;
+    }
+    t->priority = t->base_priority;
+}
+
 /**
  * @brief  Become an idle thread
  *
@@ -1113,6 +1369,7 @@ void thread_become_idle(void)
 
     /* mark ourself as idle */
     t->priority = IDLE_PRIORITY;
+    t->base_priority = IDLE_PRIORITY;
     t->flags |= THREAD_FLAG_IDLE;
     thread_set_pinned_cpu(t, arch_curr_cpu_num());
 
@@ -1242,14 +1499,25 @@ void dump_thread(thread_t *t, bool full_dump)
 #endif
         dprintf(INFO, "\truntime_ns %" PRIu64 ", runtime_s %" PRIu64 "\n",
                 runtime, runtime / 1000000000);
+        dprintf(INFO, "\trun_queue_wait_ns %" PRIu64 ", wakeups %lu, preemptions %lu, migrations %lu\n",
+                t->sched_stats.run_queue_wait, t->sched_stats.wakeups,
+                t->sched_stats.preemptions, t->sched_stats.migrations);
         dprintf(INFO, "\tstack %p, stack_size %zu\n", t->stack, t->stack_size);
-        dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
+        if (thread_is_deadline(t)) {
+            dprintf(INFO, "\tdeadline: runtime %" PRIu64 ", deadline %" PRIu64 ", period %" PRIu64
+                    ", cpu %u, remaining %" PRIu64 "%s\n",
+                    t->deadline.runtime, t->deadline.deadline, t->deadline.period,
+                    t->deadline.cpu, t->deadline.remaining,
+                    t->deadline.throttled ? ", throttled" : "");
+        }
+        dprintf(INFO, "\tentry %p, arg %p, flags 0x%x %s%s%s%s%s%s%s\n", t->entry, t->arg, t->flags,
                 (t->flags & THREAD_FLAG_DETACHED) ? "Dt" :"",
                 (t->flags & THREAD_FLAG_FREE_STACK) ? "Fs" :"",
                 (t->flags & THREAD_FLAG_FREE_STRUCT) ? "Ft" :"",
                 (t->flags & THREAD_FLAG_REAL_TIME) ? "Rt" :"",
                 (t->flags & THREAD_FLAG_IDLE) ? "Id" :"",
-                (t->flags & THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK) ? "Sc" :"");
+                (t->flags & THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK) ? "Sc" :"",
+                (t->flags & THREAD_FLAG_DEADLINE) ? "Dl" :"");
         dprintf(INFO, "\twait queue %p, blocked_status %d, interruptable %d\n",
                 t->blocking_wait_queue, t->blocked_status, t->interruptable);
         dprintf(INFO, "\taspace %p\n", t->aspace);
@@ -1382,7 +1650,8 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t deadline)
     /* if the deadline is nonzero or noninfinite, set a callback to yank us out of the queue */
     if (deadline != INFINITE_TIME) {
         timer_initialize(&timer);
-        timer_set_oneshot(&timer, deadline, wait_queue_timeout_handler, (void *)current_thread);
+        timer_set_oneshot_etc(&timer, deadline, thread_get_timer_slack(current_thread),
+                              wait_queue_timeout_handler, (void *)current_thread);
     }
 
     sched_block();
@@ -1410,6 +1679,18 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t deadline)
  * @return  The number of threads woken (zero or one)
  */
 int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue_error)
+{
+    return wait_queue_wake_one_etc(wait, reschedule, wait_queue_error, 0);
+}
+
+/**
+ * @brief  Wake up one thread sleeping on a wait queue, with placement hints
+ *
+ * As wait_queue_wake_one(), with sched_flags (SCHED_UNBLOCK_FLAG_*) passed
+ * through to the scheduler to help it decide where the thread should run.
+ */
+int wait_queue_wake_one_etc(wait_queue_t *wait, bool reschedule, status_t wait_queue_error,
+                            uint sched_flags)
 {
     thread_t *t;
     int ret = 0;
@@ -1425,7 +1706,7 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
         t->blocked_status = wait_queue_error;
         t->blocking_wait_queue = NULL;
 
-        sched_unblock(t, reschedule);
+        sched_unblock_etc(t, reschedule, sched_flags);
 
         ret = 1;
     }
@@ -35,8 +35,21 @@
 
 spin_lock_t timer_lock;
 
+/* Each cpu keeps its pending timers in two pairing heaps, one ordered by
+ * their latest allowed firing time, scheduled_time + slack, and one by their
+ * deadline, scheduled_time. Insertion is O(1), and removing the earliest timer
+ * or cancelling an arbitrary one is O(log n) amortized, so arming and
+ * cancelling stay cheap with many thousands of outstanding timers.
+ *
+ * The hardware timer is programmed for the head of the latest time heap. When
+ * it fires, every timer whose scheduled_time has passed is run, taken off the
+ * deadline heap in order, so all timers with a slack window that overlaps the
+ * interrupt get coalesced into it, not only the ones that also have the
+ * earliest latest times.
+ */
 struct timer_state {
-    struct list_node timer_queue;
+    struct timer_heap_node *latest_root;
+    struct timer_heap_node *deadline_root;
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -51,33 +64,168 @@ void timer_initialize(timer_t *timer)
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer)
+static inline bool timer_is_queued(const timer_t *timer)
 {
-    timer_t *entry;
+    return timer->queued_cpu >= 0;
+}
+
+/* the latest time the timer is allowed to fire */
+static inline lk_time_t timer_latest(const timer_t *timer)
+{
+    return timer->scheduled_time + timer->slack;
+}
+
+/* the time each heap orders a timer by */
+typedef lk_time_t (*heap_key_t)(const struct timer_heap_node *node);
+
+static lk_time_t latest_key(const struct timer_heap_node *node)
+{
+    return timer_latest(containerof(node, timer_t, latest_node));
+}
+
+static lk_time_t deadline_key(const struct timer_heap_node *node)
+{
+    return containerof(node, const timer_t, deadline_node)->scheduled_time;
+}
+
+/* meld two heaps, returning the new root. both arguments must be roots
+ * (no parent or siblings) or NULL. */
+static struct timer_heap_node *heap_meld(struct timer_heap_node *a, struct timer_heap_node *b,
+                                         heap_key_t key)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    /* the earlier timer becomes the root, a on a tie */
+    if (TIME_LT(key(b), key(a))) {
+        struct timer_heap_node *temp = a;
+        a = b;
+        b = temp;
+    }
 
+    /* make b the leftmost child of a */
+    b->prev = a;
+    b->sibling = a->child;
+    if (a->child)
+        a->child->prev = b;
+    a->child = b;
+
+    return a;
+}
+
+/* combine a list of sibling subtrees into a single heap using the standard
+ * two pass pairing: meld neighbours left to right, then fold the results
+ * together right to left. */
+static struct timer_heap_node *heap_meld_siblings(struct timer_heap_node *first, heap_key_t key)
+{
+    struct timer_heap_node *pairs = NULL;
+
+    while (first) {
+        struct timer_heap_node *a = first;
+        struct timer_heap_node *b = a->sibling;
+        first = b ? b->sibling : NULL;
+
+        a->sibling = a->prev = NULL;
+        if (b)
+            b->sibling = b->prev = NULL;
+
+        /* push the melded pair on a temporary stack threaded through sibling */
+        struct timer_heap_node *m = heap_meld(a, b, key);
+        m->sibling = pairs;
+        pairs = m;
+    }
+
+    struct timer_heap_node *root = NULL;
+    while (pairs) {
+        struct timer_heap_node *next = pairs->sibling;
+        pairs->sibling = NULL;
+        root = heap_meld(pairs, root, key);
+        pairs = next;
+    }
+
+    return root;
+}
+
+static void heap_insert(struct timer_heap_node **root, struct timer_heap_node *node,
+                        heap_key_t key)
+{
+    node->child = node->sibling = node->prev = NULL;
+    *root = heap_meld(*root, node, key);
+}
+
+static void heap_remove(struct timer_heap_node **root, struct timer_heap_node *node,
+                        heap_key_t key)
+{
+    if (node == *root) {
+        *root = heap_meld_siblings(node->child, key);
+    } else {
+        /* cut the subtree rooted at this node out of the heap */
+        if (node->prev->child == node)
+            node->prev->child = node->sibling;
+        else
+            node->prev->sibling = node->sibling;
+        if (node->sibling)
+            node->sibling->prev = node->prev;
+
+        /* and put its children back */
+        *root = heap_meld(*root, heap_meld_siblings(node->child, key), key);
+    }
+
+    node->child = node->sibling = node->prev = NULL;
+}
+
+static void insert_timer_in_queue(uint cpu, timer_t *timer)
+{
     DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(!timer_is_queued(timer));
 
     LTRACEF("timer %p, cpu %u, scheduled %" PRIu64 ", periodic %" PRIu64 "\n", timer, cpu, timer->scheduled_time, timer->period);
 
-    list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
-            return;
-        }
-    }
+    timer->queued_cpu = cpu;
+
+    heap_insert(&timers[cpu].latest_root, &timer->latest_node, latest_key);
+    heap_insert(&timers[cpu].deadline_root, &timer->deadline_node, deadline_key);
+}
+
+static void remove_timer_from_queue(timer_t *timer)
+{
+    DEBUG_ASSERT(arch_ints_disabled());
+    DEBUG_ASSERT(timer_is_queued(timer));
+
+    struct timer_state *ts = &timers[timer->queued_cpu];
+
+    heap_remove(&ts->latest_root, &timer->latest_node, latest_key);
+    heap_remove(&ts->deadline_root, &timer->deadline_node, deadline_key);
+
+    timer->queued_cpu = -1;
+}
 
-    /* walked off the end of the list */
-    list_add_tail(&timers[cpu].timer_queue, &timer->node);
+/* the timer with the earliest latest firing time, which the hardware timer is set for */
+static inline timer_t *timer_queue_head(uint cpu)
+{
+    struct timer_heap_node *node = timers[cpu].latest_root;
+    return node ? containerof(node, timer_t, latest_node) : NULL;
 }
 
-static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, timer_callback callback, void *arg)
+/* the timer with the earliest deadline */
+static inline timer_t *timer_queue_earliest(uint cpu)
 {
-    LTRACEF("timer %p, deadline %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n", timer, deadline, period, callback, arg);
+    struct timer_heap_node *node = timers[cpu].deadline_root;
+    return node ? containerof(node, timer_t, deadline_node) : NULL;
+}
+
+static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t slack, lk_time_t period,
+                      timer_callback callback, void *arg)
+{
+    LTRACEF("timer %p, deadline %" PRIu64 ", slack %" PRIu64 ", period %" PRIu64 ", callback %p, arg %p\n",
+            timer, deadline, slack, period, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    if (list_in_list(&timer->node)) {
-        panic("timer %p already in list\n", timer);
+    if (timer_is_queued(timer)) {
+        panic("timer %p already in queue\n", timer);
     }
 
     spin_lock_saved_state_t state;
@@ -95,6 +243,7 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
 
     /* set up the structure */
     timer->scheduled_time = deadline;
+    timer->slack = slack;
     timer->period = period;
     timer->callback = callback;
     timer->arg = arg;
@@ -106,10 +255,10 @@ static void timer_set(timer_t *timer, lk_time_t deadline, lk_time_t period, time
     insert_timer_in_queue(cpu, timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
+    if (timer_queue_head(cpu) == timer) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", deadline);
-        platform_set_oneshot_timer(timer_tick, NULL, deadline);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer_latest(timer));
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(timer));
     }
 #endif
 
@@ -133,7 +282,26 @@ out:
  */
 void timer_set_oneshot(timer_t *timer, lk_time_t deadline, timer_callback callback, void *arg)
 {
-    timer_set(timer, deadline, 0, callback, arg);
+    timer_set(timer, deadline, 0, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, some time within a window
+ *
+ * Like timer_set_oneshot(), but the callback may be delayed by up to slack
+ * nanoseconds past the deadline so that it can share a timer interrupt with
+ * other timers that expire around the same time.
+ *
+ * @param  timer The timer to use
+ * @param  deadline The deadline, in ns, after which the timer is executed
+ * @param  slack  How long after the deadline, in ns, the timer may be delayed
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_etc(timer_t *timer, lk_time_t deadline, lk_time_t slack,
+                           timer_callback callback, void *arg)
+{
+    timer_set(timer, deadline, slack, 0, callback, arg);
 }
 
 /**
@@ -154,7 +322,7 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 {
     if (period == 0)
         period = 1;
-    timer_set(timer, current_time() + period, period, callback, arg);
+    timer_set(timer, current_time() + period, 0, period, callback, arg);
 }
 
 /**
@@ -189,24 +357,24 @@ void timer_cancel(timer_t *timer)
     }
 
     /* if the timer is in a queue, remove it and adjust hardware timers if needed */
-    if (list_in_list(&timer->node)) {
+    if (timer_is_queued(timer)) {
 #if PLATFORM_HAS_DYNAMIC_TIMER
-        timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+        timer_t *oldhead = timer_queue_head(cpu);
 #endif
 
         /* remove it from the queue */
-        list_delete(&timer->node);
+        remove_timer_from_queue(timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
         /* see if we've just modified the head of this cpu's timer queue */
         /* if we modified another cpu's queue, we'll just let it fire and sort itself out */
-        timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+        timer_t *newhead = timer_queue_head(cpu);
         if (newhead == NULL) {
             LTRACEF("clearing old hw timer, nothing in the queue\n");
             platform_stop_timer();
         } else if (newhead != oldhead) {
-            LTRACEF("setting new timer to %" PRIu64 "\n", newhead->scheduled_time);
-            platform_set_oneshot_timer(timer_tick, NULL, newhead->scheduled_time);
+            LTRACEF("setting new timer to %" PRIu64 "\n", timer_latest(newhead));
+            platform_set_oneshot_timer(timer_tick, NULL, timer_latest(newhead));
         }
 #endif
     }
@@ -241,8 +409,9 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
     spin_lock(&timer_lock);
 
     for (;;) {
-        /* see if there's an event to process */
-        timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+        /* see if there's an event to process. going by deadline runs every
+         * timer that may fire now, even ones the hardware timer wasn't set for */
+        timer = timer_queue_earliest(cpu);
         if (likely(timer == 0))
             break;
         LTRACEF("next item on timer queue %p at %" PRIu64 " now %" PRIu64 " (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
@@ -254,7 +423,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
         DEBUG_ASSERT_MSG(timer && timer->magic == TIMER_MAGIC,
                 "ASSERT: timer failed magic check: timer %p, magic 0x%x\n",
                 timer, (uint)timer->magic);
-        list_delete(&timer->node);
+        remove_timer_from_queue(timer);
 
         /* mark the timer busy */
         timer->active_cpu = cpu;
@@ -267,6 +436,10 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
         THREAD_STATS_INC(timers);
 
+        /* fired ahead of its latest time, riding along with an earlier timer's interrupt */
+        if (TIME_LT(now, timer_latest(timer)))
+            THREAD_STATS_INC(timers_coalesced);
+
         LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
         if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
             ret = INT_RESCHEDULE;
@@ -290,7 +463,7 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
             /* if it is a periodic timer and it hasn't been requeued
              * by the callback put it back in the list
              */
-            if (timer->period > 0 && !list_in_list(&timer->node)) {
+            if (timer->period > 0 && !timer_is_queued(timer)) {
                 LTRACEF("periodic timer, period %" PRIu64 "\n", timer->period);
                 timer->scheduled_time = now + timer->period;
                 insert_timer_in_queue(cpu, timer);
@@ -300,14 +473,14 @@ static enum handler_return timer_tick(void *arg, lk_time_t now)
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
     /* reset the timer to the next event */
-    timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+    timer = timer_queue_head(cpu);
     if (timer) {
         /* has to be the case or it would have fired already */
         DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
 
-        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer->scheduled_time,
+        LTRACEF("setting new timer for %" PRIu64 " nsecs for event %p\n", timer_latest(timer),
                 timer);
-        platform_set_oneshot_timer(timer_tick, NULL, timer->scheduled_time);
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(timer));
     }
 
     /* we're done manipulating the timer queue */
@@ -349,21 +522,22 @@ void timer_transition_off_cpu(uint old_cpu)
     spin_lock_irqsave(&timer_lock, state);
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *old_head = list_peek_head_type(&timers[old_cpu].timer_queue, timer_t, node);
+    timer_t *old_head = timer_queue_head(cpu);
 
-    timer_t *entry = NULL, *tmp_entry = NULL;
-    /* Move all timers from old_cpu to this cpu */
-    list_for_every_entry_safe(&timers[old_cpu].timer_queue, entry, tmp_entry, timer_t, node) {
-        list_delete(&entry->node);
+    /* Move all timers from old_cpu to this cpu. Each one has to be visited
+     * anyway to update its queued cpu, so just pop them off in order. */
+    timer_t *entry;
+    while ((entry = timer_queue_head(old_cpu)) != NULL) {
+        remove_timer_from_queue(entry);
         insert_timer_in_queue(cpu, entry);
     }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    timer_t *new_head = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+    timer_t *new_head = timer_queue_head(cpu);
     if (new_head != NULL && new_head != old_head) {
         /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", new_head->scheduled_time);
-        platform_set_oneshot_timer(timer_tick, NULL, new_head->scheduled_time);
+        LTRACEF("setting new timer for %" PRIu64 " nsecs\n", timer_latest(new_head));
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(new_head));
     }
 #endif
 
@@ -380,10 +554,10 @@ void timer_thaw_percpu(void)
 
     uint cpu = arch_curr_cpu_num();
 
-    timer_t *t = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
+    timer_t *t = timer_queue_head(cpu);
     if (t) {
-        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", t->scheduled_time);
-        platform_set_oneshot_timer(timer_tick, NULL, t->scheduled_time);
+        LTRACEF("rescheduling timer for %" PRIu64 " nsecs\n", timer_latest(t));
+        platform_set_oneshot_timer(timer_tick, NULL, timer_latest(t));
     }
 
     spin_unlock(&timer_lock);
@@ -394,7 +568,8 @@ void timer_init(void)
 {
     timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&timers[i].timer_queue);
+        timers[i].latest_root = NULL;
+        timers[i].deadline_root = NULL;
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     /* register for a periodic timer tick */
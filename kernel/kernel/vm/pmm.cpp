@@ -6,12 +6,16 @@
 // https://opensource.org/licenses/MIT
 
 #include "vm_priv.h"
+#include <arch/ops.h>
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
 #include <kernel/auto_lock.h>
+#include <kernel/cmdline.h>
+#include <kernel/event.h>
 #include <kernel/mp.h>
 #include <kernel/mutex.h>
+#include <kernel/thread.h>
 #include <kernel/timer.h>
 #include <kernel/vm.h>
 #include <lib/console.h>
@@ -35,6 +39,426 @@ static Mutex arena_lock;
 static mxtl::DoublyLinkedList<PmmArena*> arena_list TA_GUARDED(arena_lock);
 static size_t arena_cumulative_size TA_GUARDED(arena_lock);
 
+// Pool of pre-zeroed free pages, refilled by a low priority thread so that
+// PMM_ALLOC_FLAG_ZEROED allocations rarely have to zero pages inline. The pages
+// themselves sit on each arena's zeroed free list. The target size is set with
+// the pmm.zero_pool_pages kernel commandline option, 0 disables the pool.
+#define PMM_ZERO_POOL_DEFAULT_PAGES 4096u
+#define PMM_ZERO_BATCH_PAGES 16u
+
+static size_t zero_pool_target TA_GUARDED(arena_lock);
+static bool zero_thread_waiting TA_GUARDED(arena_lock);
+static event_t zero_pool_event =
+    EVENT_INITIAL_VALUE(zero_pool_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+static uint64_t zero_pool_hits;
+static uint64_t zero_pool_misses;
+
+// Once the arenas run low on free pages, a thread asks the vm to throw away pages
+// userspace has unlocked, until the free count is a little above the watermark
+// again. The watermark is set with the pmm.reclaim_watermark_pages kernel
+// commandline option, 0 disables reclaim.
+#define PMM_RECLAIM_DEFAULT_WATERMARK_PAGES 8192u
+
+static size_t reclaim_watermark TA_GUARDED(arena_lock);
+static bool reclaim_thread_waiting TA_GUARDED(arena_lock);
+static event_t reclaim_event =
+    EVENT_INITIAL_VALUE(reclaim_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// The free page count, including pages sitting in the per-cpu caches, is compared
+// against two watermarks, and a thread tells whoever registered with
+// pmm_set_mem_level_callback() when the level changes.
+// The watermarks are set with the pmm.low_mem_warning_pages and
+// pmm.low_mem_critical_pages kernel commandline options. A level is only left
+// once the free count is an eighth above its watermark, so a system hovering
+// around one doesn't flap.
+#define PMM_LOW_MEM_DEFAULT_WARNING_PAGES 16384u
+#define PMM_LOW_MEM_DEFAULT_CRITICAL_PAGES 4096u
+
+static size_t mem_level_watermarks[PMM_MEM_LEVEL_CRITICAL + 1] TA_GUARDED(arena_lock);
+static pmm_mem_level_t mem_level TA_GUARDED(arena_lock) = PMM_MEM_LEVEL_NORMAL;
+static pmm_mem_level_callback_t mem_level_callback TA_GUARDED(arena_lock);
+static event_t mem_level_event =
+    EVENT_INITIAL_VALUE(mem_level_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+// The caches change the free count without the arena lock, so they keep a count of
+// their own, and the arena free count and the range of free counts that keep the
+// current level are published for them. Only once the free count leaves that range
+// does a cache take the arena lock to move the level.
+static uint64_t cached_pages;
+static uint64_t arena_free_pages;
+static uint64_t mem_level_low_bound;
+static uint64_t mem_level_high_bound = UINT64_MAX;
+
+static size_t arena_free_count_locked() TA_REQ(arena_lock) {
+    size_t free = 0;
+    for (const auto& a : arena_list) {
+        free += a.free_count();
+    }
+    return free;
+}
+
+static size_t zero_pool_count_locked() TA_REQ(arena_lock) {
+    size_t count = 0;
+    for (const auto& a : arena_list) {
+        count += a.zeroed_count();
+    }
+    return count;
+}
+
+// wake up the zeroing thread if it is idle and the pool is below its target
+static void zero_pool_kick_locked() TA_REQ(arena_lock) {
+    if (zero_thread_waiting && zero_pool_count_locked() < zero_pool_target) {
+        zero_thread_waiting = false;
+        event_signal(&zero_pool_event, false);
+    }
+}
+
+// wake up the reclaim thread if it is idle and the arenas are running low
+static void reclaim_kick_locked(size_t free) TA_REQ(arena_lock) {
+    if (reclaim_thread_waiting && free < reclaim_watermark) {
+        reclaim_thread_waiting = false;
+        event_signal(&reclaim_event, false);
+    }
+}
+
+// free pages in the arenas and the caches, as pmm_count_free_pages() counts them
+static size_t free_count_locked() TA_REQ(arena_lock) {
+    size_t free = arena_free_count_locked();
+    atomic_store_u64(&arena_free_pages, free);
+    return free + atomic_load_u64(&cached_pages);
+}
+
+// move to the lowest level whose watermark |free| is under, and wake up the
+// reporting thread if that is a change
+static void mem_level_update_locked(size_t free) TA_REQ(arena_lock) {
+    pmm_mem_level_t level = PMM_MEM_LEVEL_NORMAL;
+    for (int l = PMM_MEM_LEVEL_CRITICAL; l > PMM_MEM_LEVEL_NORMAL; l--) {
+        size_t watermark = mem_level_watermarks[l];
+        // the levels we are already in take some slack to leave
+        if (l <= mem_level)
+            watermark += watermark / 8;
+        if (free < watermark) {
+            level = static_cast<pmm_mem_level_t>(l);
+            break;
+        }
+    }
+
+    // the level stays put until free drops under the next watermark down or climbs
+    // out of this level's slack
+    uint64_t low = 0;
+    uint64_t high = UINT64_MAX;
+    if (level < PMM_MEM_LEVEL_CRITICAL)
+        low = mem_level_watermarks[level + 1];
+    if (level > PMM_MEM_LEVEL_NORMAL)
+        high = mem_level_watermarks[level] + mem_level_watermarks[level] / 8;
+    atomic_store_u64(&mem_level_low_bound, low);
+    atomic_store_u64(&mem_level_high_bound, high);
+
+    if (level != mem_level) {
+        mem_level = level;
+        event_signal(&mem_level_event, false);
+    }
+}
+
+// called whenever the arenas' free count goes down or up
+static void arena_free_changed_locked() TA_REQ(arena_lock) {
+    size_t free = free_count_locked();
+    reclaim_kick_locked(free);
+    mem_level_update_locked(free);
+}
+
+// called after pages move between a cache and its users, without any lock held
+static void cache_free_changed() {
+    uint64_t free = atomic_load_u64(&arena_free_pages) + atomic_load_u64(&cached_pages);
+    if (free >= atomic_load_u64(&mem_level_low_bound) &&
+        free < atomic_load_u64(&mem_level_high_bound))
+        return;
+
+    AutoLock al(&arena_lock);
+    arena_free_changed_locked();
+}
+
+// Called without the arena lock held on a page that was just allocated. Zeroes the
+// page if the caller asked for that and it didn't come from the pool, and clears
+// the pool marker either way.
+static void pmm_finish_alloc(vm_page_t* page, uint alloc_flags) {
+    bool zeroed = page->flags & VM_PAGE_FLAG_ZEROED;
+    page->flags &= ~VM_PAGE_FLAG_ZEROED;
+
+    if (!(alloc_flags & PMM_ALLOC_FLAG_ZEROED))
+        return;
+
+    if (zeroed) {
+        atomic_add_u64(&zero_pool_hits, 1);
+        return;
+    }
+    atomic_add_u64(&zero_pool_misses, 1);
+
+    void* ptr = paddr_to_kvaddr(vm_page_to_paddr(page));
+    DEBUG_ASSERT(ptr);
+    arch_zero_page(ptr);
+}
+
+static int pmm_zero_thread(void*) {
+    for (;;) {
+        // grab a batch of dirty free pages, if the pool needs them
+        vm_page_t* pages[PMM_ZERO_BATCH_PAGES];
+        size_t count = 0;
+        {
+            AutoLock al(&arena_lock);
+            size_t pool = zero_pool_count_locked();
+            for (auto& a : arena_list) {
+                // we need to be able to get at the page through the physmap
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+
+                while (count < countof(pages) && pool + count < zero_pool_target) {
+                    vm_page_t* p = a.AllocPageToZero();
+                    if (!p)
+                        break;
+                    pages[count++] = p;
+                }
+            }
+            if (count == 0)
+                zero_thread_waiting = true;
+        }
+
+        if (count == 0) {
+            event_wait(&zero_pool_event);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            void* ptr = paddr_to_kvaddr(vm_page_to_paddr(pages[i]));
+            DEBUG_ASSERT(ptr);
+            arch_zero_page(ptr);
+        }
+
+        AutoLock al(&arena_lock);
+        for (size_t i = 0; i < count; i++) {
+            for (auto& a : arena_list) {
+                if (a.page_belongs_to_arena(pages[i])) {
+                    a.FreeZeroedPage(pages[i]);
+                    break;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int pmm_reclaim_thread(void*) {
+    for (;;) {
+        size_t watermark;
+        {
+            AutoLock al(&arena_lock);
+            watermark = reclaim_watermark;
+        }
+
+        // aim a quarter above the watermark, so we aren't woken again right away
+        size_t target = watermark + watermark / 4;
+        size_t free = pmm_count_free_pages();
+        size_t freed = 0;
+        if (free < watermark)
+            freed = vm_reclaim_pages(target - free);
+
+        LTRACEF("free %zu, watermark %zu, reclaimed %zu\n", free, watermark, freed);
+
+        // wait for the next allocation to find the arenas low, if we're done or
+        // there's nothing left to throw away
+        if (freed == 0 || free + freed >= watermark) {
+            {
+                AutoLock al(&arena_lock);
+                reclaim_thread_waiting = true;
+            }
+            event_wait(&reclaim_event);
+        }
+    }
+
+    return 0;
+}
+
+static int pmm_mem_level_thread(void*) {
+    pmm_mem_level_t reported = PMM_MEM_LEVEL_NORMAL;
+    for (;;) {
+        event_wait(&mem_level_event);
+
+        pmm_mem_level_t level;
+        pmm_mem_level_callback_t callback;
+        {
+            AutoLock al(&arena_lock);
+            level = mem_level;
+            callback = mem_level_callback;
+        }
+
+        // the level may have gone back to where it was before we got to run
+        if (level == reported || !callback)
+            continue;
+
+        LTRACEF("memory level %d -> %d\n", reported, level);
+        reported = level;
+        callback(level);
+    }
+
+    return 0;
+}
+
+// Per-cpu caches of free pages, so that the common single page allocations and
+// frees don't have to take the arena lock. Caches are refilled from and drained
+// back to the arenas in batches. Cached pages are in VM_PAGE_STATE_CACHED, so the
+// arenas don't consider them free; allocations that need specific pages, and any
+// the arenas alone can't satisfy, drain every cache before giving up. Pages keep
+// VM_PAGE_FLAG_ZEROED while cached.
+#define PMM_CACHE_BATCH_PAGES 32u
+#define PMM_CACHE_MAX_PAGES (PMM_CACHE_BATCH_PAGES * 4)
+
+struct PmmCache {
+    SpinLock lock;
+    list_node dirty = LIST_INITIAL_VALUE(dirty);
+    list_node zeroed = LIST_INITIAL_VALUE(zeroed);
+    size_t count = 0;
+};
+
+static PmmCache pmm_caches[SMP_MAX_CPUS];
+
+static size_t pmm_free_to_arenas(list_node* list);
+
+// caches are only used once the cpu number can be trusted
+static bool pmm_caches_enabled;
+
+static bool pmm_use_cache(uint alloc_flags) {
+    // the caches hold pages from any arena
+    return pmm_caches_enabled && !(alloc_flags & PMM_ALLOC_FLAG_KMAP);
+}
+
+static PmmCache* pmm_current_cache() {
+    // if we migrate after this we just end up using another cpu's cache, which is
+    // fine since each cache has its own lock
+    return &pmm_caches[arch_curr_cpu_num()];
+}
+
+// take a cached page, preferring a zeroed one if |zeroed|
+static vm_page_t* pmm_cache_take_locked(PmmCache* cache, bool zeroed) {
+    list_node* first = zeroed ? &cache->zeroed : &cache->dirty;
+    list_node* second = zeroed ? &cache->dirty : &cache->zeroed;
+
+    vm_page_t* page = list_remove_head_type(first, vm_page_t, free.node);
+    if (!page)
+        page = list_remove_head_type(second, vm_page_t, free.node);
+    if (!page)
+        return nullptr;
+
+    DEBUG_ASSERT(page->state == VM_PAGE_STATE_CACHED);
+    DEBUG_ASSERT(cache->count > 0);
+    cache->count--;
+    atomic_add_u64(&cached_pages, -1ull);
+    page->state = VM_PAGE_STATE_ALLOC;
+    return page;
+}
+
+static void pmm_cache_put_locked(PmmCache* cache, vm_page_t* page) {
+    page->state = VM_PAGE_STATE_CACHED;
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        list_add_head(&cache->zeroed, &page->free.node);
+    } else {
+        list_add_head(&cache->dirty, &page->free.node);
+    }
+    cache->count++;
+    atomic_add_u64(&cached_pages, 1);
+}
+
+// move up to |count| of the coldest pages out of the cache onto |list|
+static void pmm_cache_remove_locked(PmmCache* cache, size_t count, list_node* list) {
+    while (count-- > 0) {
+        vm_page_t* page = list_remove_tail_type(&cache->dirty, vm_page_t, free.node);
+        if (!page)
+            page = list_remove_tail_type(&cache->zeroed, vm_page_t, free.node);
+        if (!page)
+            break;
+
+        DEBUG_ASSERT(cache->count > 0);
+        cache->count--;
+        atomic_add_u64(&cached_pages, -1ull);
+        list_add_tail(list, &page->free.node);
+    }
+}
+
+// Return every cached page to the arenas. Used when an allocation needs pages the
+// caches may be holding on to.
+static void pmm_drain_caches() {
+    list_node list = LIST_INITIAL_VALUE(list);
+    for (auto& cache : pmm_caches) {
+        AutoSpinLockIrqSave guard(cache.lock);
+        pmm_cache_remove_locked(&cache, cache.count, &list);
+    }
+    if (!list_is_empty(&list))
+        pmm_free_to_arenas(&list);
+}
+
+static void pmm_cache_init(uint level) {
+    pmm_caches_enabled = true;
+}
+LK_INIT_HOOK(pmm_cache, &pmm_cache_init, LK_INIT_LEVEL_VM);
+
+static void pmm_zero_pool_init(uint level) {
+    uint32_t target = cmdline_get_uint32("pmm.zero_pool_pages", PMM_ZERO_POOL_DEFAULT_PAGES);
+    if (target == 0)
+        return;
+
+    {
+        AutoLock al(&arena_lock);
+        zero_pool_target = target;
+    }
+
+    thread_t* t = thread_create("pmm zero", &pmm_zero_thread, nullptr, LOWEST_PRIORITY + 1,
+                                DEFAULT_STACK_SIZE);
+    DEBUG_ASSERT(t);
+    thread_detach_and_resume(t);
+}
+LK_INIT_HOOK(pmm_zero_pool, &pmm_zero_pool_init, LK_INIT_LEVEL_THREADING);
+
+static void pmm_reclaim_init(uint level) {
+    uint32_t watermark = cmdline_get_uint32("pmm.reclaim_watermark_pages",
+                                            PMM_RECLAIM_DEFAULT_WATERMARK_PAGES);
+    if (watermark == 0)
+        return;
+
+    {
+        AutoLock al(&arena_lock);
+        reclaim_watermark = watermark;
+    }
+
+    thread_t* t = thread_create("pmm reclaim", &pmm_reclaim_thread, nullptr, DEFAULT_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    DEBUG_ASSERT(t);
+    thread_detach_and_resume(t);
+}
+LK_INIT_HOOK(pmm_reclaim, &pmm_reclaim_init, LK_INIT_LEVEL_THREADING);
+
+static void pmm_mem_level_init(uint level) {
+    uint32_t warning = cmdline_get_uint32("pmm.low_mem_warning_pages",
+                                          PMM_LOW_MEM_DEFAULT_WARNING_PAGES);
+    uint32_t critical = cmdline_get_uint32("pmm.low_mem_critical_pages",
+                                           PMM_LOW_MEM_DEFAULT_CRITICAL_PAGES);
+    // warning is raised along with critical, so it can't be the lower of the two
+    if (critical > warning)
+        warning = critical;
+
+    {
+        AutoLock al(&arena_lock);
+        mem_level_watermarks[PMM_MEM_LEVEL_WARNING] = warning;
+        mem_level_watermarks[PMM_MEM_LEVEL_CRITICAL] = critical;
+        mem_level_update_locked(free_count_locked());
+    }
+
+    thread_t* t = thread_create("pmm mem level", &pmm_mem_level_thread, nullptr, HIGH_PRIORITY,
+                                DEFAULT_STACK_SIZE);
+    DEBUG_ASSERT(t);
+    thread_detach_and_resume(t);
+}
+LK_INIT_HOOK(pmm_mem_level, &pmm_mem_level_init, LK_INIT_LEVEL_THREADING);
+
 #if PMM_ENABLE_FREE_FILL
 static void pmm_enforce_fill(uint level) {
     for (auto& a : arena_list) {
@@ -75,7 +499,8 @@ status_t pmm_add_arena(const pmm_arena_info_t* info) TA_NO_THREAD_SAFETY_ANALYSI
 
     // Make sure we're in early boot (ints disabled and no active CPUs according
     // to the scheduler).
-    DEBUG_ASSERT(mp_get_active_mask() == 0);
+    __UNUSED mp_cpu_mask_t active = mp_get_active_mask();
+    DEBUG_ASSERT(mp_cpu_mask_is_empty(&active));
     DEBUG_ASSERT(arch_ints_disabled());
 
     DEBUG_ASSERT(IS_PAGE_ALIGNED(info->base));
@@ -105,25 +530,130 @@ done_add:
     return NO_ERROR;
 }
 
-vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+// Allocate up to count pages straight from the arenas onto the tail of list, without
+// finishing them.
+static size_t pmm_alloc_from_arenas(size_t count, uint alloc_flags, list_node* list) {
+    const bool zeroed = alloc_flags & PMM_ALLOC_FLAG_ZEROED;
+    size_t allocated = 0;
+
     AutoLock al(&arena_lock);
 
-    /* walk the arenas in order until we find one with a free page */
+    /* walk the arenas in order, allocating as many pages as we can from each */
     for (auto& a : arena_list) {
+        DEBUG_ASSERT(count > allocated);
+
         /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
         if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
             if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
                 continue;
         }
 
-        // try to allocate the page out of the arena
-        vm_page_t* page = a.AllocPage(pa);
-        if (page)
-            return page;
+        // ask the arena to allocate some pages
+        allocated += a.AllocPages(count - allocated, list, zeroed);
+        DEBUG_ASSERT(allocated <= count);
+        if (allocated == count)
+            break;
     }
 
-    LTRACEF("failed to allocate page\n");
-    return nullptr;
+    if (allocated > 0 && zeroed)
+        zero_pool_kick_locked();
+    arena_free_changed_locked();
+
+    return allocated;
+}
+
+// The arenas came up short, but other cpus' caches may still be holding free
+// pages, which pmm_count_free_pages() counts. Send those back and try again for
+// up to count more pages.
+static size_t pmm_drain_and_alloc(size_t count, uint alloc_flags, list_node* list) {
+    if (!pmm_caches_enabled)
+        return 0;
+
+    pmm_drain_caches();
+    return pmm_alloc_from_arenas(count, alloc_flags, list);
+}
+
+// Return pages to whichever arena they belong to. Pages coming out of a cache
+// keep their zeroed state.
+static size_t pmm_free_to_arenas(list_node* list) {
+    AutoLock al(&arena_lock);
+
+    size_t count = 0;
+    while (!list_is_empty(list)) {
+        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+
+        DEBUG_ASSERT(!page_is_free(page));
+
+        /* see which arena this page belongs to and add it */
+        for (auto& a : arena_list) {
+            if (!a.page_belongs_to_arena(page))
+                continue;
+
+            if (page->state == VM_PAGE_STATE_CACHED && (page->flags & VM_PAGE_FLAG_ZEROED)) {
+                a.FreeZeroedPage(page);
+            } else {
+                a.FreePage(page);
+            }
+            count++;
+            break;
+        }
+    }
+
+    if (count > 0) {
+        zero_pool_kick_locked();
+        arena_free_changed_locked();
+    }
+
+    return count;
+}
+
+vm_page_t* pmm_alloc_page(uint alloc_flags, paddr_t* pa) {
+    const bool zeroed = alloc_flags & PMM_ALLOC_FLAG_ZEROED;
+    vm_page_t* page = nullptr;
+
+    if (pmm_use_cache(alloc_flags)) {
+        PmmCache* cache = pmm_current_cache();
+        {
+            AutoSpinLockIrqSave guard(cache->lock);
+            page = pmm_cache_take_locked(cache, zeroed);
+        }
+
+        if (page) {
+            cache_free_changed();
+        } else {
+            // refill the cache with a batch from the arenas, keeping the first page
+            list_node list = LIST_INITIAL_VALUE(list);
+            if (pmm_alloc_from_arenas(PMM_CACHE_BATCH_PAGES, alloc_flags, &list) == 0)
+                pmm_drain_and_alloc(1, alloc_flags, &list);
+            page = list_remove_head_type(&list, vm_page_t, free.node);
+
+            if (!list_is_empty(&list)) {
+                {
+                    AutoSpinLockIrqSave guard(cache->lock);
+                    vm_page_t* p;
+                    while ((p = list_remove_head_type(&list, vm_page_t, free.node)))
+                        pmm_cache_put_locked(cache, p);
+                }
+                cache_free_changed();
+            }
+        }
+    } else {
+        list_node list = LIST_INITIAL_VALUE(list);
+        if (pmm_alloc_from_arenas(1, alloc_flags, &list) == 0)
+            pmm_drain_and_alloc(1, alloc_flags, &list);
+        page = list_remove_head_type(&list, vm_page_t, free.node);
+    }
+
+    if (!page) {
+        LTRACEF("failed to allocate page\n");
+        return nullptr;
+    }
+
+    if (pa)
+        *pa = vm_page_to_paddr(page);
+
+    pmm_finish_alloc(page, alloc_flags);
+    return page;
 }
 
 size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
@@ -135,24 +665,35 @@ size_t pmm_alloc_pages(size_t count, uint alloc_flags, struct list_node* list) {
     if (count == 0)
         return 0;
 
-    AutoLock al(&arena_lock);
-
-    /* walk the arenas in order, allocating as many pages as we can from each */
+    list_node alloc_list = LIST_INITIAL_VALUE(alloc_list);
     size_t allocated = 0;
-    for (auto& a : arena_list) {
-        DEBUG_ASSERT(count > allocated);
 
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
+    // small requests are served out of the cache as far as it goes
+    if (count <= PMM_CACHE_BATCH_PAGES && pmm_use_cache(alloc_flags)) {
+        PmmCache* cache = pmm_current_cache();
+        {
+            AutoSpinLockIrqSave guard(cache->lock);
+            const bool zeroed = alloc_flags & PMM_ALLOC_FLAG_ZEROED;
+            vm_page_t* page;
+            while (allocated < count && (page = pmm_cache_take_locked(cache, zeroed))) {
+                list_add_tail(&alloc_list, &page->free.node);
+                allocated++;
+            }
         }
+        if (allocated > 0)
+            cache_free_changed();
+    }
 
-        // ask the arena to allocate some pages
-        allocated += a.AllocPages(count - allocated, list);
-        DEBUG_ASSERT(allocated <= count);
-        if (allocated == count)
-            break;
+    if (allocated < count)
+        allocated += pmm_alloc_from_arenas(count - allocated, alloc_flags, &alloc_list);
+    if (allocated < count)
+        allocated += pmm_drain_and_alloc(count - allocated, alloc_flags, &alloc_list);
+
+    // finish the pages outside of the lock, moving them to the caller's list
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&alloc_list, vm_page_t, free.node))) {
+        pmm_finish_alloc(page, alloc_flags);
+        list_add_tail(list, &page->free.node);
     }
 
     return allocated;
@@ -167,6 +708,9 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
 
     address = ROUNDDOWN(address, PAGE_SIZE);
 
+    // the pages we want may be sitting in a cache
+    pmm_drain_caches();
+
     AutoLock al(&arena_lock);
 
     /* walk through the arenas, looking to see if the physical page belongs to it */
@@ -175,6 +719,7 @@ size_t pmm_alloc_range(paddr_t address, size_t count, struct list_node* list) {
             vm_page_t* page = a.AllocSpecific(address);
             if (!page)
                 break;
+            page->flags &= ~VM_PAGE_FLAG_ZEROED;
 
             if (list)
                 list_add_tail(list, &page->free.node);
@@ -199,24 +744,43 @@ size_t pmm_alloc_contiguous(size_t count, uint alloc_flags, uint8_t alignment_lo
     if (alignment_log2 < PAGE_SIZE_SHIFT)
         alignment_log2 = PAGE_SIZE_SHIFT;
 
-    AutoLock al(&arena_lock);
+    paddr_t run_pa;
+    size_t allocated = 0;
+    for (int attempt = 0; attempt < 2 && allocated == 0; attempt++) {
+        // on the second try, pull back the pages held by the caches, which may
+        // be breaking up a run
+        if (attempt > 0)
+            pmm_drain_caches();
 
-    for (auto& a : arena_list) {
-        /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
-        if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
-            if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
-                continue;
-        }
+        AutoLock al(&arena_lock);
+
+        for (auto& a : arena_list) {
+            /* skip the arena if it's not KMAP and the KMAP only allocation flag was passed */
+            if (alloc_flags & PMM_ALLOC_FLAG_KMAP) {
+                if ((a.flags() & PMM_ARENA_FLAG_KMAP) == 0)
+                    continue;
+            }
 
-        size_t allocated = a.AllocContiguous(count, alignment_log2, pa, list);
-        if (allocated > 0) {
-            DEBUG_ASSERT(allocated == count);
-            return allocated;
+            allocated = a.AllocContiguous(count, alignment_log2, &run_pa, list);
+            if (allocated > 0) {
+                DEBUG_ASSERT(allocated == count);
+                break;
+            }
         }
     }
 
-    LTRACEF("couldn't find run\n");
-    return 0;
+    if (allocated == 0) {
+        LTRACEF("couldn't find run\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < allocated; i++) {
+        pmm_finish_alloc(paddr_to_vm_page(run_pa + i * PAGE_SIZE), alloc_flags);
+    }
+
+    if (pa)
+        *pa = run_pa;
+    return allocated;
 }
 
 /* physically allocate a run from arenas marked as KMAP */
@@ -293,24 +857,38 @@ size_t pmm_free(struct list_node* list) {
 
     DEBUG_ASSERT(list);
 
-    AutoLock al(&arena_lock);
+    size_t count = 0;
+    list_node drain_list = LIST_INITIAL_VALUE(drain_list);
 
-    uint count = 0;
-    while (!list_is_empty(list)) {
-        vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+    // stash as many pages as fit in the local cache, and if that pushes it over its
+    // limit hand a batch of the coldest pages back to the arenas
+    if (pmm_use_cache(PMM_ALLOC_FLAG_ANY)) {
+        PmmCache* cache = pmm_current_cache();
+        AutoSpinLockIrqSave guard(cache->lock);
+        while (cache->count < PMM_CACHE_MAX_PAGES) {
+            vm_page_t* page = list_remove_head_type(list, vm_page_t, free.node);
+            if (!page)
+                break;
 
-        DEBUG_ASSERT(!page_is_free(page));
+            DEBUG_ASSERT(!page_is_free(page));
+            DEBUG_ASSERT(page->state != VM_PAGE_STATE_CACHED);
 
-        /* see which arena this page belongs to and add it */
-        for (auto& a : arena_list) {
-            if (a.FreePage(page) >= 0) {
-                count++;
-                break;
-            }
+            page->flags &= ~VM_PAGE_FLAG_ZEROED;
+            pmm_cache_put_locked(cache, page);
+            count++;
         }
+        if (cache->count >= PMM_CACHE_MAX_PAGES)
+            pmm_cache_remove_locked(cache, PMM_CACHE_BATCH_PAGES, &drain_list);
     }
+    if (count > 0)
+        cache_free_changed();
 
-    LTRACEF("returning count %u\n", count);
+    if (!list_is_empty(list))
+        count += pmm_free_to_arenas(list);
+    if (!list_is_empty(&drain_list))
+        pmm_free_to_arenas(&drain_list);
+
+    LTRACEF("returning count %zu\n", count);
 
     return count;
 }
@@ -335,6 +913,11 @@ void pmm_dump_free() TA_REQ(arena_lock) {
 
 size_t pmm_count_free_pages() {
     size_t free = 0u;
+    for (auto& cache : pmm_caches) {
+        AutoSpinLockIrqSave guard(cache.lock);
+        free += cache.count;
+    }
+
     AutoLock al(&arena_lock);
     for (const auto& a : arena_list) {
         free += a.free_count();
@@ -342,6 +925,29 @@ size_t pmm_count_free_pages() {
     return free;
 }
 
+void pmm_set_mem_level_callback(pmm_mem_level_callback_t callback) {
+    AutoLock al(&arena_lock);
+    mem_level_callback = callback;
+
+    // let the new callback hear about the level we're already at
+    event_signal(&mem_level_event, false);
+}
+
+pmm_mem_level_t pmm_get_mem_level() {
+    AutoLock al(&arena_lock);
+    return mem_level;
+}
+
+void pmm_get_zero_pool_stats(pmm_zero_pool_stats_t* stats) {
+    {
+        AutoLock al(&arena_lock);
+        stats->pages = zero_pool_count_locked();
+        stats->target = zero_pool_target;
+    }
+    stats->hits = atomic_load_u64(&zero_pool_hits);
+    stats->misses = atomic_load_u64(&zero_pool_misses);
+}
+
 size_t pmm_count_total_bytes() TA_REQ(arena_lock) {
     return arena_cumulative_size;
 }
@@ -374,6 +980,9 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
         printf("usage:\n");
         printf("%s arenas\n", argv[0].str);
         if (!is_panic) {
+            printf("%s zero_pool\n", argv[0].str);
+            printf("%s reclaim <count>\n", argv[0].str);
+            printf("%s mem_level\n", argv[0].str);
             printf("%s alloc <count>\n", argv[0].str);
             printf("%s alloc_range <address> <count>\n", argv[0].str);
             printf("%s alloc_kpages <count>\n", argv[0].str);
@@ -393,6 +1002,27 @@ static int cmd_pmm(int argc, const cmd_args* argv, uint32_t flags) {
         // No other operations will work during a panic.
         printf("Only the \"arenas\" command is available during a panic.\n");
         goto usage;
+    } else if (!strcmp(argv[1].str, "zero_pool")) {
+        pmm_zero_pool_stats_t stats;
+        pmm_get_zero_pool_stats(&stats);
+        printf("zero pool: %zu/%zu pages, %" PRIu64 " hits, %" PRIu64 " misses\n",
+               stats.pages, stats.target, stats.hits, stats.misses);
+    } else if (!strcmp(argv[1].str, "reclaim")) {
+        if (argc < 3)
+            goto notenoughargs;
+
+        size_t count = vm_reclaim_pages((size_t)argv[2].u);
+        printf("reclaimed %zu pages, %zu free\n", count, pmm_count_free_pages());
+    } else if (!strcmp(argv[1].str, "mem_level")) {
+        static const char* const names[] = {"normal", "warning", "critical"};
+        size_t warning, critical;
+        {
+            AutoLock al(&arena_lock);
+            warning = mem_level_watermarks[PMM_MEM_LEVEL_WARNING];
+            critical = mem_level_watermarks[PMM_MEM_LEVEL_CRITICAL];
+        }
+        printf("memory level %s, %zu free, watermarks warning %zu critical %zu pages\n",
+               names[pmm_get_mem_level()], pmm_count_free_pages(), warning, critical);
     } else if (!strcmp(argv[1].str, "free")) {
         static bool show_mem = false;
         static timer_t timer;
@@ -9,13 +9,18 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <pow2.h>
 #include <string.h>
 #include <trace.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
 PmmArena::PmmArena(const pmm_arena_info_t* info)
-    : info_(info) {}
+    : info_(info) {
+    for (auto& list : free_lists_) {
+        list_initialize(&list);
+    }
+}
 
 PmmArena::~PmmArena() {}
 
@@ -23,9 +28,9 @@ PmmArena::~PmmArena() {}
 void PmmArena::EnforceFill() {
     DEBUG_ASSERT(!enforce_fill_);
 
-    vm_page_t* page;
-    list_for_every_entry (&free_list_, page, vm_page_t, free.node) {
-        FreeFill(page);
+    for (size_t i = 0; i < page_count(); i++) {
+        if (page_is_free(&page_array_[i]))
+            FreeFill(&page_array_[i]);
     }
 
     enforce_fill_ = true;
@@ -38,6 +43,10 @@ void PmmArena::FreeFill(vm_page_t* page) {
 }
 
 void PmmArena::CheckFreeFill(vm_page_t* page) {
+    // zeroed pages have been overwritten since they were freed
+    if (page->flags & VM_PAGE_FLAG_ZEROED)
+        return;
+
     paddr_t paddr = page_address_from_arena(page);
     uint8_t* kvaddr = static_cast<uint8_t*>(paddr_to_kvaddr(paddr));
     for (size_t j = 0; j < PAGE_SIZE; ++j) {
@@ -59,32 +68,195 @@ void PmmArena::BootAllocArray() {
 
     page_array_ = (vm_page_t*)raw_page_array;
 
-    /* add them to the free list */
-    for (size_t i = 0; i < page_count; i++) {
-        auto& p = page_array_[i];
+    /* every page starts out free, carve them into blocks */
+    free_count_ += page_count;
+    FreeRange(0, page_count);
+}
 
-        list_add_tail(&free_list_, &p.free.node);
-    }
+bool PmmArena::FindBuddy(size_t index, uint order, size_t* buddy) const {
+    // buddies are paired on their physical page number, not their index into the arena,
+    // so that blocks are physically aligned even if the arena isn't
+    const paddr_t base_pfn = base() / PAGE_SIZE;
+    const paddr_t buddy_pfn = (base_pfn + index) ^ (1ul << order);
 
-    free_count_ += page_count;
+    if (buddy_pfn < base_pfn || buddy_pfn - base_pfn + (1ul << order) > page_count())
+        return false;
+
+    *buddy = buddy_pfn - base_pfn;
+    return true;
 }
 
-vm_page_t* PmmArena::AllocPage(paddr_t* pa) {
-    vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
-    if (!page)
+void PmmArena::PushBlock(size_t index, uint order) {
+    DEBUG_ASSERT(order <= PMM_MAX_ORDER);
+    DEBUG_ASSERT(index + (1ul << order) <= page_count());
+
+    vm_page_t* head = &page_array_[index];
+    DEBUG_ASSERT(page_is_free(head));
+    DEBUG_ASSERT(!(head->flags & (VM_PAGE_FLAG_FREE_BLOCK | VM_PAGE_FLAG_ZEROED)));
+
+    head->flags |= VM_PAGE_FLAG_FREE_BLOCK;
+    head->free.order = static_cast<uint8_t>(order);
+    list_add_head(&free_lists_[order], &head->free.node);
+}
+
+void PmmArena::PopBlock(vm_page_t* head) {
+    DEBUG_ASSERT(page_is_free(head));
+    DEBUG_ASSERT(head->flags & VM_PAGE_FLAG_FREE_BLOCK);
+
+    list_delete(&head->free.node);
+    head->flags &= ~VM_PAGE_FLAG_FREE_BLOCK;
+}
+
+vm_page_t* PmmArena::AllocBlock(uint order) {
+    /* find the smallest block that is big enough */
+    uint block_order = order;
+    vm_page_t* head = nullptr;
+    for (; block_order <= PMM_MAX_ORDER; block_order++) {
+        head = list_peek_head_type(&free_lists_[block_order], vm_page_t, free.node);
+        if (head)
+            break;
+    }
+    if (!head)
         return nullptr;
 
-    DEBUG_ASSERT(free_count_ > 0);
+    PopBlock(head);
 
-    free_count_--;
+    /* split it down to size, giving back the upper halves */
+    size_t index = page_index(head);
+    while (block_order > order) {
+        block_order--;
+        PushBlock(index + (1ul << block_order), block_order);
+    }
+
+    return head;
+}
+
+void PmmArena::FreeRange(size_t index, size_t count) {
+    const paddr_t base_pfn = base() / PAGE_SIZE;
+
+    while (count > 0) {
+        /* take the largest aligned block at the start of the range */
+        uint order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               (((base_pfn + index) & ((1ul << order) - 1)) != 0 || (1ul << order) > count)) {
+            order--;
+        }
+        const size_t block_pages = 1ul << order;
+
+        /* merge it with its buddy for as long as the buddy is a free block of the same size */
+        size_t block = index;
+        uint block_order = order;
+        while (block_order < PMM_MAX_ORDER) {
+            size_t buddy;
+            if (!FindBuddy(block, block_order, &buddy))
+                break;
+
+            vm_page_t* buddy_page = &page_array_[buddy];
+            if (!page_is_free(buddy_page) || !(buddy_page->flags & VM_PAGE_FLAG_FREE_BLOCK) ||
+                buddy_page->free.order != block_order)
+                break;
+
+            PopBlock(buddy_page);
+            block = MIN(block, buddy);
+            block_order++;
+        }
+        PushBlock(block, block_order);
 
+        index += block_pages;
+        count -= block_pages;
+    }
+}
+
+void PmmArena::ReleaseZeroedPages() {
+    vm_page_t* page;
+    while ((page = list_remove_head_type(&zeroed_free_list_, vm_page_t, free.node))) {
+        DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_ZEROED);
+        page->flags &= ~VM_PAGE_FLAG_ZEROED;
+        DEBUG_ASSERT(zeroed_count_ > 0);
+        zeroed_count_--;
+
+        FreeRange(page_index(page), 1);
+    }
+}
+
+void PmmArena::MarkAllocated(vm_page_t* page) {
     DEBUG_ASSERT(page_is_free(page));
+    DEBUG_ASSERT(!(page->flags & VM_PAGE_FLAG_FREE_BLOCK));
+
+    DEBUG_ASSERT(free_count_ > 0);
+    free_count_--;
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        DEBUG_ASSERT(zeroed_count_ > 0);
+        zeroed_count_--;
+    }
 
-    page->state = VM_PAGE_STATE_ALLOC;
 #if PMM_ENABLE_FREE_FILL
     CheckFreeFill(page);
 #endif
 
+    page->state = VM_PAGE_STATE_ALLOC;
+}
+
+void PmmArena::RemoveFreePage(vm_page_t* page) {
+    DEBUG_ASSERT(page_is_free(page));
+
+    if (page->flags & VM_PAGE_FLAG_ZEROED) {
+        /* zeroed pages are on their own list, outside of any block */
+        DEBUG_ASSERT(list_in_list(&page->free.node));
+        list_delete(&page->free.node);
+        MarkAllocated(page);
+        return;
+    }
+
+    /* find the block this page is in, trying each aligned block start that could contain it */
+    const paddr_t base_pfn = base() / PAGE_SIZE;
+    const paddr_t pfn = base_pfn + page_index(page);
+    vm_page_t* head = nullptr;
+    for (uint order = 0; order <= PMM_MAX_ORDER; order++) {
+        paddr_t head_pfn = pfn & ~((1ul << order) - 1);
+        if (head_pfn < base_pfn)
+            break;
+
+        vm_page_t* p = &page_array_[head_pfn - base_pfn];
+        if ((p->flags & VM_PAGE_FLAG_FREE_BLOCK) && p->free.order >= order) {
+            head = p;
+            break;
+        }
+    }
+    ASSERT(head);
+
+    /* split the block, giving back every half that doesn't contain the page */
+    PopBlock(head);
+    size_t index = page_index(head);
+    uint order = head->free.order;
+    while (order > 0) {
+        order--;
+        size_t half = 1ul << order;
+        if (page_index(page) < index + half) {
+            PushBlock(index + half, order);
+        } else {
+            PushBlock(index, order);
+            index += half;
+        }
+    }
+    DEBUG_ASSERT(index == page_index(page));
+
+    MarkAllocated(page);
+}
+
+vm_page_t* PmmArena::AllocPage(paddr_t* pa, bool prefer_zeroed) {
+    vm_page_t* page = nullptr;
+    if (prefer_zeroed)
+        page = list_remove_head_type(&zeroed_free_list_, vm_page_t, free.node);
+    if (!page)
+        page = AllocBlock(0);
+    if (!page)
+        page = list_remove_head_type(&zeroed_free_list_, vm_page_t, free.node);
+    if (!page)
+        return nullptr;
+
+    MarkAllocated(page);
+
     if (pa) {
         /* compute the physical address of the page based on its offset into the arena */
         *pa = page_address_from_arena(page);
@@ -110,37 +282,19 @@ vm_page_t* PmmArena::AllocSpecific(paddr_t pa) {
         return nullptr;
     }
 
-    list_delete(&page->free.node);
-
-    page->state = VM_PAGE_STATE_ALLOC;
-
-    DEBUG_ASSERT(free_count_ > 0);
-
-    free_count_--;
+    RemoveFreePage(page);
 
     return page;
 }
 
-size_t PmmArena::AllocPages(size_t count, list_node* list) {
+size_t PmmArena::AllocPages(size_t count, list_node* list, bool prefer_zeroed) {
     size_t allocated = 0;
 
     while (allocated < count) {
-        vm_page_t* page = list_remove_head_type(&free_list_, vm_page_t, free.node);
+        vm_page_t* page = AllocPage(nullptr, prefer_zeroed);
         if (!page)
             return allocated;
 
-        LTRACEF("allocating page %p, pa %#" PRIxPTR "\n", page, page_address_from_arena(page));
-
-        DEBUG_ASSERT(free_count_ > 0);
-
-        free_count_--;
-
-        DEBUG_ASSERT(page_is_free(page));
-#if PMM_ENABLE_FREE_FILL
-        CheckFreeFill(page);
-#endif
-
-        page->state = VM_PAGE_STATE_ALLOC;
         list_add_tail(list, &page->free.node);
 
         allocated++;
@@ -150,6 +304,49 @@ size_t PmmArena::AllocPages(size_t count, list_node* list) {
 }
 
 size_t PmmArena::AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list) {
+    /* a free block of the right order is both big enough and aligned */
+    uint order = log2_ulong_ceil(count);
+    if (alignment_log2 > PAGE_SIZE_SHIFT)
+        order = MAX(order, static_cast<uint>(alignment_log2 - PAGE_SIZE_SHIFT));
+
+    vm_page_t* head = nullptr;
+    if (order <= PMM_MAX_ORDER) {
+        head = AllocBlock(order);
+        if (!head && zeroed_count_ > 0) {
+            /* the zeroed pages may be keeping blocks from merging */
+            ReleaseZeroedPages();
+            head = AllocBlock(order);
+        }
+    }
+
+    if (!head) {
+        /* too big for a block, or no block was free. a suitable run may still exist
+         * across blocks, so fall back to searching for it */
+        return AllocContiguousScan(count, alignment_log2, pa, list);
+    }
+
+    size_t index = page_index(head);
+    LTRACEF("found block of order %u at pn %zu\n", order, index);
+
+    for (size_t i = index; i < index + count; i++) {
+        vm_page_t* p = &page_array_[i];
+        MarkAllocated(p);
+
+        if (list)
+            list_add_tail(list, &p->free.node);
+    }
+
+    /* give back the unused tail of the block */
+    FreeRange(index + count, (1ul << order) - count);
+
+    if (pa)
+        *pa = base() + index * PAGE_SIZE;
+
+    return count;
+}
+
+size_t PmmArena::AllocContiguousScan(size_t count, uint8_t alignment_log2, paddr_t* pa,
+                                     struct list_node* list) {
     /* walk the list starting at alignment boundaries.
      * calculate the starting offset into this arena, based on the
      * base address of the arena to handle the case where the arena
@@ -184,22 +381,10 @@ retry:
         /* we found a run */
         LTRACEF("found run from pn %" PRIuPTR " to %" PRIuPTR "\n", start, start + count);
 
-        /* remove the pages from the run out of the free list */
+        /* remove the pages from the run out of the free lists */
         for (paddr_t i = start; i < start + count; i++) {
             p = &page_array_[i];
-            DEBUG_ASSERT(page_is_free(p));
-            DEBUG_ASSERT(list_in_list(&p->free.node));
-
-            list_delete(&p->free.node);
-            p->state = VM_PAGE_STATE_ALLOC;
-
-            DEBUG_ASSERT(free_count_ > 0);
-
-            free_count_--;
-
-#if PMM_ENABLE_FREE_FILL
-            CheckFreeFill(p);
-#endif
+            RemoveFreePage(p);
 
             if (list)
                 list_add_tail(list, &p->free.node);
@@ -224,16 +409,53 @@ status_t PmmArena::FreePage(vm_page_t* page) {
 #endif
 
     page->state = VM_PAGE_STATE_FREE;
+    page->flags &= ~VM_PAGE_FLAG_ZEROED;
 
-    list_add_head(&free_list_, &page->free.node);
     free_count_++;
+    FreeRange(page_index(page), 1);
     return NO_ERROR;
 }
 
+vm_page_t* PmmArena::AllocPageToZero() {
+    // the tail of the single page list was freed longest ago, and is least likely to be
+    // cache hot
+    vm_page_t* page = list_peek_tail_type(&free_lists_[0], vm_page_t, free.node);
+    if (page) {
+        PopBlock(page);
+    } else {
+        page = AllocBlock(0);
+        if (!page)
+            return nullptr;
+    }
+
+    MarkAllocated(page);
+
+    return page;
+}
+
+void PmmArena::FreeZeroedPage(vm_page_t* page) {
+    DEBUG_ASSERT(page_belongs_to_arena(page));
+    DEBUG_ASSERT(!page_is_free(page));
+
+    page->state = VM_PAGE_STATE_FREE;
+    page->flags |= VM_PAGE_FLAG_ZEROED;
+
+    list_add_head(&zeroed_free_list_, &page->free.node);
+    free_count_++;
+    zeroed_count_++;
+}
+
 void PmmArena::Dump(bool dump_pages, bool dump_free_ranges) {
     printf("arena %p: name '%s' base %#" PRIxPTR " size 0x%zx priority %u flags 0x%x\n", this, name(), base(),
            size(), priority(), flags());
-    printf("\tpage_array %p, free_count %zu\n", page_array_, free_count_);
+    printf("\tpage_array %p, free_count %zu, zeroed_count %zu\n", page_array_, free_count_,
+           zeroed_count_);
+
+    printf("\tfree blocks by order:");
+    for (uint order = 0; order <= PMM_MAX_ORDER; order++) {
+        printf(" %zu", list_length(&free_lists_[order]));
+    }
+    printf("\n");
 
     /* dump all of the pages */
     if (dump_pages) {
@@ -14,6 +14,11 @@
 #define PMM_ENABLE_FREE_FILL 0
 #define PMM_FREE_FILL_BYTE 0x42
 
+// Free pages are kept in naturally aligned blocks of 2^order pages, up to this order.
+// Blocks are aligned on their physical address, so a block of a given order also
+// satisfies any alignment up to its size.
+#define PMM_MAX_ORDER 10
+
 class PmmArena : public mxtl::DoublyLinkedListable<PmmArena*> {
 public:
     PmmArena(const pmm_arena_info_t* info);
@@ -38,16 +43,32 @@ public:
     unsigned int flags() const { return info_->flags; }
     unsigned int priority() const { return info_->priority; }
     size_t free_count() const { return free_count_; };
+    size_t zeroed_count() const { return zeroed_count_; }
 
     vm_page_t* get_page(size_t index) { return &page_array_[index]; }
 
     // main allocation routines
-    vm_page_t* AllocPage(paddr_t* pa);
+    // Free pages are tracked with a buddy allocator: a free block is on the free list for
+    // its order, and is merged with its buddy when both are free. Only the first page of a
+    // block is on a list and has VM_PAGE_FLAG_FREE_BLOCK set, though every page in it is in
+    // VM_PAGE_STATE_FREE.
+    //
+    // Free pages that are known to be zeroed are kept out of the buddy blocks, on a separate
+    // list of single pages. AllocPage() and
+    // AllocPages() take from that list first if |prefer_zeroed| is set, and last otherwise.
+    // Allocated pages keep VM_PAGE_FLAG_ZEROED if they came off the zeroed list; the caller
+    // is responsible for clearing it.
+    vm_page_t* AllocPage(paddr_t* pa, bool prefer_zeroed);
     vm_page_t* AllocSpecific(paddr_t pa);
-    size_t AllocPages(size_t count, list_node* list);
+    size_t AllocPages(size_t count, list_node* list, bool prefer_zeroed);
     size_t AllocContiguous(size_t count, uint8_t alignment_log2, paddr_t* pa, struct list_node* list);
     status_t FreePage(vm_page_t* page);
 
+    // take the least recently freed page that is not known to be zeroed, for the caller
+    // to zero and hand back with FreeZeroedPage()
+    vm_page_t* AllocPageToZero();
+    void FreeZeroedPage(vm_page_t* page);
+
     // helpers
     bool page_belongs_to_arena(const vm_page* page) const {
         uintptr_t page_addr = reinterpret_cast<uintptr_t>(page);
@@ -74,11 +95,33 @@ private:
     void CheckFreeFill(vm_page_t* page);
 #endif
 
+    // remove a page from whichever free list or block it is on and mark it allocated
+    void RemoveFreePage(vm_page_t* page);
+    // account for a page that has been taken off the free lists
+    void MarkAllocated(vm_page_t* page);
+
+    // buddy block helpers, working on page indices into the arena
+    size_t page_count() const { return size() / PAGE_SIZE; }
+    size_t page_index(const vm_page_t* page) const { return page - page_array_; }
+    bool FindBuddy(size_t index, uint order, size_t* buddy) const;
+    void PushBlock(size_t index, uint order);
+    void PopBlock(vm_page_t* head);
+    vm_page_t* AllocBlock(uint order);
+    // add the already accounted for pages [index, index + count) to the buddy lists
+    void FreeRange(size_t index, size_t count);
+    // move the zeroed pages back into the buddy lists so they can be merged
+    void ReleaseZeroedPages();
+    size_t AllocContiguousScan(size_t count, uint8_t alignment_log2, paddr_t* pa,
+                               struct list_node* list);
+
     const pmm_arena_info_t* info_ = nullptr;
     vm_page_t* page_array_ = nullptr;
 
+    // free_count_ includes the zeroed pages
     size_t free_count_ = 0;
-    list_node free_list_ = LIST_INITIAL_VALUE(free_list_);
+    list_node free_lists_[PMM_MAX_ORDER + 1];
+    size_t zeroed_count_ = 0;
+    list_node zeroed_free_list_ = LIST_INITIAL_VALUE(zeroed_free_list_);
 
 #if PMM_ENABLE_FREE_FILL
     bool enforce_fill_ = false;
@@ -28,6 +28,7 @@ MODULE_SRCS += \
     $(LOCAL_DIR)/vm_object_paged.cpp \
     $(LOCAL_DIR)/vm_object_physical.cpp \
     $(LOCAL_DIR)/vm_page_list.cpp \
+    $(LOCAL_DIR)/vm_page_source.cpp \
     $(LOCAL_DIR)/vm_unittest.cpp \
     $(LOCAL_DIR)/vmm.cpp \
 
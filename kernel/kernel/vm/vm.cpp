@@ -14,6 +14,7 @@
 #include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
+#include <kernel/vm/vm_object_paged.h>
 #include <lib/console.h>
 #include <lk/init.h>
 #include <string.h>
@@ -288,6 +289,7 @@ static int cmd_vm(int argc, const cmd_args* argv, uint32_t flags) {
         printf("%s virt2phys <address>\n", argv[0].str);
         printf("%s map <phys> <virt> <count> <flags>\n", argv[0].str);
         printf("%s unmap <virt> <count>\n", argv[0].str);
+        printf("%s clones\n", argv[0].str);
         return ERR_INTERNAL;
     }
 
@@ -347,6 +349,9 @@ static int cmd_vm(int argc, const cmd_args* argv, uint32_t flags) {
         size_t unmapped;
         auto err = arch_mmu_unmap(&aspace->arch_aspace(), argv[2].u, (uint)argv[3].u, &unmapped);
         printf("arch_mmu_unmap returns %d, unmapped %zu\n", err, unmapped);
+    } else if (!strcmp(argv[1].str, "clones")) {
+        printf("max clone chain depth %" PRIu64 ", collapsed clones %" PRIu64 "\n",
+               VmObjectPaged::max_clone_chain_depth(), VmObjectPaged::collapsed_clone_count());
     } else {
         printf("unknown command\n");
         goto usage;
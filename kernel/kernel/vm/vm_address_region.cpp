@@ -79,7 +79,7 @@ status_t VmAddressRegion::CreateSubVmarInternal(size_t offset, size_t size, uint
                                                 mxtl::RefPtr<VmAddressRegionOrMapping>* out) {
     DEBUG_ASSERT(out);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -233,7 +233,7 @@ status_t VmAddressRegion::OverwriteVmMapping(vaddr_t base, size_t size, uint32_t
                                              uint arch_mmu_flags, const char* name,
                                              mxtl::RefPtr<VmAddressRegionOrMapping>* out) {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     DEBUG_ASSERT(vmo);
     DEBUG_ASSERT(vmar_flags & VMAR_FLAG_SPECIFIC_OVERWRITE);
 
@@ -258,7 +258,7 @@ status_t VmAddressRegion::OverwriteVmMapping(vaddr_t base, size_t size, uint32_t
 
 status_t VmAddressRegion::DestroyLocked() {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     LTRACEF("%p '%s'\n", this, name_);
 
     // Take a reference to ourself, so that we do not get destructed after
@@ -293,7 +293,7 @@ void VmAddressRegion::RemoveSubregion(VmAddressRegionOrMapping* region) {
 }
 
 mxtl::RefPtr<VmAddressRegionOrMapping> VmAddressRegion::FindRegion(vaddr_t addr) {
-    AutoLock guard(aspace_->lock());
+    AutoReadLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return nullptr;
     }
@@ -315,7 +315,7 @@ mxtl::RefPtr<VmAddressRegionOrMapping> VmAddressRegion::FindRegionLocked(vaddr_t
 
 size_t VmAddressRegion::AllocatedPagesLocked() const {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_held(aspace_->lock()));
 
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
@@ -328,9 +328,10 @@ size_t VmAddressRegion::AllocatedPagesLocked() const {
     return sum;
 }
 
-status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
+status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags,
+                                    mxtl::RefPtr<VmPageRequest>* page_request) {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_held(aspace_->lock()));
 
     mxtl::RefPtr<VmAddressRegion> vmar(this);
     while (1) {
@@ -340,7 +341,7 @@ status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
         }
 
         if (next->is_mapping()) {
-            return next->PageFault(va, pf_flags);
+            return next->PageFault(va, pf_flags, page_request);
         }
 
         vmar = next->as_vm_address_region();
@@ -348,7 +349,7 @@ status_t VmAddressRegion::PageFault(vaddr_t va, uint pf_flags) {
 }
 
 bool VmAddressRegion::IsRangeAvailableLocked(vaddr_t base, size_t size) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     DEBUG_ASSERT(size > 0);
 
     // Find the first region with base > *base*.  Since subregions_ has no
@@ -380,7 +381,7 @@ bool VmAddressRegion::CheckGapLocked(const ChildList::iterator& prev,
                                      const ChildList::iterator& next,
                                      vaddr_t* pva, vaddr_t search_base, vaddr_t align,
                                      size_t region_size, size_t min_gap, uint arch_mmu_flags) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
 
     safeint::CheckedNumeric<vaddr_t> gap_beg; // first byte of a gap
     safeint::CheckedNumeric<vaddr_t> gap_end; // last byte of a gap
@@ -467,7 +468,7 @@ status_t VmAddressRegion::AllocSpotLocked(size_t size, uint8_t align_pow2, uint
                                           vaddr_t* spot) {
     DEBUG_ASSERT(magic_ == kMagic);
     DEBUG_ASSERT(size > 0 && IS_PAGE_ALIGNED(size));
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
 
     LTRACEF_LEVEL(2, "aspace %p size 0x%zx align %hhu\n", this, size,
                   align_pow2);
@@ -486,7 +487,7 @@ status_t VmAddressRegion::AllocSpotLocked(size_t size, uint8_t align_pow2, uint
 bool VmAddressRegion::EnumerateChildrenLocked(VmEnumerator* ve, uint depth) {
     DEBUG_ASSERT(magic_ == kMagic);
     DEBUG_ASSERT(ve != nullptr);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_held(aspace_->lock()));
     for (auto& child : subregions_) {
         DEBUG_ASSERT(child.IsAliveLocked());
         if (child.is_mapping()) {
@@ -523,7 +524,7 @@ void VmAddressRegion::Dump(uint depth, bool verbose) const {
 
 void VmAddressRegion::Activate() {
     DEBUG_ASSERT(state_ == LifeCycleState::NOT_READY);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
 
     state_ = LifeCycleState::ALIVE;
     parent_->subregions_.insert(mxtl::RefPtr<VmAddressRegionOrMapping>(this));
@@ -538,7 +539,7 @@ status_t VmAddressRegion::Unmap(vaddr_t base, size_t size) {
 
     size = ROUNDUP(size, PAGE_SIZE);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -547,7 +548,7 @@ status_t VmAddressRegion::Unmap(vaddr_t base, size_t size) {
 }
 
 status_t VmAddressRegion::UnmapInternalLocked(vaddr_t base, size_t size, bool can_destroy_regions) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
 
     if (!is_in_range(base, size)) {
         return ERR_INVALID_ARGS;
@@ -625,7 +626,7 @@ status_t VmAddressRegion::Protect(vaddr_t base, size_t size, uint new_arch_mmu_f
 
     size = ROUNDUP(size, PAGE_SIZE);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -696,7 +697,7 @@ status_t VmAddressRegion::Protect(vaddr_t base, size_t size, uint new_arch_mmu_f
 
 status_t VmAddressRegion::LinearRegionAllocatorLocked(size_t size, uint8_t align_pow2,
                                                      uint arch_mmu_flags, vaddr_t* spot) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
 
     const vaddr_t base = 0;
 
@@ -705,26 +706,75 @@ status_t VmAddressRegion::LinearRegionAllocatorLocked(size_t size, uint8_t align
     const vaddr_t align = 1UL << align_pow2;
 
     // Find the first gap in the address space which can contain a region of the
-    // requested size.
-    auto before_iter = subregions_.end();
-    auto after_iter = subregions_.begin();
+    // requested size.  Only gaps at least that big are considered at all.
+    bool stopped = false;
+    auto check_gap = [&](const ChildList::iterator& prev, const ChildList::iterator& next) -> bool {
+        stopped = CheckGapLocked(prev, next, spot, base, align, size, 0, arch_mmu_flags);
+        return !stopped;
+    };
 
-    do {
-        if (CheckGapLocked(before_iter, after_iter, spot, base, align, size, 0, arch_mmu_flags)) {
-            if (*spot != static_cast<vaddr_t>(-1)) {
-                return NO_ERROR;
-            } else {
-                return ERR_NO_MEMORY;
-            }
-        }
+    auto root = subregions_.root();
+    if (root.IsValid())
+        ForEachLargeGapLocked(root, subregions_.end(), size, check_gap);
+
+    // then the gap after the last child
+    if (!stopped) {
+        auto last = subregions_.is_empty() ? subregions_.end() : --subregions_.end();
+        check_gap(last, subregions_.end());
+    }
 
-        before_iter = after_iter++;
-    } while (before_iter.IsValid());
+    if (stopped && *spot != static_cast<vaddr_t>(-1)) {
+        return NO_ERROR;
+    }
 
     // couldn't find anything
     return ERR_NO_MEMORY;
 }
 
+template <typename F>
+bool VmAddressRegion::ForEachLargeGapLocked(const ChildList::iterator& node,
+                                            const ChildList::iterator& prev,
+                                            size_t min_size, F& func) {
+    DEBUG_ASSERT(node.IsValid());
+
+    // the end of whatever comes before this subtree
+    const vaddr_t prev_end = prev.IsValid() ? prev->base() + prev->size() : base_;
+
+    // the gaps to the left of node, including the one right before it
+    auto left = node.left();
+    if (left.IsValid()) {
+        if (left->subtree_max_gap_ >= min_size || left->subtree_first_base_ - prev_end >= min_size) {
+            if (!ForEachLargeGapLocked(left, prev, min_size, func)) {
+                return false;
+            }
+        }
+        if (node->base() - left->subtree_last_byte_ - 1 >= min_size) {
+            auto before = node;
+            --before;
+            if (!func(before, node)) {
+                return false;
+            }
+        }
+    } else if (node->base() - prev_end >= min_size) {
+        if (!func(prev, node)) {
+            return false;
+        }
+    }
+
+    // the gaps to the right of node, up to the last child in this subtree
+    auto right = node.right();
+    if (right.IsValid()) {
+        const vaddr_t node_end = node->base() + node->size();
+        if (right->subtree_max_gap_ >= min_size || right->subtree_first_base_ - node_end >= min_size) {
+            if (!ForEachLargeGapLocked(right, node, min_size, func)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 template <typename F>
 void VmAddressRegion::ForEachGap(F func, uint8_t align_pow2) {
     const vaddr_t align = 1UL << align_pow2;
@@ -754,6 +804,10 @@ void VmAddressRegion::ForEachGap(F func, uint8_t align_pow2) {
 
 namespace {
 
+// Number of random spots the non-compact allocator tries before falling back to
+// looking at every gap.
+constexpr uint kRandomSpotAttempts = 16;
+
 // Compute the number of allocation spots that satisfy the alignment within the
 // given range size, for a range that has a base that satisfies the alignment.
 constexpr size_t AllocationSpotsInRange(size_t range_size, size_t alloc_size, uint8_t align_pow2) {
@@ -768,12 +822,41 @@ constexpr size_t AllocationSpotsInRange(size_t range_size, size_t alloc_size, ui
 status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t size, uint8_t align_pow2,
                                                                    uint arch_mmu_flags,
                                                                    vaddr_t* spot) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     DEBUG_ASSERT(spot);
 
     align_pow2 = mxtl::max(align_pow2, static_cast<uint8_t>(PAGE_SIZE_SHIFT));
     const vaddr_t align = 1UL << align_pow2;
 
+    // Pick uniformly among every aligned spot in the region, and keep the spot
+    // if the allocation fits there.  Each try is a single tree lookup, and since
+    // every spot is equally likely to be picked, so is every spot that fits.
+    // Regions which are mostly full are unlikely to get a hit this way; for them,
+    // fall back to counting all of the spots that fit.
+    const vaddr_t first_spot = ROUNDUP(base_, align);
+    if (first_spot < base_ || first_spot - base_ > size_ || size_ - (first_spot - base_) < size) {
+        return ERR_NO_MEMORY;
+    }
+    const size_t total_spots = AllocationSpotsInRange(size_ - (first_spot - base_), size, align_pow2);
+    for (uint i = 0; i < kRandomSpotAttempts; i++) {
+        const vaddr_t candidate = first_spot + (aspace_->AslrPrng().RandInt(total_spots) << align_pow2);
+
+        auto after_iter = subregions_.upper_bound(candidate + size - 1);
+        auto before_iter = after_iter;
+        if (after_iter == subregions_.begin() || subregions_.size() == 0) {
+            before_iter = subregions_.end();
+        } else {
+            --before_iter;
+        }
+
+        vaddr_t chosen;
+        if (CheckGapLocked(before_iter, after_iter, &chosen, candidate, align, size, 0,
+                           arch_mmu_flags) && chosen == candidate) {
+            *spot = candidate;
+            return NO_ERROR;
+        }
+    }
+
     // Calculate the number of spaces that we can fit this allocation in.
     size_t candidate_spaces = 0;
     ForEachGap([align, align_pow2, size, &candidate_spaces](vaddr_t gap_base, size_t gap_len) -> bool {
@@ -838,7 +921,7 @@ status_t VmAddressRegion::NonCompactRandomizedRegionAllocatorLocked(size_t size,
 status_t VmAddressRegion::CompactRandomizedRegionAllocatorLocked(size_t size, uint8_t align_pow2,
                                                                 uint arch_mmu_flags,
                                                                 vaddr_t* spot) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
 
     align_pow2 = mxtl::max(align_pow2, static_cast<uint8_t>(PAGE_SIZE_SHIFT));
     const vaddr_t align = 1UL << align_pow2;
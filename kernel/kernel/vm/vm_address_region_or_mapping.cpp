@@ -12,6 +12,7 @@
 #include <inttypes.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
+#include <mxtl/algorithm.h>
 #include <mxtl/auto_call.h>
 #include <mxtl/auto_lock.h>
 #include <string.h>
@@ -31,7 +32,7 @@ VmAddressRegionOrMapping::VmAddressRegionOrMapping(uint32_t magic,
 }
 
 status_t VmAddressRegionOrMapping::Destroy() {
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -53,7 +54,7 @@ VmAddressRegionOrMapping::~VmAddressRegionOrMapping() {
 }
 
 bool VmAddressRegionOrMapping::IsAliveLocked() const {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_held(aspace_->lock()));
     return state_ == LifeCycleState::ALIVE;
 }
 
@@ -85,9 +86,47 @@ bool VmAddressRegionOrMapping::is_valid_mapping_flags(uint arch_mmu_flags) {
 }
 
 size_t VmAddressRegionOrMapping::AllocatedPages() const {
-    AutoLock guard(aspace_->lock());
+    AutoReadLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
     }
     return AllocatedPagesLocked();
 }
+
+void VmAddressRegionOrMapping::UpdateSubtreeGaps() {
+    using PtrTraits = mxtl::internal::ContainerPtrTraits<mxtl::RefPtr<VmAddressRegionOrMapping>>;
+    const auto& left = subregion_list_node_.left_;
+    const auto& right = subregion_list_node_.right_;
+
+    subtree_first_base_ = base_;
+    subtree_last_byte_ = base_ + size_ - 1;
+    subtree_max_gap_ = 0;
+
+    if (PtrTraits::IsValid(left)) {
+        subtree_first_base_ = left->subtree_first_base_;
+        subtree_max_gap_ = mxtl::max(left->subtree_max_gap_,
+                                     base_ - left->subtree_last_byte_ - 1);
+    }
+    if (PtrTraits::IsValid(right)) {
+        subtree_last_byte_ = right->subtree_last_byte_;
+        subtree_max_gap_ = mxtl::max(subtree_max_gap_, right->subtree_max_gap_);
+        subtree_max_gap_ = mxtl::max(subtree_max_gap_,
+                                     right->subtree_first_base_ - (base_ + size_ - 1) - 1);
+    }
+}
+
+void VmAddressRegionOrMapping::SetSizeLocked(size_t size) {
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
+    using PtrTraits = mxtl::internal::ContainerPtrTraits<mxtl::RefPtr<VmAddressRegionOrMapping>>;
+
+    size_ = size;
+
+    // the end of this region is part of the gap tracking of every subtree that
+    // contains it, all the way up to the root of the parent's child tree
+    if (!subregion_list_node_.InContainer())
+        return;
+    for (VmAddressRegionOrMapping* node = this; PtrTraits::IsValid(node);
+         node = node->subregion_list_node_.parent_) {
+        node->UpdateSubtreeGaps();
+    }
+}
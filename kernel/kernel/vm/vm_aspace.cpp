@@ -18,6 +18,7 @@
 #include <kernel/vm/vm_object.h>
 #include <kernel/vm/vm_object_paged.h>
 #include <kernel/vm/vm_object_physical.h>
+#include <kernel/vm/vm_page_source.h>
 #include <lib/crypto/global_prng.h>
 #include <lib/crypto/prng.h>
 #include <mxtl/auto_call.h>
@@ -217,7 +218,7 @@ VmAspace::~VmAspace() {
 }
 
 mxtl::RefPtr<VmAddressRegion> VmAspace::RootVmar() {
-    AutoLock guard(&lock_);
+    AutoReadLock guard(&lock_);
     mxtl::RefPtr<VmAddressRegion> ref(root_vmar_);
     return mxtl::move(ref);
 }
@@ -226,7 +227,7 @@ status_t VmAspace::Destroy() {
     canary_.Assert();
     LTRACEF("%p '%s'\n", this, name_);
 
-    AutoLock guard(&lock_);
+    AutoWriteLock guard(&lock_);
     // tear down and free all of the regions in our address space
     status_t status = root_vmar_->DestroyLocked();
     if (status != NO_ERROR && status != ERR_BAD_STATE) {
@@ -241,7 +242,7 @@ status_t VmAspace::Destroy() {
 }
 
 bool VmAspace::is_destroyed() const {
-    AutoLock guard(&lock_);
+    AutoReadLock guard(&lock_);
     return aspace_destroyed_;
 }
 
@@ -507,12 +508,28 @@ status_t VmAspace::PageFault(vaddr_t va, uint flags) {
     DEBUG_ASSERT(!aspace_destroyed_);
     LTRACEF("va %#" PRIxPTR ", flags %#x\n", va, flags);
 
-    // for now, hold the aspace lock across the page fault operation,
-    // which stops any other operations on the address space from moving
-    // the region out from underneath it
-    AutoLock a(&lock_);
+    for (;;) {
+        mxtl::RefPtr<VmPageRequest> page_request;
+        status_t status;
+        {
+            // hold the aspace lock shared across the page fault operation, which
+            // stops any other operations on the address space from moving the region
+            // out from underneath it, but lets faults elsewhere in the aspace proceed
+            // in parallel.  The vmo lock serializes faults on the same pages, and the
+            // page table lock serializes the page table updates.
+            AutoReadLock a(&lock_);
+
+            status = root_vmar_->PageFault(va, flags, &page_request);
+        }
+        if (status != ERR_SHOULD_WAIT)
+            return status;
 
-    return root_vmar_->PageFault(va, flags);
+        // the page has to come from a page source. wait for it without holding
+        // any locks, then fault again, since the mapping may have changed meanwhile
+        status = page_request->Wait();
+        if (status != NO_ERROR)
+            return status;
+    }
 }
 
 void VmAspace::Dump(bool verbose) const {
@@ -520,7 +537,7 @@ void VmAspace::Dump(bool verbose) const {
     printf("as %p [%#" PRIxPTR " %#" PRIxPTR "] sz %#zx fl %#x ref %d '%s'\n", this,
            base_, base_ + size_ - 1, size_, flags_, ref_count_debug(), name_);
 
-    AutoLock a(&lock_);
+    AutoReadLock a(&lock_);
 
     if (verbose)
         root_vmar_->Dump(1, verbose);
@@ -529,7 +546,7 @@ void VmAspace::Dump(bool verbose) const {
 bool VmAspace::EnumerateChildren(VmEnumerator* ve) {
     canary_.Assert();
     DEBUG_ASSERT(ve != nullptr);
-    AutoLock a(&lock_);
+    AutoWriteLock a(&lock_);
     if (root_vmar_ == nullptr || aspace_destroyed_) {
         // Aspace hasn't been initialized or has already been destroyed.
         return true;
@@ -552,7 +569,7 @@ void DumpAllAspaces(bool verbose) {
 size_t VmAspace::AllocatedPages() const {
     canary_.Assert();
 
-    AutoLock a(&lock_);
+    AutoReadLock a(&lock_);
     return root_vmar_->AllocatedPagesLocked();
 }
 
@@ -10,17 +10,35 @@
 #include <assert.h>
 #include <err.h>
 #include <inttypes.h>
+#include <kernel/cmdline.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
+#include <lk/init.h>
 #include <mxtl/auto_call.h>
 #include <mxtl/auto_lock.h>
 #include <new.h>
+#include <pow2.h>
 #include <safeint/safe_math.h>
 #include <trace.h>
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
+// Size in pages of the naturally aligned window around a user read fault in which
+// already resident pages are mapped along with the faulting one.
+// Set with the vm.faultaround kernel commandline option, 1 disables fault-around.
+#define FAULT_AROUND_DEFAULT_PAGES 16u
+#define FAULT_AROUND_MAX_PAGES 512u
+
+static uint fault_around_pages = FAULT_AROUND_DEFAULT_PAGES;
+
+static void vm_fault_around_init(uint level) {
+    uint32_t pages = cmdline_get_uint32("vm.faultaround", FAULT_AROUND_DEFAULT_PAGES);
+    pages = MIN(MAX(pages, 1u), FAULT_AROUND_MAX_PAGES);
+    fault_around_pages = valpow2(log2_uint_floor(pages));
+}
+LK_INIT_HOOK(vm_fault_around, &vm_fault_around_init, LK_INIT_LEVEL_VM);
+
 VmMapping::VmMapping(VmAddressRegion& parent, vaddr_t base, size_t size, uint32_t vmar_flags,
                      mxtl::RefPtr<VmObject> vmo, uint64_t vmo_offset, uint arch_mmu_flags,
                      const char* name)
@@ -38,7 +56,7 @@ VmMapping::~VmMapping() {
 
 size_t VmMapping::AllocatedPagesLocked() const {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_held(aspace_->lock()));
 
     if (state_ != LifeCycleState::ALIVE) {
         return 0;
@@ -75,7 +93,7 @@ status_t VmMapping::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flags)
 
     size = ROUNDUP(size, PAGE_SIZE);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -88,7 +106,7 @@ status_t VmMapping::Protect(vaddr_t base, size_t size, uint new_arch_mmu_flags)
 }
 
 status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_flags) {
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     DEBUG_ASSERT(size != 0 && IS_PAGE_ALIGNED(base) && IS_PAGE_ALIGNED(size));
 
     // Do not allow changing caching
@@ -116,8 +134,10 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
 
     // If we're changing the whole mapping, just make the change.
     if (base_ == base && size_ == size) {
+        AutoLock pt(aspace_->page_table_lock());
         status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
                                            new_arch_mmu_flags);
+        pt.release();
         LTRACEF("arch_mmu_protect returns %d\n", status);
         arch_mmu_flags_ = new_arch_mmu_flags;
         return NO_ERROR;
@@ -134,12 +154,14 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
             return ERR_NO_MEMORY;
         }
 
+        AutoLock pt(aspace_->page_table_lock());
         status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
                                            new_arch_mmu_flags);
+        pt.release();
         LTRACEF("arch_mmu_protect returns %d\n", status);
         arch_mmu_flags_ = new_arch_mmu_flags;
 
-        size_ = size;
+        SetSizeLocked(size);
         mapping->ActivateLocked();
         return NO_ERROR;
     }
@@ -157,11 +179,13 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
             return ERR_NO_MEMORY;
         }
 
+        AutoLock pt(aspace_->page_table_lock());
         status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
                                            new_arch_mmu_flags);
+        pt.release();
         LTRACEF("arch_mmu_protect returns %d\n", status);
 
-        size_ -= size;
+        SetSizeLocked(size_ - size);
         mapping->ActivateLocked();
         return NO_ERROR;
     }
@@ -186,12 +210,14 @@ status_t VmMapping::ProtectLocked(vaddr_t base, size_t size, uint new_arch_mmu_f
         return ERR_NO_MEMORY;
     }
 
+    AutoLock pt(aspace_->page_table_lock());
     status_t status = arch_mmu_protect(&aspace_->arch_aspace(), base, size / PAGE_SIZE,
                                        new_arch_mmu_flags);
+    pt.release();
     LTRACEF("arch_mmu_protect returns %d\n", status);
 
     // Turn us into the left half
-    size_ = left_size;
+    SetSizeLocked(left_size);
 
     center_mapping->ActivateLocked();
     right_mapping->ActivateLocked();
@@ -212,7 +238,7 @@ status_t VmMapping::Unmap(vaddr_t base, size_t size) {
         return ERR_BAD_STATE;
     }
 
-    AutoLock guard(aspace->lock());
+    AutoWriteLock guard(aspace->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -231,7 +257,7 @@ status_t VmMapping::Unmap(vaddr_t base, size_t size) {
 
 status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     DEBUG_ASSERT(size != 0 && IS_PAGE_ALIGNED(size) && IS_PAGE_ALIGNED(base));
     DEBUG_ASSERT(base >= base_ && base - base_ < size_);
     DEBUG_ASSERT(size_ - (base - base_) >= size);
@@ -253,7 +279,9 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
     // Check if unmapping from one of the ends
     if (base_ == base || base + size == base_ + size_) {
         LTRACEF("unmapping base %#lx size %#zx\n", base, size);
+        AutoLock pt(aspace_->page_table_lock());
         status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE, nullptr);
+        pt.release();
         if (status < 0) {
             return status;
         }
@@ -266,7 +294,7 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
             object_offset_ += size;
             parent_->subregions_.insert(mxtl::move(ref));
         }
-        size_ -= size;
+        SetSizeLocked(size_ - size);
 
         return NO_ERROR;
     }
@@ -288,13 +316,15 @@ status_t VmMapping::UnmapLocked(vaddr_t base, size_t size) {
 
     // Unmap the middle segment
     LTRACEF("unmapping base %#lx size %#zx\n", base, size);
+    AutoLock pt(aspace_->page_table_lock());
     status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), base, size / PAGE_SIZE, nullptr);
+    pt.release();
     if (status < 0) {
         return status;
     }
 
     // Turn us into the left half
-    size_ = base - base_;
+    SetSizeLocked(base - base_);
     mapping->ActivateLocked();
     return NO_ERROR;
 }
@@ -325,8 +355,9 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
     // back to us, detect the recursion and abort here.
     // The specific path we're avoiding is if the VMO calls back into us during vmo->GetPageLocked()
     // via UnmapVmoRangeLocked(). If we set this flag we're short circuiting the unmap operation
-    // so that we don't do extra work.
-    if (likely(currently_faulting_)) {
+    // so that we don't do extra work. A larger range, such as a whole large page committed
+    // around the fault, still has to be unmapped since we only replace the faulting page.
+    if (likely(currently_faulting_) && len == PAGE_SIZE) {
         LTRACEF("recursing to ourself, abort\n");
         return NO_ERROR;
     }
@@ -358,6 +389,7 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
     LTRACEF("going to unmap %#" PRIxPTR ", len %#" PRIx64 " aspace %p\n",
             unmap_base.ValueOrDie(), len_new, aspace_.get());
 
+    AutoLock pt(aspace_->page_table_lock());
     status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), unmap_base.ValueOrDie(),
                                      static_cast<size_t>(len_new) / PAGE_SIZE, nullptr);
     if (status < 0)
@@ -369,7 +401,7 @@ status_t VmMapping::UnmapVmoRangeLocked(uint64_t offset, uint64_t len) const {
 status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     DEBUG_ASSERT(magic_ == kMagic);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -399,10 +431,11 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
     size_t o;
     for (o = offset; o < offset + len; o += PAGE_SIZE) {
         uint64_t vmo_offset = object_offset_ + o;
+        vaddr_t va = base_ + o;
 
         status_t status;
         paddr_t pa;
-        status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &pa);
+        status = object_->GetPageLocked(vmo_offset, pf_flags, nullptr, &pa, nullptr);
         if (status < 0) {
             // no page to map
             if (commit) {
@@ -414,7 +447,15 @@ status_t VmMapping::MapRange(size_t offset, size_t len, bool commit) {
             }
         }
 
-        vaddr_t va = base_ + o;
+        AutoLock pt(aspace_->page_table_lock());
+
+        // map a whole large page at once if the object has one here
+        if (IS_ALIGNED(va, LARGE_PAGE_SIZE) && offset + len - o >= LARGE_PAGE_SIZE &&
+            MapLargePageLocked(va, arch_mmu_flags_)) {
+            o += LARGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+
         LTRACEF_LEVEL(2, "mapping pa %#" PRIxPTR " to va %#" PRIxPTR "\n", pa, va);
 
         size_t mapped;
@@ -435,7 +476,7 @@ status_t VmMapping::DecommitRange(size_t offset, size_t len,
     LTRACEF("%p '%s' [%#zx+%#zx], offset %#zx, len %#zx\n",
             this, name_, base_, size_, offset, len);
 
-    AutoLock guard(aspace_->lock());
+    AutoWriteLock guard(aspace_->lock());
     if (state_ != LifeCycleState::ALIVE) {
         return ERR_BAD_STATE;
     }
@@ -449,7 +490,7 @@ status_t VmMapping::DecommitRange(size_t offset, size_t len,
 
 status_t VmMapping::DestroyLocked() {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     LTRACEF("%p '%s'\n", this, name_);
 
     // Take a reference to ourself, so that we do not get destructed after
@@ -487,9 +528,10 @@ status_t VmMapping::DestroyLocked() {
     return NO_ERROR;
 }
 
-status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
+status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags,
+                             mxtl::RefPtr<VmPageRequest>* page_request) {
     DEBUG_ASSERT(magic_ == kMagic);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_held(aspace_->lock()));
 
     DEBUG_ASSERT(va >= base_ && va <= base_ + size_ - 1);
 
@@ -532,7 +574,12 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     // fault in or grab an existing page
     paddr_t new_pa;
     vm_page_t* page;
-    status_t status = object_->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa);
+    status_t status = object_->GetPageLocked(vmo_offset, pf_flags, &page, &new_pa, page_request);
+    if (status == ERR_SHOULD_WAIT) {
+        // the page is on its way from a page source, our caller will wait for it
+        LTRACEF("waiting for page source, vmo_offset %#" PRIx64 "\n", vmo_offset);
+        return status;
+    }
     if (status < 0) {
         TRACEF("ERROR: failed to fault in or grab existing page\n");
         TRACEF("%p '%s', vmo_offset %#" PRIx64 ", pf_flags %#x\n", this, name_, vmo_offset, pf_flags);
@@ -548,11 +595,26 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
         mmu_flags &= ~ARCH_MMU_FLAG_PERM_WRITE;
     }
 
+    // hold the page table lock from looking up what is mapped here until it has
+    // been replaced, since faults elsewhere in the aspace may be changing the
+    // page tables around it
+    AutoLock pt(aspace_->page_table_lock());
+
     // see if something is mapped here now
     // this may happen if we are one of multiple threads racing on a single address
     uint page_flags;
     paddr_t pa;
     status_t err = arch_mmu_query(&aspace_->arch_aspace(), va, &pa, &page_flags);
+    const bool already_mapped = err >= 0 && pa == new_pa &&
+                                (page_flags == arch_mmu_flags_ || page_flags == mmu_flags);
+
+    // if the object has a physically contiguous large page here, map all of it
+    if (!already_mapped && new_pa != vm_get_zero_page_paddr() &&
+        MapLargePageLocked(va, mmu_flags)) {
+        LTRACEF("mapped large page around va %#" PRIxPTR "\n", va);
+        return NO_ERROR;
+    }
+
     if (err >= 0) {
         LTRACEF("queried va, page at pa %#" PRIxPTR ", flags %#x is already there\n", pa,
                 page_flags);
@@ -560,7 +622,7 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             // page was already mapped, are the permissions compatible?
             // test that the page is already mapped with either the region's mmu flags
             // or the flags that we're about to try to switch it to, which may be read-only
-            if (page_flags == arch_mmu_flags_ || page_flags == mmu_flags)
+            if (already_mapped)
                 return NO_ERROR;
 
             // assert that we're not accidentally marking the zero page writable
@@ -613,6 +675,12 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
             return ERR_NO_MEMORY;
         }
         DEBUG_ASSERT(mapped == 1);
+
+        // opportunistically map any neighbouring pages the vmo already has
+        if ((pf_flags & VMM_PF_FLAG_USER) && (pf_flags & VMM_PF_FLAG_HW_FAULT) &&
+            !(pf_flags & VMM_PF_FLAG_WRITE)) {
+            FaultAroundLocked(va, mmu_flags);
+        }
     }
 
 // TODO: figure out what to do with this
@@ -623,6 +691,135 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
     return NO_ERROR;
 }
 
+// Map the LARGE_PAGE_SIZE aligned block containing va with a single large page,
+// if it lies entirely within the mapping and the object backs it with pages it
+// owns that are physically contiguous and aligned. Any small pages already mapped
+// in the block are replaced. Returns false if the block has to be mapped page by
+// page instead. The caller holds the page table lock, so that nothing can map
+// into the block between the small pages being unmapped and the large page
+// taking their place.
+//
+// See ActivateLocked() below for why thread safety analysis is disabled here.
+bool VmMapping::MapLargePageLocked(vaddr_t va, uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+    DEBUG_ASSERT(is_mutex_held(aspace_->page_table_lock()));
+
+    if (LARGE_PAGE_SIZE == PAGE_SIZE)
+        return false;
+
+    const vaddr_t large_va = ROUNDDOWN(va, LARGE_PAGE_SIZE);
+    if (large_va < base_ || large_va + (LARGE_PAGE_SIZE - 1) > base_ + size_ - 1)
+        return false;
+
+    paddr_t pa;
+    uint64_t vmo_offset = large_va - base_ + object_offset_;
+    if (object_->LookupContiguousLocked(vmo_offset, LARGE_PAGE_SIZE, &pa) != NO_ERROR ||
+        !IS_ALIGNED(pa, LARGE_PAGE_SIZE)) {
+        return false;
+    }
+
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+
+    // the block may already be partially mapped with small pages of the same memory
+    status_t status = arch_mmu_unmap(&aspace_->arch_aspace(), large_va, count, nullptr);
+    if (status < 0) {
+        TRACEF("failed to unmap small pages before mapping large page\n");
+        return false;
+    }
+
+    size_t mapped;
+    status = arch_mmu_map(&aspace_->arch_aspace(), large_va, pa, count, mmu_flags, &mapped);
+    if (status < 0) {
+        // let the pages fault back in one at a time
+        LTRACEF("failed to map large page at va %#" PRIxPTR ": %d\n", large_va, status);
+        return false;
+    }
+    DEBUG_ASSERT(mapped == count);
+
+#if ARCH_ARM64
+    if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE)
+        arch_sync_cache_range(large_va, LARGE_PAGE_SIZE);
+#endif
+    return true;
+}
+
+// Map the pages surrounding a read fault at va that are already resident in the
+// vmo (or one of its parents), so that sequential or clustered access does not
+// take a fault per page. Never allocates pages; anything not present, or already
+// mapped, is left for a regular fault. Pages are mapped without write permission
+// since they may belong to a copy-on-write parent, and physically contiguous runs
+// are mapped with a single arch_mmu_map call.
+//
+// See ActivateLocked() below for why thread safety analysis is disabled here.
+void VmMapping::FaultAroundLocked(vaddr_t va, uint mmu_flags) TA_NO_THREAD_SAFETY_ANALYSIS {
+    DEBUG_ASSERT(object_->lock()->IsHeld());
+    DEBUG_ASSERT(is_mutex_held(aspace_->page_table_lock()));
+    DEBUG_ASSERT(!(mmu_flags & ARCH_MMU_FLAG_PERM_WRITE));
+
+    const size_t window = fault_around_pages * PAGE_SIZE;
+    if (window <= PAGE_SIZE)
+        return;
+
+    // clip the aligned window to the mapping
+    const vaddr_t window_base = ROUNDDOWN(va, window);
+    const vaddr_t start = MAX(window_base, base_);
+    const vaddr_t last = MIN(window_base + (window - 1), base_ + size_ - 1);
+    const size_t count = (last - start) / PAGE_SIZE + 1;
+
+    vaddr_t run_va = 0;
+    paddr_t run_pa = 0;
+    size_t run_len = 0;
+    auto map_run = [&]() {
+        if (run_len == 0)
+            return;
+
+        LTRACEF("fault-around mapping pa %#" PRIxPTR " to va %#" PRIxPTR " count %zu\n",
+                run_pa, run_va, run_len);
+
+        size_t mapped;
+        status_t status = arch_mmu_map(&aspace_->arch_aspace(), run_va, run_pa, run_len,
+                                       mmu_flags, &mapped);
+        if (status < 0) {
+            // this is purely an optimization, let the pages fault in normally
+            LTRACEF("fault-around map failed %d\n", status);
+        }
+#if ARCH_ARM64
+        else if (arch_mmu_flags_ & ARCH_MMU_FLAG_PERM_EXECUTE) {
+            arch_sync_cache_range(run_va, run_len * PAGE_SIZE);
+        }
+#endif
+        run_len = 0;
+    };
+
+    for (size_t i = 0; i < count; i++) {
+        const vaddr_t addr = start + i * PAGE_SIZE;
+
+        // skip the faulting page and anything another thread has already mapped
+        if (addr == va || arch_mmu_query(&aspace_->arch_aspace(), addr, nullptr, nullptr) >= 0) {
+            map_run();
+            continue;
+        }
+
+        // without any fault flags the vmo only returns pages it already has
+        paddr_t pa;
+        if (object_->GetPageLocked(addr - base_ + object_offset_, 0, nullptr, &pa, nullptr) < 0) {
+            map_run();
+            continue;
+        }
+        DEBUG_ASSERT(pa != vm_get_zero_page_paddr());
+
+        if (run_len > 0 && pa == run_pa + run_len * PAGE_SIZE) {
+            run_len++;
+        } else {
+            map_run();
+            run_va = addr;
+            run_pa = pa;
+            run_len = 1;
+        }
+    }
+    map_run();
+}
+
 // We disable thread safety analysis here because one of the common uses of this
 // function is for splitting one mapping object into several that will be backed
 // by the same VmObject.  In that case, object_->lock() gets aliased across all
@@ -633,7 +830,7 @@ status_t VmMapping::PageFault(vaddr_t va, const uint pf_flags) {
 // function.
 void VmMapping::ActivateLocked() TA_NO_THREAD_SAFETY_ANALYSIS {
     DEBUG_ASSERT(state_ == LifeCycleState::NOT_READY);
-    DEBUG_ASSERT(is_mutex_held(aspace_->lock()));
+    DEBUG_ASSERT(rwlock_is_write_held(aspace_->lock()));
     DEBUG_ASSERT(object_->lock()->IsHeld());
     DEBUG_ASSERT(parent_);
 
@@ -69,12 +69,15 @@ void VmObject::AddChildLocked(VmObject* o) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
     children_list_.push_front(o);
+    children_count_++;
 }
 
 void VmObject::RemoveChildLocked(VmObject* o) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
     children_list_.erase(*o);
+    DEBUG_ASSERT(children_count_ > 0);
+    children_count_--;
 }
 
 void VmObject::RangeChangeUpdateLocked(uint64_t offset, uint64_t len) {
@@ -25,24 +25,22 @@
 
 #define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
 
-namespace {
-
-void ZeroPage(paddr_t pa) {
-    void* ptr = paddr_to_kvaddr(pa);
-    DEBUG_ASSERT(ptr);
-
-    arch_zero_page(ptr);
-}
-
-void ZeroPage(vm_page_t* p) {
-    paddr_t pa = vm_page_to_paddr(p);
-    ZeroPage(pa);
-}
-
-} // namespace
-
-VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, mxtl::RefPtr<VmObject> parent)
-    : VmObject(mxtl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags) {
+// debug counters for copy-on-write clone chains
+static uint64_t max_clone_chain_depth_seen;
+static uint64_t collapsed_clones;
+
+// objects with unlocked ranges, least recently unlocked first. taken before any
+// object's lock, and an object takes itself off in its destructor, so anything on
+// the list can be used while this is held.
+static Mutex discardable_lock;
+static mxtl::DoublyLinkedList<VmObjectPaged*, VmObjectPaged::DiscardableListTraits>
+    discardable_list TA_GUARDED(discardable_lock);
+static uint64_t discarded_pages;
+
+VmObjectPaged::VmObjectPaged(uint32_t pmm_alloc_flags, uint32_t options,
+                             mxtl::RefPtr<VmObject> parent, mxtl::RefPtr<VmPageSource> page_source)
+    : VmObject(mxtl::move(parent)), pmm_alloc_flags_(pmm_alloc_flags), options_(options),
+      page_source_(mxtl::move(page_source)) {
     LTRACEF("%p\n", this);
 }
 
@@ -51,17 +49,25 @@ VmObjectPaged::~VmObjectPaged() {
 
     LTRACEF("%p\n", this);
 
+    // get off the discardable list before anything is torn down
+    if (discardable_) {
+        AutoLock a(&discardable_lock);
+        if (discardable_list_node_.InContainer())
+            discardable_list.erase(*this);
+    }
+
     // free all of the pages attached to us
     page_list_.FreeAllPages();
 }
 
-mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size) {
+mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t size,
+                                             uint32_t options) {
     // there's a max size to keep indexes within range
     if (size > MAX_SIZE)
         return nullptr;
 
     AllocChecker ac;
-    auto vmo = mxtl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, nullptr));
+    auto vmo = mxtl::AdoptRef<VmObject>(new (&ac) VmObjectPaged(pmm_alloc_flags, options, nullptr));
     if (!ac.check())
         return nullptr;
 
@@ -76,21 +82,56 @@ mxtl::RefPtr<VmObject> VmObjectPaged::Create(uint32_t pmm_alloc_flags, uint64_t
     return vmo;
 }
 
+mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromSource(mxtl::RefPtr<VmPageSource> source,
+                                                       uint64_t size) {
+    DEBUG_ASSERT(source);
+
+    // there's a max size to keep indexes within range
+    if (size > MAX_SIZE)
+        return nullptr;
+
+    AllocChecker ac;
+    auto vmo = mxtl::AdoptRef<VmObjectPaged>(
+        new (&ac) VmObjectPaged(PMM_ALLOC_FLAG_ANY, 0, nullptr, mxtl::move(source)));
+    if (!ac.check())
+        return nullptr;
+
+    // the size is fixed from here on, since Resize() isn't supported with a page source
+    AutoLock a(&vmo->lock_);
+    auto status = vmo->ResizeLocked(size);
+    DEBUG_ASSERT(status == NO_ERROR);
+    if (status != NO_ERROR)
+        return nullptr;
+
+    return vmo;
+}
+
 status_t VmObjectPaged::CloneCOW(uint64_t offset, uint64_t size, mxtl::RefPtr<VmObject>* clone_vmo) {
     LTRACEF("vmo %p offset %#" PRIx64 " size %#" PRIx64 "\n", this, offset, size);
 
     canary_.Assert();
 
     AllocChecker ac;
-    auto vmo = mxtl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags_, mxtl::WrapRefPtr(this)));
+    auto vmo = mxtl::AdoptRef<VmObjectPaged>(new (&ac) VmObjectPaged(pmm_alloc_flags_, 0, mxtl::WrapRefPtr(this)));
     if (!ac.check())
         return ERR_NO_MEMORY;
 
     AutoLock a(&lock_);
 
+    // don't build on top of ancestors that nothing else is using anymore
+    CollapseParentLocked();
+
     // add it as a child to us
     AddChildLocked(vmo.get());
 
+    // keep track of the longest chain a clone has been created at the end of
+    uint64_t depth = 1;
+    for (const VmObjectPaged* o = this; o->parent_; o = static_cast<VmObjectPaged*>(o->parent_.get()))
+        depth++;
+    uint64_t max_depth = atomic_load_u64(&max_clone_chain_depth_seen);
+    while (depth > max_depth && !atomic_cmpxchg_u64(&max_clone_chain_depth_seen, &max_depth, depth))
+        ;
+
     // set the new clone's size
     auto status = vmo->ResizeLocked(size);
     if (status != NO_ERROR)
@@ -198,7 +239,7 @@ mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t
 
             if (page->state == VM_PAGE_STATE_WIRED) {
                 // it's wired to the kernel, so we can just use it directly
-            } else if (page->state == VM_PAGE_STATE_FREE) {
+            } else if (page->state == VM_PAGE_STATE_FREE || page->state == VM_PAGE_STATE_CACHED) {
                 ASSERT(pmm_alloc_range(pa, 1, nullptr) == 1);
                 page->state = VM_PAGE_STATE_WIRED;
             } else {
@@ -223,7 +264,8 @@ mxtl::RefPtr<VmObject> VmObjectPaged::CreateFromROData(const void* data, size_t
     return vmo;
 }
 
-status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** const page_out, paddr_t* const pa_out) {
+status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** const page_out, paddr_t* const pa_out,
+                                     mxtl::RefPtr<VmPageRequest>* page_request) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
 
@@ -247,8 +289,11 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
     LTRACEF("vmo %p, offset %#" PRIx64 ", pf_flags %#x (%s)\n", this, offset, pf_flags,
             vmm_pf_flags_to_string(pf_flags, pf_string));
 
+    // splice out any ancestors that only we can see before walking up the chain
+    CollapseParentLocked();
+
     // if we have a parent see if they have a page for us
-    if (parent_) {
+    if (parent_ && offset < parent_limit_) {
         safeint::CheckedNumeric<uint64_t> parent_offset = parent_offset_;
         parent_offset += offset;
         DEBUG_ASSERT(parent_offset.IsValid());
@@ -256,8 +301,15 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
         // make sure we don't cause the parent to fault in new pages, just ask for any that already exist
         uint parent_pf_flags = pf_flags & ~(VMM_PF_FLAG_FAULT_MASK);
 
-        status_t status = parent_->GetPageLocked(parent_offset.ValueOrDie(), parent_pf_flags, &p, &pa);
-        if (status == NO_ERROR) {
+        status_t status = parent_->GetPageLocked(parent_offset.ValueOrDie(), parent_pf_flags, &p, &pa,
+                                                 page_request);
+        if (status == ERR_SHOULD_WAIT) {
+            // a page source further up the chain is still working on it
+            return status;
+        } else if (status != NO_ERROR && status != ERR_NOT_FOUND && status != ERR_OUT_OF_RANGE) {
+            // a page source further up the chain can't provide it
+            return status;
+        } else if (status == NO_ERROR) {
             // we have a page from them. if we're read-only faulting, return that page so they can map
             // or read from it directly
             if ((pf_flags & VMM_PF_FLAG_WRITE) == 0) {
@@ -303,6 +355,14 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
         }
     }
 
+    // pages we don't have come from our page source rather than being zero filled, as
+    // long as the caller is able to wait for them, even if it's only a child looking
+    if (page_source_) {
+        if (!page_request)
+            return ERR_NOT_FOUND;
+        return page_source_->GetPage(ROUNDDOWN(offset, PAGE_SIZE), page_request);
+    }
+
     // if we're not being asked to sw or hw fault in the page, return not found
     if ((pf_flags & VMM_PF_FLAG_FAULT_MASK) == 0)
         return ERR_NOT_FOUND;
@@ -318,16 +378,28 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
         return NO_ERROR;
     }
 
+    // try to commit the whole large page around the offset, falling back to a single page
+    if ((options_ & kLargePages) && CommitLargePageLocked(offset) == NO_ERROR) {
+        p = page_list_.GetPage(offset);
+        DEBUG_ASSERT(p);
+
+        LTRACEF("faulted in large page run, page %p\n", p);
+
+        if (page_out)
+            *page_out = p;
+        if (pa_out)
+            *pa_out = vm_page_to_paddr(p);
+
+        return NO_ERROR;
+    }
+
     // allocate a page
-    p = pmm_alloc_page(pmm_alloc_flags_, &pa);
+    p = pmm_alloc_page(pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &pa);
     if (!p)
         return ERR_NO_MEMORY;
 
     p->state = VM_PAGE_STATE_OBJECT;
 
-    // TODO: remove once pmm returns zeroed pages
-    ZeroPage(pa);
-
     status_t status = AddPageLocked(p, offset);
     DEBUG_ASSERT(status == NO_ERROR);
 
@@ -344,10 +416,86 @@ status_t VmObjectPaged::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t*
     return NO_ERROR;
 }
 
+status_t VmObjectPaged::LookupContiguousLocked(uint64_t offset, uint64_t len, paddr_t* pa_out) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    if (len == 0 || offset >= size_ || len > size_ - offset)
+        return ERR_OUT_OF_RANGE;
+
+    // only pages we own count, anything coming from the parent must stay copy-on-write
+    paddr_t base = 0;
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.GetPage(o);
+        if (!p)
+            return ERR_NOT_FOUND;
+
+        paddr_t pa = vm_page_to_paddr(p);
+        if (o == offset) {
+            base = pa;
+        } else if (pa != base + (o - offset)) {
+            return ERR_NOT_FOUND;
+        }
+    }
+
+    *pa_out = base;
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::CommitLargePageLocked(uint64_t offset) {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    if (LARGE_PAGE_SIZE == PAGE_SIZE)
+        return ERR_NOT_SUPPORTED;
+
+    // the whole run has to fit within the object and be entirely uncommitted
+    const uint64_t start = ROUNDDOWN(offset, LARGE_PAGE_SIZE);
+    if (start >= size_ || LARGE_PAGE_SIZE > size_ - start)
+        return ERR_OUT_OF_RANGE;
+    for (uint64_t o = start; o < start + LARGE_PAGE_SIZE; o += PAGE_SIZE) {
+        if (page_list_.GetPage(o))
+            return ERR_ALREADY_EXISTS;
+    }
+
+    const size_t count = LARGE_PAGE_SIZE / PAGE_SIZE;
+    list_node page_list;
+    list_initialize(&page_list);
+
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                            LARGE_PAGE_SIZE_SHIFT, nullptr, &page_list);
+    if (allocated < count) {
+        LTRACEF("failed to allocate a large page run at offset %#" PRIx64 "\n", start);
+        pmm_free(&page_list);
+        return ERR_NO_MEMORY;
+    }
+
+    for (uint64_t o = start; o < start + LARGE_PAGE_SIZE; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(&page_list, vm_page_t, free.node);
+        ASSERT(p);
+
+        p->state = VM_PAGE_STATE_OBJECT;
+
+        status_t status = page_list_.AddPage(p, o);
+        DEBUG_ASSERT(status == NO_ERROR);
+    }
+    DEBUG_ASSERT(list_is_empty(&page_list));
+
+    // other mappings may have covered this range of the vmo, so unmap it
+    RangeChangeUpdateLocked(start, LARGE_PAGE_SIZE);
+
+    return NO_ERROR;
+}
+
 status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* committed) {
     canary_.Assert();
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
 
+    // the contents of pages can only come from the page source
+    if (page_source_)
+        return ERR_NOT_SUPPORTED;
+
     if (committed)
         *committed = 0;
 
@@ -366,6 +514,18 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     uint64_t end = ROUNDUP_PAGE_SIZE(offset + new_len);
     DEBUG_ASSERT(end > offset);
 
+    // commit as much as we can in physically contiguous large page runs first
+    uint64_t large_committed = 0;
+    if (options_ & kLargePages) {
+        for (uint64_t o = ROUNDUP(offset, LARGE_PAGE_SIZE); o + LARGE_PAGE_SIZE <= end;
+             o += LARGE_PAGE_SIZE) {
+            if (CommitLargePageLocked(o) == NO_ERROR)
+                large_committed += LARGE_PAGE_SIZE;
+        }
+        if (committed)
+            *committed = large_committed;
+    }
+
     // make a pass through the list, counting the number of pages we need to allocate
     size_t count = 0;
     for (uint64_t o = offset; o < end; o += PAGE_SIZE) {
@@ -379,8 +539,10 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_, &page_list);
+    size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &page_list);
     if (allocated < count) {
+        // any large page runs committed above are kept. they hold zeroed pages, so
+        // the object reads the same either way, and *committed accounts for them
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
         return ERR_NO_MEMORY;
@@ -400,9 +562,6 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         status_t status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
 
@@ -413,7 +572,7 @@ status_t VmObjectPaged::CommitRange(uint64_t offset, uint64_t len, uint64_t* com
     DEBUG_ASSERT(list_is_empty(&page_list));
 
     // for now we only support committing as much as we were asked for
-    DEBUG_ASSERT(!committed || *committed == count * PAGE_SIZE);
+    DEBUG_ASSERT(!committed || *committed == large_committed + count * PAGE_SIZE);
 
     return NO_ERROR;
 }
@@ -423,6 +582,10 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
     canary_.Assert();
     LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 ", alignment %hhu\n", offset, len, alignment_log2);
 
+    // the contents of pages can only come from the page source
+    if (page_source_)
+        return ERR_NOT_SUPPORTED;
+
     if (committed)
         *committed = 0;
 
@@ -454,7 +617,8 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
     list_node page_list;
     list_initialize(&page_list);
 
-    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_, alignment_log2, nullptr, &page_list);
+    size_t allocated = pmm_alloc_contiguous(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED,
+                                            alignment_log2, nullptr, &page_list);
     if (allocated < count) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", count, allocated);
         pmm_free(&page_list);
@@ -473,9 +637,6 @@ status_t VmObjectPaged::CommitRangeContiguous(uint64_t offset, uint64_t len, uin
 
         p->state = VM_PAGE_STATE_OBJECT;
 
-        // TODO: remove once pmm returns zeroed pages
-        ZeroPage(p);
-
         auto status = page_list_.AddPage(p, o);
         DEBUG_ASSERT(status == NO_ERROR);
 
@@ -532,6 +693,341 @@ status_t VmObjectPaged::DecommitRange(uint64_t offset, uint64_t len, uint64_t* d
     return NO_ERROR;
 }
 
+void VmObjectPaged::RemoveDiscardableRangesLocked(uint64_t offset, uint64_t len,
+                                                  mxtl::unique_ptr<DiscardableRange>* spare,
+                                                  bool* discarded) {
+    const uint64_t end = offset + len;
+
+    for (auto iter = discardable_ranges_.begin(); iter != discardable_ranges_.end();) {
+        auto cur = iter++;
+        const uint64_t cur_end = cur->offset + cur->len;
+
+        if (!Intersects(cur->offset, cur->len, offset, len))
+            continue;
+
+        *discarded |= cur->discarded;
+
+        if (cur->offset >= offset && cur_end <= end) {
+            // entirely covered
+            discardable_ranges_.erase(cur);
+        } else if (cur->offset < offset && cur_end > end) {
+            // covers the middle, so keep both ends
+            DEBUG_ASSERT(*spare);
+            (*spare)->offset = end;
+            (*spare)->len = cur_end - end;
+            (*spare)->discarded = cur->discarded;
+            discardable_ranges_.push_back(mxtl::move(*spare));
+            cur->len = offset - cur->offset;
+        } else if (cur->offset < offset) {
+            // keep the front
+            cur->len = offset - cur->offset;
+        } else {
+            // keep the back
+            cur->offset = end;
+            cur->len = cur_end - end;
+        }
+    }
+}
+
+status_t VmObjectPaged::UnlockRange(uint64_t offset, uint64_t len) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+
+    AllocChecker ac;
+    mxtl::unique_ptr<DiscardableRange> range(new (&ac) DiscardableRange);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+    mxtl::unique_ptr<DiscardableRange> spare(new (&ac) DiscardableRange);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    {
+        AutoLock a(&lock_);
+
+        if (!InRange(offset, len, size_))
+            return ERR_OUT_OF_RANGE;
+
+        // a clone's pages stand in for its parent's, so throwing them away
+        // wouldn't leave zeros behind
+        if (parent_)
+            return ERR_NOT_SUPPORTED;
+
+        if (len == 0)
+            return NO_ERROR;
+
+        // unlocking a range again starts it over, but has to remember anything
+        // already thrown away so the next lock still reports it
+        bool discarded = false;
+        RemoveDiscardableRangesLocked(offset, len, &spare, &discarded);
+
+        range->offset = offset;
+        range->len = len;
+        range->discarded = discarded;
+        discardable_ranges_.push_back(mxtl::move(range));
+        discardable_ = true;
+    }
+
+    // move to the back of the line to be reclaimed
+    AutoLock a(&discardable_lock);
+    if (discardable_list_node_.InContainer())
+        discardable_list.erase(*this);
+    discardable_list.push_back(this);
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::LockRange(uint64_t offset, uint64_t len, bool* discarded) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    DEBUG_ASSERT(discarded);
+    *discarded = false;
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(len))
+        return ERR_INVALID_ARGS;
+
+    AllocChecker ac;
+    mxtl::unique_ptr<DiscardableRange> spare(new (&ac) DiscardableRange);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    AutoLock a(&lock_);
+
+    if (!InRange(offset, len, size_))
+        return ERR_OUT_OF_RANGE;
+
+    // we stay on the global list, and get dropped from it the next time reclaim
+    // finds nothing to throw away
+    RemoveDiscardableRangesLocked(offset, len, &spare, discarded);
+
+    return NO_ERROR;
+}
+
+bool VmObjectPaged::DiscardUnlockedRanges(size_t* freed) {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+
+    // children see through to our pages, so they have to stay for now
+    if (!children_list_.is_empty()) {
+        for (const auto& r : discardable_ranges_) {
+            if (!r.discarded)
+                return true;
+        }
+        return false;
+    }
+
+    for (auto& r : discardable_ranges_) {
+        if (r.discarded)
+            continue;
+
+        // unmap all of the pages in this range on all the mapping regions
+        RangeChangeUpdateLocked(r.offset, r.len);
+
+        uint64_t end = mxtl::min(r.offset + r.len, size_);
+        for (uint64_t o = r.offset; o < end; o += PAGE_SIZE) {
+            if (page_list_.FreePage(o) == NO_ERROR)
+                (*freed)++;
+        }
+        r.discarded = true;
+    }
+
+    return false;
+}
+
+size_t VmObjectPaged::ReclaimDiscardablePages(size_t count) {
+    LTRACEF("count %zu\n", count);
+
+    AutoLock a(&discardable_lock);
+
+    // objects fall off the list once everything they've unlocked is gone, until they
+    // unlock another range. ones we had to skip go back on at the front.
+    mxtl::DoublyLinkedList<VmObjectPaged*, DiscardableListTraits> skipped;
+
+    size_t freed = 0;
+    while (freed < count && !discardable_list.is_empty()) {
+        VmObjectPaged* vmo = discardable_list.pop_front();
+        if (vmo->DiscardUnlockedRanges(&freed))
+            skipped.push_back(vmo);
+    }
+
+    while (!skipped.is_empty())
+        discardable_list.push_front(skipped.pop_back());
+
+    atomic_add_u64(&discarded_pages, freed);
+
+    LTRACEF("freed %zu\n", freed);
+    return freed;
+}
+
+size_t VmObjectPaged::ReclaimUnlockedPages() {
+    canary_.Assert();
+
+    // stays on the global list, reclaim drops it the next time it finds nothing
+    size_t freed = 0;
+    DiscardUnlockedRanges(&freed);
+    atomic_add_u64(&discarded_pages, freed);
+
+    LTRACEF("freed %zu\n", freed);
+    return freed;
+}
+
+uint64_t VmObjectPaged::discarded_page_count() {
+    return atomic_load_u64(&discarded_pages);
+}
+
+size_t vm_reclaim_pages(size_t count) {
+    return VmObjectPaged::ReclaimDiscardablePages(count);
+}
+
+status_t VmObjectPaged::SupplyPages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    if (!page_source_)
+        return ERR_NOT_SUPPORTED;
+
+    AutoLock a(&lock_);
+
+    if (!InRange(offset, len, size_))
+        return ERR_OUT_OF_RANGE;
+
+    // nothing can have been mapped for pages we didn't have, so there's nothing to unmap
+    status_t status = NO_ERROR;
+    uint64_t o;
+    for (o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+
+        // keep a page we already have, since it may have been written to since
+        if (page_list_.GetPage(o)) {
+            pmm_free_page(p);
+            continue;
+        }
+
+        p->state = VM_PAGE_STATE_OBJECT;
+
+        status = page_list_.AddPage(p, o);
+        if (status != NO_ERROR) {
+            list_add_head(pages, &p->free.node);
+            break;
+        }
+    }
+
+    // wake up anyone waiting on what made it in
+    page_source_->OnPagesSupplied(offset, o - offset);
+
+    return status;
+}
+
+status_t VmObjectPaged::TakePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    AutoLock a(&lock_);
+
+    if (!InRange(offset, len, size_))
+        return ERR_OUT_OF_RANGE;
+
+    // the pages can't be taken away from anything else that can see them
+    if (page_source_ || !children_list_.is_empty())
+        return ERR_BAD_STATE;
+
+    // pages we haven't committed read as zero, unless they show through from a parent
+    size_t count = 0;
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        if (!page_list_.GetPage(o)) {
+            if (parent_)
+                return ERR_BAD_STATE;
+            count++;
+        }
+    }
+
+    list_node zero_list;
+    list_initialize(&zero_list);
+    if (count > 0) {
+        size_t allocated = pmm_alloc_pages(count, pmm_alloc_flags_ | PMM_ALLOC_FLAG_ZEROED, &zero_list);
+        if (allocated < count) {
+            pmm_free(&zero_list);
+            return ERR_NO_MEMORY;
+        }
+    }
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = page_list_.RemovePage(o);
+        if (!p)
+            p = list_remove_head_type(&zero_list, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+
+        list_add_tail(pages, &p->free.node);
+    }
+    DEBUG_ASSERT(list_is_empty(&zero_list));
+
+    return NO_ERROR;
+}
+
+status_t VmObjectPaged::ReplacePages(uint64_t offset, uint64_t len, list_node* pages) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", len %#" PRIx64 "\n", offset, len);
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(len));
+
+    // a pager supplies all of its object's pages, and the pages could be from any
+    // arena, so they can't go into objects that need theirs mapped in the kernel
+    if (page_source_ || (pmm_alloc_flags_ & PMM_ALLOC_FLAG_KMAP))
+        return ERR_NOT_SUPPORTED;
+
+    AutoLock a(&lock_);
+
+    if (!InRange(offset, len, size_))
+        return ERR_OUT_OF_RANGE;
+
+    // clones that haven't copied a page yet would see it change underneath them
+    if (!children_list_.is_empty())
+        return ERR_BAD_STATE;
+
+    // unmap all of the pages in this range on all the mapping regions
+    RangeChangeUpdateLocked(offset, len);
+
+    list_node old_list;
+    list_initialize(&old_list);
+
+    status_t status = NO_ERROR;
+    for (uint64_t o = offset; o < offset + len; o += PAGE_SIZE) {
+        vm_page_t* p = list_remove_head_type(pages, vm_page_t, free.node);
+        DEBUG_ASSERT(p);
+
+        vm_page_t* old = page_list_.RemovePage(o);
+
+        p->state = VM_PAGE_STATE_OBJECT;
+        status = page_list_.AddPage(p, o);
+        if (status != NO_ERROR) {
+            list_add_head(pages, &p->free.node);
+            // put back what we took out, if there's still room for it
+            if (old && page_list_.AddPage(old, o) != NO_ERROR)
+                list_add_tail(&old_list, &old->free.node);
+            break;
+        }
+
+        if (old)
+            list_add_tail(&old_list, &old->free.node);
+    }
+
+    pmm_free(&old_list);
+
+    return status;
+}
+
 status_t VmObjectPaged::ResizeLocked(uint64_t s) {
     canary_.Assert();
     DEBUG_ASSERT(lock_.IsHeld());
@@ -582,6 +1078,10 @@ status_t VmObjectPaged::ResizeLocked(uint64_t s) {
 }
 
 status_t VmObjectPaged::Resize(uint64_t s) {
+    // the page source decides how big the object is
+    if (page_source_)
+        return ERR_NOT_SUPPORTED;
+
     AutoLock a(&lock_);
 
     return ResizeLocked(s);
@@ -607,6 +1107,96 @@ status_t VmObjectPaged::SetParentOffsetLocked(uint64_t offset) {
     return NO_ERROR;
 }
 
+void VmObjectPaged::CollapseParentLocked() {
+    canary_.Assert();
+    DEBUG_ASSERT(lock_.IsHeld());
+
+    while (parent_) {
+        // only paged objects are ever cloned, so our parent is one as well
+        auto parent = static_cast<VmObjectPaged*>(parent_.get());
+
+        // the root owns the lock the whole chain shares, so it has to stay. anything above it
+        // can go once it has no handles, mappings or other children. none of those can come
+        // back: clones only get handles when they're created, and new mappings and clones
+        // need a handle.
+        if (!parent->parent_ || !parent->collapsible_ || !parent->mapping_list_.is_empty() ||
+            parent->children_count_ != 1)
+            return;
+
+        safeint::CheckedNumeric<uint64_t> grandparent_offset = parent_offset_;
+        grandparent_offset += parent->parent_offset_;
+        if (!grandparent_offset.IsValid())
+            return;
+
+        // the range of our offsets that currently show through to the parent, and the part
+        // of that which in turn shows through to the grandparent. anything past our current
+        // size is dropped, so growing later reads zeros there rather than the old parent's pages.
+        const uint64_t visible = MIN(size_, parent_limit_);
+        const uint64_t parent_visible = MIN(parent->size_, parent->parent_limit_);
+        const uint64_t grandparent_visible =
+            MIN(visible, parent_visible > parent_offset_ ? parent_visible - parent_offset_ : 0);
+
+        // take over the parent's pages we can see and haven't already copied, and free the
+        // rest, since nothing else can reach them
+        list_node freed_list;
+        list_initialize(&freed_list);
+        bool moved_all = true;
+        parent->page_list_.ForEveryPage([&](vm_page*& p, uint64_t offset) {
+            if (offset >= parent_offset_ && offset - parent_offset_ < visible &&
+                !page_list_.GetPage(offset - parent_offset_)) {
+                if (page_list_.AddPage(p, offset - parent_offset_) != NO_ERROR) {
+                    moved_all = false;
+                    return;
+                }
+            } else {
+                list_add_tail(&freed_list, &p->free.node);
+            }
+            p = nullptr;
+        });
+        pmm_free(&freed_list);
+
+        // if we ran out of memory part way the parent still has pages we need, so leave it
+        // where it is. what was moved is still correct, as only we could see it anyway.
+        if (!moved_all)
+            return;
+
+        LTRACEF("vmo %p collapsing parent %p into it\n", this, parent);
+
+        // take the parent's place as a child of the grandparent. the parent keeps its own
+        // reference to the grandparent, and its place among the grandparent's children,
+        // until it goes away: a syscall that looked it up just before its last handle was
+        // closed may still be using it, and needs the lock it shares with the chain to
+        // stay alive. such a late user sees the grandparent's pages through it.
+        mxtl::RefPtr<VmObject> old_parent = mxtl::move(parent_);
+        parent->RemoveChildLocked(this);
+        parent->parent_->AddChildLocked(this);
+        parent_ = parent->parent_;
+        parent_offset_ = grandparent_offset.ValueOrDie();
+        parent_limit_ = grandparent_visible;
+
+        // normally this is the last reference, and the old parent takes itself off the
+        // grandparent's children now
+        old_parent.reset();
+
+        atomic_add_u64(&collapsed_clones, 1);
+    }
+}
+
+void VmObjectPaged::OnZeroHandles() {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+    collapsible_ = true;
+}
+
+uint64_t VmObjectPaged::max_clone_chain_depth() {
+    return atomic_load_u64(&max_clone_chain_depth_seen);
+}
+
+uint64_t VmObjectPaged::collapsed_clone_count() {
+    return atomic_load_u64(&collapsed_clones);
+}
+
 // perform some sort of copy in/out on a range of the object using a passed in lambda
 // for the copy routine
 template <typename T>
@@ -636,7 +1226,18 @@ status_t VmObjectPaged::ReadWriteInternal(uint64_t offset, size_t len, size_t* b
 
         // fault in the page
         paddr_t pa;
-        auto status = GetPageLocked(src_offset, VMM_PF_FLAG_SW_FAULT | (write ? VMM_PF_FLAG_WRITE : 0), nullptr, &pa);
+        mxtl::RefPtr<VmPageRequest> page_request;
+        auto status = GetPageLocked(src_offset, VMM_PF_FLAG_SW_FAULT | (write ? VMM_PF_FLAG_WRITE : 0),
+                                    nullptr, &pa, &page_request);
+        if (status == ERR_SHOULD_WAIT) {
+            // wait for the page source without the lock held, then look it up again
+            lock_.Release();
+            status = page_request->Wait();
+            lock_.Acquire();
+            if (status != NO_ERROR)
+                return status;
+            continue;
+        }
         if (status < 0)
             return status;
 
@@ -712,7 +1313,7 @@ status_t VmObjectPaged::Lookup(uint64_t offset, uint64_t len, uint pf_flags,
     size_t index = 0;
     for (uint64_t off = start_page_offset; off != end_page_offset; off += PAGE_SIZE, index++) {
         paddr_t pa;
-        auto status = GetPageLocked(off, pf_flags, nullptr, &pa);
+        auto status = GetPageLocked(off, pf_flags, nullptr, &pa, nullptr);
         if (status < 0)
             return ERR_NO_MEMORY;
 
@@ -821,7 +1422,7 @@ status_t VmObjectPaged::CacheOp(const uint64_t start_offset, const uint64_t len,
 
         // lookup the physical address of the page, careful not to fault in a new one
         paddr_t pa;
-        auto status = GetPageLocked(op_start_offset, 0, nullptr, &pa);
+        auto status = GetPageLocked(op_start_offset, 0, nullptr, &pa, nullptr);
 
         if (likely(status == NO_ERROR)) {
             // Convert the page address to a Kernel virtual address.
@@ -62,7 +62,8 @@ void VmObjectPhysical::Dump(uint depth, bool verbose) {
 }
 
 // get the physical address of a page at offset
-status_t VmObjectPhysical::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** _page, paddr_t* _pa) {
+status_t VmObjectPhysical::GetPageLocked(uint64_t offset, uint pf_flags, vm_page_t** _page, paddr_t* _pa,
+                                         mxtl::RefPtr<VmPageRequest>* page_request) {
     canary_.Assert();
 
     if (_page)
@@ -80,6 +81,21 @@ status_t VmObjectPhysical::GetPageLocked(uint64_t offset, uint pf_flags, vm_page
     return NO_ERROR;
 }
 
+status_t VmObjectPhysical::LookupContiguousLocked(uint64_t offset, uint64_t len, paddr_t* pa) {
+    canary_.Assert();
+
+    if (len == 0 || offset >= size_ || len > size_ - offset)
+        return ERR_OUT_OF_RANGE;
+
+    uint64_t base = base_ + offset;
+    if (base > UINTPTR_MAX || len - 1 > UINTPTR_MAX - base)
+        return ERR_OUT_OF_RANGE;
+
+    *pa = (paddr_t)base;
+
+    return NO_ERROR;
+}
+
 status_t VmObjectPhysical::LookupUser(uint64_t offset, uint64_t len, user_ptr<paddr_t> buffer,
                                       size_t buffer_size) {
     canary_.Assert();
@@ -0,0 +1,118 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/vm/vm_page_source.h>
+
+#include "vm_priv.h"
+
+#include <assert.h>
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/auto_lock.h>
+#include <kernel/vm.h>
+#include <new.h>
+#include <trace.h>
+
+#define LOCAL_TRACE MAX(VM_GLOBAL_TRACE, 0)
+
+VmPageRequest::VmPageRequest(uint64_t offset)
+    : offset_(offset) {
+    event_init(&event_, false, 0);
+}
+
+VmPageRequest::~VmPageRequest() {
+    canary_.Assert();
+    event_destroy(&event_);
+}
+
+status_t VmPageRequest::Wait() {
+    canary_.Assert();
+
+    // let the thread be killed while it waits, in case the page never comes
+    status_t status = event_wait_deadline(&event_, INFINITE_TIME, true);
+    if (status != NO_ERROR)
+        return status;
+
+    return status_;
+}
+
+void VmPageRequest::Complete(status_t status) {
+    canary_.Assert();
+
+    status_ = status;
+    event_signal(&event_, false);
+}
+
+VmPageSource::VmPageSource() {
+    LTRACEF("%p\n", this);
+}
+
+VmPageSource::~VmPageSource() {
+    canary_.Assert();
+    LTRACEF("%p\n", this);
+
+    // the vmo is gone, so anyone still waiting has to go and look again
+    Detach();
+}
+
+status_t VmPageSource::GetPage(uint64_t offset, mxtl::RefPtr<VmPageRequest>* request) {
+    canary_.Assert();
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset));
+    DEBUG_ASSERT(request);
+
+    AutoLock a(&lock_);
+
+    if (detached_)
+        return ERR_BAD_STATE;
+
+    // share a request that is already on its way. a request stays here until
+    // its page is supplied or the source is detached, even if every thread
+    // waiting for it has been killed, so this is one per page asked for and
+    // not yet supplied. that's bounded by what the pager leaves unanswered.
+    for (auto& r : requests_) {
+        if (r.offset() == offset) {
+            *request = mxtl::WrapRefPtr(&r);
+            return ERR_SHOULD_WAIT;
+        }
+    }
+
+    AllocChecker ac;
+    auto r = mxtl::AdoptRef(new (&ac) VmPageRequest(offset));
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    status_t status = SendRequest(offset);
+    if (status != NO_ERROR)
+        return status;
+
+    LTRACEF("source %p requested page at offset %#" PRIx64 "\n", this, offset);
+
+    requests_.push_back(r);
+    *request = mxtl::move(r);
+    return ERR_SHOULD_WAIT;
+}
+
+void VmPageSource::OnPagesSupplied(uint64_t offset, uint64_t len) {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+
+    for (auto iter = requests_.begin(); iter != requests_.end();) {
+        auto cur = iter++;
+        if (cur->offset() >= offset && cur->offset() - offset < len)
+            requests_.erase(cur)->Complete(NO_ERROR);
+    }
+}
+
+void VmPageSource::Detach() {
+    canary_.Assert();
+
+    AutoLock a(&lock_);
+
+    detached_ = true;
+    while (!requests_.is_empty())
+        requests_.pop_front()->Complete(ERR_BAD_STATE);
+}
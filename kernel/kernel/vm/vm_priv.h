@@ -26,6 +26,10 @@ extern uintptr_t boot_alloc_end;
 void vmm_init_preheap(void);
 void vmm_init(void);
 
+// throw away up to count pages that userspace has said it can live without,
+// returning how many were freed
+size_t vm_reclaim_pages(size_t count);
+
 // global vmm lock (for now)
 extern mutex_t vmm_lock;
 
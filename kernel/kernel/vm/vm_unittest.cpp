@@ -6,6 +6,8 @@
 
 #include <assert.h>
 #include <err.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
 #include <kernel/vm.h>
 #include <kernel/vm/vm_address_region.h>
 #include <kernel/vm/vm_aspace.h>
@@ -34,6 +36,149 @@ static bool pmm_smoke_test(void* context) {
     END_TEST;
 }
 
+// Dirties pages, frees them and checks that zeroed allocations come back clean,
+// whether or not they are satisfied from the pre-zeroed pool.
+static bool pmm_alloc_zeroed_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 64;
+
+    auto count = pmm_alloc_pages(alloc_count, 0, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages");
+    vm_page_t* page;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        memset(paddr_to_kvaddr(vm_page_to_paddr(page)), 0xa5, PAGE_SIZE);
+    }
+    pmm_free(&list);
+
+    count = pmm_alloc_pages(alloc_count, PMM_ALLOC_FLAG_ZEROED, &list);
+    EXPECT_EQ(alloc_count, count, "pmm_alloc_pages zeroed");
+    bool all_zero = true;
+    list_for_every_entry (&list, page, vm_page_t, free.node) {
+        EXPECT_EQ(0u, page->flags & VM_PAGE_FLAG_ZEROED, "pool marker cleared");
+        auto ptr = static_cast<const uint8_t*>(paddr_to_kvaddr(vm_page_to_paddr(page)));
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            if (ptr[i] != 0) {
+                all_zero = false;
+                break;
+            }
+        }
+    }
+    EXPECT_TRUE(all_zero, "zeroed pages are filled with zeros");
+    pmm_free(&list);
+
+    paddr_t pa;
+    page = pmm_alloc_page(PMM_ALLOC_FLAG_ZEROED, &pa);
+    REQUIRE_NONNULL(page, "pmm_alloc_page zeroed");
+    auto ptr = static_cast<const uint8_t*>(paddr_to_kvaddr(pa));
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        if (ptr[i] != 0) {
+            EXPECT_EQ(0u, ptr[i], "zeroed page is filled with zeros");
+            break;
+        }
+    }
+    pmm_free_page(page);
+    END_TEST;
+}
+
+// Allocates and frees more single pages than a per-cpu cache holds, making sure
+// pages passing through the cache come back out in a usable state.
+static bool pmm_cache_alloc_test(void* context) {
+    BEGIN_TEST;
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    static const size_t alloc_count = 512;
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        vm_page_t* page = pmm_alloc_page(0, nullptr);
+        REQUIRE_NONNULL(page, "pmm_alloc_page");
+        EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "allocated page state");
+        list_add_tail(&list, &page->free.node);
+    }
+
+    auto ret = pmm_free(&list);
+    EXPECT_EQ(alloc_count, ret, "pmm_free on a list of single pages");
+
+    for (size_t i = 0; i < alloc_count; i++) {
+        vm_page_t* page = pmm_alloc_page(0, nullptr);
+        REQUIRE_NONNULL(page, "pmm_alloc_page after free");
+        EXPECT_EQ(VM_PAGE_STATE_ALLOC, page->state, "reallocated page state");
+        pmm_free_page(page);
+    }
+    END_TEST;
+}
+
+static const size_t kOtherCpuCachedPages = 64;
+
+// Allocates some pages and frees them again, which leaves them in the cache of
+// the cpu it runs on.
+static int pmm_fill_cache_thread(void* arg) {
+    list_node list = LIST_INITIAL_VALUE(list);
+    pmm_alloc_pages(kOtherCpuCachedPages, 0, &list);
+    pmm_free(&list);
+    return 0;
+}
+
+static bool pmm_fill_other_cpu_cache(uint cpu) {
+    BEGIN_TEST;
+    thread_t* t = thread_create("pmm cache fill", pmm_fill_cache_thread, nullptr,
+                                DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    REQUIRE_NONNULL(t, "thread_create");
+    thread_set_pinned_cpu(t, cpu);
+    thread_resume(t);
+    thread_join(t, nullptr, INFINITE_TIME);
+    END_TEST;
+}
+
+// Runs the pmm dry with both single and multi page allocations while another
+// cpu's cache is holding free pages, making sure they are handed out too.
+static bool pmm_alloc_drains_caches_test(void* context) {
+    BEGIN_TEST;
+
+    uint cpu = arch_curr_cpu_num();
+    uint other = cpu;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i != cpu && mp_is_cpu_online(i)) {
+            other = i;
+            break;
+        }
+    }
+    if (other == cpu) {
+        unittest_printf("only one cpu online, skipping\n");
+        END_TEST;
+    }
+
+    // we'll be running the pmm out of pages, so don't get moved onto the cpu
+    // whose cache we're counting on draining
+    int old_pinned_cpu = thread_pinned_cpu(get_current_thread());
+    thread_set_pinned_cpu(get_current_thread(), cpu);
+
+    list_node list = LIST_INITIAL_VALUE(list);
+
+    REQUIRE_TRUE(pmm_fill_other_cpu_cache(other), "");
+    static const size_t alloc_count =
+        (128 * 1024 * 1024 * 1024ULL) / PAGE_SIZE; // 128GB
+    size_t count = pmm_alloc_pages(alloc_count, 0, &list);
+    EXPECT_LT(pmm_count_free_pages(), kOtherCpuCachedPages,
+              "pmm_alloc_pages left pages in another cpu's cache");
+    EXPECT_EQ(count, pmm_free(&list), "pmm_free");
+
+    REQUIRE_TRUE(pmm_fill_other_cpu_cache(other), "");
+    count = 0;
+    vm_page_t* page;
+    while ((page = pmm_alloc_page(0, nullptr))) {
+        list_add_tail(&list, &page->free.node);
+        count++;
+    }
+    EXPECT_LT(pmm_count_free_pages(), kOtherCpuCachedPages,
+              "pmm_alloc_page left pages in another cpu's cache");
+    EXPECT_EQ(count, pmm_free(&list), "pmm_free");
+
+    thread_set_pinned_cpu(get_current_thread(), old_pinned_cpu);
+    END_TEST;
+}
+
 // Allocates a bunch of pages then frees them.
 static bool pmm_large_alloc_test(void* context) {
     BEGIN_TEST;
@@ -51,6 +196,37 @@ static bool pmm_large_alloc_test(void* context) {
     END_TEST;
 }
 
+// Allocates physically contiguous runs of various sizes and alignments.
+static bool pmm_alloc_contiguous_test(void* context) {
+    BEGIN_TEST;
+
+    static const struct {
+        size_t count;
+        uint8_t alignment_log2;
+    } cases[] = {
+        {1, PAGE_SIZE_SHIFT}, {3, PAGE_SIZE_SHIFT}, {16, PAGE_SIZE_SHIFT + 4}, {5, 20}, {512, 21},
+    };
+
+    for (const auto& c : cases) {
+        list_node list = LIST_INITIAL_VALUE(list);
+        paddr_t pa;
+        auto count = pmm_alloc_contiguous(c.count, 0, c.alignment_log2, &pa, &list);
+        REQUIRE_EQ(c.count, count, "pmm_alloc_contiguous");
+        EXPECT_EQ(0u, pa & ((1ul << c.alignment_log2) - 1), "run is aligned");
+
+        paddr_t expected = pa;
+        vm_page_t* page;
+        list_for_every_entry (&list, page, vm_page_t, free.node) {
+            EXPECT_EQ(expected, vm_page_to_paddr(page), "run is contiguous");
+            expected += PAGE_SIZE;
+        }
+
+        auto ret = pmm_free(&list);
+        EXPECT_EQ(c.count, ret, "pmm_free");
+    }
+    END_TEST;
+}
+
 // Allocates too many pages and makes sure it fails nicely.
 static bool pmm_oversized_alloc_test(void* context) {
     BEGIN_TEST;
@@ -619,12 +795,130 @@ static bool vmo_read_write_smoke_test(void* context) {
     END_TEST;
 }
 
+// Unlocks part of a vm object, and checks that reclaim only throws away what's
+// still unlocked and that locking reports it.
+static bool vmo_discardable_test(void* context) {
+    BEGIN_TEST;
+    static const size_t alloc_size = PAGE_SIZE * 4;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+    auto paged = static_cast<VmObjectPaged*>(vmo.get());
+
+    uint64_t committed;
+    auto ret = vmo->CommitRange(0, alloc_size, &committed);
+    REQUIRE_EQ(NO_ERROR, ret, "committing vm object\n");
+
+    EXPECT_EQ(ERR_INVALID_ARGS, vmo->UnlockRange(1, PAGE_SIZE), "unaligned unlock\n");
+    EXPECT_EQ(ERR_OUT_OF_RANGE, vmo->UnlockRange(0, alloc_size * 2), "unlock past end\n");
+
+    // unlock the middle two pages, then take one of them back
+    bool discarded;
+    EXPECT_EQ(NO_ERROR, vmo->UnlockRange(PAGE_SIZE, PAGE_SIZE * 2), "unlocking\n");
+    EXPECT_EQ(NO_ERROR, vmo->LockRange(PAGE_SIZE, PAGE_SIZE, &discarded), "locking\n");
+    EXPECT_FALSE(discarded, "nothing reclaimed yet\n");
+
+    EXPECT_EQ(1u, paged->ReclaimUnlockedPages(), "reclaiming\n");
+
+    EXPECT_EQ(3u, vmo->AllocatedPages(), "only the unlocked page is gone\n");
+    EXPECT_EQ(NO_ERROR, vmo->LockRange(0, alloc_size, &discarded), "locking\n");
+    EXPECT_TRUE(discarded, "unlocked page reclaimed\n");
+
+    // nothing is unlocked anymore
+    EXPECT_EQ(0u, paged->ReclaimUnlockedPages(), "reclaiming\n");
+    EXPECT_EQ(3u, vmo->AllocatedPages(), "locked pages kept\n");
+    EXPECT_EQ(NO_ERROR, vmo->LockRange(0, alloc_size, &discarded), "locking\n");
+    EXPECT_FALSE(discarded, "already locked\n");
+
+    // unlocking a reclaimed range again still reports it discarded when locked
+    EXPECT_EQ(NO_ERROR, vmo->UnlockRange(0, PAGE_SIZE), "unlocking\n");
+    EXPECT_EQ(1u, paged->ReclaimUnlockedPages(), "reclaiming\n");
+    EXPECT_EQ(NO_ERROR, vmo->UnlockRange(0, PAGE_SIZE), "unlocking again\n");
+    EXPECT_EQ(NO_ERROR, vmo->LockRange(0, PAGE_SIZE, &discarded), "locking\n");
+    EXPECT_TRUE(discarded, "discard survives a second unlock\n");
+    EXPECT_EQ(2u, vmo->AllocatedPages(), "reclaimed pages stay gone\n");
+    END_TEST;
+}
+
+// Maps a vmo backed by large pages, and checks that touching it maps a whole
+// large page at once, read only until it is written to.
+static bool vmo_large_page_map_test(void* context) {
+    BEGIN_TEST;
+    if (LARGE_PAGE_SIZE == PAGE_SIZE) {
+        unittest_printf("no large pages on this architecture, skipping\n");
+        END_TEST;
+    }
+
+    static const size_t alloc_size = LARGE_PAGE_SIZE * 2;
+    auto vmo = VmObjectPaged::Create(PMM_ALLOC_FLAG_ANY, alloc_size, VmObjectPaged::kLargePages);
+    REQUIRE_NONNULL(vmo, "vmobject creation\n");
+
+    // commit it up front, since a read fault on a missing page only maps the zero page
+    uint64_t committed;
+    auto ret = vmo->CommitRange(0, alloc_size, &committed);
+    REQUIRE_EQ(NO_ERROR, ret, "committing vm object\n");
+
+    paddr_t large_pa;
+    {
+        AutoLock al(vmo->lock());
+        ret = vmo->LookupContiguousLocked(0, LARGE_PAGE_SIZE, &large_pa);
+    }
+    if (ret != NO_ERROR) {
+        unittest_printf("no physically contiguous memory for a large page, skipping\n");
+        END_TEST;
+    }
+
+    auto ka = VmAspace::kernel_aspace();
+    void* ptr;
+    ret = ka->MapObjectInternal(vmo, "test", 0, alloc_size, &ptr, LARGE_PAGE_SIZE_SHIFT, 0,
+                                kArchRwFlags);
+    REQUIRE_EQ(NO_ERROR, ret, "mapping object");
+    const vaddr_t base = reinterpret_cast<vaddr_t>(ptr);
+    arch_aspace_t* aa = &ka->arch_aspace();
+
+    // a read of one page maps the whole first large page, without write permission
+    __UNUSED uint8_t val = reinterpret_cast<volatile uint8_t*>(base)[PAGE_SIZE * 3];
+    for (size_t off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE) {
+        paddr_t pa;
+        uint flags;
+        ret = arch_mmu_query(aa, base + off, &pa, &flags);
+        if (ret != NO_ERROR || pa != large_pa + off || (flags & ARCH_MMU_FLAG_PERM_WRITE)) {
+            EXPECT_EQ(NO_ERROR, ret, "querying large page\n");
+            EXPECT_EQ(large_pa + off, pa, "large page is contiguous\n");
+            EXPECT_FALSE(flags & ARCH_MMU_FLAG_PERM_WRITE, "read fault maps read only\n");
+            break;
+        }
+    }
+#if ARCH_X86
+    EXPECT_EQ(LARGE_PAGE_SIZE, x86_mmu_mapping_size(aa, base), "mapped with a large page\n");
+#endif
+    EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(aa, base + LARGE_PAGE_SIZE, nullptr, nullptr),
+              "second large page untouched\n");
+
+    // a write makes all of it writable, still as a single large page
+    reinterpret_cast<volatile uint8_t*>(base)[PAGE_SIZE * 5] = 1;
+    uint flags = 0;
+    EXPECT_EQ(NO_ERROR, arch_mmu_query(aa, base + PAGE_SIZE * 7, nullptr, &flags),
+              "querying large page\n");
+    EXPECT_TRUE(flags & ARCH_MMU_FLAG_PERM_WRITE, "write fault maps writable\n");
+#if ARCH_X86
+    EXPECT_EQ(LARGE_PAGE_SIZE, x86_mmu_mapping_size(aa, base), "mapped with a large page\n");
+#endif
+
+    ret = ka->FreeRegion(base);
+    EXPECT_EQ(NO_ERROR, ret, "unmapping object");
+    END_TEST;
+}
+
 // Use the function name as the test name
 #define VM_UNITTEST(fname) UNITTEST(#fname, fname)
 
 UNITTEST_START_TESTCASE(vm_tests)
 VM_UNITTEST(pmm_smoke_test)
+VM_UNITTEST(pmm_alloc_zeroed_test)
+VM_UNITTEST(pmm_cache_alloc_test)
+VM_UNITTEST(pmm_alloc_drains_caches_test)
 VM_UNITTEST(pmm_large_alloc_test)
+VM_UNITTEST(pmm_alloc_contiguous_test)
 VM_UNITTEST(pmm_oversized_alloc_test)
 VM_UNITTEST(vmm_alloc_smoke_test)
 VM_UNITTEST(vmm_alloc_contiguous_smoke_test)
@@ -645,5 +939,7 @@ VM_UNITTEST(vmo_dropped_ref_test)
 VM_UNITTEST(vmo_remap_test)
 VM_UNITTEST(vmo_double_remap_test)
 VM_UNITTEST(vmo_read_write_smoke_test)
+VM_UNITTEST(vmo_discardable_test)
+VM_UNITTEST(vmo_large_page_map_test)
 VM_UNITTEST(dump_all_aspaces) // Run last
 UNITTEST_END_TESTCASE(vm_tests, "vmtests", "Virtual memory tests", nullptr, nullptr);
@@ -8,15 +8,27 @@
 #include <assert.h>
 #include <err.h>
 #include <list.h>
+#include <stdio.h>
 #include <trace.h>
 
 #include <kernel/event.h>
 #include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <lk/init.h>
 
-static spin_lock_t dpc_lock = SPIN_LOCK_INITIAL_VALUE;
-static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
-static event_t dpc_event = EVENT_INITIAL_VALUE(dpc_event, false, 0);
+// Each cpu has its own list of pending dpcs and its own worker thread,
+// pinned to that cpu, so deferred work runs where it was queued.
+struct dpc_queue {
+    spin_lock_t lock;
+    struct list_node list;
+    event_t event;
+
+    // set by dpc_shutdown() to make the worker exit
+    bool stop;
+    thread_t *thread;
+};
+
+static struct dpc_queue dpc_queues[SMP_MAX_CPUS];
 
 status_t dpc_queue(dpc_t *dpc, bool reschedule)
 {
@@ -26,14 +38,20 @@ status_t dpc_queue(dpc_t *dpc, bool reschedule)
     if (list_in_list(&dpc->node))
         return NO_ERROR;
 
+    // keep interrupts off while using the local cpu's queue, so that we
+    // can't be migrated between picking the queue and locking it
     spin_lock_saved_state_t state;
-    spin_lock_irqsave(&dpc_lock, state);
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    struct dpc_queue *q = &dpc_queues[arch_curr_cpu_num()];
+    spin_lock(&q->lock);
 
     // put the dpc at the tail of the list and signal the worker
-    list_add_tail(&dpc_list, &dpc->node);
-    event_signal(&dpc_event, false);
+    list_add_tail(&q->list, &dpc->node);
+    event_signal(&q->event, false);
 
-    spin_unlock_irqrestore(&dpc_lock, state);
+    spin_unlock(&q->lock);
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
 
     // reschedule here if asked to
     if (reschedule)
@@ -44,36 +62,145 @@ status_t dpc_queue(dpc_t *dpc, bool reschedule)
 
 static int dpc_thread(void *arg)
 {
+    struct dpc_queue *q = arg;
+
     for (;;) {
         // wait for a dpc to fire
-        __UNUSED status_t err = event_wait(&dpc_event);
+        __UNUSED status_t err = event_wait(&q->event);
         DEBUG_ASSERT(err == NO_ERROR);
 
         spin_lock_saved_state_t state;
-        spin_lock_irqsave(&dpc_lock, state);
+        spin_lock_irqsave(&q->lock, state);
+
+        if (q->stop) {
+            spin_unlock_irqrestore(&q->lock, state);
+            return 0;
+        }
 
         // pop a dpc off the list
-        dpc_t *dpc = list_remove_head_type(&dpc_list, dpc_t, node);
+        dpc_t *dpc = list_remove_head_type(&q->list, dpc_t, node);
 
         // if the list is now empty, unsignal the event so we block until it is
         if (!dpc)
-            event_unsignal(&dpc_event);
+            event_unsignal(&q->event);
 
-        spin_unlock_irqrestore(&dpc_lock, state);
+        spin_unlock_irqrestore(&q->lock, state);
 
         // call the dpc
         if (dpc && dpc->func)
             dpc->func(dpc);
     }
 
-
     return 0;
 }
 
+// Stop the worker for the given cpu and wait for it to exit.  Any dpcs
+// queued on the cpu after this stay put until dpc_transition_off_cpu().
+void dpc_shutdown(uint cpu)
+{
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    struct dpc_queue *q = &dpc_queues[cpu];
+    thread_t *t = q->thread;
+    if (!t)
+        return;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&q->lock, state);
+    q->stop = true;
+    event_signal(&q->event, false);
+    spin_unlock_irqrestore(&q->lock, state);
+
+    __UNUSED status_t err = thread_join(t, NULL, INFINITE_TIME);
+    DEBUG_ASSERT(err == NO_ERROR);
+    q->thread = NULL;
+}
+
+// Move every dpc still queued on old_cpu over to the current cpu.  Used
+// once old_cpu has been taken out of the scheduler.
+void dpc_transition_off_cpu(uint old_cpu)
+{
+    DEBUG_ASSERT(old_cpu < SMP_MAX_CPUS);
+
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    uint cpu = arch_curr_cpu_num();
+    DEBUG_ASSERT(cpu != old_cpu);
+
+    struct dpc_queue *src = &dpc_queues[old_cpu];
+    struct dpc_queue *dst = &dpc_queues[cpu];
+
+    spin_lock(&src->lock);
+    spin_lock(&dst->lock);
+
+    dpc_t *dpc;
+    bool moved = false;
+    while ((dpc = list_remove_head_type(&src->list, dpc_t, node))) {
+        list_add_tail(&dst->list, &dpc->node);
+        moved = true;
+    }
+    if (moved)
+        event_signal(&dst->event, false);
+    event_unsignal(&src->event);
+
+    spin_unlock(&dst->lock);
+    spin_unlock(&src->lock);
+
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static void dpc_start_worker(uint cpu)
+{
+    struct dpc_queue *q = &dpc_queues[cpu];
+
+    DEBUG_ASSERT(q->thread == NULL);
+    q->stop = false;
+
+    char name[16];
+    snprintf(name, sizeof(name), "dpc %u", cpu);
+    thread_t *t = thread_create(name, &dpc_thread, q, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!t) {
+        panic("dpc: unable to create worker for cpu %u\n", cpu);
+    }
+    thread_set_pinned_cpu(t, cpu);
+    q->thread = t;
+    thread_resume(t);
+}
+
+// Start a new worker for a cpu whose worker was stopped by dpc_shutdown(),
+// for when the unplug of that cpu fails before it is taken down.
+void dpc_restart(uint cpu)
+{
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+
+    dpc_start_worker(cpu);
+}
+
+// Start the worker for the current cpu.  Runs on every cpu as it comes up,
+// including when a previously unplugged cpu is brought back.
+static void dpc_init_for_cpu(void)
+{
+    dpc_start_worker(arch_curr_cpu_num());
+}
+
 static void dpc_init(unsigned int level)
 {
-    thread_t *t = thread_create("dpc", &dpc_thread, NULL, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
-    thread_detach_and_resume(t);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        struct dpc_queue *q = &dpc_queues[i];
+        q->lock = SPIN_LOCK_INITIAL_VALUE;
+        list_initialize(&q->list);
+        event_init(&q->event, false, 0);
+    }
+
+    dpc_init_for_cpu();
+}
+
+static void dpc_init_secondary(unsigned int level)
+{
+    dpc_init_for_cpu();
 }
 
 LK_INIT_HOOK(dpc, dpc_init, LK_INIT_LEVEL_THREADING);
+LK_INIT_HOOK_FLAGS(dpc_secondary, dpc_init_secondary, LK_INIT_LEVEL_THREADING,
+                   LK_INIT_FLAG_SECONDARY_CPUS);
@@ -21,7 +21,16 @@ typedef struct dpc {
     void *arg;
 } dpc_t;
 
+/* Queue a dpc to run on the current cpu's dpc thread.  May be called from
+ * interrupt context. */
 status_t dpc_queue(dpc_t *dpc, bool reschedule);
 
+/* cpu hotplug support: stop the dpc thread of a cpu that is about to be
+ * unplugged, then move whatever it left queued to the current cpu.
+ * dpc_restart() brings the thread back if the unplug fails in between. */
+void dpc_shutdown(uint cpu);
+void dpc_restart(uint cpu);
+void dpc_transition_off_cpu(uint old_cpu);
+
 __END_CDECLS
 
@@ -0,0 +1,123 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <kernel/cpu_mask.h>
+#include <unittest.h>
+
+// cpus either side of each word boundary, and the last cpu there is
+static const uint test_cpus[] = {
+    0, 1, 31, 32, 63, 64, 65, 127, 128, 255, SMP_MAX_CPUS - 1,
+};
+
+#define for_each_test_cpu(cpu)                                          \
+    for (uint _i = 0; _i < countof(test_cpus); _i++)                    \
+        if (((cpu) = test_cpus[_i]) < SMP_MAX_CPUS)
+
+static bool cpu_mask_set_test(void* context)
+{
+    BEGIN_TEST;
+    uint cpu;
+
+    mp_cpu_mask_t none = mp_cpu_mask_none();
+    EXPECT_TRUE(mp_cpu_mask_is_empty(&none), "");
+    EXPECT_EQ(0u, mp_cpu_mask_count(&none), "");
+    EXPECT_EQ((uint)SMP_MAX_CPUS, mp_cpu_mask_first(&none), "");
+    EXPECT_EQ((uint)SMP_MAX_CPUS, mp_cpu_mask_last(&none), "");
+
+    for_each_test_cpu(cpu) {
+        mp_cpu_mask_t m = mp_cpu_mask_of(cpu);
+        EXPECT_TRUE(mp_cpu_mask_test(&m, cpu), "");
+        EXPECT_EQ(1u, mp_cpu_mask_count(&m), "");
+        EXPECT_EQ(cpu, mp_cpu_mask_first(&m), "");
+        EXPECT_EQ(cpu, mp_cpu_mask_last(&m), "");
+        EXPECT_EQ(cpu, mp_cpu_mask_next(&m, cpu), "");
+        EXPECT_EQ((uint)SMP_MAX_CPUS, mp_cpu_mask_next(&m, cpu + 1), "");
+
+        mp_cpu_mask_clear(&m, cpu);
+        EXPECT_TRUE(mp_cpu_mask_is_empty(&m), "");
+        mp_cpu_mask_set(&m, cpu);
+        mp_cpu_mask_t of = mp_cpu_mask_of(cpu);
+        EXPECT_TRUE(mp_cpu_mask_equal(&m, &of), "");
+    }
+    END_TEST;
+}
+
+static bool cpu_mask_ops_test(void* context)
+{
+    BEGIN_TEST;
+    uint cpu;
+
+    // every other test cpu in a, all of them in b
+    mp_cpu_mask_t a = mp_cpu_mask_none();
+    mp_cpu_mask_t b = mp_cpu_mask_none();
+    uint expected = 0;
+    uint n = 0;
+    for_each_test_cpu(cpu) {
+        if (!mp_cpu_mask_test(&b, cpu))
+            expected++;
+        mp_cpu_mask_set(&b, cpu);
+        if (n++ % 2 == 0)
+            mp_cpu_mask_set(&a, cpu);
+    }
+    EXPECT_EQ(expected, mp_cpu_mask_count(&b), "");
+
+    mp_cpu_mask_t both = mp_cpu_mask_and(&a, &b);
+    EXPECT_TRUE(mp_cpu_mask_equal(&both, &a), "");
+    mp_cpu_mask_t either = mp_cpu_mask_or(&a, &b);
+    EXPECT_TRUE(mp_cpu_mask_equal(&either, &b), "");
+    mp_cpu_mask_t andnot = mp_cpu_mask_andnot(&b, &a);
+    EXPECT_EQ(mp_cpu_mask_count(&b) - mp_cpu_mask_count(&a), mp_cpu_mask_count(&andnot), "");
+    both = mp_cpu_mask_and(&andnot, &a);
+    EXPECT_TRUE(mp_cpu_mask_is_empty(&both), "");
+
+    // for_each visits exactly the set cpus, in increasing order
+    uint visited = 0;
+    uint prev = 0;
+    mp_cpu_mask_for_each(cpu, &b) {
+        EXPECT_TRUE(mp_cpu_mask_test(&b, cpu), "");
+        if (visited > 0)
+            EXPECT_LT(prev, cpu, "");
+        prev = cpu;
+        visited++;
+    }
+    EXPECT_EQ(mp_cpu_mask_count(&b), visited, "");
+    EXPECT_EQ(prev, mp_cpu_mask_last(&b), "");
+    END_TEST;
+}
+
+static bool cpu_mask_atomic_test(void* context)
+{
+    BEGIN_TEST;
+    uint cpu;
+
+    mp_cpu_mask_t expected = mp_cpu_mask_none();
+    volatile mp_cpu_mask_t m = MP_CPU_MASK_INITIAL_VALUE;
+    for_each_test_cpu(cpu) {
+        mp_cpu_mask_atomic_set(&m, cpu);
+        mp_cpu_mask_set(&expected, cpu);
+        EXPECT_TRUE(mp_cpu_mask_atomic_test(&m, cpu), "");
+    }
+    mp_cpu_mask_t loaded = mp_cpu_mask_atomic_load(&m);
+    EXPECT_TRUE(mp_cpu_mask_equal(&loaded, &expected), "");
+
+    cpu = mp_cpu_mask_last(&expected);
+    EXPECT_TRUE(mp_cpu_mask_atomic_clear(&m, cpu), "");
+    EXPECT_FALSE(mp_cpu_mask_atomic_clear(&m, cpu), "");
+    mp_cpu_mask_t last = mp_cpu_mask_of(cpu);
+    mp_cpu_mask_atomic_or(&m, &last);
+
+    loaded = mp_cpu_mask_atomic_swap_none(&m);
+    EXPECT_TRUE(mp_cpu_mask_equal(&loaded, &expected), "");
+    loaded = mp_cpu_mask_atomic_load(&m);
+    EXPECT_TRUE(mp_cpu_mask_is_empty(&loaded), "");
+    END_TEST;
+}
+
+UNITTEST_START_TESTCASE(cpu_mask_tests)
+UNITTEST("cpu mask set and test", cpu_mask_set_test)
+UNITTEST("cpu mask operations", cpu_mask_ops_test)
+UNITTEST("cpu mask atomics", cpu_mask_atomic_test)
+UNITTEST_END_TESTCASE(cpu_mask_tests, "cpumask", "cpu mask tests", NULL, NULL);
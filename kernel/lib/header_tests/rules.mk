@@ -9,6 +9,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS := \
+    $(LOCAL_DIR)/cpu_mask_tests.c \
     $(LOCAL_DIR)/pow2_tests.c \
 
 MODULE_DEPS = kernel/lib/unittest
@@ -27,7 +27,8 @@ FutexContext::~FutexContext() {
     DEBUG_ASSERT(futex_table_.is_empty());
 }
 
-status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline) {
+status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline,
+                                 thread_t* pi_owner) {
     LTRACE_ENTRY;
 
     uintptr_t futex_key = reinterpret_cast<uintptr_t>(value_ptr.get());
@@ -58,12 +59,21 @@ status_t FutexContext::FutexWait(user_ptr<int> value_ptr, int current_value, mx_
     UserThread* thread = UserThread::GetCurrent();
     node = thread->futex_node();
     node->set_hash_key(futex_key);
+    node->set_waiter(thread->kernel_thread(), pi_owner != nullptr);
     node->SetAsSingletonList();
 
     QueueNodesLocked(node);
 
+    // The newest waiter has the freshest idea of who owns the lock, so move
+    // the other waiters' loans over to it.
+    if (pi_owner) {
+        auto iter = futex_table_.find(futex_key);
+        DEBUG_ASSERT(iter.IsValid());
+        FutexNode::SetPiOwner(&*iter, pi_owner);
+    }
+
     // Block current thread.  This releases lock_ and does not reacquire it.
-    result = node->BlockThread(&lock_, deadline);
+    result = node->BlockThread(&lock_, deadline, pi_owner);
     if (result == NO_ERROR) {
         // Fix/workaround for MG-624:
         // We must re-acquire the lock here to force this thread to wait until
@@ -131,6 +141,11 @@ status_t FutexContext::FutexWake(user_ptr<const int> value_ptr,
         if (node != nullptr) {
             DEBUG_ASSERT(node->GetKey() == futex_key);
             futex_table_.insert(node);
+
+            // A single woken thread is about to take the lock, so whoever is
+            // still waiting now waits on it. Otherwise we can't tell who
+            // will win.
+            FutexNode::SetPiOwner(node, count == 1 ? wake_head->waiter() : nullptr);
         }
 
         // Traversing this list of threads must be done while holding the
@@ -188,8 +203,10 @@ status_t FutexContext::FutexRequeue(user_ptr<int> wake_ptr, uint32_t wake_count,
             node = FutexNode::RemoveFromHead(node, requeue_count,
                                              wake_key, requeue_key);
 
-            // now requeue our nodes to requeue_ptr mutex
+            // now requeue our nodes to requeue_ptr mutex. Their priority
+            // loans were for the owner of the lock at wake_ptr.
             DEBUG_ASSERT(requeue_head->GetKey() == requeue_key);
+            FutexNode::SetPiOwner(requeue_head, nullptr);
             QueueNodesLocked(requeue_head);
         }
     }
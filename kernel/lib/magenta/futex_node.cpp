@@ -105,7 +105,8 @@ FutexNode* FutexNode::RemoveFromHead(FutexNode* list_head, uint32_t count,
 // This blocks the current thread.  This releases the given mutex (which
 // must be held when BlockThread() is called).  To reduce contention, it
 // does not reclaim the mutex on return.
-status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline) TA_NO_THREAD_SAFETY_ANALYSIS {
+status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline,
+                                thread_t* pi_owner) TA_NO_THREAD_SAFETY_ANALYSIS {
     THREAD_LOCK(state);
 
     // We specifically want reschedule=false here, otherwise the
@@ -118,9 +119,13 @@ status_t FutexNode::BlockThread(Mutex* mutex, mx_time_t deadline) TA_NO_THREAD_S
     // otherwise we could miss a thread termination.
     thread_t* current_thread = get_current_thread();
     status_t result;
+    if (pi_owner)
+        thread_pi_block_on(current_thread, pi_owner);
     current_thread->interruptable = true;
     result = wait_queue_block(&wait_queue_, deadline);
     current_thread->interruptable = false;
+    // The waker normally does this, but not if we timed out or were killed.
+    thread_pi_unblock(current_thread);
 
     THREAD_UNLOCK(state);
 
@@ -134,6 +139,8 @@ void FutexNode::WakeThreads(FutexNode* head) {
     do {
         FutexNode* next = node->queue_next_;
         THREAD_LOCK(state);
+        if (node->pi_)
+            thread_pi_unblock(node->waiter_);
         wait_queue_wake_one(&node->wait_queue_, true, NO_ERROR);
         THREAD_UNLOCK(state);
         node->MarkAsNotInQueue();
@@ -141,6 +148,25 @@ void FutexNode::WakeThreads(FutexNode* head) {
     } while (node != head);
 }
 
+void FutexNode::SetPiOwner(FutexNode* head, thread_t* owner) {
+    if (!head)
+        return;
+    THREAD_LOCK(state);
+    FutexNode* node = head;
+    do {
+        // A waiter that timed out is already running, on its way to remove
+        // itself from the queue.
+        if (node->pi_ && node->waiter_->state == THREAD_BLOCKED) {
+            if (owner)
+                thread_pi_block_on(node->waiter_, owner);
+            else
+                thread_pi_unblock(node->waiter_);
+        }
+        node = node->queue_next_;
+    } while (node != head);
+    THREAD_UNLOCK(state);
+}
+
 // Set |node1| and |node2|'s list pointers so that |node1| is immediately
 // before |node2| in the linked list.
 void FutexNode::RelinkAsAdjacent(FutexNode* node1, FutexNode* node2) {
@@ -68,7 +68,9 @@ public:
     // See also: comments in ChannelDispatcher::Call()
     class MessageWaiter : public mxtl::DoublyLinkedListable<MessageWaiter*> {
     public:
-        MessageWaiter() : txid_(0), status_(ERR_BAD_STATE) {
+        // The reply is delivered by a thread that is about to go back to
+        // waiting for the next request, so let the caller wake up near it.
+        MessageWaiter() : event_(EVENT_FLAG_SYNC_WAKE), txid_(0), status_(ERR_BAD_STATE) {
         }
 
         ~MessageWaiter() {
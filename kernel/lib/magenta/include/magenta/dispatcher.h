@@ -48,6 +48,7 @@ DECLARE_DISPTAG(FifoDispatcher, MX_OBJ_TYPE_FIFO)
 DECLARE_DISPTAG(PortDispatcherV2, MX_OBJ_TYPE_IOPORT2)
 DECLARE_DISPTAG(HypervisorDispatcher, MX_OBJ_TYPE_HYPERVISOR)
 DECLARE_DISPTAG(GuestDispatcher, MX_OBJ_TYPE_GUEST)
+DECLARE_DISPTAG(PagerDispatcher, MX_OBJ_TYPE_PAGER)
 
 #undef DECLARE_DISPTAG
 
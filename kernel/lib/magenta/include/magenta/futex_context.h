@@ -33,9 +33,14 @@ public:
     // Otherwise it will block the current thread until the |deadline| passes,
     // or until the thread is woken by a FutexWake or FutexRequeue operation
     // on the same |value_ptr| futex.
-    status_t FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline);
+    // If |pi_owner| is non-null, it is the thread holding the lock the futex
+    // implements, and it inherits the priority of the threads waiting on it.
+    status_t FutexWait(user_ptr<int> value_ptr, int current_value, mx_time_t deadline,
+                       thread_t* pi_owner);
 
     // FutexWake will wake up to |count| number of threads blocked on the |value_ptr| futex.
+    // When exactly one thread is woken, it is taken to be the new owner of the
+    // lock, and any priority inheriting waiters left lend it their priority.
     status_t FutexWake(user_ptr<const int> value_ptr, uint32_t count);
 
     // FutexWait first verifies that the integer pointed to by |wake_ptr|
@@ -39,15 +39,30 @@ public:
                                      uintptr_t new_hash_key);
 
     // This must be called with |mutex| held and returns without |mutex| held.
-    status_t BlockThread(Mutex* mutex, mx_time_t deadline) TA_REL(mutex);
+    // If |pi_owner| is non-null, it inherits the current thread's priority
+    // while the thread is blocked.
+    status_t BlockThread(Mutex* mutex, mx_time_t deadline, thread_t* pi_owner) TA_REL(mutex);
 
     // wakes the list of threads starting with node |head|
     static void WakeThreads(FutexNode* head);
 
+    // Makes the blocked priority inheriting waiters in the list starting
+    // with node |head| lend their priority to |owner| instead of whoever
+    // they were lending it to, or to nobody if |owner| is null.
+    static void SetPiOwner(FutexNode* head, thread_t* owner);
+
     void set_hash_key(uintptr_t key) {
         hash_key_ = key;
     }
 
+    // The thread waiting on this node, and whether it waited with
+    // mx_futex_wait_pi(). Set before the node is queued.
+    void set_waiter(thread_t* waiter, bool pi) {
+        waiter_ = waiter;
+        pi_ = pi;
+    }
+    thread_t* waiter() const { return waiter_; }
+
     // Trait implementation for mxtl::HashTable
     uintptr_t GetKey() const { return hash_key_; }
     static size_t GetHash(uintptr_t key) { return (key >> 3); }
@@ -69,6 +84,9 @@ private:
     // Used for waking the thread corresponding to the FutexNode.
     wait_queue_t wait_queue_;
 
+    thread_t* waiter_ = nullptr;
+    bool pi_ = false;
+
     // queue_prev_ and queue_next_ are used for maintaining a circular
     // doubly-linked list of threads that are waiting on one futex address.
     //  * When the list contains only this node, queue_prev_ and
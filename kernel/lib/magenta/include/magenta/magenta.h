@@ -43,6 +43,10 @@ mxtl::RefPtr<JobDispatcher> GetRootJobDispatcher();
 
 PolicyManager* GetSystemPolicyManager();
 
+// The event that MX_SYSTEM_MEMORY_WARNING and MX_SYSTEM_MEMORY_CRITICAL are
+// asserted on while free memory is low.
+mxtl::RefPtr<Dispatcher> GetLowMemoryEvent();
+
 bool magenta_rights_check(const Handle* handle, mx_rights_t desired);
 
 mx_status_t magenta_sleep(mx_time_t deadline);
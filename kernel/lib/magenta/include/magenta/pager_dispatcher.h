@@ -0,0 +1,79 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#pragma once
+
+#include <kernel/mutex.h>
+#include <kernel/vm/vm_object.h>
+#include <kernel/vm/vm_page_source.h>
+#include <magenta/dispatcher.h>
+#include <magenta/port_dispatcher_v2.h>
+#include <magenta/types.h>
+#include <mxtl/canary.h>
+#include <mxtl/intrusive_double_list.h>
+
+#include <sys/types.h>
+
+class PagerDispatcher;
+
+// Supplies the pages of one vmo by queueing a packet on a port for each page
+// that is needed, for the pager's owner to answer with mx_pager_supply_pages().
+class PagerSource final : public VmPageSource,
+                          public PortCloseObserver,
+                          public mxtl::DoublyLinkedListable<PagerSource*> {
+public:
+    PagerSource(mxtl::RefPtr<PagerDispatcher> pager, mxtl::RefPtr<PortDispatcherV2> port,
+                uint64_t key);
+    ~PagerSource() final;
+
+    // Starts watching the port, so that closing it fails the requests that
+    // were queued there.
+    void Init();
+
+private:
+    status_t SendRequest(uint64_t offset) final;
+    void OnPortClosed() final;
+
+    const mxtl::RefPtr<PagerDispatcher> pager_;
+    const mxtl::RefPtr<PortDispatcherV2> port_;
+    const uint64_t key_;
+    bool observing_port_ = false;
+};
+
+class PagerDispatcher final : public Dispatcher {
+public:
+    static status_t Create(uint32_t options, mxtl::RefPtr<Dispatcher>* dispatcher,
+                           mx_rights_t* rights);
+
+    ~PagerDispatcher() final;
+    mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_PAGER; }
+
+    void on_zero_handles() final;
+
+    // Makes a source for a new vmo that sends its page requests to port.
+    status_t CreateSource(mxtl::RefPtr<PortDispatcherV2> port, uint64_t key,
+                          mxtl::RefPtr<VmPageSource>* source);
+
+    // Moves the pages backing a range of aux_vmo into the same size range of
+    // vmo, which must be one of this pager's.
+    status_t SupplyPages(mxtl::RefPtr<VmObject> vmo, uint64_t offset, uint64_t length,
+                         mxtl::RefPtr<VmObject> aux_vmo, uint64_t aux_offset);
+
+private:
+    friend class PagerSource;
+
+    explicit PagerDispatcher(uint32_t options);
+
+    void RemoveSource(PagerSource* source);
+
+    mxtl::Canary<mxtl::magic("PGRD")> canary_;
+
+    Mutex lock_;
+    bool zero_handles_ TA_GUARDED(lock_) = false;
+    // the sources hold a reference to us, and take themselves off this list
+    // when the vmo they belong to goes away
+    mxtl::DoublyLinkedList<PagerSource*> sources_ TA_GUARDED(lock_);
+};
@@ -88,6 +88,11 @@ struct PortPacket final : public mxtl::DoublyLinkedListable<PortPacket*> {
     void operator=(PortPacket) = delete;
 
     uint32_t type() const { return packet.type; }
+    // Packets not owned by an observer are allocated when queued, and freed
+    // when dequeued.
+    bool is_allocated() const {
+        return packet.type == MX_PKT_TYPE_USER || packet.type == MX_PKT_TYPE_PAGE_REQUEST;
+    }
 };
 
 // Observers are weakly contained in state trackers until |remove_| member
@@ -123,6 +128,29 @@ private:
     PortPacket packet_;
 };
 
+// Something that queues packets on a port and waits for answers to them, and
+// so needs to hear when the port loses its last handle and the answers stop.
+class PortCloseObserver {
+public:
+    // Called once, after the port's queued packets have been dropped. No port
+    // locks are held, but the observer must not queue on the port from here.
+    virtual void OnPortClosed() = 0;
+
+protected:
+    ~PortCloseObserver() {}
+
+private:
+    friend struct PortCloseObserverListTraits;
+    mxtl::DoublyLinkedListNodeState<PortCloseObserver*> port_close_list_node_state_;
+};
+
+struct PortCloseObserverListTraits {
+    inline static mxtl::DoublyLinkedListNodeState<PortCloseObserver*>& node_state(
+            PortCloseObserver& obj) {
+        return obj.port_close_list_node_state_;
+    }
+};
+
 class PortDispatcherV2 final : public Dispatcher {
 public:
     static status_t Create(uint32_t options,
@@ -136,6 +164,8 @@ public:
 
     mx_status_t Queue(PortPacket* port_packet, mx_signals_t observed, uint64_t count);
     mx_status_t QueueUser(const mx_port_packet_t& packet);
+    // Queues a copy of a packet generated by the kernel, such as a page request.
+    mx_status_t QueueKernel(const mx_port_packet_t& packet);
     mx_status_t DeQueue(mx_time_t deadline, mx_port_packet_t* packet);
 
     // Decides who is going to destroy the observer. If it returns |true| it
@@ -146,8 +176,15 @@ public:
     mx_status_t MakeObservers(uint32_t options, Handle* handle,
                               uint64_t key, mx_signals_t signals);
 
+    // Has |observer| told when the port loses its last handle. Returns false
+    // without adding it if that has already happened. An observer that was
+    // added must remove itself before it is destroyed.
+    bool AddCloseObserver(PortCloseObserver* observer);
+    void RemoveCloseObserver(PortCloseObserver* observer);
+
 private:
     PortDispatcherV2(uint32_t options);
+    mx_status_t QueueCopy(const mx_port_packet_t& packet);
     PortObserver* CopyLocked(PortPacket* port_packet, mx_port_packet_t* packet) TA_REQ(lock_);
 
     mxtl::Canary<mxtl::magic("POR2")> canary_;
@@ -155,4 +192,11 @@ private:
     Semaphore sema_;
     bool zero_handles_ TA_GUARDED(lock_);
     mxtl::DoublyLinkedList<PortPacket*> packets_ TA_GUARDED(lock_);
+
+    // separate from |lock_|, since observers queue packets while holding
+    // locks of their own that OnPortClosed() takes
+    Mutex close_lock_;
+    bool closed_ TA_GUARDED(close_lock_) = false;
+    mxtl::DoublyLinkedList<PortCloseObserver*, PortCloseObserverListTraits>
+        close_observers_ TA_GUARDED(close_lock_);
 };
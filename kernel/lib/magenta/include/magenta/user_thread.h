@@ -97,11 +97,20 @@ public:
     ThreadDispatcher* dispatcher() { return dispatcher_; }
 
     FutexNode* futex_node() { return &futex_node_; }
+    thread_t* kernel_thread() { return &thread_; }
     StateTracker* state_tracker() { return &state_tracker_; }
     const char* name() const { return thread_.name; }
     status_t set_name(const char* name, size_t len);
     void get_name(char out_name[MX_MAX_NAME_LEN]);
     uint64_t runtime_ns() const { return thread_runtime(&thread_); }
+    lk_time_t timer_slack() const { return thread_get_timer_slack(&thread_); }
+    status_t set_timer_slack(lk_time_t slack) { return thread_set_timer_slack(&thread_, slack); }
+    void get_deadline(lk_time_t* runtime, lk_time_t* deadline, lk_time_t* period) {
+        thread_get_deadline(&thread_, runtime, deadline, period);
+    }
+    status_t set_deadline(lk_time_t runtime, lk_time_t deadline, lk_time_t period) {
+        return thread_set_deadline(&thread_, runtime, deadline, period);
+    }
 
     status_t SetExceptionPort(ThreadDispatcher* td, mxtl::RefPtr<ExceptionPort> eport);
     // Returns true if a port had been set.
@@ -138,6 +147,9 @@ public:
     // Fetch the state of the thread for userspace tools.
     void GetInfoForUserspace(mx_info_thread_t* info);
 
+    // Fetch the scheduler statistics of the thread for userspace tools.
+    void GetStatsForUserspace(mx_info_thread_stats_t* info);
+
     // For debugger usage.
     // TODO(dje): The term "state" here conflicts with "state tracker".
     uint32_t get_num_state_kinds() const;
@@ -24,6 +24,7 @@ public:
 
     ~VmObjectDispatcher() final;
     mx_obj_type_t get_type() const final { return MX_OBJ_TYPE_VMEM; }
+    void on_zero_handles() final;
     StateTracker* get_state_tracker() final { return &state_tracker_; }
     CookieJar* get_cookie_jar() final { return &cookie_jar_; }
 
@@ -36,6 +37,11 @@ public:
     mx_status_t RangeOp(uint32_t op, uint64_t offset, uint64_t size, user_ptr<void> buffer, size_t buffer_size);
     mx_status_t Clone(uint32_t options, uint64_t offset, uint64_t size, mxtl::RefPtr<VmObject>* clone_vmo);
 
+    // move the pages backing a page aligned range of |src| into this vmo, leaving
+    // the source range decommitted
+    mx_status_t TransferFrom(uint64_t offset, VmObjectDispatcher* src, uint64_t src_offset,
+                             uint64_t length);
+
     mxtl::RefPtr<VmObject> vmo() const { return vmo_; }
 
 private:
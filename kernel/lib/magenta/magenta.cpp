@@ -12,12 +12,14 @@
 #include <kernel/auto_lock.h>
 #include <kernel/cmdline.h>
 #include <kernel/mutex.h>
+#include <kernel/vm.h>
 
 #include <lk/init.h>
 
 #include <lib/console.h>
 
 #include <magenta/dispatcher.h>
+#include <magenta/event_dispatcher.h>
 #include <magenta/excp_port.h>
 #include <magenta/job_dispatcher.h>
 #include <magenta/handle.h>
@@ -64,11 +66,36 @@ static bool fatal_small_deadlines = false;
 // a magenta internal class (not a dispatcher-derived).
 static PolicyManager* policy_manager;
 
+// Event that carries the MX_SYSTEM_MEMORY_* signals for the pmm's memory level.
+static mxtl::RefPtr<Dispatcher> low_memory_event;
+
+static void low_memory_level_changed(pmm_mem_level_t level) {
+    mx_signals_t set = 0u;
+    switch (level) {
+    case PMM_MEM_LEVEL_CRITICAL:
+        set |= MX_SYSTEM_MEMORY_CRITICAL;
+        // fall through
+    case PMM_MEM_LEVEL_WARNING:
+        set |= MX_SYSTEM_MEMORY_WARNING;
+        break;
+    case PMM_MEM_LEVEL_NORMAL:
+        break;
+    }
+
+    constexpr mx_signals_t kAll = MX_SYSTEM_MEMORY_WARNING | MX_SYSTEM_MEMORY_CRITICAL;
+    low_memory_event->get_state_tracker()->UpdateState(kAll & ~set, set);
+}
+
 void magenta_init(uint level) TA_NO_THREAD_SAFETY_ANALYSIS {
     handle_arena.Init("handles", sizeof(Handle), kMaxHandleCount);
     root_job = JobDispatcher::CreateRootJob();
     fatal_small_deadlines = cmdline_get_bool("magenta.fatal_small_deadlines", false);
     policy_manager = PolicyManager::Create(POL_ACTION_ALLOW);
+
+    mx_rights_t rights;
+    status_t status = EventDispatcher::Create(0u, &low_memory_event, &rights);
+    ASSERT(status == NO_ERROR);
+    pmm_set_mem_level_callback(&low_memory_level_changed);
 }
 
 // Masks for building a Handle's base_value, which ProcessDispatcher
@@ -269,6 +296,10 @@ PolicyManager* GetSystemPolicyManager() {
     return policy_manager;
 }
 
+mxtl::RefPtr<Dispatcher> GetLowMemoryEvent() {
+    return low_memory_event;
+}
+
 bool magenta_rights_check(const Handle* handle, mx_rights_t desired) {
     auto actual = handle->rights();
     if ((actual & desired) == desired)
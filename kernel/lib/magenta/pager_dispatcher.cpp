@@ -0,0 +1,161 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <magenta/pager_dispatcher.h>
+
+#include <err.h>
+#include <inttypes.h>
+#include <kernel/auto_lock.h>
+#include <kernel/vm.h>
+#include <new.h>
+#include <trace.h>
+
+#define LOCAL_TRACE 0
+
+constexpr mx_rights_t kDefaultPagerRights =
+    MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ | MX_RIGHT_WRITE;
+
+PagerSource::PagerSource(mxtl::RefPtr<PagerDispatcher> pager,
+                         mxtl::RefPtr<PortDispatcherV2> port, uint64_t key)
+    : pager_(mxtl::move(pager)), port_(mxtl::move(port)), key_(key) {
+}
+
+PagerSource::~PagerSource() {
+    if (observing_port_)
+        port_->RemoveCloseObserver(this);
+    pager_->RemoveSource(this);
+}
+
+void PagerSource::Init() {
+    observing_port_ = port_->AddCloseObserver(this);
+    if (!observing_port_)
+        Detach();
+}
+
+void PagerSource::OnPortClosed() {
+    LTRACEF("key %#" PRIx64 "\n", key_);
+
+    // the requests queued on the port went with it, and nothing new can be
+    // queued, so nobody is going to supply the pages anyone is waiting for
+    Detach();
+}
+
+status_t PagerSource::SendRequest(uint64_t offset) {
+    LTRACEF("key %#" PRIx64 ", offset %#" PRIx64 "\n", key_, offset);
+
+    mx_port_packet_t packet = {};
+    packet.key = key_;
+    packet.type = MX_PKT_TYPE_PAGE_REQUEST;
+    packet.page_request.command = MX_PAGER_READ;
+    packet.page_request.offset = offset;
+    packet.page_request.length = PAGE_SIZE;
+
+    // fails once the port has been closed, which leaves nobody to answer
+    return port_->QueueKernel(packet);
+}
+
+status_t PagerDispatcher::Create(uint32_t options, mxtl::RefPtr<Dispatcher>* dispatcher,
+                                 mx_rights_t* rights) {
+    AllocChecker ac;
+    auto disp = new (&ac) PagerDispatcher(options);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    *rights = kDefaultPagerRights;
+    *dispatcher = mxtl::AdoptRef<Dispatcher>(disp);
+    return NO_ERROR;
+}
+
+PagerDispatcher::PagerDispatcher(uint32_t /*options*/) {}
+
+PagerDispatcher::~PagerDispatcher() {
+    DEBUG_ASSERT(sources_.is_empty());
+}
+
+void PagerDispatcher::on_zero_handles() {
+    canary_.Assert();
+
+    // nobody is left to supply pages, so fail anything waiting for them. the
+    // vmos stay usable for the pages they already have.
+    AutoLock lock(&lock_);
+    zero_handles_ = true;
+    for (auto& source : sources_)
+        source.Detach();
+}
+
+status_t PagerDispatcher::CreateSource(mxtl::RefPtr<PortDispatcherV2> port, uint64_t key,
+                                       mxtl::RefPtr<VmPageSource>* source) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+
+    if (zero_handles_)
+        return ERR_BAD_STATE;
+
+    AllocChecker ac;
+    auto s = new (&ac) PagerSource(mxtl::WrapRefPtr(this), mxtl::move(port), key);
+    if (!ac.check())
+        return ERR_NO_MEMORY;
+
+    sources_.push_back(s);
+    *source = mxtl::AdoptRef<VmPageSource>(s);
+    s->Init();
+    return NO_ERROR;
+}
+
+void PagerDispatcher::RemoveSource(PagerSource* source) {
+    canary_.Assert();
+
+    AutoLock lock(&lock_);
+    sources_.erase(*source);
+}
+
+status_t PagerDispatcher::SupplyPages(mxtl::RefPtr<VmObject> vmo, uint64_t offset,
+                                      uint64_t length, mxtl::RefPtr<VmObject> aux_vmo,
+                                      uint64_t aux_offset) {
+    canary_.Assert();
+    LTRACEF("offset %#" PRIx64 ", length %#" PRIx64 ", aux_offset %#" PRIx64 "\n",
+            offset, length, aux_offset);
+
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(offset) && IS_PAGE_ALIGNED(length) &&
+                 IS_PAGE_ALIGNED(aux_offset));
+
+    // the vmo keeps its source alive, so it's enough to check that it's ours
+    {
+        AutoLock lock(&lock_);
+
+        VmPageSource* source = vmo->page_source();
+        bool found = false;
+        for (auto& s : sources_) {
+            if (&s == source) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return ERR_INVALID_ARGS;
+    }
+
+    if (length == 0)
+        return NO_ERROR;
+
+    // check the destination before emptying out the source
+    if (offset + length < offset || offset + length > vmo->size())
+        return ERR_OUT_OF_RANGE;
+
+    list_node pages;
+    list_initialize(&pages);
+
+    status_t status = aux_vmo->TakePages(aux_offset, length, &pages);
+    if (status != NO_ERROR)
+        return status;
+
+    status = vmo->SupplyPages(offset, length, &pages);
+
+    // free anything the vmo didn't use
+    pmm_free(&pages);
+    return status;
+}
@@ -122,18 +122,53 @@ void PortDispatcherV2::on_zero_handles() {
         zero_handles_ = true;
     }
     while (DeQueue(0ull, nullptr) == NO_ERROR) {}
+
+    // anything waiting for an answer to a packet just dropped won't get one
+    AutoLock al(&close_lock_);
+    closed_ = true;
+    for (auto& observer : close_observers_)
+        observer.OnPortClosed();
+}
+
+bool PortDispatcherV2::AddCloseObserver(PortCloseObserver* observer) {
+    canary_.Assert();
+
+    AutoLock al(&close_lock_);
+    if (closed_)
+        return false;
+    close_observers_.push_back(observer);
+    return true;
+}
+
+void PortDispatcherV2::RemoveCloseObserver(PortCloseObserver* observer) {
+    canary_.Assert();
+
+    AutoLock al(&close_lock_);
+    close_observers_.erase(*observer);
 }
 
 mx_status_t PortDispatcherV2::QueueUser(const mx_port_packet_t& packet) {
     canary_.Assert();
 
+    mx_port_packet_t user_packet = packet;
+    user_packet.type = MX_PKT_TYPE_USER;
+    return QueueCopy(user_packet);
+}
+
+mx_status_t PortDispatcherV2::QueueKernel(const mx_port_packet_t& packet) {
+    canary_.Assert();
+    DEBUG_ASSERT(packet.type == MX_PKT_TYPE_PAGE_REQUEST);
+
+    return QueueCopy(packet);
+}
+
+mx_status_t PortDispatcherV2::QueueCopy(const mx_port_packet_t& packet) {
     AllocChecker ac;
     auto port_packet = new (&ac) PortPacket();
     if (!ac.check())
         return ERR_NO_MEMORY;
 
     port_packet->packet = packet;
-    port_packet->packet.type = MX_PKT_TYPE_USER;
 
     auto status = Queue(port_packet, 0u, 0u);
     if (status < 0)
@@ -187,7 +222,7 @@ mx_status_t PortDispatcherV2::DeQueue(mx_time_t deadline, mx_port_packet_t* pack
 
         if (observer)
             delete observer;
-        else if (packet && packet->type == MX_PKT_TYPE_USER)
+        else if (port_packet->is_allocated())
             delete port_packet;
         return NO_ERROR;
 
@@ -202,7 +237,7 @@ PortObserver* PortDispatcherV2::CopyLocked(PortPacket* port_packet, mx_port_pack
     if (packet)
         *packet = port_packet->packet;
 
-    return (port_packet->type() == MX_PKT_TYPE_USER) ? nullptr : port_packet->observer;
+    return port_packet->is_allocated() ? nullptr : port_packet->observer;
 }
 
 bool PortDispatcherV2::CanReap(PortObserver* observer, PortPacket* port_packet) {
@@ -803,6 +803,26 @@ void UserThread::GetInfoForUserspace(mx_info_thread_t* info) {
     }
 }
 
+void UserThread::GetStatsForUserspace(mx_info_thread_stats_t* info) {
+    canary_.Assert();
+
+    LTRACE_ENTRY_OBJ;
+    memset(info, 0, sizeof(*info));
+
+    static_assert(MX_INFO_THREAD_STATS_LATENCY_BUCKETS == THREAD_LATENCY_BUCKETS, "");
+
+    struct thread_sched_stats stats;
+    thread_get_sched_stats(&thread_, &stats);
+
+    info->total_runtime = thread_runtime(&thread_);
+    info->total_run_queue_wait = stats.run_queue_wait;
+    info->wakeups = stats.wakeups;
+    info->preemptions = stats.preemptions;
+    info->migrations = stats.migrations;
+    for (uint i = 0; i < THREAD_LATENCY_BUCKETS; i++)
+        info->wakeup_latency[i] = stats.wakeup_latency[i];
+}
+
 status_t UserThread::GetExceptionReport(mx_exception_report_t* report) {
     canary_.Assert();
 
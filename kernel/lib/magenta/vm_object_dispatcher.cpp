@@ -6,6 +6,7 @@
 
 #include <magenta/vm_object_dispatcher.h>
 
+#include <kernel/vm.h>
 #include <kernel/vm/vm_aspace.h>
 #include <kernel/vm/vm_object.h>
 
@@ -13,6 +14,7 @@
 #include <new.h>
 #include <err.h>
 #include <inttypes.h>
+#include <list.h>
 #include <trace.h>
 
 #define LOCAL_TRACE 0
@@ -38,6 +40,12 @@ VmObjectDispatcher::VmObjectDispatcher(mxtl::RefPtr<VmObject> vmo)
 
 VmObjectDispatcher::~VmObjectDispatcher() {}
 
+void VmObjectDispatcher::on_zero_handles() {
+    canary_.Assert();
+
+    vmo_->OnZeroHandles();
+}
+
 mx_status_t VmObjectDispatcher::Read(user_ptr<void> user_data,
                                      size_t length,
                                      uint64_t offset,
@@ -89,10 +97,23 @@ mx_status_t VmObjectDispatcher::RangeOp(uint32_t op, uint64_t offset, uint64_t s
             auto status = vmo_->DecommitRange(offset, size, nullptr);
             return status;
         }
-        case MX_VMO_OP_LOCK:
+        case MX_VMO_OP_LOCK: {
+            // the result goes in the buffer, if there is one
+            if (buffer && buffer_size < sizeof(uint32_t))
+                return ERR_BUFFER_TOO_SMALL;
+
+            bool discarded;
+            auto status = vmo_->LockRange(offset, size, &discarded);
+            if (status != NO_ERROR || !buffer)
+                return status;
+
+            uint32_t result = discarded ? MX_VMO_LOCK_DISCARDED : MX_VMO_LOCK_INTACT;
+            if (buffer.reinterpret<uint32_t>().copy_to_user(result) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
         case MX_VMO_OP_UNLOCK:
-            // TODO: handle
-            return ERR_NOT_SUPPORTED;
+            return vmo_->UnlockRange(offset, size);
         case MX_VMO_OP_LOOKUP:
             // we will be using the user pointer
             if (!buffer)
@@ -128,3 +149,38 @@ mx_status_t VmObjectDispatcher::Clone(uint32_t options, uint64_t offset, uint64_
         return ERR_INVALID_ARGS;
     }
 }
+
+mx_status_t VmObjectDispatcher::TransferFrom(uint64_t offset, VmObjectDispatcher* src,
+                                             uint64_t src_offset, uint64_t length) {
+    canary_.Assert();
+
+    LTRACEF("offset %#" PRIx64 " src_offset %#" PRIx64 " length %#" PRIx64 "\n",
+            offset, src_offset, length);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(src_offset) || !IS_PAGE_ALIGNED(length))
+        return ERR_INVALID_ARGS;
+
+    if (length == 0)
+        return NO_ERROR;
+
+    // check the destination before emptying out the source
+    if (offset + length < offset || offset + length > vmo_->size())
+        return ERR_OUT_OF_RANGE;
+
+    list_node pages;
+    list_initialize(&pages);
+
+    status_t status = src->vmo_->TakePages(src_offset, length, &pages);
+    if (status != NO_ERROR)
+        return status;
+
+    status = vmo_->ReplacePages(offset, length, &pages);
+
+    // if none of them made it in, put them back where they came from
+    if (status != NO_ERROR && list_length(&pages) == length / PAGE_SIZE)
+        src->vmo_->ReplacePages(src_offset, length, &pages);
+
+    // free anything neither vmo used
+    pmm_free(&pages);
+    return status;
+}
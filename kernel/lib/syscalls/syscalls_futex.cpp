@@ -7,6 +7,8 @@
 #include <trace.h>
 
 #include <magenta/process_dispatcher.h>
+#include <magenta/thread_dispatcher.h>
+#include <magenta/user_thread.h>
 
 #include "syscalls_priv.h"
 
@@ -17,7 +19,31 @@ mx_status_t sys_futex_wait(user_ptr<mx_futex_t> value_ptr, int current_value, mx
     magenta_check_deadline("futex_wait", deadline);
 
     return ProcessDispatcher::GetCurrent()->futex_context()->FutexWait(
-        value_ptr, current_value, deadline);
+        value_ptr, current_value, deadline, nullptr);
+}
+
+mx_status_t sys_futex_wait_pi(user_ptr<mx_futex_t> value_ptr, int current_value,
+                              mx_handle_t owner, mx_time_t deadline) {
+    LTRACEF("futex %p current %d owner %x\n", value_ptr.get(), current_value, owner);
+    magenta_check_deadline("futex_wait_pi", deadline);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // Holding a reference to the owner for the whole wait keeps its
+    // thread_t around for as long as we lend it our priority.
+    mxtl::RefPtr<ThreadDispatcher> owner_thread;
+    thread_t* pi_owner = nullptr;
+    if (owner != MX_HANDLE_INVALID) {
+        mx_status_t status = up->GetDispatcher(owner, &owner_thread);
+        if (status != NO_ERROR)
+            return status;
+        // Only threads sharing the futex's address space can own it.
+        if (owner_thread->thread()->process() != up)
+            return ERR_INVALID_ARGS;
+        pi_owner = owner_thread->thread()->kernel_thread();
+    }
+
+    return up->futex_context()->FutexWait(value_ptr, current_value, deadline, pi_owner);
 }
 
 mx_status_t sys_futex_wake(user_ptr<const mx_futex_t> value_ptr, uint32_t count) {
@@ -90,6 +90,40 @@ mx_status_t sys_clock_adjust(mx_handle_t hrsrc, uint32_t clock_id, int64_t offse
     }
 }
 
+mx_status_t sys_system_get_event(mx_handle_t root_resource, uint32_t kind,
+                                 user_ptr<mx_handle_t> _out) {
+    LTRACEF("kind %u\n", kind);
+
+    // TODO: finer grained validation
+    mx_status_t status;
+    if ((status = validate_resource_handle(root_resource)) < 0) {
+        return status;
+    }
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    switch (kind) {
+    case MX_SYSTEM_EVENT_LOW_MEMORY:
+        dispatcher = GetLowMemoryEvent();
+        break;
+    default:
+        return ERR_INVALID_ARGS;
+    }
+
+    // no MX_RIGHT_WRITE; only the kernel gets to signal these
+    HandleOwner handle(MakeHandle(mxtl::move(dispatcher),
+                                  MX_RIGHT_DUPLICATE | MX_RIGHT_TRANSFER | MX_RIGHT_READ));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    if (_out.copy_to_user(up->MapHandleToValue(handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(handle));
+    return NO_ERROR;
+}
+
 mx_status_t sys_event_create(uint32_t options, user_ptr<mx_handle_t> _out) {
     LTRACEF("options 0x%x\n", options);
 
@@ -263,6 +263,37 @@ mx_status_t sys_object_get_info(mx_handle_t handle, uint32_t topic,
                 return ERR_BUFFER_TOO_SMALL;
             return NO_ERROR;
         }
+        case MX_INFO_THREAD_STATS: {
+            // TODO(MG-458): Handle forward/backward compatibility issues
+            // with changes to the struct.
+            size_t actual = (buffer_size < sizeof(mx_info_thread_stats_t)) ? 0 : 1;
+            size_t avail = 1;
+
+            // grab a reference to the dispatcher
+            mxtl::RefPtr<ThreadDispatcher> thread;
+            auto error = up->GetDispatcherWithRights(handle, MX_RIGHT_READ, &thread);
+            if (error < 0)
+                return error;
+
+            if (actual > 0) {
+                // build the info structure
+                mx_info_thread_stats_t info = { };
+
+                auto err = thread->GetStats(&info);
+                if (err != NO_ERROR)
+                    return err;
+
+                if (_buffer.copy_array_to_user(&info, sizeof(info)) != NO_ERROR)
+                    return ERR_INVALID_ARGS;
+            }
+            if (_actual && (_actual.copy_to_user(actual) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (_avail && (_avail.copy_to_user(avail) != NO_ERROR))
+                return ERR_INVALID_ARGS;
+            if (actual == 0)
+                return ERR_BUFFER_TOO_SMALL;
+            return NO_ERROR;
+        }
         case MX_INFO_THREAD_EXCEPTION_REPORT: {
             // TODO(MG-458): Handle forward/backward compatibility issues
             // with changes to the struct.
@@ -428,6 +459,30 @@ mx_status_t sys_object_get_property(mx_handle_t handle_value, uint32_t property,
                 return ERR_INVALID_ARGS;
             return NO_ERROR;
         }
+        case MX_PROP_TIMER_SLACK: {
+            if (size < sizeof(mx_duration_t))
+                return ERR_BUFFER_TOO_SMALL;
+            auto thread = DownCastDispatcher<ThreadDispatcher>(&dispatcher);
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_duration_t value = thread->thread()->timer_slack();
+            if (_value.reinterpret<mx_duration_t>().copy_to_user(value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
+        case MX_PROP_DEADLINE: {
+            if (size < sizeof(mx_deadline_params_t))
+                return ERR_BUFFER_TOO_SMALL;
+            auto thread = DownCastDispatcher<ThreadDispatcher>(&dispatcher);
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_deadline_params_t value = {};
+            thread->thread()->get_deadline(&value.runtime, &value.deadline, &value.period);
+            value.resource = MX_HANDLE_INVALID;
+            if (_value.reinterpret<mx_deadline_params_t>().copy_to_user(value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            return NO_ERROR;
+        }
         default:
             return ERR_INVALID_ARGS;
     }
@@ -492,6 +547,33 @@ mx_status_t sys_object_set_property(mx_handle_t handle_value, uint32_t property,
                 return ERR_INVALID_ARGS;
             return process->set_debug_addr(value);
         }
+        case MX_PROP_TIMER_SLACK: {
+            if (size < sizeof(mx_duration_t))
+                return ERR_BUFFER_TOO_SMALL;
+            auto thread = DownCastDispatcher<ThreadDispatcher>(&dispatcher);
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_duration_t value = 0;
+            if (_value.reinterpret<const mx_duration_t>().copy_from_user(&value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            return thread->thread()->set_timer_slack(value);
+        }
+        case MX_PROP_DEADLINE: {
+            if (size < sizeof(mx_deadline_params_t))
+                return ERR_BUFFER_TOO_SMALL;
+            auto thread = DownCastDispatcher<ThreadDispatcher>(&dispatcher);
+            if (!thread)
+                return ERR_WRONG_TYPE;
+            mx_deadline_params_t value;
+            if (_value.reinterpret<const mx_deadline_params_t>().copy_from_user(&value) != NO_ERROR)
+                return ERR_INVALID_ARGS;
+            // deadline threads preempt every priority, kernel threads included,
+            // so only the holder of the root resource gets to admit one
+            bool admitting = value.runtime != 0 || value.deadline != 0 || value.period != 0;
+            if (admitting && validate_resource_handle(value.resource) != NO_ERROR)
+                return ERR_ACCESS_DENIED;
+            return thread->thread()->set_deadline(value.runtime, value.deadline, value.period);
+        }
     }
 
     return ERR_INVALID_ARGS;
@@ -0,0 +1,132 @@
+// Copyright 2017 The Fuchsia Authors
+//
+// Use of this source code is governed by a MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT
+
+#include <err.h>
+#include <inttypes.h>
+#include <trace.h>
+
+#include <kernel/vm.h>
+#include <kernel/vm/vm_object_paged.h>
+
+#include <magenta/handle_owner.h>
+#include <magenta/pager_dispatcher.h>
+#include <magenta/port_dispatcher_v2.h>
+#include <magenta/process_dispatcher.h>
+#include <magenta/vm_object_dispatcher.h>
+
+#include <mxtl/ref_ptr.h>
+
+#include "syscalls_priv.h"
+
+#define LOCAL_TRACE 0
+
+mx_status_t sys_pager_create(uint32_t options, user_ptr<mx_handle_t> _out) {
+    LTRACEF("options %#x\n", options);
+
+    if (options != 0)
+        return ERR_INVALID_ARGS;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    mx_status_t result = PagerDispatcher::Create(options, &dispatcher, &rights);
+    if (result != NO_ERROR)
+        return result;
+
+    HandleOwner handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    if (_out.copy_to_user(up->MapHandleToValue(handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(handle));
+
+    return NO_ERROR;
+}
+
+mx_status_t sys_pager_create_vmo(mx_handle_t pager, mx_handle_t port, uint64_t key,
+                                 uint64_t size, uint32_t options,
+                                 user_ptr<mx_handle_t> _out) {
+    LTRACEF("pager %d, port %d, key %#" PRIx64 ", size %#" PRIx64 "\n",
+            pager, port, key, size);
+
+    if (options != 0)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PagerDispatcher> pager_dispatcher;
+    mx_status_t status = up->GetDispatcherWithRights(pager, MX_RIGHT_WRITE, &pager_dispatcher);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<PortDispatcherV2> port_dispatcher;
+    status = up->GetDispatcherWithRights(port, MX_RIGHT_WRITE, &port_dispatcher);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmPageSource> source;
+    status = pager_dispatcher->CreateSource(mxtl::move(port_dispatcher), key, &source);
+    if (status != NO_ERROR)
+        return status;
+
+    // create a vm object whose pages come from the pager
+    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::CreateFromSource(mxtl::move(source), size);
+    if (!vmo)
+        return ERR_NO_MEMORY;
+
+    mxtl::RefPtr<Dispatcher> dispatcher;
+    mx_rights_t rights;
+    status = VmObjectDispatcher::Create(mxtl::move(vmo), &dispatcher, &rights);
+    if (status != NO_ERROR)
+        return status;
+
+    HandleOwner handle(MakeHandle(mxtl::move(dispatcher), rights));
+    if (!handle)
+        return ERR_NO_MEMORY;
+
+    if (_out.copy_to_user(up->MapHandleToValue(handle)) != NO_ERROR)
+        return ERR_INVALID_ARGS;
+
+    up->AddHandle(mxtl::move(handle));
+
+    return NO_ERROR;
+}
+
+mx_status_t sys_pager_supply_pages(mx_handle_t pager, mx_handle_t pager_vmo,
+                                   uint64_t offset, uint64_t length,
+                                   mx_handle_t aux_vmo, uint64_t aux_offset) {
+    LTRACEF("pager %d, pager_vmo %d, offset %#" PRIx64 ", length %#" PRIx64
+            ", aux_vmo %d, aux_offset %#" PRIx64 "\n",
+            pager, pager_vmo, offset, length, aux_vmo, aux_offset);
+
+    if (!IS_PAGE_ALIGNED(offset) || !IS_PAGE_ALIGNED(length) || !IS_PAGE_ALIGNED(aux_offset))
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    mxtl::RefPtr<PagerDispatcher> pager_dispatcher;
+    mx_status_t status = up->GetDispatcherWithRights(pager, MX_RIGHT_WRITE, &pager_dispatcher);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmObjectDispatcher> pager_vmo_dispatcher;
+    status = up->GetDispatcher(pager_vmo, &pager_vmo_dispatcher);
+    if (status != NO_ERROR)
+        return status;
+
+    // the pages are taken out of the aux vmo, so it has to be fully writable
+    mxtl::RefPtr<VmObjectDispatcher> aux_vmo_dispatcher;
+    status = up->GetDispatcherWithRights(aux_vmo, MX_RIGHT_READ | MX_RIGHT_WRITE,
+                                         &aux_vmo_dispatcher);
+    if (status != NO_ERROR)
+        return status;
+
+    return pager_dispatcher->SupplyPages(pager_vmo_dispatcher->vmo(), offset, length,
+                                         aux_vmo_dispatcher->vmo(), aux_offset);
+}
@@ -6,6 +6,7 @@
 
 #include <err.h>
 #include <inttypes.h>
+#include <iovec.h>
 #include <trace.h>
 
 #include <kernel/vm/vm_object.h>
@@ -26,14 +27,97 @@
 
 #define LOCAL_TRACE 0
 
+// Force map the range, even if it crosses multiple mappings.
+// TODO(MG-730): This is a workaround for this bug.  If we start decommitting
+// things, the bug will come back.  We should fix this more properly.
+static mx_status_t force_map_user_buffer(user_ptr<void> _data, size_t len) {
+    uint8_t byte = 0;
+    auto int_data = _data.reinterpret<uint8_t>();
+    for (size_t i = 0; i < len; i += PAGE_SIZE) {
+        mx_status_t status = int_data.copy_array_to_user(&byte, 1, i);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    if (len > 0) {
+        return int_data.copy_array_to_user(&byte, 1, len - 1);
+    }
+    return NO_ERROR;
+}
+
+static mx_status_t force_map_user_buffer(user_ptr<const void> _data, size_t len) {
+    uint8_t byte = 0;
+    auto int_data = _data.reinterpret<const uint8_t>();
+    for (size_t i = 0; i < len; i += PAGE_SIZE) {
+        mx_status_t status = int_data.copy_array_from_user(&byte, 1, i);
+        if (status != NO_ERROR) {
+            return status;
+        }
+    }
+    if (len > 0) {
+        return int_data.copy_array_from_user(&byte, 1, len - 1);
+    }
+    return NO_ERROR;
+}
+
+// The iovec arrays of mx_vmo_readv() and mx_vmo_writev() are copied in this
+// many entries at a time.
+static constexpr uint32_t kIovecBatch = 16;
+
+static_assert(sizeof(mx_iovec_t) == sizeof(iovec_t), "");
+static_assert(offsetof(mx_iovec_t, iov_base) == offsetof(iovec_t, iov_base), "");
+static_assert(offsetof(mx_iovec_t, iov_len) == offsetof(iovec_t, iov_len), "");
+
+// Copy the vmo to or from each buffer of the user's iovec array in turn, starting
+// at |offset|, until the buffers are full or the end of the vmo is reached.
+// |copy| is called with each buffer and the vmo offset to copy at, and returns
+// how much it copied.
+template <typename T>
+static mx_status_t vmo_iovec_copy(user_ptr<const mx_iovec_t> _iov, uint32_t num_iov,
+                                  uint64_t offset, size_t* actual, T copy) {
+    size_t total = 0;
+    for (uint32_t i = 0; i < num_iov; i += kIovecBatch) {
+        iovec_t iov[kIovecBatch];
+        uint32_t count = MIN(num_iov - i, kIovecBatch);
+        if (_iov.reinterpret<const iovec_t>().copy_array_from_user(iov, count, i) != NO_ERROR)
+            return ERR_INVALID_ARGS;
+
+        for (uint32_t j = 0; j < count; j++) {
+            if (iov[j].iov_len > SIZE_MAX - total)
+                return ERR_INVALID_ARGS;
+
+            size_t copied;
+            mx_status_t status = copy(iov[j], offset, &copied);
+            if (status != NO_ERROR)
+                return status;
+
+            total += copied;
+            offset += copied;
+
+            // a short copy means we ran into the end of the vmo
+            if (copied < iov[j].iov_len) {
+                *actual = total;
+                return NO_ERROR;
+            }
+        }
+    }
+
+    *actual = total;
+    return NO_ERROR;
+}
+
 mx_status_t sys_vmo_create(uint64_t size, uint32_t options, user_ptr<mx_handle_t> _out) {
     LTRACEF("size %#" PRIx64 "\n", size);
 
-    if (options)
+    if (options & ~MX_VMO_OPTION_LARGE_PAGES)
         return ERR_INVALID_ARGS;
 
+    uint32_t vmo_options = 0;
+    if (options & MX_VMO_OPTION_LARGE_PAGES)
+        vmo_options |= VmObjectPaged::kLargePages;
+
     // create a vm object
-    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::Create(0, size);
+    mxtl::RefPtr<VmObject> vmo = VmObjectPaged::Create(0, size, vmo_options);
     if (!vmo)
         return ERR_NO_MEMORY;
 
@@ -72,25 +156,9 @@ mx_status_t sys_vmo_read(mx_handle_t handle, user_ptr<void> _data,
     if (status != NO_ERROR)
         return status;
 
-    // Force map the range, even if it crosses multiple mappings.
-    // TODO(MG-730): This is a workaround for this bug.  If we start decommitting
-    // things, the bug will come back.  We should fix this more properly.
-    {
-        uint8_t byte = 0;
-        auto int_data = _data.reinterpret<uint8_t>();
-        for (size_t i = 0; i < len; i += PAGE_SIZE) {
-            status = int_data.copy_array_to_user(&byte, 1, i);
-            if (status != NO_ERROR) {
-                return status;
-            }
-        }
-        if (len > 0) {
-            status = int_data.copy_array_to_user(&byte, 1, len - 1);
-            if (status != NO_ERROR) {
-                return status;
-            }
-        }
-    }
+    status = force_map_user_buffer(_data, len);
+    if (status != NO_ERROR)
+        return status;
 
     // do the read operation
     size_t nread;
@@ -114,25 +182,9 @@ mx_status_t sys_vmo_write(mx_handle_t handle, user_ptr<const void> _data,
     if (status != NO_ERROR)
         return status;
 
-    // Force map the range, even if it crosses multiple mappings.
-    // TODO(MG-730): This is a workaround for this bug.  If we start decommitting
-    // things, the bug will come back.  We should fix this more properly.
-    {
-        uint8_t byte = 0;
-        auto int_data = _data.reinterpret<const uint8_t>();
-        for (size_t i = 0; i < len; i += PAGE_SIZE) {
-            status = int_data.copy_array_from_user(&byte, 1, i);
-            if (status != NO_ERROR) {
-                return status;
-            }
-        }
-        if (len > 0) {
-            status = int_data.copy_array_from_user(&byte, 1, len - 1);
-            if (status != NO_ERROR) {
-                return status;
-            }
-        }
-    }
+    status = force_map_user_buffer(_data, len);
+    if (status != NO_ERROR)
+        return status;
 
     // do the write operation
     size_t nwritten;
@@ -143,6 +195,90 @@ mx_status_t sys_vmo_write(mx_handle_t handle, user_ptr<const void> _data,
     return status;
 }
 
+mx_status_t sys_vmo_readv(mx_handle_t handle, user_ptr<const mx_iovec_t> _iov, uint32_t num_iov,
+                          uint64_t offset, user_ptr<size_t> _actual) {
+    LTRACEF("handle %d, iov %p, num_iov %u, offset %#" PRIx64 "\n",
+            handle, _iov.get(), num_iov, offset);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // lookup the dispatcher from handle
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_READ, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    auto read = [&vmo](const iovec_t& iov, uint64_t offset, size_t* nread) -> mx_status_t {
+        user_ptr<void> data(iov.iov_base);
+        mx_status_t status = force_map_user_buffer(data, iov.iov_len);
+        if (status != NO_ERROR)
+            return status;
+        return vmo->Read(data, iov.iov_len, offset, nread);
+    };
+
+    size_t nread;
+    status = vmo_iovec_copy(_iov, num_iov, offset, &nread, read);
+    if (status == NO_ERROR)
+        status = _actual.copy_to_user(nread);
+
+    return status;
+}
+
+mx_status_t sys_vmo_writev(mx_handle_t handle, user_ptr<const mx_iovec_t> _iov, uint32_t num_iov,
+                           uint64_t offset, user_ptr<size_t> _actual) {
+    LTRACEF("handle %d, iov %p, num_iov %u, offset %#" PRIx64 "\n",
+            handle, _iov.get(), num_iov, offset);
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // lookup the dispatcher from handle
+    mxtl::RefPtr<VmObjectDispatcher> vmo;
+    mx_status_t status = up->GetDispatcherWithRights(handle, MX_RIGHT_WRITE, &vmo);
+    if (status != NO_ERROR)
+        return status;
+
+    auto write = [&vmo](const iovec_t& iov, uint64_t offset, size_t* nwritten) -> mx_status_t {
+        user_ptr<const void> data(iov.iov_base);
+        mx_status_t status = force_map_user_buffer(data, iov.iov_len);
+        if (status != NO_ERROR)
+            return status;
+        return vmo->Write(data, iov.iov_len, offset, nwritten);
+    };
+
+    size_t nwritten;
+    status = vmo_iovec_copy(_iov, num_iov, offset, &nwritten, write);
+    if (status == NO_ERROR)
+        status = _actual.copy_to_user(nwritten);
+
+    return status;
+}
+
+mx_status_t sys_vmo_transfer(mx_handle_t dst_handle, uint64_t dst_offset,
+                             mx_handle_t src_handle, uint64_t src_offset,
+                             uint64_t len, uint32_t options) {
+    LTRACEF("dst %d offset %#" PRIx64 ", src %d offset %#" PRIx64 ", len %#" PRIx64 "\n",
+            dst_handle, dst_offset, src_handle, src_offset, len);
+
+    if (options != 0u)
+        return ERR_INVALID_ARGS;
+
+    auto up = ProcessDispatcher::GetCurrent();
+
+    // the source loses its pages, so it has to be writable as well as readable
+    mxtl::RefPtr<VmObjectDispatcher> src;
+    mx_status_t status = up->GetDispatcherWithRights(src_handle, MX_RIGHT_READ | MX_RIGHT_WRITE,
+                                                     &src);
+    if (status != NO_ERROR)
+        return status;
+
+    mxtl::RefPtr<VmObjectDispatcher> dst;
+    status = up->GetDispatcherWithRights(dst_handle, MX_RIGHT_WRITE, &dst);
+    if (status != NO_ERROR)
+        return status;
+
+    return dst->TransferFrom(dst_offset, src.get(), src_offset, len);
+}
+
 mx_status_t sys_vmo_get_size(mx_handle_t handle, user_ptr<uint64_t> _size) {
     LTRACEF("handle %d, sizep %p\n", handle, _size.get());
 
@@ -44,7 +44,7 @@ KERNEL_DEFINES += \
     PLATFORM_SUPPORTS_PANIC_SHELL=1
 
 WITH_SMP ?= 1
-SMP_MAX_CPUS ?= 8
+SMP_MAX_CPUS ?= 256
 
 LK_HEAP_IMPLEMENTATION ?= cmpctmalloc
 
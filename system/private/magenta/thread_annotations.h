@@ -15,11 +15,13 @@
 // TA_CAP(x)                    |x| is the capability this type represents, e.g. "mutex".
 // TA_GUARDED(x)                the annotated variable is guarded by the capability (e.g. lock) |x|
 // TA_ACQ(x)                    function acquires the mutex |x|
+// TA_ACQ_SHARED(x)             function acquires the reader-writer lock |x| in shared mode
 // TA_ACQ_BEFORE(x)             Indicates that if both this mutex and muxex |x| are to be acquired,
 //                              that this mutex must be acquired before mutex |x|.
 // TA_ACQ_AFTER(x)              Indicates that if both this mutex and muxex |x| are to be acquired,
 //                              that this mutex must be acquired after mutex |x|.
 // TA_REL(x)                    function releases the mutex |x|
+// TA_REL_SHARED(x)             function releases the reader-writer lock |x| from shared mode
 // TA_REQ(x)                    function requires that the caller hold the mutex |x|
 // TA_EXCL(x)                   function requires that the caller not be holding the mutex |x|
 // TA_RET_CAP(x)                function returns a reference to the mutex |x|
@@ -35,9 +37,11 @@
 #define TA_CAP(x) THREAD_ANNOTATION(capability(x))
 #define TA_GUARDED(x) THREAD_ANNOTATION(guarded_by(x))
 #define TA_ACQ(...) THREAD_ANNOTATION(acquire_capability(__VA_ARGS__))
+#define TA_ACQ_SHARED(...) THREAD_ANNOTATION(acquire_shared_capability(__VA_ARGS__))
 #define TA_ACQ_BEFORE(...) THREAD_ANNOTATION(acquired_before(__VA_ARGS__))
 #define TA_ACQ_AFTER(...) THREAD_ANNOTATION(acquired_after(__VA_ARGS__))
 #define TA_REL(...) THREAD_ANNOTATION(release_capability(__VA_ARGS__))
+#define TA_REL_SHARED(...) THREAD_ANNOTATION(release_shared_capability(__VA_ARGS__))
 #define TA_REQ(...) THREAD_ANNOTATION(requires_capability(__VA_ARGS__))
 #define TA_EXCL(...) THREAD_ANNOTATION(locks_excluded(__VA_ARGS__))
 #define TA_RET_CAP(x) THREAD_ANNOTATION(lock_returned(x))
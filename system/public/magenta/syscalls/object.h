@@ -27,6 +27,7 @@ typedef enum {
     MX_INFO_THREAD_EXCEPTION_REPORT    = 11, // mx_exception_report_t[1]
     MX_INFO_TASK_STATS                 = 12, // mx_info_task_stats_t[1]
     MX_INFO_PROCESS_MAPS               = 13, // mx_info_maps_t[n]
+    MX_INFO_THREAD_STATS               = 14, // mx_info_thread_stats_t[1]
     MX_INFO_LAST
 } mx_object_info_topic_t;
 
@@ -52,6 +53,7 @@ typedef enum {
     MX_OBJ_TYPE_IOPORT2             = 20,
     MX_OBJ_TYPE_HYPERVISOR          = 21,
     MX_OBJ_TYPE_GUEST               = 22,
+    MX_OBJ_TYPE_PAGER               = 23,
     MX_OBJ_TYPE_LAST
 } mx_obj_type_t;
 
@@ -108,6 +110,37 @@ typedef struct mx_info_thread {
     uint32_t wait_exception_port_type;
 } mx_info_thread_t;
 
+// Number of entries in mx_info_thread_stats_t.wakeup_latency.
+#define MX_INFO_THREAD_STATS_LATENCY_BUCKETS 16
+
+// Scheduler statistics for a thread.
+typedef struct mx_info_thread_stats {
+    // Total time the thread has spent running, in nanoseconds.
+    mx_duration_t total_runtime;
+
+    // Total time the thread has spent ready to run but waiting for a cpu,
+    // in nanoseconds.
+    mx_duration_t total_run_queue_wait;
+
+    // The number of times the thread was made runnable after blocking
+    // or sleeping.
+    uint64_t wakeups;
+
+    // The number of times the thread was descheduled while it still wanted
+    // to run, because its time slice expired or a higher priority thread
+    // became runnable.
+    uint64_t preemptions;
+
+    // The number of times the thread started running on a different cpu
+    // than the one it last ran on.
+    uint64_t migrations;
+
+    // Histogram of the time between a wakeup and the thread starting to run.
+    // Entry 0 counts latencies under 1us, entry i counts latencies in
+    // [2^(i-1), 2^i) us, and the last entry also counts anything longer.
+    uint64_t wakeup_latency[MX_INFO_THREAD_STATS_LATENCY_BUCKETS];
+} mx_info_thread_stats_t;
+
 // Statistics about resources (e.g., memory) used by a task. Can be relatively
 // expensive to gather.
 typedef struct mx_info_task_stats {
@@ -191,6 +224,26 @@ typedef struct mx_info_maps {
 // Argument is the value of ld.so's _dl_debug_addr, a uintptr_t.
 #define MX_PROP_PROCESS_DEBUG_ADDR          5u
 
+// How late a thread's sleep and wait deadlines may fire so the kernel
+// can coalesce them with other timers. Argument is a mx_duration_t.
+#define MX_PROP_TIMER_SLACK                 6u
+
+// Moves a thread into the deadline scheduling class, where it is guaranteed
+// |runtime| of cpu time within |deadline| of the start of every |period|.
+// All zeros moves it back to priority scheduling. Argument is a
+// mx_deadline_params_t. Admitting a thread requires |resource| to be a handle
+// to the root resource, since deadline threads run ahead of everything else;
+// moving one back doesn't.
+#define MX_PROP_DEADLINE                    7u
+
+typedef struct mx_deadline_params {
+    mx_duration_t runtime;
+    mx_duration_t deadline;
+    mx_duration_t period;
+    mx_handle_t resource;
+    uint32_t reserved;
+} mx_deadline_params_t;
+
 // Values for mx_info_thread_t.state.
 #define MX_THREAD_STATE_NEW                 0u
 #define MX_THREAD_STATE_RUNNING             1u
@@ -147,6 +147,10 @@ typedef uint32_t mx_signals_t;
 #define MX_LOG_READABLE             __MX_OBJECT_READABLE
 #define MX_LOG_WRITABLE             __MX_OBJECT_WRITABLE
 
+// System events (see mx_system_get_event())
+#define MX_SYSTEM_MEMORY_WARNING    __MX_OBJECT_SIGNAL_4
+#define MX_SYSTEM_MEMORY_CRITICAL   __MX_OBJECT_SIGNAL_5
+
 
 // Compatibility Definitions
 // TODO: remove when safe
@@ -214,9 +218,25 @@ typedef uint32_t mx_rights_t;
 #define MX_VMO_OP_CACHE_CLEAN            8u
 #define MX_VMO_OP_CACHE_CLEAN_INVALIDATE 9u
 
+// MX_VMO_OP_LOCK results
+#define MX_VMO_LOCK_INTACT               0u
+#define MX_VMO_LOCK_DISCARDED            1u
+
+// System event kinds for mx_system_get_event()
+#define MX_SYSTEM_EVENT_LOW_MEMORY       0u
+
+// VM Object creation options
+#define MX_VMO_OPTION_LARGE_PAGES        1u
+
 // VM Object clone flags
 #define MX_VMO_CLONE_COPY_ON_WRITE       1u
 
+// Buffer for mx_vmo_readv() and mx_vmo_writev(), laid out like struct iovec
+typedef struct mx_iovec {
+    void* iov_base;
+    size_t iov_len;
+} mx_iovec_t;
+
 // Mapping flags to vmar routines
 #define MX_VM_FLAG_PERM_READ          (1u << 0)
 #define MX_VM_FLAG_PERM_WRITE         (1u << 1)
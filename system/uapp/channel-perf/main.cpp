@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #include <magenta/compiler.h>
 #include <magenta/syscalls.h>
@@ -111,6 +112,106 @@ void do_test(uint32_t duration, const TestArgs& test_args) {
            test_args.size, test_args.handles, test_args.queue, its_per_second);
 }
 
+// The largest message the kernel will accept on a channel.
+constexpr uint32_t kMaxMessageSize = 65536u;
+
+// Echoes every message received on |arg| (a channel handle) back to the
+// sender, until the peer is closed.
+int call_server_thread(void* arg) {
+    mx_handle_t channel = static_cast<mx_handle_t>(reinterpret_cast<uintptr_t>(arg));
+    mxtl::unique_ptr<uint8_t[]> buffer(new uint8_t[kMaxMessageSize]);
+
+    for (;;) {
+        mx_signals_t observed = 0;
+        mx_status_t status = mx_object_wait_one(
+            channel, MX_CHANNEL_READABLE | MX_CHANNEL_PEER_CLOSED, MX_TIME_INFINITE, &observed);
+        if (status != NO_ERROR || !(observed & MX_CHANNEL_READABLE))
+            break;
+
+        uint32_t r_size = 0;
+        uint32_t r_handles = 0;
+        status = mx_channel_read(channel, 0u, buffer.get(), nullptr, kMaxMessageSize, 0u,
+                                 &r_size, &r_handles);
+        if (status != NO_ERROR)
+            break;
+        // The reply carries the caller's txid, which leads the message.
+        status = mx_channel_write(channel, 0u, buffer.get(), r_size, nullptr, 0u);
+        if (status != NO_ERROR)
+            break;
+    }
+
+    mx_handle_close(channel);
+    return 0;
+}
+
+// Measures round trips through mx_channel_call() against an echo server on
+// another thread.  Each call blocks the client and wakes the server, then the
+// reply does the reverse, so this is dominated by wakeup latency and by where
+// the scheduler places the two threads.
+void do_call_test(uint32_t duration, uint32_t size) {
+    __UNUSED mx_status_t status;
+
+    uint64_t duration_ns = duration * 1000000000ull;
+
+    if (size < sizeof(mx_txid_t))
+        size = sizeof(mx_txid_t);
+    if (size > kMaxMessageSize)
+        size = kMaxMessageSize;
+
+    mx_handle_t mp[2] = {MX_HANDLE_INVALID, MX_HANDLE_INVALID};
+    status = mx_channel_create(0u, &mp[0], &mp[1]);
+    assert(status == NO_ERROR);
+
+    thrd_t server;
+    int ret = thrd_create(&server, call_server_thread,
+                          reinterpret_cast<void*>(static_cast<uintptr_t>(mp[1])));
+    assert(ret == thrd_success);
+
+    mxtl::unique_ptr<uint8_t[]> wr_data(new uint8_t[size]);
+    mxtl::unique_ptr<uint8_t[]> rd_data(new uint8_t[size]);
+    for (uint32_t i = 0; i < size; i++)
+        wr_data[i] = static_cast<uint8_t>(i);
+
+    mx_channel_call_args_t args = {};
+    args.wr_bytes = wr_data.get();
+    args.wr_num_bytes = size;
+    args.rd_bytes = rd_data.get();
+    args.rd_num_bytes = size;
+
+    static constexpr uint32_t big_it_size = 1000;
+    uint64_t big_its = 0;
+    uint64_t start_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+    uint64_t end_ns;
+    for (;;) {
+        big_its++;
+        for (uint32_t i = 0; i < big_it_size; i++) {
+            uint32_t r_size = 0;
+            uint32_t r_handles = 0;
+            mx_status_t read_status = NO_ERROR;
+            status = mx_channel_call(mp[0], 0u, MX_TIME_INFINITE, &args, &r_size,
+                                     &r_handles, &read_status);
+            assert(status == NO_ERROR);
+            assert(r_size == size);
+        }
+
+        end_ns = mx_time_get(MX_CLOCK_MONOTONIC);
+        if ((end_ns - start_ns) >= duration_ns)
+            break;
+    }
+
+    // Closing our end makes the server exit.
+    status = mx_handle_close(mp[0]);
+    assert(status == NO_ERROR);
+    ret = thrd_join(server, nullptr);
+    assert(ret == thrd_success);
+
+    double real_duration = static_cast<double>(end_ns - start_ns) / 1000000000.0;
+    double calls = static_cast<double>(big_its) * big_it_size;
+    printf("call %" PRIu32 " bytes: %.0f calls/second, %.0f ns/call\n",
+           size, calls / real_duration,
+           static_cast<double>(end_ns - start_ns) / calls);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -121,6 +222,8 @@ int main(int argc, char** argv) {
         "  -h    show help (this)\n"
         "  -o    run single test (default)\n"
         "  -s    run suite (ignores -S/-H/-Q)\n"
+        "  -c    measure mx_channel_call() round trips to a server thread\n"
+        "        instead of write/read on one thread (ignores -H/-Q)\n"
         "  -n N  set test repetition count to N (default: 1)\n"
         "  -d N  set test duration to N seconds (default: 5)\n"
         "  -S N  set message size to N bytes (default: 10)\n"
@@ -128,6 +231,7 @@ int main(int argc, char** argv) {
         "  -Q N  set message pre-queue count to N messages (default: 0)\n";
 
     bool run_suite = false;  // -o/-s
+    bool run_call = false;   // -c
     uint32_t duration = 5;   // -d
     uint32_t repeats = 1;    // -n
     // Ignored when running a suite:
@@ -138,7 +242,7 @@ int main(int argc, char** argv) {
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "+hosn:d:S:H:Q:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hoscn:d:S:H:Q:")) != -1) {
         // Our option values are always unsigned numbers.
         uint32_t value = 0;
         if (optarg) {
@@ -160,6 +264,9 @@ int main(int argc, char** argv) {
             case 's':
                 run_suite = true;
                 break;
+            case 'c':
+                run_call = true;
+                break;
             case 'n':
                 assert(optarg);
                 repeats = value;
@@ -196,7 +303,15 @@ int main(int argc, char** argv) {
                    repeats);
         }
 
-        if (run_suite) {
+        if (run_call) {
+            if (run_suite) {
+                static constexpr uint32_t call_suite[] = {16, 100, 1000, 10000};
+                for (size_t i = 0; i < countof(call_suite); i++)
+                    do_call_test(duration, call_suite[i]);
+            } else {
+                do_call_test(duration, test_args.size);
+            }
+        } else if (run_suite) {
             static constexpr TestArgs suite[] = {
                 {10, 0, 0},
                 {100, 0, 0},
@@ -52,6 +52,18 @@ MODULE_LIBS := system/ulib/mxio system/ulib/magenta system/ulib/c
 
 include make/module.mk
 
+MODULE := $(LOCAL_DIR).threadstats
+
+MODULE_TYPE := userapp
+
+MODULE_SRCS += $(LOCAL_DIR)/threadstats.c $(LOCAL_DIR)/processes.c
+
+MODULE_NAME := threadstats
+
+MODULE_LIBS := system/ulib/mxio system/ulib/magenta system/ulib/c
+
+include make/module.mk
+
 MODULE := $(LOCAL_DIR).test
 
 MODULE_TYPE := usertest
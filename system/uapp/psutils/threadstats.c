@@ -0,0 +1,161 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/status.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/object.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "processes.h"
+
+// Only threads of this process are printed, unless it's zero.
+static mx_koid_t filter_koid;
+// The process whose threads are being walked, zero if they're filtered out.
+static mx_koid_t current_process;
+static char current_process_name[MX_MAX_NAME_LEN];
+// Print the full wakeup latency histogram for each thread.
+static bool verbose;
+
+static mx_status_t process_callback(int depth, mx_handle_t process, mx_koid_t koid) {
+    if (filter_koid != 0 && koid != filter_koid) {
+        current_process = 0;
+        return NO_ERROR;
+    }
+    current_process = koid;
+    return mx_object_get_property(process, MX_PROP_NAME,
+                                  current_process_name, sizeof(current_process_name));
+}
+
+// Returns the upper bound, in microseconds, of the wakeup latency under
+// which |fraction| of the wakeups counted in |hist| fall. The last bucket
+// has no upper bound, so UINT64_MAX is returned for it.
+static uint64_t latency_percentile(const uint64_t* hist, uint64_t total, double fraction) {
+    uint64_t target = (uint64_t)(total * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < MX_INFO_THREAD_STATS_LATENCY_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > 0 && seen >= target) {
+            return i == MX_INFO_THREAD_STATS_LATENCY_BUCKETS - 1 ? UINT64_MAX : 1ull << i;
+        }
+    }
+    return UINT64_MAX;
+}
+
+static void print_latency(uint64_t us) {
+    if (us == UINT64_MAX) {
+        printf(" %7s", "inf");
+    } else {
+        printf(" %7" PRIu64, us);
+    }
+}
+
+static void print_header(void) {
+    printf("%8s %8s %10s %10s %8s %8s %8s %7s %7s %s\n",
+           "PID", "TID", "RUN(us)", "WAIT(us)", "WAKEUPS", "PREEMPTS", "MIGRATES",
+           "P50(us)", "P99(us)", "NAME");
+}
+
+static mx_status_t thread_callback(int depth, mx_handle_t thread, mx_koid_t koid) {
+    if (current_process == 0) {
+        return NO_ERROR;
+    }
+
+    char name[MX_MAX_NAME_LEN];
+    mx_status_t status = mx_object_get_property(thread, MX_PROP_NAME, name, sizeof(name));
+    if (status != NO_ERROR) {
+        return status;
+    }
+    mx_info_thread_stats_t stats;
+    status = mx_object_get_info(thread, MX_INFO_THREAD_STATS, &stats, sizeof(stats), NULL, NULL);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "ERROR: couldn't get stats for thread %" PRIu64 ": %s (%d)\n",
+                koid, mx_status_get_string(status), status);
+        return status;
+    }
+
+    uint64_t woken = 0;
+    for (int i = 0; i < MX_INFO_THREAD_STATS_LATENCY_BUCKETS; i++) {
+        woken += stats.wakeup_latency[i];
+    }
+
+    printf("%8" PRIu64 " %8" PRIu64 " %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64
+           " %8" PRIu64,
+           current_process, koid, stats.total_runtime / 1000, stats.total_run_queue_wait / 1000,
+           stats.wakeups, stats.preemptions, stats.migrations);
+    if (woken > 0) {
+        print_latency(latency_percentile(stats.wakeup_latency, woken, 0.5));
+        print_latency(latency_percentile(stats.wakeup_latency, woken, 0.99));
+    } else {
+        printf(" %7s %7s", "-", "-");
+    }
+    printf(" %s:%s\n", current_process_name, name);
+
+    if (verbose && woken > 0) {
+        printf("%17s wakeup latency:", "");
+        for (int i = 0; i < MX_INFO_THREAD_STATS_LATENCY_BUCKETS; i++) {
+            if (stats.wakeup_latency[i] == 0) {
+                continue;
+            }
+            if (i == 0) {
+                printf(" <1us:%" PRIu64, stats.wakeup_latency[i]);
+            } else if (i == MX_INFO_THREAD_STATS_LATENCY_BUCKETS - 1) {
+                printf(" >=%lluus:%" PRIu64, 1ull << (i - 1), stats.wakeup_latency[i]);
+            } else {
+                printf(" <%lluus:%" PRIu64, 1ull << i, stats.wakeup_latency[i]);
+            }
+        }
+        printf("\n");
+    }
+    return NO_ERROR;
+}
+
+static void print_help(FILE* f) {
+    fprintf(f, "Usage: threadstats [options] [<process-koid>]\n");
+    fprintf(f, "Prints scheduler statistics for every thread, or only the\n");
+    fprintf(f, "threads of the given process.\n");
+    fprintf(f, "Options:\n");
+    fprintf(f, " -v  Also print each thread's wakeup latency histogram\n");
+    fprintf(f, "\n");
+    fprintf(f, "WAIT is the time spent runnable but waiting for a cpu.\n");
+    fprintf(f, "P50 and P99 are upper bounds on the time from wakeup to running.\n");
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "--help")) {
+            print_help(stdout);
+            return 0;
+        }
+        if (!strcmp(arg, "-v")) {
+            verbose = true;
+        } else if (arg[0] != '-' && filter_koid == 0) {
+            char* end;
+            filter_koid = strtoull(arg, &end, 0);
+            if (*end != '\0' || filter_koid == 0) {
+                fprintf(stderr, "ERROR: \"%s\" is not a process koid\n", arg);
+                print_help(stderr);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            print_help(stderr);
+            return 1;
+        }
+    }
+
+    print_header();
+    mx_status_t status = walk_process_tree(NULL, process_callback, thread_callback);
+    if (status != NO_ERROR) {
+        fprintf(stderr, "WARNING: walk_process_tree failed: %s (%d)\n",
+                mx_status_get_string(status), status);
+        return 1;
+    }
+    return 0;
+}
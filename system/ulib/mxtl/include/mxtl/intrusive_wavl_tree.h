@@ -53,6 +53,12 @@
 // Erase-by-key runs in O(log) time; finding the node to erase takes O(log) time
 // while post-erase rebalancing runs in amortized constant time.
 //
+// Trees may be augmented with per-subtree values using an Observer (see
+// DefaultWAVLTreeObserver::RecordSubtreeChanged).  Keeping such values up to
+// date makes insert and erase O(log) overall.  Searches which use the values
+// can walk the tree structure directly, starting with root() and moving down
+// with an iterator's left() and right().
+//
 // Because of the intrusive nature of the container, direct-erase operations
 // (AKA, erase operations where the reference to the element to be erased is
 // already known) run in amortized constant time.
@@ -183,6 +189,11 @@ public:
     // make_iterator : construct an iterator out of a pointer to an object
     iterator make_iterator(ValueType& obj) { return iterator(&obj); }
 
+    // root : an iterator to the root node of the tree, or an invalid iterator if
+    // the tree is empty.  Use the iterator's left() and right() to descend.
+    iterator       root()       { return iterator(PtrTraits::GetRaw(root_)); }
+    const_iterator root() const { return const_iterator(PtrTraits::GetRaw(root_)); }
+
     // is_empty : True if the tree has at least one element in it, false otherwise.
     bool is_empty() const { return root_ == nullptr; }
 
@@ -575,6 +586,12 @@ private:
             return IsValid() ? PtrTraits::Copy(node_) : nullptr;
         }
 
+        // The children of this node in the tree structure, or invalid iterators
+        // if the node has no such child.  Unlike the results of ++ and --,
+        // these may not be compared with end().
+        iterator_impl left() const  { return child(NodeTraits::node_state(*node_).left_); }
+        iterator_impl right() const { return child(NodeTraits::node_state(*node_).right_); }
+
         typename IterTraits::RefType operator*()     const { MX_DEBUG_ASSERT(node_); return *node_; }
         typename IterTraits::RawPtrType operator->() const { MX_DEBUG_ASSERT(node_); return node_; }
 
@@ -583,6 +600,10 @@ private:
 
         iterator_impl(typename PtrTraits::RawPtrType node) : node_(node) { }
 
+        static iterator_impl child(const PtrType& ptr) {
+            return iterator_impl(PtrTraits::IsValid(ptr) ? PtrTraits::GetRaw(ptr) : nullptr);
+        }
+
         ContainerType* GetTree() const {
             return reinterpret_cast<ContainerType*>(
                     reinterpret_cast<uintptr_t>(node_) & ~internal::kContainerSentinelBit);
@@ -666,6 +687,7 @@ private:
 
             ++count_;
             Observer::RecordInsert();
+            Observer::RecordSubtreeChanged(PtrTraits::GetRaw(root_));
             return;
         }
 
@@ -742,6 +764,9 @@ private:
         ++count_;
         Observer::RecordInsert();
 
+        // Every node on the path up to the root has gained a descendant.
+        RecordPathChanged(PtrTraits::GetRaw(*owner));
+
         // Finally, perform post-insert balance operations.
         BalancePostInsert(PtrTraits::GetRaw(*owner));
     }
@@ -882,6 +907,12 @@ private:
         --count_;
         Observer::RecordErase();
 
+        // Every node on the path from the target's old parent up to the root
+        // has lost a descendant.  If the target was swapped with its successor
+        // above, the successor is on this path as well.
+        if (!PtrTraits::IsSentinel(parent))
+            RecordPathChanged(parent);
+
         // Time to rebalance.  We know that we don't need to rebalance if we
         // just removed the root (IOW - its parent was the sentinel value).
         if (!PtrTraits::IsSentinel(parent)) {
@@ -1260,6 +1291,22 @@ private:
         Z_ns.parent_ = X;
         if (Y)
             NodeTraits::node_state(*Y).parent_ = Z;
+
+        // Z is now a child of X, so it must be brought up to date first.  The
+        // set of nodes below G is unchanged.
+        Observer::RecordSubtreeChanged(Z);
+        Observer::RecordSubtreeChanged(X);
+    }
+
+    // RecordPathChanged
+    //
+    // Report a change to the subtree of every node from |node| up to the root
+    // of the tree to the Observer.
+    void RecordPathChanged(RawPtrType node) {
+        while (PtrTraits::IsValid(node)) {
+            Observer::RecordSubtreeChanged(node);
+            node = NodeTraits::node_state(*node).parent_;
+        }
     }
 
     // PostInsertFixupLR<LRTraits>
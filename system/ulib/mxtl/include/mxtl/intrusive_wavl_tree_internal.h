@@ -26,6 +26,14 @@ class WAVLTreeChecker;
 // phase of rebalancing are considered to be part of the cost of rotation and
 // are not tallied in the overall promote/demote accounting.
 //
+// Observers are also how users of the tree augment it.  RecordSubtreeChanged
+// is called for every node whose set of descendants may have changed, after
+// that has already been done for any of its children which also changed.  An
+// observer may use it to recompute a value which summarizes the node's subtree
+// from the node and its children (eg. the largest key gap in the subtree).
+// Nodes are reported bottom up along the insertion path before rebalancing, on
+// both sides of every rotation, and along the path above an erased node.
+//
 struct DefaultWAVLTreeObserver {
     static void RecordInsert()               { }
     static void RecordInsertPromote()        { }
@@ -37,6 +45,9 @@ struct DefaultWAVLTreeObserver {
     static void RecordEraseRotation()        { }
     static void RecordEraseDoubleRotation()  { }
 
+    template <typename RawPtrType>
+    static void RecordSubtreeChanged(RawPtrType node) { }
+
     template <typename TreeType>
     static bool VerifyRankRule(const TreeType& tree, typename TreeType::RawPtrType node) {
         return true;
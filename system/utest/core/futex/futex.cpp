@@ -4,6 +4,7 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <magenta/process.h>
 #include <magenta/syscalls.h>
 #include <magenta/threads.h>
 #include <unittest/unittest.h>
@@ -394,6 +395,40 @@ bool test_futex_thread_killed() {
     END_TEST;
 }
 
+static int pi_waiter_thread(void* arg) {
+    mx_futex_t* futex = static_cast<mx_futex_t*>(arg);
+    mx_handle_t owner = *reinterpret_cast<mx_handle_t*>(futex + 1);
+    return mx_futex_wait_pi(futex, 0, owner, mx_deadline_after(MX_SEC(10)));
+}
+
+static bool test_futex_wait_pi() {
+    BEGIN_TEST;
+    mx_futex_t futex = 0;
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+
+    EXPECT_EQ(mx_futex_wait_pi(&futex, 1, self, MX_TIME_INFINITE), ERR_BAD_STATE,
+              "value mismatch");
+    EXPECT_EQ(mx_futex_wait_pi(&futex, 0, MX_HANDLE_INVALID, 0), ERR_TIMED_OUT,
+              "no owner is a plain wait");
+    EXPECT_EQ(mx_futex_wait_pi(&futex, 0, self, 0), ERR_TIMED_OUT,
+              "waiting on ourselves is a plain wait");
+    EXPECT_EQ(mx_futex_wait_pi(&futex, 0, mx_process_self(), 0), ERR_WRONG_TYPE,
+              "owner must be a thread");
+
+    // A waiter lending us its priority is woken like any other.
+    mx_futex_t futex_and_owner[2] = {0, static_cast<mx_futex_t>(self)};
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, pi_waiter_thread, futex_and_owner), thrd_success, "");
+    // Give the thread a chance to block before waking it.
+    mx_nanosleep(mx_deadline_after(MX_MSEC(100)));
+    ASSERT_EQ(mx_futex_wake(&futex_and_owner[0], 1), NO_ERROR, "");
+    int result;
+    ASSERT_EQ(thrd_join(thread, &result), thrd_success, "");
+    EXPECT_EQ(result, NO_ERROR, "waiter should have been woken");
+
+    END_TEST;
+}
+
 // Test that misaligned pointers cause futex syscalls to return a failure.
 static bool test_futex_misaligned() {
   BEGIN_TEST;
@@ -417,6 +452,8 @@ static bool test_futex_misaligned() {
   memset(&buffer, 0, sizeof(buffer));
 
   ASSERT_EQ(mx_futex_wait(futex, 0, MX_TIME_INFINITE), ERR_INVALID_ARGS, "");
+  ASSERT_EQ(mx_futex_wait_pi(futex, 0, MX_HANDLE_INVALID, MX_TIME_INFINITE),
+            ERR_INVALID_ARGS, "");
   ASSERT_EQ(mx_futex_wake(futex, 1), ERR_INVALID_ARGS, "");
   ASSERT_EQ(mx_futex_requeue(futex, 1, 0, futex_2, 1), ERR_INVALID_ARGS, "");
 
@@ -513,6 +550,7 @@ RUN_TEST(test_futex_requeue_same_addr);
 RUN_TEST(test_futex_requeue);
 RUN_TEST(test_futex_requeue_unqueued_on_timeout);
 RUN_TEST(test_futex_thread_killed);
+RUN_TEST(test_futex_wait_pi);
 RUN_TEST(test_futex_misaligned);
 RUN_TEST(test_event_signaling);
 END_TEST_CASE(futex_tests)
@@ -0,0 +1,112 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <magenta/syscalls.h>
+#include <magenta/types.h>
+#include <unittest/unittest.h>
+#include <stdio.h>
+
+extern mx_handle_t root_resource;
+
+#define CHUNK_SIZE (4u * 1024 * 1024)
+#define MAX_CHUNKS 1024u
+
+static mx_handle_t chunks[MAX_CHUNKS];
+
+static mx_signals_t current_signals(mx_handle_t h) {
+    mx_signals_t observed = 0u;
+    mx_object_wait_one(h, MX_SYSTEM_MEMORY_WARNING | MX_SYSTEM_MEMORY_CRITICAL, 0u, &observed);
+    return observed & (MX_SYSTEM_MEMORY_WARNING | MX_SYSTEM_MEMORY_CRITICAL);
+}
+
+static bool test_get_event(void) {
+    BEGIN_TEST;
+
+    ASSERT_NEQ(root_resource, MX_HANDLE_INVALID, "no root resource handle");
+
+    mx_handle_t ev;
+    ASSERT_EQ(mx_system_get_event(root_resource, MX_SYSTEM_EVENT_LOW_MEMORY, &ev), NO_ERROR, "");
+
+    // only the kernel gets to signal it
+    EXPECT_EQ(mx_object_signal(ev, 0u, MX_USER_SIGNAL_0), ERR_ACCESS_DENIED, "");
+
+    mx_handle_t h;
+    EXPECT_EQ(mx_system_get_event(root_resource, 12345u, &h), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_system_get_event(ev, MX_SYSTEM_EVENT_LOW_MEMORY, &h), ERR_WRONG_TYPE, "");
+
+    EXPECT_EQ(mx_handle_close(ev), NO_ERROR, "");
+
+    END_TEST;
+}
+
+// Commit memory a chunk at a time until the warning and then the critical
+// signal fire, then give it all back and check they go away again.
+static bool test_low_memory_signals(void) {
+    BEGIN_TEST;
+
+    ASSERT_NEQ(root_resource, MX_HANDLE_INVALID, "no root resource handle");
+
+    mx_handle_t ev;
+    ASSERT_EQ(mx_system_get_event(root_resource, MX_SYSTEM_EVENT_LOW_MEMORY, &ev), NO_ERROR, "");
+
+    mx_signals_t initial = current_signals(ev);
+    ASSERT_EQ(initial & MX_SYSTEM_MEMORY_CRITICAL, 0u, "memory already critical");
+
+    mx_signals_t seen = initial;
+    size_t count = 0;
+    while (!(seen & MX_SYSTEM_MEMORY_CRITICAL) && count < MAX_CHUNKS) {
+        mx_handle_t vmo;
+        ASSERT_EQ(mx_vmo_create(CHUNK_SIZE, 0u, &vmo), NO_ERROR, "");
+        mx_status_t status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0u, CHUNK_SIZE, NULL, 0u);
+        chunks[count++] = vmo;
+        if (status != NO_ERROR) {
+            EXPECT_EQ(status, ERR_NO_MEMORY, "");
+            break;
+        }
+
+        // the signals are raised from a kernel thread, so give it a moment
+        mx_signals_t want = (seen & MX_SYSTEM_MEMORY_WARNING) ? MX_SYSTEM_MEMORY_CRITICAL
+                                                              : MX_SYSTEM_MEMORY_WARNING;
+        mx_signals_t observed = 0u;
+        mx_object_wait_one(ev, want, mx_deadline_after(MX_MSEC(10)), &observed);
+        observed &= MX_SYSTEM_MEMORY_WARNING | MX_SYSTEM_MEMORY_CRITICAL;
+
+        // warning is always raised along with critical
+        if (observed & MX_SYSTEM_MEMORY_CRITICAL)
+            EXPECT_TRUE(observed & MX_SYSTEM_MEMORY_WARNING, "critical without warning");
+        if ((observed & MX_SYSTEM_MEMORY_WARNING) && !(seen & MX_SYSTEM_MEMORY_WARNING))
+            unittest_printf("warning after %zu MB\n", count * CHUNK_SIZE / (1024 * 1024));
+        if (observed & MX_SYSTEM_MEMORY_CRITICAL)
+            unittest_printf("critical after %zu MB\n", count * CHUNK_SIZE / (1024 * 1024));
+        seen |= observed;
+    }
+
+    if (count == MAX_CHUNKS && !(seen & MX_SYSTEM_MEMORY_CRITICAL)) {
+        unittest_printf("too much memory to run low, skipping\n");
+    } else {
+        EXPECT_TRUE(seen & MX_SYSTEM_MEMORY_WARNING, "warning never signalled");
+        EXPECT_TRUE(seen & MX_SYSTEM_MEMORY_CRITICAL, "critical never signalled");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(mx_handle_close(chunks[i]), NO_ERROR, "");
+    }
+
+    // the signals we caused should clear once the memory is back
+    mx_signals_t observed = current_signals(ev);
+    for (int i = 0; i < 100 && observed != initial; i++) {
+        mx_nanosleep(mx_deadline_after(MX_MSEC(10)));
+        observed = current_signals(ev);
+    }
+    EXPECT_EQ(observed, initial, "signals not cleared");
+
+    EXPECT_EQ(mx_handle_close(ev), NO_ERROR, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(memory_pressure_tests)
+RUN_TEST(test_get_event);
+RUN_TEST_LARGE(test_low_memory_signals); // Runs the whole system low on memory => large test
+END_TEST_CASE(memory_pressure_tests)
@@ -0,0 +1,281 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+#include <magenta/process.h>
+#include <magenta/syscalls.h>
+#include <magenta/syscalls/port.h>
+
+#include <unittest/unittest.h>
+
+static const uint64_t kPagerKey = 0x1234u;
+static const size_t kNumPages = 4;
+
+struct pager_server {
+    mx_handle_t pager;
+    mx_handle_t port;
+    mx_handle_t vmo;
+    int requests;
+};
+
+// every byte of a page holds its page number plus one, so it can't be confused with zero fill
+static uint8_t page_byte(uint64_t offset) {
+    return static_cast<uint8_t>(offset / PAGE_SIZE + 1);
+}
+
+// answer page requests until a user packet arrives
+static int pager_server_thread(void* arg) {
+    auto server = static_cast<pager_server*>(arg);
+
+    for (;;) {
+        mx_port_packet_t packet;
+        if (mx_port_wait(server->port, MX_TIME_INFINITE, &packet, 0u) != NO_ERROR)
+            return -1;
+        if (packet.type == MX_PKT_TYPE_USER)
+            return 0;
+        if (packet.type != MX_PKT_TYPE_PAGE_REQUEST || packet.key != kPagerKey ||
+            packet.page_request.command != MX_PAGER_READ)
+            return -1;
+
+        server->requests++;
+
+        uint64_t offset = packet.page_request.offset;
+        uint64_t length = packet.page_request.length;
+
+        mx_handle_t aux;
+        if (mx_vmo_create(length, 0, &aux) != NO_ERROR)
+            return -1;
+
+        uint8_t buf[PAGE_SIZE];
+        for (uint64_t o = 0; o < length; o += PAGE_SIZE) {
+            memset(buf, page_byte(offset + o), sizeof(buf));
+            size_t actual;
+            if (mx_vmo_write(aux, buf, o, sizeof(buf), &actual) != NO_ERROR)
+                return -1;
+        }
+
+        mx_status_t status = mx_pager_supply_pages(server->pager, server->vmo, offset, length,
+                                                   aux, 0);
+        mx_handle_close(aux);
+        if (status != NO_ERROR)
+            return -1;
+    }
+}
+
+static bool start_server(pager_server* server, thrd_t* thread) {
+    BEGIN_HELPER;
+
+    ASSERT_EQ(mx_pager_create(0, &server->pager), NO_ERROR, "");
+    ASSERT_EQ(mx_port_create(MX_PORT_OPT_V2, &server->port), NO_ERROR, "");
+    ASSERT_EQ(mx_pager_create_vmo(server->pager, server->port, kPagerKey,
+                                  kNumPages * PAGE_SIZE, 0, &server->vmo), NO_ERROR, "");
+    server->requests = 0;
+
+    ASSERT_EQ(thrd_create(thread, pager_server_thread, server), thrd_success, "");
+
+    END_HELPER;
+}
+
+static bool stop_server(pager_server* server, thrd_t thread) {
+    BEGIN_HELPER;
+
+    const mx_port_packet_t quit = {};
+    ASSERT_EQ(mx_port_queue(server->port, &quit, 0u), NO_ERROR, "");
+
+    int ret;
+    ASSERT_EQ(thrd_join(thread, &ret), thrd_success, "");
+    EXPECT_EQ(ret, 0, "pager server failed");
+
+    EXPECT_EQ(mx_handle_close(server->vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(server->port), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(server->pager), NO_ERROR, "");
+
+    END_HELPER;
+}
+
+static bool pager_read_test(void) {
+    BEGIN_TEST;
+
+    pager_server server;
+    thrd_t thread;
+    ASSERT_TRUE(start_server(&server, &thread), "");
+
+    // reading the whole vmo brings in every page once
+    uint8_t buf[kNumPages * PAGE_SIZE];
+    size_t actual;
+    EXPECT_EQ(mx_vmo_read(server.vmo, buf, 0, sizeof(buf), &actual), NO_ERROR, "");
+    EXPECT_EQ(actual, sizeof(buf), "");
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        if (buf[i] != page_byte(i)) {
+            EXPECT_EQ(buf[i], page_byte(i), "wrong data read");
+            break;
+        }
+    }
+
+    // and reading it again asks for nothing more
+    EXPECT_EQ(mx_vmo_read(server.vmo, buf, 0, sizeof(buf), &actual), NO_ERROR, "");
+
+    ASSERT_TRUE(stop_server(&server, thread), "");
+    EXPECT_EQ(server.requests, static_cast<int>(kNumPages), "");
+
+    END_TEST;
+}
+
+static bool pager_map_test(void) {
+    BEGIN_TEST;
+
+    pager_server server;
+    thrd_t thread;
+    ASSERT_TRUE(start_server(&server, &thread), "");
+
+    uintptr_t ptr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, server.vmo, 0, kNumPages * PAGE_SIZE,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &ptr), NO_ERROR, "");
+
+    // faulting brings the pages in, and writes to them stick
+    auto p = reinterpret_cast<volatile uint8_t*>(ptr);
+    for (size_t i = 0; i < kNumPages; i++)
+        EXPECT_EQ(p[i * PAGE_SIZE + 10], page_byte(i * PAGE_SIZE), "");
+    p[PAGE_SIZE] = 0xaa;
+
+    uint8_t b;
+    size_t actual;
+    EXPECT_EQ(mx_vmo_read(server.vmo, &b, PAGE_SIZE, 1, &actual), NO_ERROR, "");
+    EXPECT_EQ(b, 0xaa, "");
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), ptr, kNumPages * PAGE_SIZE), NO_ERROR, "");
+
+    ASSERT_TRUE(stop_server(&server, thread), "");
+    EXPECT_EQ(server.requests, static_cast<int>(kNumPages), "");
+
+    END_TEST;
+}
+
+static bool pager_clone_test(void) {
+    BEGIN_TEST;
+
+    pager_server server;
+    thrd_t thread;
+    ASSERT_TRUE(start_server(&server, &thread), "");
+
+    // a clone reads its parent's pages through the pager
+    mx_handle_t clone;
+    ASSERT_EQ(mx_vmo_clone(server.vmo, MX_VMO_CLONE_COPY_ON_WRITE, 0, kNumPages * PAGE_SIZE,
+                           &clone), NO_ERROR, "");
+
+    uint8_t b;
+    size_t actual;
+    EXPECT_EQ(mx_vmo_read(clone, &b, 2 * PAGE_SIZE, 1, &actual), NO_ERROR, "");
+    EXPECT_EQ(b, page_byte(2 * PAGE_SIZE), "");
+
+    // writing to the clone doesn't change the parent
+    b = 0x55;
+    EXPECT_EQ(mx_vmo_write(clone, &b, 2 * PAGE_SIZE, 1, &actual), NO_ERROR, "");
+    EXPECT_EQ(mx_vmo_read(server.vmo, &b, 2 * PAGE_SIZE, 1, &actual), NO_ERROR, "");
+    EXPECT_EQ(b, page_byte(2 * PAGE_SIZE), "");
+
+    EXPECT_EQ(mx_handle_close(clone), NO_ERROR, "");
+
+    ASSERT_TRUE(stop_server(&server, thread), "");
+    EXPECT_EQ(server.requests, 1, "");
+
+    END_TEST;
+}
+
+static bool pager_errors_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t pager, port, vmo, other_vmo, aux;
+    ASSERT_EQ(mx_pager_create(0, &pager), NO_ERROR, "");
+    ASSERT_EQ(mx_port_create(MX_PORT_OPT_V2, &port), NO_ERROR, "");
+    ASSERT_EQ(mx_pager_create_vmo(pager, port, kPagerKey, PAGE_SIZE, 0, &vmo), NO_ERROR, "");
+    ASSERT_EQ(mx_vmo_create(PAGE_SIZE, 0, &other_vmo), NO_ERROR, "");
+    ASSERT_EQ(mx_vmo_create(PAGE_SIZE, 0, &aux), NO_ERROR, "");
+
+    // only the pager's own vmos can be supplied, a page at a time
+    EXPECT_EQ(mx_pager_supply_pages(pager, other_vmo, 0, PAGE_SIZE, aux, 0),
+              ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_pager_supply_pages(pager, vmo, 0, 10, aux, 0), ERR_INVALID_ARGS, "");
+    EXPECT_EQ(mx_pager_supply_pages(pager, vmo, PAGE_SIZE, PAGE_SIZE, aux, 0),
+              ERR_OUT_OF_RANGE, "");
+
+    // the pager decides how big the vmo is
+    EXPECT_EQ(mx_vmo_set_size(vmo, 2 * PAGE_SIZE), ERR_NOT_SUPPORTED, "");
+
+    // once the pager is gone, missing pages can't be read
+    EXPECT_EQ(mx_handle_close(pager), NO_ERROR, "");
+    uint8_t b;
+    size_t actual;
+    EXPECT_EQ(mx_vmo_read(vmo, &b, 0, 1, &actual), ERR_BAD_STATE, "");
+
+    EXPECT_EQ(mx_handle_close(aux), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(other_vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(port), NO_ERROR, "");
+
+    END_TEST;
+}
+
+struct blocked_read {
+    mx_handle_t vmo;
+    mx_status_t status;
+};
+
+static int blocked_read_thread(void* arg) {
+    auto read = static_cast<blocked_read*>(arg);
+    uint8_t b;
+    size_t actual;
+    read->status = mx_vmo_read(read->vmo, &b, 0, 1, &actual);
+    return 0;
+}
+
+static bool pager_port_closed_test(void) {
+    BEGIN_TEST;
+
+    mx_handle_t pager, port, vmo;
+    ASSERT_EQ(mx_pager_create(0, &pager), NO_ERROR, "");
+    ASSERT_EQ(mx_port_create(MX_PORT_OPT_V2, &port), NO_ERROR, "");
+    ASSERT_EQ(mx_pager_create_vmo(pager, port, kPagerKey, PAGE_SIZE, 0, &vmo), NO_ERROR, "");
+
+    // start a read and wait until its request is on the port, unanswered
+    blocked_read read = {vmo, NO_ERROR};
+    thrd_t thread;
+    ASSERT_EQ(thrd_create(&thread, blocked_read_thread, &read), thrd_success, "");
+    mx_port_packet_t packet;
+    ASSERT_EQ(mx_port_wait(port, MX_TIME_INFINITE, &packet, 0u), NO_ERROR, "");
+    EXPECT_EQ(packet.type, MX_PKT_TYPE_PAGE_REQUEST, "");
+
+    // closing the port leaves nobody to answer it, so the read has to fail
+    // rather than wait forever, and so does the next one for the same page
+    EXPECT_EQ(mx_handle_close(port), NO_ERROR, "");
+    int ret;
+    ASSERT_EQ(thrd_join(thread, &ret), thrd_success, "");
+    EXPECT_EQ(read.status, ERR_BAD_STATE, "");
+    uint8_t b;
+    size_t actual;
+    EXPECT_EQ(mx_vmo_read(vmo, &b, 0, 1, &actual), ERR_BAD_STATE, "");
+
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(pager), NO_ERROR, "");
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(pager_tests)
+RUN_TEST(pager_read_test)
+RUN_TEST(pager_map_test)
+RUN_TEST(pager_clone_test)
+RUN_TEST(pager_errors_test)
+RUN_TEST(pager_port_closed_test)
+END_TEST_CASE(pager_tests)
+
+#ifndef BUILD_COMBINED_TESTS
+int main(int argc, char** argv) {
+    return unittest_run_all_tests(argc, argv) ? 0 : -1;
+}
+#endif
@@ -320,12 +320,62 @@ static bool pthread_getstack_other_thread_explicit_size() {
     END_TEST;
 }
 
+static pthread_mutex_t pi_mutex;
+static int pi_counter;
+constexpr int kPiIterations = 10000;
+
+static void* pi_mutex_thread(void* arg) {
+    for (int i = 0; i < kPiIterations; i++) {
+        pthread_mutex_lock(&pi_mutex);
+        int value = pi_counter;
+        if (i % 16 == 0)
+            sched_yield();
+        pi_counter = value + 1;
+        pthread_mutex_unlock(&pi_mutex);
+    }
+    return nullptr;
+}
+
+static bool pthread_mutex_prio_inherit() {
+    BEGIN_TEST;
+
+    pthread_mutexattr_t attr;
+    ASSERT_EQ(pthread_mutexattr_init(&attr), 0, "");
+    EXPECT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_PROTECT), ENOTSUP,
+              "priority ceilings are not supported");
+    ASSERT_EQ(pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT), 0, "");
+    int protocol;
+    ASSERT_EQ(pthread_mutexattr_getprotocol(&attr, &protocol), 0, "");
+    EXPECT_EQ(protocol, PTHREAD_PRIO_INHERIT, "");
+    ASSERT_EQ(pthread_mutex_init(&pi_mutex, &attr), 0, "");
+    pthread_mutexattr_destroy(&attr);
+
+    // Only the owner may unlock a priority inheriting mutex.
+    EXPECT_EQ(pthread_mutex_unlock(&pi_mutex), EPERM, "");
+
+    pi_counter = 0;
+    pthread_t threads[4];
+    for (auto& thread : threads)
+        ASSERT_EQ(pthread_create(&thread, nullptr, pi_mutex_thread, nullptr), 0, "");
+    for (auto& thread : threads)
+        ASSERT_EQ(pthread_join(thread, nullptr), 0, "");
+    EXPECT_EQ(pi_counter, kPiIterations * 4, "lost updates under the mutex");
+
+    EXPECT_EQ(pthread_mutex_trylock(&pi_mutex), 0, "");
+    EXPECT_EQ(pthread_mutex_trylock(&pi_mutex), EBUSY, "");
+    EXPECT_EQ(pthread_mutex_unlock(&pi_mutex), 0, "");
+    pthread_mutex_destroy(&pi_mutex);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(pthread_tests)
 RUN_TEST(pthread_test)
 RUN_TEST(pthread_self_main_thread_test)
 RUN_TEST(pthread_big_stack_size)
 RUN_TEST(pthread_getstack_main_thread)
 RUN_TEST(pthread_getstack_other_thread)
+RUN_TEST(pthread_mutex_prio_inherit)
 END_TEST_CASE(pthread_tests)
 
 #ifndef BUILD_COMBINED_TESTS
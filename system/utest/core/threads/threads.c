@@ -3,7 +3,9 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <inttypes.h>
 #include <stddef.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <magenta/process.h>
@@ -11,6 +13,7 @@
 #include <magenta/syscalls/exception.h>
 #include <magenta/syscalls/object.h>
 #include <magenta/syscalls/port.h>
+#include <magenta/threads.h>
 
 #include <unittest/unittest.h>
 #include <runtime/thread.h>
@@ -226,6 +229,51 @@ static bool test_info_task_stats_fails(void) {
     END_TEST;
 }
 
+static bool test_info_thread_stats(void) {
+    BEGIN_TEST;
+
+    mx_handle_t event;
+    mxr_thread_t thread;
+
+    ASSERT_EQ(mx_event_create(0, &event), NO_ERROR, "");
+    ASSERT_TRUE(start_thread(test_wait_thread_fn, &event, &thread), "");
+    mx_handle_t thread_h = mxr_thread_get_handle(&thread);
+
+    // Wait for the thread to block on the event, then wake it up.
+    mx_info_thread_t info;
+    do {
+        mx_nanosleep(mx_deadline_after(MX_MSEC(1)));
+        ASSERT_EQ(mx_object_get_info(thread_h, MX_INFO_THREAD,
+                                     &info, sizeof(info), NULL, NULL),
+                  NO_ERROR, "");
+    } while (info.state != MX_THREAD_STATE_BLOCKED);
+    ASSERT_EQ(mx_object_signal(event, 0, MX_USER_SIGNAL_0), NO_ERROR, "");
+    ASSERT_EQ(mx_object_wait_one(
+        thread_h, MX_THREAD_SIGNALED, MX_TIME_INFINITE, NULL), NO_ERROR, "");
+
+    mx_info_thread_stats_t stats;
+    ASSERT_EQ(mx_object_get_info(thread_h, MX_INFO_THREAD_STATS,
+                                 &stats, sizeof(stats) - 1, NULL, NULL),
+              ERR_BUFFER_TOO_SMALL, "");
+    ASSERT_EQ(mx_object_get_info(thread_h, MX_INFO_THREAD_STATS,
+                                 &stats, sizeof(stats), NULL, NULL),
+              NO_ERROR, "");
+
+    // Starting the thread and signaling the event each made it runnable,
+    // and every wakeup of an exited thread has been followed by it running.
+    EXPECT_GE(stats.wakeups, 2u, "");
+    uint64_t latencies = 0;
+    for (size_t i = 0; i < MX_INFO_THREAD_STATS_LATENCY_BUCKETS; i++)
+        latencies += stats.wakeup_latency[i];
+    EXPECT_EQ(latencies, stats.wakeups, "");
+    EXPECT_GT(stats.total_runtime, 0u, "");
+
+    ASSERT_EQ(mx_handle_close(event), NO_ERROR, "");
+    ASSERT_EQ(mx_handle_close(thread_h), NO_ERROR, "");
+
+    END_TEST;
+}
+
 static bool test_resume_suspended(void) {
     BEGIN_TEST;
 
@@ -520,6 +568,104 @@ static bool test_suspend_stops_thread(void) {
     END_TEST;
 }
 
+#ifdef BUILD_COMBINED_TESTS
+// Admitting a deadline thread takes the root resource, which only the
+// combined core tests are handed.
+extern mx_handle_t root_resource;
+
+// Use up |duration| of cpu time, however long that takes.
+static void burn_cpu(mx_duration_t duration) {
+    mx_time_t end = mx_time_get(MX_CLOCK_THREAD) + duration;
+    while (mx_time_get(MX_CLOCK_THREAD) < end)
+        ;
+}
+
+static bool test_deadline_admission(void) {
+    BEGIN_TEST;
+
+    ASSERT_NEQ(root_resource, MX_HANDLE_INVALID, "no root resource handle");
+
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+    mx_deadline_params_t params = {MX_MSEC(1), MX_MSEC(5), MX_MSEC(10), root_resource};
+    ASSERT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              NO_ERROR, "");
+    params = (mx_deadline_params_t){};
+    EXPECT_EQ(mx_object_get_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              NO_ERROR, "");
+    EXPECT_EQ(params.runtime, MX_MSEC(1), "");
+    EXPECT_EQ(params.deadline, MX_MSEC(5), "");
+    EXPECT_EQ(params.period, MX_MSEC(10), "");
+
+    // the runtime has to fit in the deadline, and the deadline in the period
+    params = (mx_deadline_params_t){MX_MSEC(5), MX_MSEC(1), MX_MSEC(10), root_resource};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              ERR_INVALID_ARGS, "");
+    params = (mx_deadline_params_t){MX_MSEC(1), MX_MSEC(10), MX_MSEC(5), root_resource};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              ERR_INVALID_ARGS, "");
+
+    // no cpu can be given over entirely to deadline threads
+    params = (mx_deadline_params_t){MX_MSEC(10), MX_MSEC(10), MX_MSEC(10), root_resource};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              ERR_NO_RESOURCES, "");
+
+    params = (mx_deadline_params_t){};
+    EXPECT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool test_deadline_met_under_load(void) {
+    BEGIN_TEST;
+
+    ASSERT_NEQ(root_resource, MX_HANDLE_INVALID, "no root resource handle");
+
+    // Keep every cpu busy with threads of our priority, which would each
+    // get a full time slice ahead of us under round robin scheduling.
+    const uint32_t num_busy = mx_system_get_num_cpus() * 2;
+    mxr_thread_t busy[num_busy];
+    for (uint32_t i = 0; i < num_busy; i++)
+        ASSERT_TRUE(start_thread(busy_thread_fn, NULL, &busy[i]), "");
+
+    mx_handle_t self = thrd_get_mx_handle(thrd_current());
+    const mx_duration_t kRuntime = MX_MSEC(2);
+    const mx_duration_t kWork = MX_MSEC(1);
+    const mx_duration_t kDeadline = MX_MSEC(5);
+    const mx_duration_t kPeriod = MX_MSEC(10);
+    mx_deadline_params_t params = {kRuntime, kDeadline, kPeriod, root_resource};
+    ASSERT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              NO_ERROR, "");
+
+    const int kPeriods = 100;
+    int misses = 0;
+    mx_duration_t worst = 0;
+    mx_time_t release = mx_time_get(MX_CLOCK_MONOTONIC) + kPeriod;
+    for (int i = 0; i < kPeriods; i++, release += kPeriod) {
+        mx_nanosleep(release);
+        burn_cpu(kWork);
+        mx_duration_t finished = mx_time_get(MX_CLOCK_MONOTONIC) - release;
+        if (finished > kDeadline)
+            misses++;
+        if (finished > worst)
+            worst = finished;
+    }
+
+    params = (mx_deadline_params_t){};
+    ASSERT_EQ(mx_object_set_property(self, MX_PROP_DEADLINE, &params, sizeof(params)),
+              NO_ERROR, "");
+    for (uint32_t i = 0; i < num_busy; i++) {
+        ASSERT_EQ(mxr_thread_kill(&busy[i]), NO_ERROR, "");
+        ASSERT_EQ(mxr_thread_join(&busy[i]), NO_ERROR, "");
+    }
+
+    unittest_printf("worst completion %" PRIu64 " us after release\n", worst / 1000);
+    EXPECT_EQ(misses, 0, "deadline thread missed deadlines");
+
+    END_TEST;
+}
+#endif
+
 BEGIN_TEST_CASE(threads_tests)
 RUN_TEST(test_basics)
 RUN_TEST(test_long_name_succeeds)
@@ -529,12 +675,17 @@ RUN_TEST(test_kill_busy_thread)
 RUN_TEST(test_kill_sleep_thread)
 RUN_TEST(test_kill_wait_thread)
 RUN_TEST(test_info_task_stats_fails)
+RUN_TEST(test_info_thread_stats)
 RUN_TEST(test_resume_suspended)
 RUN_TEST(test_kill_suspended)
 RUN_TEST(test_suspend_sleeping)
 RUN_TEST(test_suspend_channel_call)
 RUN_TEST(test_suspend_port_call)
 RUN_TEST(test_suspend_stops_thread)
+#ifdef BUILD_COMBINED_TESTS
+RUN_TEST(test_deadline_admission)
+RUN_TEST(test_deadline_met_under_load)
+#endif
 END_TEST_CASE(threads_tests)
 
 #ifndef BUILD_COMBINED_TESTS
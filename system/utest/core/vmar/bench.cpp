@@ -0,0 +1,102 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <magenta/process.h>
+#include <magenta/syscalls.h>
+
+#include "bench.h"
+
+// spin the cpu a bit to make sure the frequency is cranked to the top
+static void spin(mx_time_t nanosecs) {
+    mx_time_t t = mx_time_get(MX_CLOCK_MONOTONIC);
+
+    while (mx_time_get(MX_CLOCK_MONOTONIC) - t < nanosecs)
+        ;
+}
+
+template <typename T>
+inline mx_time_t time_it(T func) {
+    spin(MX_MSEC(10));
+
+    mx_time_t t = mx_time_get(MX_CLOCK_MONOTONIC);
+    func();
+    return mx_time_get(MX_CLOCK_MONOTONIC) - t;
+}
+
+int vmar_run_benchmark() {
+    mx_time_t t;
+
+    printf("starting VMAR benchmark\n");
+
+    // fill a vmar with many small mappings, then time finding room for more
+    // in it.  Placement should not slow down as the vmar fills up.
+    const size_t vmar_size = 1024*1024*1024;
+    const size_t num_mappings = 8192;
+    const size_t num_timed = 1024;
+    mx_handle_t vmo;
+    mx_handle_t vmar;
+    uintptr_t ptr;
+    uintptr_t vmar_addr;
+    uintptr_t* addrs = new uintptr_t[num_timed];
+
+    mx_vmo_create(PAGE_SIZE, 0, &vmo);
+    mx_vmar_allocate(mx_vmar_root_self(), 0, vmar_size,
+                     MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_CAN_MAP_SPECIFIC, &vmar, &vmar_addr);
+
+    t = time_it([&](){
+        for (size_t i = 0; i < num_mappings; i++) {
+            mx_vmar_map(vmar, 0, vmo, 0, PAGE_SIZE, MX_VM_FLAG_PERM_READ, &ptr);
+        }
+    });
+    printf("\ttook %" PRIu64 " nsecs to map %zu single pages at random in a vmar\n", t, num_mappings);
+
+    t = time_it([&](){
+        for (size_t i = 0; i < num_timed; i++) {
+            mx_vmar_map(vmar, 0, vmo, 0, PAGE_SIZE, MX_VM_FLAG_PERM_READ, &addrs[i]);
+        }
+    });
+    printf("\ttook %" PRIu64 " nsecs to map %zu more single pages at random with %zu already mapped\n",
+           t, num_timed, num_mappings);
+
+    t = time_it([&](){
+        for (size_t i = 0; i < num_timed; i++) {
+            mx_vmar_unmap(vmar, addrs[i], PAGE_SIZE);
+        }
+    });
+    printf("\ttook %" PRIu64 " nsecs to unmap %zu single pages with %zu others mapped\n",
+           t, num_timed, num_mappings);
+
+    mx_vmar_destroy(vmar);
+    mx_handle_close(vmar);
+
+    // the same, for a vmar using the compact placement policy
+    mx_vmar_allocate(mx_vmar_root_self(), 0, vmar_size,
+                     MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_CAN_MAP_SPECIFIC | MX_VM_FLAG_COMPACT,
+                     &vmar, &vmar_addr);
+    for (size_t i = 0; i < num_mappings; i++) {
+        mx_vmar_map(vmar, 0, vmo, 0, PAGE_SIZE, MX_VM_FLAG_PERM_READ, &ptr);
+    }
+
+    t = time_it([&](){
+        for (size_t i = 0; i < num_timed; i++) {
+            mx_vmar_map(vmar, 0, vmo, 0, PAGE_SIZE, MX_VM_FLAG_PERM_READ, &addrs[i]);
+        }
+    });
+    printf("\ttook %" PRIu64 " nsecs to map %zu more single pages compactly with %zu already mapped\n",
+           t, num_timed, num_mappings);
+
+    mx_vmar_destroy(vmar);
+    mx_handle_close(vmar);
+    mx_handle_close(vmo);
+    delete[] addrs;
+
+    printf("done with benchmark\n");
+
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdalign.h>
+#include <string.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <magenta/process.h>
@@ -15,6 +17,8 @@
 #include <unittest/unittest.h>
 #include <sys/mman.h>
 
+#include "bench.h"
+
 // These tests focus on the semantics of the VMARs themselves.  For heavier
 // testing of the mapping permissions, see the VMO tests.
 
@@ -1593,6 +1597,96 @@ bool protect_over_demand_paged_test() {
     END_TEST;
 }
 
+// Each fault thread writes its index into every kFaultThreads'th page of a
+// shared mapping, so that all of them fault on the same vmo at once.
+constexpr size_t kFaultThreads = 8;
+constexpr size_t kFaultPages = 1024;
+
+struct FaultThreadArgs {
+    uintptr_t base;
+    size_t index;
+};
+
+int fault_thread(void* arg) {
+    auto args = static_cast<FaultThreadArgs*>(arg);
+    for (size_t i = args->index; i < kFaultPages; i += kFaultThreads) {
+        reinterpret_cast<volatile uint8_t*>(args->base + i * PAGE_SIZE)[0] =
+                static_cast<uint8_t>(args->index + 1);
+    }
+    return 0;
+}
+
+// Keeps mapping and unmapping elsewhere in the address space while the fault
+// threads run, so that faults race with changes to the vmar tree.
+volatile bool remap_thread_stop;
+
+int remap_thread(void* arg) {
+    mx_handle_t vmo = *static_cast<mx_handle_t*>(arg);
+    while (!remap_thread_stop) {
+        uintptr_t addr;
+        if (mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, 4 * PAGE_SIZE,
+                        MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &addr) != NO_ERROR) {
+            return -1;
+        }
+        reinterpret_cast<volatile uint8_t*>(addr)[PAGE_SIZE] = 1;
+        if (mx_vmar_unmap(mx_vmar_root_self(), addr, 4 * PAGE_SIZE) != NO_ERROR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Verify that many threads can fault on the same address space at once, while
+// it is being changed underneath them, and that every page ends up with the
+// right contents.
+bool concurrent_fault_test() {
+    BEGIN_TEST;
+
+    const size_t size = kFaultPages * PAGE_SIZE;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(size, 0, &vmo), NO_ERROR, "");
+    mx_handle_t remap_vmo;
+    ASSERT_EQ(mx_vmo_create(4 * PAGE_SIZE, 0, &remap_vmo), NO_ERROR, "");
+
+    uintptr_t mapping_addr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE,
+                          &mapping_addr),
+              NO_ERROR, "");
+
+    remap_thread_stop = false;
+    thrd_t remapper;
+    ASSERT_EQ(thrd_create(&remapper, remap_thread, &remap_vmo), thrd_success, "");
+
+    FaultThreadArgs args[kFaultThreads];
+    thrd_t threads[kFaultThreads];
+    for (size_t i = 0; i < kFaultThreads; i++) {
+        args[i] = { mapping_addr, i };
+        ASSERT_EQ(thrd_create(&threads[i], fault_thread, &args[i]), thrd_success, "");
+    }
+    for (size_t i = 0; i < kFaultThreads; i++) {
+        int ret;
+        EXPECT_EQ(thrd_join(threads[i], &ret), thrd_success, "");
+        EXPECT_EQ(ret, 0, "");
+    }
+
+    remap_thread_stop = true;
+    int ret;
+    EXPECT_EQ(thrd_join(remapper, &ret), thrd_success, "");
+    EXPECT_EQ(ret, 0, "remapping failed");
+
+    for (size_t i = 0; i < kFaultPages; i++) {
+        uint8_t val = reinterpret_cast<volatile uint8_t*>(mapping_addr + i * PAGE_SIZE)[0];
+        EXPECT_EQ(val, static_cast<uint8_t>(i % kFaultThreads + 1), "wrong page contents");
+    }
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), mapping_addr, size), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "");
+    EXPECT_EQ(mx_handle_close(remap_vmo), NO_ERROR, "");
+
+    END_TEST;
+}
+
 }
 
 BEGIN_TEST_CASE(vmar_tests)
@@ -1616,10 +1710,15 @@ RUN_TEST(map_specific_overwrite_test);
 RUN_TEST(protect_split_test);
 RUN_TEST(protect_multiple_test);
 RUN_TEST(protect_over_demand_paged_test);
+RUN_TEST(concurrent_fault_test);
 END_TEST_CASE(vmar_tests)
 
 #ifndef BUILD_COMBINED_TESTS
 int main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        return vmar_run_benchmark();
+    }
+
     bool success = unittest_run_all_tests(argc, argv);
     return success ? 0 : -1;
 }
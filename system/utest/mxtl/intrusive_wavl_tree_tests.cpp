@@ -88,6 +88,9 @@ using RPTE = DEFINE_TEST_THUNK(OrderedAssociative, WAVL, RefPtr);
 //    both insert and erase operations, are obeyed.
 // 3) Sufficient code coverage has been achieved during testing (eg. all of the
 //    rebalancing edge cases have been run over the length of the test).
+//
+// It also keeps each node's count of nodes in its subtree up to date, to test
+// the augmentation hook.
 class WAVLBalanceTestObserver {
 public:
     struct OpCounts {
@@ -138,6 +141,9 @@ public:
     static void RecordEraseRotation()           { ++op_counts_.erase_rotations_; }
     static void RecordEraseDoubleRotation()     { ++op_counts_.erase_double_rotations_; }
 
+    template <typename RawPtrType>
+    static void RecordSubtreeChanged(RawPtrType node) { node->UpdateSubtreeSize(); }
+
     template <typename TreeType>
     static bool VerifyRankRule(const TreeType& tree, typename TreeType::RawPtrType node) {
         BEGIN_TEST;
@@ -261,6 +267,16 @@ public:
 
     bool InContainer() const { return wavl_node_state_.InContainer(); }
 
+    size_t subtree_size() const { return subtree_size_; }
+    void UpdateSubtreeSize() {
+        using PtrTraits = ::mxtl::internal::ContainerPtrTraits<BalanceTestObjPtr>;
+        subtree_size_ = 1;
+        if (PtrTraits::IsValid(wavl_node_state_.left_))
+            subtree_size_ += wavl_node_state_.left_->subtree_size_;
+        if (PtrTraits::IsValid(wavl_node_state_.right_))
+            subtree_size_ += wavl_node_state_.right_->subtree_size_;
+    }
+
 private:
     friend DefaultWAVLTreeTraits<BalanceTestObjPtr, int32_t>;
 
@@ -272,11 +288,25 @@ private:
 
     BalanceTestKeyType key_;
     BalanceTestObj* erase_deck_ptr_;
+    size_t subtree_size_ = 0;
     WAVLTreeNodeState<BalanceTestObjPtr, int32_t> wavl_node_state_;
 };
 
 static constexpr size_t kBalanceTestSize = 2048;
 
+// Walks the tree structure, checking that every node's subtree size (as
+// maintained by the observer) is correct.  Returns the size of the subtree.
+static size_t CheckSubtreeSizes(BalanceTestTree::iterator iter, bool* ok) {
+    if (!iter.IsValid())
+        return 0;
+
+    size_t size = 1 + CheckSubtreeSizes(iter.left(), ok) + CheckSubtreeSizes(iter.right(), ok);
+    if (size != iter->subtree_size())
+        *ok = false;
+
+    return size;
+}
+
 static bool DoBalanceTestInsert(BalanceTestTree& tree, BalanceTestObj* ptr) {
     BEGIN_TEST;
 
@@ -289,6 +319,10 @@ static bool DoBalanceTestInsert(BalanceTestTree& tree, BalanceTestObj* ptr) {
     ASSERT_TRUE(tree.insert_or_find(BalanceTestObjPtr(ptr)), "");
     ASSERT_TRUE(WAVLTreeChecker::SanityCheck(tree), "");
 
+    bool sizes_ok = true;
+    ASSERT_EQ(tree.size(), CheckSubtreeSizes(tree.root(), &sizes_ok), "");
+    ASSERT_TRUE(sizes_ok, "Subtree sizes must be maintained across inserts");
+
     END_TEST;
 }
 
@@ -309,6 +343,10 @@ static bool DoBalanceTestErase(BalanceTestTree& tree, BalanceTestObj* ptr) {
     // consistent with a tree which has seen both inserts and erases.
     ASSERT_TRUE(WAVLTreeChecker::SanityCheck(tree), "");
 
+    bool sizes_ok = true;
+    ASSERT_EQ(tree.size(), CheckSubtreeSizes(tree.root(), &sizes_ok), "");
+    ASSERT_TRUE(sizes_ok, "Subtree sizes must be maintained across erases");
+
     END_TEST;
 }
 
@@ -105,9 +105,103 @@ static bool thread_name_test(void)
     END_TEST;
 }
 
+static bool thread_timer_slack_test(void)
+{
+    BEGIN_TEST;
+
+    mx_handle_t main_thread = thrd_get_mx_handle(thrd_current());
+    mx_duration_t slack = 1;
+
+    // exact deadlines by default
+    EXPECT_EQ(mx_object_get_property(main_thread, MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(slack)),
+              NO_ERROR, "");
+    EXPECT_EQ(slack, 0u, "");
+
+    slack = MX_MSEC(1);
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(slack)),
+              NO_ERROR, "");
+    slack = 0;
+    EXPECT_EQ(mx_object_get_property(main_thread, MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(slack)),
+              NO_ERROR, "");
+    EXPECT_EQ(slack, MX_MSEC(1), "");
+
+    // sleeping with slack still waits at least until the deadline
+    mx_time_t deadline = mx_deadline_after(MX_MSEC(5));
+    EXPECT_EQ(mx_nanosleep(deadline), NO_ERROR, "");
+    EXPECT_GE(mx_time_get(MX_CLOCK_MONOTONIC), deadline, "");
+
+    slack = MX_SEC(10);
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(slack)),
+              ERR_OUT_OF_RANGE, "");
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(uint32_t)),
+              ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(mx_object_set_property(mx_process_self(), MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(slack)),
+              ERR_WRONG_TYPE, "");
+
+    slack = 0;
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_TIMER_SLACK,
+                                     &slack, sizeof(slack)),
+              NO_ERROR, "");
+
+    END_TEST;
+}
+
+static bool thread_deadline_test(void)
+{
+    BEGIN_TEST;
+
+    mx_handle_t main_thread = thrd_get_mx_handle(thrd_current());
+    mx_deadline_params_t params = {1, 1, 1};
+
+    // priority scheduled by default
+    EXPECT_EQ(mx_object_get_property(main_thread, MX_PROP_DEADLINE,
+                                     &params, sizeof(params)),
+              NO_ERROR, "");
+    EXPECT_EQ(params.runtime, 0u, "");
+    EXPECT_EQ(params.deadline, 0u, "");
+    EXPECT_EQ(params.period, 0u, "");
+
+    // we don't hold the root resource, so we can't admit a deadline thread,
+    // with or without something else in place of it
+    params = (mx_deadline_params_t){MX_MSEC(1), MX_MSEC(5), MX_MSEC(10), MX_HANDLE_INVALID};
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_DEADLINE,
+                                     &params, sizeof(params)),
+              ERR_ACCESS_DENIED, "");
+    params.resource = main_thread;
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_DEADLINE,
+                                     &params, sizeof(params)),
+              ERR_ACCESS_DENIED, "");
+    EXPECT_EQ(mx_object_get_property(main_thread, MX_PROP_DEADLINE,
+                                     &params, sizeof(params)),
+              NO_ERROR, "");
+    EXPECT_EQ(params.runtime, 0u, "");
+
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_DEADLINE,
+                                     &params, sizeof(uint32_t)),
+              ERR_BUFFER_TOO_SMALL, "");
+    EXPECT_EQ(mx_object_set_property(mx_process_self(), MX_PROP_DEADLINE,
+                                     &params, sizeof(params)),
+              ERR_WRONG_TYPE, "");
+
+    params = (mx_deadline_params_t){};
+    EXPECT_EQ(mx_object_set_property(main_thread, MX_PROP_DEADLINE,
+                                     &params, sizeof(params)),
+              NO_ERROR, "");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(property_tests)
 RUN_TEST(process_name_test);
 RUN_TEST(thread_name_test);
+RUN_TEST(thread_timer_slack_test);
+RUN_TEST(thread_deadline_test);
 END_TEST_CASE(property_tests)
 
 int main(int argc, char **argv)
@@ -7,6 +7,7 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <threads.h>
 #include <unistd.h>
 
 #include <magenta/compiler.h>
@@ -23,6 +24,30 @@ static void spin(mx_time_t nanosecs) {
         ;
 }
 
+// Keeps a cpu busy inside this process, so the address space stays active on
+// it and every unmap or protect has to shoot down its TLB as well.
+static volatile bool spinners_stop;
+static int spinner(void*) {
+    while (!spinners_stop)
+        ;
+    return 0;
+}
+
+// Write faults in every page of its own mapping, for measuring how page fault
+// throughput scales with the number of threads faulting in one process.
+struct FaultArgs {
+    uintptr_t base;
+    size_t size;
+};
+
+static int fault_writer(void* arg) {
+    auto args = static_cast<FaultArgs*>(arg);
+    for (size_t i = 0; i < args->size; i += PAGE_SIZE) {
+        ((volatile char *)args->base)[i] = 99;
+    }
+    return 0;
+}
+
 template <typename T>
 inline mx_time_t time_it(T func) {
     spin(MX_MSEC(10));
@@ -157,6 +182,85 @@ int vmo_run_benchmark() {
 
     mx_handle_close(vmo);
 
+    // unmap and protect a large populated mapping while the address space
+    // is active on every other cpu, which is the worst case for tlb shootdowns
+    const size_t large_size = 64*1024*1024;
+    thrd_t spinners[64];
+    uint32_t num_spinners = mx_system_get_num_cpus() - 1;
+    if (num_spinners > countof(spinners))
+        num_spinners = countof(spinners);
+    spinners_stop = false;
+    for (uint32_t i = 0; i < num_spinners; i++) {
+        thrd_create(&spinners[i], spinner, nullptr);
+    }
+
+    mx_vmo_create(large_size, 0, &vmo);
+    mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, large_size, nullptr, 0);
+
+    mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, large_size, MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &ptr);
+    for (size_t i = 0; i < large_size; i += PAGE_SIZE) {
+        __UNUSED char a = ((volatile char *)ptr)[i];
+    }
+
+    t = time_it([&](){
+        mx_vmar_protect(mx_vmar_root_self(), ptr, large_size, MX_VM_FLAG_PERM_READ);
+    });
+    printf("\ttook %" PRIu64 " nsecs to protect a mapping of size %zu with %u other cpus active\n", t, large_size, num_spinners);
+
+    t = time_it([&](){
+        mx_vmar_unmap(mx_vmar_root_self(), ptr, large_size);
+    });
+    printf("\ttook %" PRIu64 " nsecs to unmap a mapping of size %zu with %u other cpus active\n", t, large_size, num_spinners);
+
+    // unmapping a single page shouldn't need more than a targeted invlpg
+    mx_vmar_map(mx_vmar_root_self(), 0, vmo, 0, PAGE_SIZE, MX_VM_FLAG_PERM_READ, &ptr);
+    __UNUSED char a = ((volatile char *)ptr)[0];
+
+    t = time_it([&](){
+        mx_vmar_unmap(mx_vmar_root_self(), ptr, PAGE_SIZE);
+    });
+    printf("\ttook %" PRIu64 " nsecs to unmap a single page with %u other cpus active\n", t, num_spinners);
+
+    spinners_stop = true;
+    for (uint32_t i = 0; i < num_spinners; i++) {
+        thrd_join(spinners[i], nullptr);
+    }
+    mx_handle_close(vmo);
+
+    // write fault the same amount of memory per thread in parallel, each thread
+    // into its own vmo. With faults not serialized on the address space, the
+    // time should stay close to flat as threads are added.
+    const size_t fault_size = 16*1024*1024;
+    const uint32_t num_cpus = mx_system_get_num_cpus();
+    for (uint32_t num_threads = 1; num_threads <= num_cpus && num_threads <= countof(spinners);
+         num_threads *= 2) {
+        FaultArgs args[countof(spinners)];
+        mx_handle_t fault_vmos[countof(spinners)];
+        thrd_t threads[countof(spinners)];
+        for (uint32_t i = 0; i < num_threads; i++) {
+            mx_vmo_create(fault_size, 0, &fault_vmos[i]);
+            mx_vmar_map(mx_vmar_root_self(), 0, fault_vmos[i], 0, fault_size,
+                        MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &args[i].base);
+            args[i].size = fault_size;
+        }
+
+        t = time_it([&](){
+            for (uint32_t i = 0; i < num_threads; i++) {
+                thrd_create(&threads[i], fault_writer, &args[i]);
+            }
+            for (uint32_t i = 0; i < num_threads; i++) {
+                thrd_join(threads[i], nullptr);
+            }
+        });
+        printf("\ttook %" PRIu64 " nsecs for %u threads to each write fault in a vmo of size %zu\n",
+               t, num_threads, fault_size);
+
+        for (uint32_t i = 0; i < num_threads; i++) {
+            mx_vmar_unmap(mx_vmar_root_self(), args[i].base, fault_size);
+            mx_handle_close(fault_vmos[i]);
+        }
+    }
+
     printf("done with benchmark\n");
 
     return 0;
@@ -90,6 +90,131 @@ bool vmo_read_write_test() {
     END_TEST;
 }
 
+bool vmo_readv_writev_test() {
+    BEGIN_TEST;
+
+    const size_t len = PAGE_SIZE * 2;
+    mx_handle_t vmo;
+    ASSERT_EQ(mx_vmo_create(len, 0, &vmo), NO_ERROR, "vm_object_create");
+
+    // gather a header, a payload straddling the page boundary and a trailer
+    char header[16], payload[PAGE_SIZE], trailer[32];
+    memset(header, 'h', sizeof(header));
+    memset(payload, 'p', sizeof(payload));
+    memset(trailer, 't', sizeof(trailer));
+    mx_iovec_t out[] = {
+        { header, sizeof(header) },
+        { payload, sizeof(payload) },
+        { nullptr, 0 },
+        { trailer, sizeof(trailer) },
+    };
+    const uint64_t offset = PAGE_SIZE / 2;
+    size_t actual;
+    EXPECT_EQ(mx_vmo_writev(vmo, out, countof(out), offset, &actual), NO_ERROR, "writev");
+    EXPECT_EQ(actual, sizeof(header) + sizeof(payload) + sizeof(trailer), "writev");
+
+    // it should read back in one piece
+    char buf[sizeof(header) + sizeof(payload) + sizeof(trailer)];
+    EXPECT_EQ(mx_vmo_read(vmo, buf, offset, sizeof(buf), &actual), NO_ERROR, "read");
+    EXPECT_EQ(actual, sizeof(buf), "read");
+    EXPECT_BYTES_EQ((uint8_t*)header, (uint8_t*)buf, sizeof(header), "header");
+    EXPECT_BYTES_EQ((uint8_t*)payload, (uint8_t*)buf + sizeof(header), sizeof(payload),
+                    "payload");
+    EXPECT_BYTES_EQ((uint8_t*)trailer, (uint8_t*)buf + sizeof(header) + sizeof(payload),
+                    sizeof(trailer), "trailer");
+
+    // and scatter back out; the last buffer runs off the end of the vmo
+    char in_header[sizeof(header)], in_rest[PAGE_SIZE], untouched[8];
+    memset(untouched, 'u', sizeof(untouched));
+    mx_iovec_t in[] = {
+        { in_header, sizeof(in_header) },
+        { in_rest, sizeof(in_rest) },
+        { untouched, sizeof(untouched) },
+    };
+    EXPECT_EQ(mx_vmo_readv(vmo, in, countof(in), offset, &actual), NO_ERROR, "readv");
+    EXPECT_EQ(actual, len - offset, "readv");
+    EXPECT_BYTES_EQ((uint8_t*)header, (uint8_t*)in_header, sizeof(header), "header");
+    EXPECT_BYTES_EQ((uint8_t*)buf + sizeof(header), (uint8_t*)in_rest,
+                    len - offset - sizeof(header), "rest");
+    for (auto c: untouched) {
+        EXPECT_EQ(c, 'u', "buffer past the end was touched");
+    }
+
+    // a bad buffer anywhere in the list fails the call
+    mx_iovec_t bad[] = {
+        { header, sizeof(header) },
+        { (void*)1, 1 },
+    };
+    EXPECT_EQ(mx_vmo_writev(vmo, bad, countof(bad), 0, &actual), ERR_INVALID_ARGS, "bad buffer");
+    EXPECT_EQ(mx_vmo_readv(vmo, out, countof(out), len + 1, &actual), ERR_OUT_OF_RANGE,
+              "past the end");
+
+    EXPECT_EQ(mx_handle_close(vmo), NO_ERROR, "handle_close");
+
+    END_TEST;
+}
+
+bool vmo_transfer_test() {
+    BEGIN_TEST;
+
+    const size_t len = PAGE_SIZE * 4;
+    mx_handle_t src, dst;
+    ASSERT_EQ(mx_vmo_create(len, 0, &src), NO_ERROR, "vm_object_create");
+    ASSERT_EQ(mx_vmo_create(len, 0, &dst), NO_ERROR, "vm_object_create");
+
+    // fill the first two pages of the source, leaving the third uncommitted
+    char buf[PAGE_SIZE * 2];
+    memset(buf, 's', sizeof(buf));
+    size_t actual;
+    EXPECT_EQ(mx_vmo_write(src, buf, 0, sizeof(buf), &actual), NO_ERROR, "write");
+
+    // and give the destination something to lose
+    memset(buf, 'd', sizeof(buf));
+    EXPECT_EQ(mx_vmo_write(dst, buf, PAGE_SIZE, sizeof(buf), &actual), NO_ERROR, "write");
+
+    // watch the destination through a mapping
+    uintptr_t ptr;
+    ASSERT_EQ(mx_vmar_map(mx_vmar_root_self(), 0, dst, 0, len,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE, &ptr),
+              NO_ERROR, "vm_map");
+    EXPECT_EQ(((volatile char*)ptr)[PAGE_SIZE], 'd', "mapping before transfer");
+
+    EXPECT_EQ(mx_vmo_transfer(dst, PAGE_SIZE, src, 0, PAGE_SIZE * 3, 0), NO_ERROR, "transfer");
+
+    char expected[len];
+    memset(expected, 0, sizeof(expected));
+    memset(expected + PAGE_SIZE, 's', PAGE_SIZE * 2);
+    EXPECT_BYTES_EQ((uint8_t*)expected, (uint8_t*)ptr, len, "mapped destination");
+    EXPECT_EQ(mx_vmo_read(src, buf, 0, sizeof(buf), &actual), NO_ERROR, "read");
+    memset(expected, 0, sizeof(buf));
+    EXPECT_BYTES_EQ((uint8_t*)expected, (uint8_t*)buf, sizeof(buf), "source zeroed");
+
+    // bad arguments leave both vmos alone
+    EXPECT_EQ(mx_vmo_transfer(dst, 1, src, 0, PAGE_SIZE, 0), ERR_INVALID_ARGS, "unaligned");
+    EXPECT_EQ(mx_vmo_transfer(dst, 0, src, 0, PAGE_SIZE, 1), ERR_INVALID_ARGS, "options");
+    EXPECT_EQ(mx_vmo_transfer(dst, len, src, 0, PAGE_SIZE, 0), ERR_OUT_OF_RANGE, "dst range");
+    EXPECT_EQ(mx_vmo_transfer(dst, 0, src, len, PAGE_SIZE, 0), ERR_OUT_OF_RANGE, "src range");
+
+    // the source gives up its pages, so it needs to be writable
+    mx_handle_t ro;
+    ASSERT_EQ(mx_handle_duplicate(src, MX_RIGHT_READ, &ro), NO_ERROR, "duplicate");
+    EXPECT_EQ(mx_vmo_transfer(dst, 0, ro, 0, PAGE_SIZE, 0), ERR_ACCESS_DENIED, "read only source");
+    EXPECT_EQ(mx_handle_close(ro), NO_ERROR, "handle_close");
+
+    // nothing can move out from under a clone
+    mx_handle_t clone;
+    ASSERT_EQ(mx_vmo_clone(dst, MX_VMO_CLONE_COPY_ON_WRITE, 0, len, &clone), NO_ERROR, "clone");
+    EXPECT_EQ(mx_vmo_transfer(src, 0, dst, 0, PAGE_SIZE, 0), ERR_BAD_STATE, "source with clone");
+    EXPECT_EQ(mx_vmo_transfer(dst, 0, src, 0, PAGE_SIZE, 0), ERR_BAD_STATE, "dest with clone");
+    EXPECT_EQ(mx_handle_close(clone), NO_ERROR, "handle_close");
+
+    EXPECT_EQ(mx_vmar_unmap(mx_vmar_root_self(), ptr, len), NO_ERROR, "vm_unmap");
+    EXPECT_EQ(mx_handle_close(src), NO_ERROR, "handle_close");
+    EXPECT_EQ(mx_handle_close(dst), NO_ERROR, "handle_close");
+
+    END_TEST;
+}
+
 bool vmo_map_test() {
     BEGIN_TEST;
 
@@ -414,6 +539,54 @@ bool vmo_lookup_test() {
     END_TEST;
 }
 
+bool vmo_unlock_test() {
+    BEGIN_TEST;
+
+    mx_handle_t vmo;
+    mx_status_t status;
+    const size_t size = PAGE_SIZE * 4;
+
+    status = mx_vmo_create(size, 0, &vmo);
+    EXPECT_EQ(NO_ERROR, status, "vm_object_create");
+
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_COMMIT, 0, size, nullptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm commit");
+
+    // ranges have to be page aligned and inside the vmo
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 1, PAGE_SIZE, nullptr, 0);
+    EXPECT_EQ(ERR_INVALID_ARGS, status, "unaligned unlock");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, 0, size * 2, nullptr, 0);
+    EXPECT_EQ(ERR_OUT_OF_RANGE, status, "unlock past end");
+
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_UNLOCK, PAGE_SIZE, PAGE_SIZE * 2, nullptr, 0);
+    EXPECT_EQ(NO_ERROR, status, "vm unlock");
+
+    // locking reports whether the contents survived, which they may not have
+    uint32_t result = UINT32_MAX;
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, &result, 1);
+    EXPECT_EQ(ERR_BUFFER_TOO_SMALL, status, "lock result buffer");
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, &result, sizeof(result));
+    EXPECT_EQ(NO_ERROR, status, "vm lock");
+    EXPECT_TRUE(result == MX_VMO_LOCK_INTACT || result == MX_VMO_LOCK_DISCARDED, "lock result");
+
+    // once locked, it stays intact
+    status = mx_vmo_op_range(vmo, MX_VMO_OP_LOCK, 0, size, &result, sizeof(result));
+    EXPECT_EQ(NO_ERROR, status, "vm lock");
+    EXPECT_EQ(MX_VMO_LOCK_INTACT, result, "lock result");
+
+    // clones can't be unlocked
+    mx_handle_t clone;
+    status = mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, 0, size, &clone);
+    EXPECT_EQ(NO_ERROR, status, "vm clone");
+    status = mx_vmo_op_range(clone, MX_VMO_OP_UNLOCK, 0, size, nullptr, 0);
+    EXPECT_EQ(ERR_NOT_SUPPORTED, status, "clone unlock");
+
+    EXPECT_EQ(NO_ERROR, mx_handle_close(clone), "handle_close");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
 bool vmo_commit_test() {
     BEGIN_TEST;
 
@@ -866,20 +1039,219 @@ bool vmo_clone_test_4() {
     END_TEST;
 }
 
+// test set 5: reading one page of a mapping may map resident neighbouring pages
+// read-only; make sure writes to those pages still copy-on-write correctly
+bool vmo_clone_fault_around_test() {
+    BEGIN_TEST;
+
+    mx_handle_t vmo;
+    mx_handle_t clone_vmo;
+    uintptr_t clone_ptr;
+    volatile size_t *cp;
+    size_t handled_bytes;
+
+    // create a vmo and commit every page with a known pattern
+    const size_t size = PAGE_SIZE * 32;
+    EXPECT_EQ(NO_ERROR, mx_vmo_create(size, 0, &vmo), "vm_object_create");
+    for (size_t page = 0; page < size / PAGE_SIZE; page++) {
+        size_t val = page + 1;
+        EXPECT_EQ(NO_ERROR, mx_vmo_write(vmo, &val, page * PAGE_SIZE, sizeof(val), &handled_bytes),
+                  "writing to original");
+    }
+
+    // clone it and map the clone
+    EXPECT_EQ(NO_ERROR, mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, 0, size, &clone_vmo), "vm_clone");
+    EXPECT_EQ(NO_ERROR,
+            mx_vmar_map(mx_vmar_root_self(), 0, clone_vmo, 0, size, MX_VM_FLAG_PERM_READ|MX_VM_FLAG_PERM_WRITE, &clone_ptr),
+            "map");
+    EXPECT_NONNULL(clone_ptr, "map address");
+    cp = (volatile size_t *)clone_ptr;
+
+    // read fault a page in the middle, then write to each of the others
+    const size_t words_per_page = PAGE_SIZE / sizeof(*cp);
+    EXPECT_EQ(8u, cp[7 * words_per_page], "reading from clone");
+    for (size_t page = 0; page < size / PAGE_SIZE; page++) {
+        EXPECT_EQ(page + 1, cp[page * words_per_page], "reading from clone");
+        cp[page * words_per_page] = page + 100;
+        EXPECT_EQ(page + 100, cp[page * words_per_page], "read back from clone");
+    }
+
+    // the original must be untouched
+    for (size_t page = 0; page < size / PAGE_SIZE; page++) {
+        size_t val = 0;
+        EXPECT_EQ(NO_ERROR, mx_vmo_read(vmo, &val, page * PAGE_SIZE, sizeof(val), &handled_bytes),
+                  "reading from original");
+        EXPECT_EQ(page + 1, val, "original unmodified");
+    }
+
+    // close and unmap
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(clone_vmo), "handle_close");
+    EXPECT_EQ(NO_ERROR, mx_vmar_unmap(mx_vmar_root_self(), clone_ptr, size), "unmap");
+
+    END_TEST;
+}
+
+// test set 6: build long chains of clones while closing the intermediate ones,
+// which lets the kernel collapse them, and make sure nothing visible changes
+bool vmo_clone_chain_test() {
+    BEGIN_TEST;
+
+    mx_handle_t vmo;
+    size_t handled_bytes;
+    size_t val;
+
+    // create a vmo with the page index at the start of every page
+    const size_t size = PAGE_SIZE * 4;
+    EXPECT_EQ(NO_ERROR, mx_vmo_create(size, 0, &vmo), "vm_object_create");
+    for (size_t i = 0; i < size / PAGE_SIZE; i++) {
+        EXPECT_EQ(NO_ERROR, mx_vmo_write(vmo, &i, i * PAGE_SIZE, sizeof(i), &handled_bytes), "write");
+    }
+
+    // clone the latest clone over and over, stamping a page of each new one with its generation
+    mx_handle_t cur = vmo;
+    for (size_t gen = 1; gen <= 16; gen++) {
+        mx_handle_t next = MX_HANDLE_INVALID;
+        EXPECT_EQ(NO_ERROR, mx_vmo_clone(cur, MX_VMO_CLONE_COPY_ON_WRITE, 0, size, &next), "vm_clone");
+        uint64_t offset = (gen % 4) * PAGE_SIZE + sizeof(val);
+        EXPECT_EQ(NO_ERROR, mx_vmo_write(next, &gen, offset, sizeof(gen), &handled_bytes), "write");
+        if (cur != vmo)
+            EXPECT_EQ(NO_ERROR, mx_handle_close(cur), "handle_close");
+        cur = next;
+    }
+
+    // every page should have the original index and the last generation to touch it
+    for (size_t i = 0; i < size / PAGE_SIZE; i++) {
+        EXPECT_EQ(NO_ERROR, mx_vmo_read(cur, &val, i * PAGE_SIZE, sizeof(val), &handled_bytes), "read");
+        EXPECT_EQ(i, val, "page index");
+        EXPECT_EQ(NO_ERROR, mx_vmo_read(cur, &val, i * PAGE_SIZE + sizeof(val), sizeof(val), &handled_bytes), "read");
+        EXPECT_EQ(i == 0 ? 16u : 12 + i, val, "generation");
+
+        // and the original should be untouched
+        EXPECT_EQ(NO_ERROR, mx_vmo_read(vmo, &val, i * PAGE_SIZE + sizeof(val), sizeof(val), &handled_bytes), "read");
+        EXPECT_EQ(0u, val, "original");
+    }
+    EXPECT_EQ(NO_ERROR, mx_handle_close(cur), "handle_close");
+
+    // clone a window of the middle two pages, and clone that with a larger size
+    mx_handle_t mid = MX_HANDLE_INVALID;
+    EXPECT_EQ(NO_ERROR, mx_vmo_clone(vmo, MX_VMO_CLONE_COPY_ON_WRITE, PAGE_SIZE, PAGE_SIZE * 2, &mid), "vm_clone");
+    val = 100;
+    EXPECT_EQ(NO_ERROR, mx_vmo_write(mid, &val, sizeof(val), sizeof(val), &handled_bytes), "write");
+    mx_handle_t child = MX_HANDLE_INVALID;
+    EXPECT_EQ(NO_ERROR, mx_vmo_clone(mid, MX_VMO_CLONE_COPY_ON_WRITE, 0, size, &child), "vm_clone");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(mid), "handle_close");
+
+    // the window's own page and the original behind it still show through, but
+    // the part past the end of the window has to stay zero
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(child, &val, sizeof(val), sizeof(val), &handled_bytes), "read");
+    EXPECT_EQ(100u, val, "window page");
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(child, &val, 0, sizeof(val), &handled_bytes), "read");
+    EXPECT_EQ(1u, val, "original page 1");
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(child, &val, PAGE_SIZE, sizeof(val), &handled_bytes), "read");
+    EXPECT_EQ(2u, val, "original page 2");
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(child, &val, PAGE_SIZE * 2, sizeof(val), &handled_bytes), "read");
+    EXPECT_EQ(0u, val, "past the window");
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(child, &val, PAGE_SIZE * 3, sizeof(val), &handled_bytes), "read");
+    EXPECT_EQ(0u, val, "past the window");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(child), "handle_close");
+
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
+// vmos created with large pages behave like any other vmo, including when a
+// large page mapping of them is partially protected or unmapped
+bool vmo_large_pages_test() {
+    BEGIN_TEST;
+
+    const size_t large_page = 2 * 1024 * 1024;
+    const size_t size = large_page * 2;
+    mx_handle_t vmo;
+    mx_handle_t vmar;
+    uintptr_t vmar_addr;
+    uintptr_t ptr;
+    size_t handled_bytes;
+
+    EXPECT_EQ(ERR_INVALID_ARGS, mx_vmo_create(size, 1u << 31, &vmo), "bad create options");
+    ASSERT_EQ(NO_ERROR, mx_vmo_create(size, MX_VMO_OPTION_LARGE_PAGES, &vmo), "vm_object_create");
+
+    // make room for a large page aligned mapping of the whole vmo
+    ASSERT_EQ(NO_ERROR,
+              mx_vmar_allocate(mx_vmar_root_self(), 0, size + large_page,
+                               MX_VM_FLAG_CAN_MAP_READ | MX_VM_FLAG_CAN_MAP_WRITE |
+                               MX_VM_FLAG_CAN_MAP_SPECIFIC, &vmar, &vmar_addr),
+              "vmar_allocate");
+    size_t map_offset = ((vmar_addr + large_page - 1) & ~(large_page - 1)) - vmar_addr;
+    ASSERT_EQ(NO_ERROR,
+              mx_vmar_map(vmar, map_offset, vmo, 0, size,
+                          MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE | MX_VM_FLAG_SPECIFIC, &ptr),
+              "map");
+    volatile size_t* p = (volatile size_t*)ptr;
+
+    // fault everything in through the mapping and check it with vmo_read
+    for (size_t off = 0; off < size / sizeof(*p); off += PAGE_SIZE / sizeof(*p))
+        p[off] = off;
+    for (size_t off = 0; off < size / sizeof(*p); off += PAGE_SIZE / sizeof(*p)) {
+        size_t val = 0;
+        EXPECT_EQ(NO_ERROR, mx_vmo_read(vmo, &val, off * sizeof(*p), sizeof(val), &handled_bytes),
+                  "vmo_read");
+        if (val != off) {
+            EXPECT_EQ(off, val, "reading back through vmo_read");
+            break;
+        }
+    }
+
+    // make one page in the middle of the first large page read only and unmap another
+    EXPECT_EQ(NO_ERROR, mx_vmar_protect(vmar, ptr + PAGE_SIZE * 7, PAGE_SIZE, MX_VM_FLAG_PERM_READ),
+              "protect");
+    EXPECT_EQ(NO_ERROR, mx_vmar_unmap(vmar, ptr + PAGE_SIZE * 9, PAGE_SIZE), "unmap");
+
+    // the rest of the large page must still be mapped and writable
+    for (size_t page = 0; page < large_page / PAGE_SIZE; page++) {
+        size_t off = page * PAGE_SIZE / sizeof(*p);
+        if (page == 9)
+            continue;
+        if (p[off] != off) {
+            EXPECT_EQ(off, p[off], "reading after split");
+            break;
+        }
+        if (page != 7)
+            p[off] = off + 1;
+    }
+    size_t val = 0;
+    EXPECT_EQ(NO_ERROR, mx_vmo_read(vmo, &val, PAGE_SIZE * 8, sizeof(val), &handled_bytes),
+              "vmo_read");
+    EXPECT_EQ(PAGE_SIZE * 8 / sizeof(*p) + 1, val, "write after split");
+
+    EXPECT_EQ(NO_ERROR, mx_vmar_destroy(vmar), "vmar_destroy");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmar), "handle_close");
+    EXPECT_EQ(NO_ERROR, mx_handle_close(vmo), "handle_close");
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(vmo_tests)
 RUN_TEST(vmo_create_test);
 RUN_TEST(vmo_read_write_test);
+RUN_TEST(vmo_readv_writev_test);
+RUN_TEST(vmo_transfer_test);
 RUN_TEST(vmo_map_test);
 RUN_TEST(vmo_read_only_map_test);
 RUN_TEST(vmo_resize_test);
 RUN_TEST(vmo_rights_test);
 RUN_TEST(vmo_lookup_test);
 RUN_TEST(vmo_commit_test);
+RUN_TEST(vmo_unlock_test);
 RUN_TEST(vmo_zero_page_test);
 RUN_TEST(vmo_clone_test_1);
 RUN_TEST(vmo_clone_test_2);
 RUN_TEST(vmo_clone_test_3);
 RUN_TEST(vmo_clone_test_4);
+RUN_TEST(vmo_clone_fault_around_test);
+RUN_TEST(vmo_clone_chain_test);
+RUN_TEST(vmo_large_pages_test);
 END_TEST_CASE(vmo_tests)
 
 int main(int argc, char** argv) {
@@ -5,7 +5,7 @@
 int pthread_mutex_unlock(pthread_mutex_t* m) {
     int waiters = atomic_load(&m->_m_waiters);
     int cont;
-    int type = m->_m_type & PTHREAD_MUTEX_MASK;
+    int type = m->_m_type & PTHREAD_MUTEX_OWNER_MASK;
 
     if (type != PTHREAD_MUTEX_NORMAL) {
         if ((atomic_load(&m->_m_lock) & PTHREAD_MUTEX_OWNED_LOCK_MASK) != __thread_get_tid())
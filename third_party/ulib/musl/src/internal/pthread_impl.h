@@ -122,6 +122,10 @@ static inline struct pthread* tp_to_pthread(void* tp) {
 #define SIGTIMER_SET ((sigset_t*)(const unsigned long[_NSIG / 8 / sizeof(long)]){0x80000000})
 
 #define PTHREAD_MUTEX_MASK (PTHREAD_MUTEX_RECURSIVE | PTHREAD_MUTEX_ERRORCHECK)
+// Set in the type of PTHREAD_PRIO_INHERIT mutexes, which also track thread owners.
+#define PTHREAD_MUTEX_PRIO_INHERIT_BIT 4
+// The mutexes that don't match PTHREAD_MUTEX_NORMAL under this mask track owners.
+#define PTHREAD_MUTEX_OWNER_MASK (PTHREAD_MUTEX_MASK | PTHREAD_MUTEX_PRIO_INHERIT_BIT)
 // The bit used in the recursive and errorchecking cases, which track thread owners.
 #define PTHREAD_MUTEX_OWNED_LOCK_BIT 0x80000000
 #define PTHREAD_MUTEX_OWNED_LOCK_MASK 0x7fffffff
@@ -154,6 +158,11 @@ int __libc_sigprocmask(int, const sigset_t*, sigset_t*);
 int __timedwait(atomic_int*, int, clockid_t, const struct timespec*)
     ATTR_LIBC_VISIBILITY;
 
+// As __timedwait, but the thread whose handle is |owner| inherits our
+// priority while we wait.
+int __timedwait_pi(atomic_int*, int, mx_handle_t owner, clockid_t, const struct timespec*)
+    ATTR_LIBC_VISIBILITY;
+
 // Loading a library can introduce more thread_local variables. Thread
 // allocation bases bookkeeping decisions based on the current state
 // of thread_locals in the program, so thread creation needs to be
@@ -2,13 +2,15 @@
 #include <errno.h>
 #include <magenta/syscalls.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <time.h>
 
 int __clock_gettime(clockid_t, struct timespec*);
 
 #define NS_PER_S (1000000000ull)
 
-int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+static int timedwait(atomic_int* futex, int val, mx_handle_t owner, bool pi,
+                     clockid_t clk, const struct timespec* at) {
     struct timespec to;
     mx_time_t deadline = MX_TIME_INFINITE;
 
@@ -31,10 +33,20 @@ int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec
     // races with this call. But this is indistinguishable from
     // otherwise being woken up just before someone else changes the
     // value. Therefore this functions returns 0 in that case.
-    switch (_mx_futex_wait(futex, val, deadline)) {
+    mx_status_t status = pi ? _mx_futex_wait_pi(futex, val, owner, deadline)
+                            : _mx_futex_wait(futex, val, deadline);
+    switch (status) {
     case NO_ERROR:
     case ERR_BAD_STATE:
         return 0;
+    // The owner the caller read out of the lock word can exit and have its
+    // handle closed (or even reused) before we get here, in which case it no
+    // longer holds the lock either.
+    case ERR_BAD_HANDLE:
+    case ERR_WRONG_TYPE:
+        if (pi)
+            return 0;
+        __builtin_trap();
     case ERR_TIMED_OUT:
         return ETIMEDOUT;
     case ERR_INVALID_ARGS:
@@ -42,3 +54,12 @@ int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec
         __builtin_trap();
     }
 }
+
+int __timedwait(atomic_int* futex, int val, clockid_t clk, const struct timespec* at) {
+    return timedwait(futex, val, MX_HANDLE_INVALID, false, clk, at);
+}
+
+int __timedwait_pi(atomic_int* futex, int val, mx_handle_t owner, clockid_t clk,
+                   const struct timespec* at) {
+    return timedwait(futex, val, owner, true, clk, at);
+}